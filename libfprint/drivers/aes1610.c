@@ -72,13 +72,12 @@ static int adjust_gain (unsigned char *buffer,
 
 struct _FpiDeviceAes1610
 {
-  FpImageDevice parent;
+  FpImageDevice      parent;
 
-  guint8        read_regs_retry_count;
-  GSList       *strips;
-  gsize         strips_len;
-  gboolean      deactivating;
-  guint8        blanks_count;
+  guint8             read_regs_retry_count;
+  FpiFrameAssembler *assembler;
+  gboolean           deactivating;
+  guint8             blanks_count;
 };
 G_DECLARE_FINAL_TYPE (FpiDeviceAes1610, fpi_device_aes1610, FPI, DEVICE_AES1610,
                       FpImageDevice);
@@ -581,8 +580,7 @@ capture_read_strip_cb (FpiUsbTransfer *transfer, FpDevice *device,
       stripe->delta_y = 0;
       stripdata = stripe->data;
       memcpy (stripdata, data + 1, FRAME_WIDTH * (FRAME_HEIGHT / 2));
-      self->strips = g_slist_prepend (self->strips, stripe);
-      self->strips_len++;
+      fpi_frame_assembler_add_frame (self->assembler, stripe);
       self->blanks_count = 0;
     }
   else
@@ -601,22 +599,17 @@ capture_read_strip_cb (FpiUsbTransfer *transfer, FpDevice *device,
   adjust_gain (data, GAIN_STATUS_NORMAL);
 
   /* stop capturing if MAX_FRAMES is reached */
-  if (self->blanks_count > 10 || g_slist_length (self->strips) >= MAX_FRAMES)
+  if (self->blanks_count > 10 || fpi_frame_assembler_get_n_frames (self->assembler) >= MAX_FRAMES)
     {
       FpImage *img;
 
       fp_dbg ("sending stop capture.... blanks=%d  frames=%d",
-              self->blanks_count, g_slist_length (self->strips));
+              self->blanks_count, fpi_frame_assembler_get_n_frames (self->assembler));
       /* send stop capture bits */
       aes_write_regv (dev, capture_stop, G_N_ELEMENTS (capture_stop), stub_capture_stop_cb, NULL);
-      self->strips = g_slist_reverse (self->strips);
-      fpi_do_movement_estimation (&assembling_ctx, self->strips);
-      img = fpi_assemble_frames (&assembling_ctx, self->strips);
+      img = fpi_frame_assembler_finish (self->assembler);
       img->flags |= FPI_IMAGE_PARTIAL;
 
-      g_slist_free_full (self->strips, g_free);
-      self->strips = NULL;
-      self->strips_len = 0;
       self->blanks_count = 0;
       fpi_image_device_image_captured (dev, img);
       fpi_image_device_report_finger_status (dev, FALSE);
@@ -791,9 +784,7 @@ complete_deactivation (FpImageDevice *dev)
    * maybe we can do this with a master reset, unconditionally? */
 
   self->deactivating = FALSE;
-  g_slist_free (self->strips);
-  self->strips = NULL;
-  self->strips_len = 0;
+  fpi_frame_assembler_reset (self->assembler);
   self->blanks_count = 0;
   fpi_image_device_deactivate_complete (dev, NULL);
 }
@@ -801,6 +792,7 @@ complete_deactivation (FpImageDevice *dev)
 static void
 dev_init (FpImageDevice *dev)
 {
+  FpiDeviceAes1610 *self = FPI_DEVICE_AES1610 (dev);
   GError *error = NULL;
 
   /* FIXME check endpoints */
@@ -811,14 +803,19 @@ dev_init (FpImageDevice *dev)
       return;
     }
 
+  self->assembler = fpi_frame_assembler_new (&assembling_ctx);
+
   fpi_image_device_open_complete (dev, NULL);
 }
 
 static void
 dev_deinit (FpImageDevice *dev)
 {
+  FpiDeviceAes1610 *self = FPI_DEVICE_AES1610 (dev);
   GError *error = NULL;
 
+  g_clear_pointer (&self->assembler, fpi_frame_assembler_free);
+
   g_usb_device_release_interface (fpi_device_get_usb_device (FP_DEVICE (dev)),
                                   0, 0, &error);
   fpi_image_device_close_complete (dev, error);
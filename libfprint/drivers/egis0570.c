@@ -30,17 +30,16 @@
 /* Struct */
 struct _FpDeviceEgis0570
 {
-  FpImageDevice parent;
+  FpImageDevice      parent;
 
-  gboolean      running;
-  gboolean      stop;
+  gboolean           running;
+  gboolean           stop;
 
-  GSList       *strips;
-  guint8       *background;
-  gsize         strips_len;
+  FpiFrameAssembler *assembler;
+  guint8            *background;
 
-  int           pkt_num;
-  int           pkt_type;
+  int                pkt_num;
+  int                pkt_type;
 };
 G_DECLARE_FINAL_TYPE (FpDeviceEgis0570, fpi_device_egis0570, FPI, DEVICE_EGIS0570, FpImageDevice);
 G_DEFINE_TYPE (FpDeviceEgis0570, fpi_device_egis0570, FP_TYPE_IMAGE_DEVICE);
@@ -170,8 +169,7 @@ data_resp_cb (FpiUsbTransfer *transfer, FpDevice *dev, gpointer user_data, GErro
                   stripe->delta_y = 0;
                   stripdata = stripe->data;
                   memcpy (stripdata, (transfer->buffer) + (((k) * EGIS0570_IMGSIZE) + EGIS0570_IMGWIDTH * EGIS0570_RFMDIS), EGIS0570_IMGWIDTH * EGIS0570_RFMGHEIGHT);
-                  self->strips = g_slist_prepend (self->strips, stripe);
-                  self->strips_len += 1;
+                  fpi_frame_assembler_add_frame (self->assembler, stripe);
                 }
               else
                 {
@@ -188,16 +186,11 @@ data_resp_cb (FpiUsbTransfer *transfer, FpDevice *dev, gpointer user_data, GErro
 
   if (end)
     {
-      if (!self->stop && (self->strips_len > 0))
+      if (!self->stop && (fpi_frame_assembler_get_n_frames (self->assembler) > 0))
         {
           FpImage *img;
-          self->strips = g_slist_reverse (self->strips);
-          fpi_do_movement_estimation (&assembling_ctx, self->strips);
-          img = fpi_assemble_frames (&assembling_ctx, self->strips);
+          img = fpi_frame_assembler_finish (self->assembler);
           img->flags |= (FPI_IMAGE_COLORS_INVERTED | FPI_IMAGE_PARTIAL);
-          g_slist_free_full (self->strips, g_free);
-          self->strips = NULL;
-          self->strips_len = 0;
           FpImage *resizeImage = fpi_image_resize (img, EGIS0570_RESIZE, EGIS0570_RESIZE);
           fpi_image_device_image_captured (img_self, resizeImage);
         }
@@ -369,11 +362,18 @@ dev_activate (FpImageDevice *dev)
 static void
 dev_init (FpImageDevice *dev)
 {
+  FpDeviceEgis0570 *self = FPI_DEVICE_EGIS0570 (dev);
   GError *error = NULL;
 
-  g_usb_device_claim_interface (fpi_device_get_usb_device (FP_DEVICE (dev)), 0, 0, &error);
+  if (!g_usb_device_claim_interface (fpi_device_get_usb_device (FP_DEVICE (dev)), 0, 0, &error))
+    {
+      fpi_image_device_open_complete (dev, error);
+      return;
+    }
 
-  fpi_image_device_open_complete (dev, error);
+  self->assembler = fpi_frame_assembler_new (&assembling_ctx);
+
+  fpi_image_device_open_complete (dev, NULL);
 }
 
 /*
@@ -383,8 +383,11 @@ dev_init (FpImageDevice *dev)
 static void
 dev_deinit (FpImageDevice *dev)
 {
+  FpDeviceEgis0570 *self = FPI_DEVICE_EGIS0570 (dev);
   GError *error = NULL;
 
+  g_clear_pointer (&self->assembler, fpi_frame_assembler_free);
+
   g_usb_device_release_interface (fpi_device_get_usb_device (FP_DEVICE (dev)), 0, 0, &error);
 
   fpi_image_device_close_complete (dev, error);
@@ -726,26 +726,16 @@ identify_msg_cb (FpiDeviceSynaptics *self,
     case BMKT_RSP_ID_OK:
       {
         FpPrint *print = NULL;
-        GPtrArray *prints = NULL;
+        FpPrint *match = NULL;
         g_autoptr(GVariant) data = NULL;
-        gboolean found = FALSE;
-        guint index;
 
         print = create_print (self,
                               resp->response.id_resp.user_id,
                               resp->response.id_resp.finger_id);
 
-        fpi_device_get_identify_data (device, &prints);
+        match = fpi_print_index_lookup (fpi_device_get_identify_index (device), print);
 
-        found = g_ptr_array_find_with_equal_func (prints,
-                                                  print,
-                                                  (GEqualFunc) fp_print_equal,
-                                                  &index);
-
-        if (found)
-          fpi_device_identify_report (device, g_ptr_array_index (prints, index), print, NULL);
-        else
-          fpi_device_identify_report (device, NULL, print, NULL);
+        fpi_device_identify_report (device, match, print, NULL);
 
         identify_complete_after_finger_removal (self);
       }
@@ -207,14 +207,15 @@ usb_exchange_async (FpiSsm                  *ssm,
 
 /* Calculade squared standand deviation of sum of two lines */
 static int
-vfs5011_get_deviation2 (struct fpi_line_asmbl_ctx *ctx, GSList *row1, GSList *row2)
+vfs5011_get_deviation2 (struct fpi_line_asmbl_ctx *ctx, FpiFrameStore *rows,
+                        unsigned int row1, unsigned int row2)
 {
   unsigned char *buf1, *buf2;
   int res = 0, mean = 0, i;
   const int size = 64;
 
-  buf1 = (unsigned char *) row1->data + 56;
-  buf2 = (unsigned char *) row2->data + 168;
+  buf1 = (unsigned char *) fpi_frame_store_get (rows, row1) + 56;
+  buf2 = (unsigned char *) fpi_frame_store_get (rows, row2) + 168;
 
   for (i = 0; i < size; i++)
     mean += (int) buf1[i] + (int) buf2[i];
@@ -232,10 +233,11 @@ vfs5011_get_deviation2 (struct fpi_line_asmbl_ctx *ctx, GSList *row1, GSList *ro
 
 static unsigned char
 vfs5011_get_pixel (struct fpi_line_asmbl_ctx *ctx,
-                   GSList                    *row,
+                   FpiFrameStore             *rows,
+                   unsigned                   row,
                    unsigned                   x)
 {
-  unsigned char *data = (unsigned char *) row->data + 8;
+  unsigned char *data = (unsigned char *) fpi_frame_store_get (rows, row) + 8;
 
   return data[x];
 }
@@ -254,8 +256,8 @@ static struct fpi_line_asmbl_ctx assembling_ctx = {
   .resolution = 10,
   .median_filter_size = 25,
   .max_search_offset = 30,
-  .get_deviation = vfs5011_get_deviation2,
-  .get_pixel = vfs5011_get_pixel,
+  .get_line_deviation = vfs5011_get_deviation2,
+  .get_line_pixel = vfs5011_get_pixel,
 };
 
 struct _FpDeviceVfs5011
@@ -266,7 +268,7 @@ struct _FpDeviceVfs5011
   unsigned char          *capture_buffer;
   unsigned char          *row_buffer;
   unsigned char          *lastline;
-  GSList                 *rows;
+  FpiFrameStore          *rows;
   int                     lines_captured, lines_recorded, empty_lines;
   int                     max_lines_captured, max_lines_recorded;
   int                     lines_total, lines_total_allocated;
@@ -299,6 +301,7 @@ capture_init (FpDeviceVfs5011 *self, int max_captured,
 {
   fp_dbg ("capture_init");
   self->lastline = NULL;
+  fpi_frame_store_truncate (self->rows, 0);
   self->lines_captured = 0;
   self->lines_recorded = 0;
   self->empty_lines = 0;
@@ -359,9 +362,7 @@ process_chunk (FpDeviceVfs5011 *self, int transferred)
                                   linebuf + 8,
                                   VFS5011_IMAGE_WIDTH) >= DIFFERENCE_THRESHOLD))
         {
-          self->lastline = g_malloc (VFS5011_LINE_SIZE);
-          self->rows = g_slist_prepend (self->rows,
-                                        self->lastline);
+          self->lastline = fpi_frame_store_append (self->rows);
           memmove (self->lastline, linebuf, VFS5011_LINE_SIZE);
           self->lines_recorded++;
           if (self->lines_recorded >= self->max_lines_recorded)
@@ -388,15 +389,12 @@ submit_image (FpiSsm          *ssm,
       return;
     }
 
-  g_assert (self->rows != NULL);
+  g_assert (fpi_frame_store_get_length (self->rows) == self->lines_recorded);
 
-  self->rows = g_slist_reverse (self->rows);
+  img = fpi_assemble_lines_store (&assembling_ctx, self->rows);
 
-  img = fpi_assemble_lines (&assembling_ctx, self->rows,
-                            self->lines_recorded);
-
-  g_slist_free_full (self->rows, g_free);
-  self->rows = NULL;
+  fpi_frame_store_truncate (self->rows, 0);
+  self->lastline = NULL;
 
   fp_dbg ("Image captured, committing");
 
@@ -787,6 +785,10 @@ open_loop_complete (FpiSsm *ssm, FpDevice *_dev, GError *error)
   g_free (self->init_sequence.receive_buf);
   self->init_sequence.receive_buf = NULL;
 
+  /* dev_close() is not called if opening fails */
+  if (error)
+    g_clear_pointer (&self->rows, fpi_frame_store_free);
+
   fpi_image_device_open_complete (dev, error);
 }
 
@@ -806,6 +808,8 @@ dev_open (FpImageDevice *dev)
       return;
     }
 
+  self->rows = fpi_frame_store_new (VFS5011_LINE_SIZE, MAXLINES);
+
   ssm = fpi_ssm_new (FP_DEVICE (dev), open_loop, DEV_OPEN_NUM_STATES);
   fpi_ssm_start (ssm, open_loop_complete);
 }
@@ -820,7 +824,7 @@ dev_close (FpImageDevice *dev)
                                   0, 0, &error);
 
   g_free (self->capture_buffer);
-  g_slist_free_full (g_steal_pointer (&self->rows), g_free);
+  g_clear_pointer (&self->rows, fpi_frame_store_free);
 
   fpi_image_device_close_complete (dev, error);
 }
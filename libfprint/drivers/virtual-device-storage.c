@@ -33,8 +33,6 @@
 
 G_DEFINE_TYPE (FpDeviceVirtualDeviceStorage, fpi_device_virtual_device_storage, fpi_device_virtual_device_get_type ())
 
-static GPtrArray * get_stored_prints (FpDeviceVirtualDevice * self);
-
 static void
 dev_identify (FpDevice *dev)
 {
@@ -47,12 +45,10 @@ dev_identify (FpDevice *dev)
 
   if (scan_id)
     {
-      g_autoptr(GPtrArray) stored = get_stored_prints (self);
       GPtrArray *prints;
       GVariant *data = NULL;
       FpPrint *new_scan;
       FpPrint *match = NULL;
-      guint idx;
 
       new_scan = fp_print_new (dev);
       fpi_print_set_type (new_scan, FPI_PRINT_RAW);
@@ -63,20 +59,15 @@ dev_identify (FpDevice *dev)
       fpi_device_get_identify_data (dev, &prints);
       g_debug ("Trying to identify print '%s' against a gallery of %u prints", scan_id, prints->len);
 
-      if (!g_ptr_array_find_with_equal_func (stored,
-                                             new_scan,
-                                             (GEqualFunc) fp_print_equal,
-                                             NULL))
+      /* The stored prints are keyed by their data, no need to list them */
+      if (!g_hash_table_contains (self->prints_storage, scan_id))
         {
           match = FALSE;
           g_clear_object (&new_scan);
         }
-      else if (g_ptr_array_find_with_equal_func (prints,
-                                                 new_scan,
-                                                 (GEqualFunc) fp_print_equal,
-                                                 &idx))
+      else
         {
-          match = g_ptr_array_index (prints, idx);
+          match = fpi_print_index_lookup (fpi_device_get_identify_index (dev), new_scan);
         }
 
       if (!self->match_reported)
@@ -117,6 +117,9 @@ typedef struct
 {
   FpPrint       *enrolled_print;   /* verify */
   GPtrArray     *gallery;   /* identify */
+  FpiPrintIndex *gallery_index; /* identify, created on demand */
+  FpIdentifyMode identify_mode; /* identify */
+  guint          prefilter_candidates; /* identify */
 
   gboolean       result_reported;
   FpPrint       *match;
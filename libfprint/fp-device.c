@@ -22,6 +22,7 @@
 #include "fpi-log.h"
 
 #include "fp-device-private.h"
+#include "fp-gallery-private.h"
 
 /**
  * SECTION: fp-device
@@ -1428,30 +1429,17 @@ fp_device_verify_finish (FpDevice     *device,
   return res != FPI_MATCH_ERROR;
 }
 
-/**
- * fp_device_identify:
- * @device: a #FpDevice
- * @prints: (element-type FpPrint) (transfer none): #GPtrArray of #FpPrint
- * @cancellable: (nullable): a #GCancellable, or %NULL
- * @match_cb: (nullable) (scope notified): match reporting callback
- * @match_data: (closure match_cb): user data for @match_cb
- * @match_destroy: (destroy match_data): Destroy notify for @match_data
- * @callback: the function to call on completion
- * @user_data: the data to pass to @callback
- *
- * Start an asynchronous operation to identify prints. The callback will
- * be called once the operation has finished. Retrieve the result with
- * fp_device_identify_finish().
- */
-void
-fp_device_identify (FpDevice           *device,
-                    GPtrArray          *prints,
-                    GCancellable       *cancellable,
-                    FpMatchCb           match_cb,
-                    gpointer            match_data,
-                    GDestroyNotify      match_destroy,
-                    GAsyncReadyCallback callback,
-                    gpointer            user_data)
+/* Either prints or gallery must be given */
+static void
+device_identify (FpDevice           *device,
+                 GPtrArray          *prints,
+                 FpGallery          *gallery,
+                 GCancellable       *cancellable,
+                 FpMatchCb           match_cb,
+                 gpointer            match_data,
+                 GDestroyNotify      match_destroy,
+                 GAsyncReadyCallback callback,
+                 gpointer            user_data)
 {
   g_autoptr(GTask) task = NULL;
   FpDevicePrivate *priv = fp_device_get_instance_private (device);
@@ -1498,13 +1486,23 @@ fp_device_identify (FpDevice           *device,
     }
 
   data = g_new0 (FpMatchData, 1);
-  /* We cannot store the gallery directly, because the ptr array may not own
-   * a reference to each print. Also, the caller could in principle modify the
-   * GPtrArray afterwards.
-   */
-  data->gallery = g_ptr_array_new_full (prints->len, g_object_unref);
-  for (i = 0; i < prints->len; i++)
-    g_ptr_array_add (data->gallery, g_object_ref (g_ptr_array_index (prints, i)));
+  if (gallery)
+    {
+      /* The gallery owns its prints and copies them before any change */
+      fpi_gallery_share (gallery, &data->gallery, &data->gallery_index);
+      data->identify_mode = fp_gallery_get_identify_mode (gallery);
+      data->prefilter_candidates = fp_gallery_get_prefilter_candidates (gallery);
+    }
+  else
+    {
+      /* We cannot store the gallery directly, because the ptr array may not
+       * own a reference to each print. Also, the caller could in principle
+       * modify the GPtrArray afterwards.
+       */
+      data->gallery = g_ptr_array_new_full (prints->len, g_object_unref);
+      for (i = 0; i < prints->len; i++)
+        g_ptr_array_add (data->gallery, g_object_ref (g_ptr_array_index (prints, i)));
+    }
   data->match_cb = match_cb;
   data->match_data = match_data;
   data->match_destroy = match_destroy;
@@ -1515,6 +1513,80 @@ fp_device_identify (FpDevice           *device,
   cls->identify (device);
 }
 
+/**
+ * fp_device_identify:
+ * @device: a #FpDevice
+ * @prints: (element-type FpPrint) (transfer none): #GPtrArray of #FpPrint
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @match_cb: (nullable) (scope notified): match reporting callback
+ * @match_data: (closure match_cb): user data for @match_cb
+ * @match_destroy: (destroy match_data): Destroy notify for @match_data
+ * @callback: the function to call on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Start an asynchronous operation to identify prints. The callback will
+ * be called once the operation has finished. Retrieve the result with
+ * fp_device_identify_finish().
+ *
+ * If the same prints are identified against repeatedly, consider using
+ * a #FpGallery and fp_device_identify_gallery() instead.
+ */
+void
+fp_device_identify (FpDevice           *device,
+                    GPtrArray          *prints,
+                    GCancellable       *cancellable,
+                    FpMatchCb           match_cb,
+                    gpointer            match_data,
+                    GDestroyNotify      match_destroy,
+                    GAsyncReadyCallback callback,
+                    gpointer            user_data)
+{
+  g_return_if_fail (FP_IS_DEVICE (device));
+  g_return_if_fail (prints != NULL);
+
+  device_identify (device, prints, NULL, cancellable,
+                   match_cb, match_data, match_destroy,
+                   callback, user_data);
+}
+
+/**
+ * fp_device_identify_gallery:
+ * @device: a #FpDevice
+ * @gallery: (transfer none): a #FpGallery
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @match_cb: (nullable) (scope notified): match reporting callback
+ * @match_data: (closure match_cb): user data for @match_cb
+ * @match_destroy: (destroy match_data): Destroy notify for @match_data
+ * @callback: the function to call on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Start an asynchronous operation to identify the prints in @gallery.
+ * This behaves like fp_device_identify(), but the gallery is used as is
+ * rather than being copied. Changes to @gallery while the operation is
+ * running do not affect it. Retrieve the result with
+ * fp_device_identify_finish().
+ *
+ * Devices that match on the host search the gallery as selected by
+ * #FpGallery:identify-mode and #FpGallery:prefilter-candidates.
+ */
+void
+fp_device_identify_gallery (FpDevice           *device,
+                            FpGallery          *gallery,
+                            GCancellable       *cancellable,
+                            FpMatchCb           match_cb,
+                            gpointer            match_data,
+                            GDestroyNotify      match_destroy,
+                            GAsyncReadyCallback callback,
+                            gpointer            user_data)
+{
+  g_return_if_fail (FP_IS_DEVICE (device));
+  g_return_if_fail (FP_IS_GALLERY (gallery));
+
+  device_identify (device, NULL, gallery, cancellable,
+                   match_cb, match_data, match_destroy,
+                   callback, user_data);
+}
+
 /**
  * fp_device_identify_finish:
  * @device: A #FpDevice
@@ -2069,6 +2141,46 @@ fp_device_identify_sync (FpDevice     *device,
   return fp_device_identify_finish (device, task, match, print, error);
 }
 
+/**
+ * fp_device_identify_gallery_sync:
+ * @device: a #FpDevice
+ * @gallery: (transfer none): a #FpGallery
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @match_cb: (nullable) (scope call): match reporting callback
+ * @match_data: (closure match_cb): user data for @match_cb
+ * @match: (out) (transfer full) (nullable): Location for the matched #FpPrint, or %NULL
+ * @print: (out) (transfer full) (nullable): Location for the new #FpPrint, or %NULL
+ * @error: Return location for errors, or %NULL to ignore
+ *
+ * Identify the prints in a gallery synchronously.
+ *
+ * Returns: (type void): %FALSE on error, %TRUE otherwise
+ */
+gboolean
+fp_device_identify_gallery_sync (FpDevice     *device,
+                                 FpGallery    *gallery,
+                                 GCancellable *cancellable,
+                                 FpMatchCb     match_cb,
+                                 gpointer      match_data,
+                                 FpPrint     **match,
+                                 FpPrint     **print,
+                                 GError      **error)
+{
+  g_autoptr(GAsyncResult) task = NULL;
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), FALSE);
+
+  fp_device_identify_gallery (device,
+                              gallery,
+                              cancellable,
+                              match_cb, match_data, NULL,
+                              async_result_ready, &task);
+  while (!task)
+    g_main_context_iteration (NULL, TRUE);
+
+  return fp_device_identify_finish (device, task, match, print, error);
+}
+
 
 /**
  * fp_device_capture_sync:
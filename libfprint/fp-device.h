@@ -32,6 +32,7 @@ G_BEGIN_DECLS
 G_DECLARE_DERIVABLE_TYPE (FpDevice, fp_device, FP, DEVICE, GObject)
 
 #include "fp-print.h"
+#include "fp-gallery.h"
 
 /* NOTE: We keep the class struct private! */
 
@@ -278,6 +279,15 @@ void fp_device_identify (FpDevice           *device,
                          GAsyncReadyCallback callback,
                          gpointer            user_data);
 
+void fp_device_identify_gallery (FpDevice           *device,
+                                 FpGallery          *gallery,
+                                 GCancellable       *cancellable,
+                                 FpMatchCb           match_cb,
+                                 gpointer            match_data,
+                                 GDestroyNotify      match_destroy,
+                                 GAsyncReadyCallback callback,
+                                 gpointer            user_data);
+
 void fp_device_capture (FpDevice           *device,
                         gboolean            wait_for_finger,
                         GCancellable       *cancellable,
@@ -366,6 +376,14 @@ gboolean fp_device_identify_sync (FpDevice     *device,
                                   FpPrint     **match,
                                   FpPrint     **print,
                                   GError      **error);
+gboolean fp_device_identify_gallery_sync (FpDevice     *device,
+                                          FpGallery    *gallery,
+                                          GCancellable *cancellable,
+                                          FpMatchCb     match_cb,
+                                          gpointer      match_data,
+                                          FpPrint     **match,
+                                          FpPrint     **print,
+                                          GError      **error);
 FpImage * fp_device_capture_sync (FpDevice     *device,
                                   gboolean      wait_for_finger,
                                   GCancellable *cancellable,
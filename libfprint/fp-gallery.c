@@ -0,0 +1,855 @@
+/*
+ * FpGallery - A reusable collection of prints for identification
+ * Copyright (C) 2026 The libfprint authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#define FP_COMPONENT "gallery"
+
+#include "fp-gallery-private.h"
+#include "fp-print-private.h"
+#include "fpi-device.h"
+#include "fpi-log.h"
+
+/**
+ * SECTION: fp-gallery
+ * @title: FpGallery
+ * @short_description: Reusable gallery of prints
+ *
+ * A #FpGallery is a collection of prints that can be identified against
+ * repeatedly using fp_device_identify_gallery(). Unlike the #GPtrArray
+ * passed to fp_device_identify(), the gallery is not copied for every
+ * identification and it can be updated incrementally.
+ *
+ * The gallery keeps the data that is derived from its prints, such as
+ * the content hashes and the tables that are needed to match them, so
+ * this work is only done once for every print that is added.
+ *
+ * A gallery never contains two prints that are equal according to
+ * fp_print_equal().
+ *
+ * For devices that match on the host, #FpGallery:identify-mode selects
+ * whether identification stops at the first matching print or searches
+ * the whole gallery for the best one, and #FpGallery:prefilter-candidates
+ * limits the search of large galleries to the most promising prints.
+ *
+ * Prints of type NBIS can also be compared against the gallery without
+ * a device using fp_gallery_score_prints(), for example to find
+ * duplicates in a database of enrolled prints, or be ranked against the
+ * gallery using fp_gallery_identify_ranked().
+ */
+
+struct _FpGallery
+{
+  GObject        parent_instance;
+
+  /* Operations using the gallery hold a reference to both prints and
+   * index until they are done. While they do, the two need to be copied
+   * before they are modified. */
+  GPtrArray     *prints;
+  FpiPrintIndex *index;
+
+  FpIdentifyMode identify_mode;
+  guint          prefilter_candidates;
+};
+
+G_DEFINE_TYPE (FpGallery, fp_gallery, G_TYPE_OBJECT)
+
+enum {
+  PROP_0,
+  PROP_IDENTIFY_MODE,
+  PROP_PREFILTER_CANDIDATES,
+  N_PROPS
+};
+
+static GParamSpec *properties[N_PROPS];
+
+static void
+fp_gallery_finalize (GObject *object)
+{
+  FpGallery *self = FP_GALLERY (object);
+
+  g_clear_pointer (&self->prints, g_ptr_array_unref);
+  g_clear_pointer (&self->index, fpi_print_index_unref);
+
+  G_OBJECT_CLASS (fp_gallery_parent_class)->finalize (object);
+}
+
+static void
+fp_gallery_get_property (GObject    *object,
+                         guint       prop_id,
+                         GValue     *value,
+                         GParamSpec *pspec)
+{
+  FpGallery *self = FP_GALLERY (object);
+
+  switch (prop_id)
+    {
+    case PROP_IDENTIFY_MODE:
+      g_value_set_enum (value, self->identify_mode);
+      break;
+
+    case PROP_PREFILTER_CANDIDATES:
+      g_value_set_uint (value, self->prefilter_candidates);
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+fp_gallery_set_property (GObject      *object,
+                         guint         prop_id,
+                         const GValue *value,
+                         GParamSpec   *pspec)
+{
+  FpGallery *self = FP_GALLERY (object);
+
+  switch (prop_id)
+    {
+    case PROP_IDENTIFY_MODE:
+      fp_gallery_set_identify_mode (self, g_value_get_enum (value));
+      break;
+
+    case PROP_PREFILTER_CANDIDATES:
+      fp_gallery_set_prefilter_candidates (self, g_value_get_uint (value));
+      break;
+
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+    }
+}
+
+static void
+fp_gallery_class_init (FpGalleryClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = fp_gallery_finalize;
+  object_class->get_property = fp_gallery_get_property;
+  object_class->set_property = fp_gallery_set_property;
+
+  /**
+   * FpGallery:identify-mode:
+   *
+   * Whether identification reports the first print of the gallery that
+   * matches or searches the whole gallery for the best match. Only
+   * devices that match on the host support this, other devices ignore it.
+   */
+  properties[PROP_IDENTIFY_MODE] =
+    g_param_spec_enum ("identify-mode",
+                       "Identify Mode",
+                       "How the gallery is searched during identification",
+                       FP_TYPE_IDENTIFY_MODE,
+                       FP_IDENTIFY_MODE_FIRST_MATCH,
+                       G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
+
+  /**
+   * FpGallery:prefilter-candidates:
+   *
+   * The number of gallery prints that are matched during identification,
+   * or 0 to match all of them. See fp_gallery_set_prefilter_candidates().
+   */
+  properties[PROP_PREFILTER_CANDIDATES] =
+    g_param_spec_uint ("prefilter-candidates",
+                       "Pre-filter Candidates",
+                       "Number of gallery prints to match, or 0 to match all",
+                       0, G_MAXUINT, 0,
+                       G_PARAM_STATIC_STRINGS | G_PARAM_READWRITE | G_PARAM_EXPLICIT_NOTIFY);
+
+  g_object_class_install_properties (object_class, N_PROPS, properties);
+}
+
+static void
+fp_gallery_init (FpGallery *self)
+{
+  self->prints = g_ptr_array_new_with_free_func (g_object_unref);
+  self->index = fpi_print_index_new (NULL);
+}
+
+static void
+fp_gallery_unshare (FpGallery *self)
+{
+  GPtrArray *prints;
+  guint i;
+
+  if (!fpi_print_index_is_shared (self->index))
+    return;
+
+  prints = g_ptr_array_new_full (self->prints->len, g_object_unref);
+  for (i = 0; i < self->prints->len; i++)
+    g_ptr_array_add (prints, g_object_ref (g_ptr_array_index (self->prints, i)));
+
+  g_ptr_array_unref (self->prints);
+  self->prints = prints;
+
+  /* The content hashes are cached with the prints, so this is cheap */
+  fpi_print_index_unref (self->index);
+  self->index = fpi_print_index_new (self->prints);
+}
+
+/**
+ * fp_gallery_new:
+ *
+ * Creates a new, empty gallery.
+ *
+ * Returns: (transfer full): A new #FpGallery
+ */
+FpGallery *
+fp_gallery_new (void)
+{
+  return g_object_new (FP_TYPE_GALLERY, NULL);
+}
+
+/**
+ * fp_gallery_new_from_prints:
+ * @prints: (element-type FpPrint) (transfer none): #GPtrArray of #FpPrint
+ *
+ * Creates a new gallery containing @prints. Prints that are equal to an
+ * earlier print in @prints are skipped.
+ *
+ * Returns: (transfer full): A new #FpGallery
+ */
+FpGallery *
+fp_gallery_new_from_prints (GPtrArray *prints)
+{
+  FpGallery *gallery;
+  guint i;
+
+  g_return_val_if_fail (prints != NULL, NULL);
+
+  gallery = fp_gallery_new ();
+  for (i = 0; i < prints->len; i++)
+    fp_gallery_add (gallery, g_ptr_array_index (prints, i));
+
+  return gallery;
+}
+
+/**
+ * fp_gallery_add:
+ * @gallery: A #FpGallery
+ * @print: (transfer none): The #FpPrint to add
+ *
+ * Appends @print to the gallery, unless an equal print is part of it
+ * already. The gallery keeps a reference to @print.
+ *
+ * Returns: %TRUE if @print was added
+ */
+gboolean
+fp_gallery_add (FpGallery *gallery,
+                FpPrint   *print)
+{
+  g_return_val_if_fail (FP_IS_GALLERY (gallery), FALSE);
+  g_return_val_if_fail (FP_IS_PRINT (print), FALSE);
+  g_return_val_if_fail (print->type != FPI_PRINT_UNDEFINED, FALSE);
+
+  if (fpi_print_index_lookup (gallery->index, print))
+    return FALSE;
+
+  fp_gallery_unshare (gallery);
+
+  g_ptr_array_add (gallery->prints, g_object_ref_sink (print));
+  fpi_print_index_add (gallery->index, print);
+
+  return TRUE;
+}
+
+/**
+ * fp_gallery_remove:
+ * @gallery: A #FpGallery
+ * @print: (transfer none): The #FpPrint to remove
+ *
+ * Removes the print that is equal to @print from the gallery. The order
+ * of the remaining prints is preserved.
+ *
+ * Returns: %TRUE if a print was removed
+ */
+gboolean
+fp_gallery_remove (FpGallery *gallery,
+                   FpPrint   *print)
+{
+  FpPrint *stored;
+
+  g_return_val_if_fail (FP_IS_GALLERY (gallery), FALSE);
+  g_return_val_if_fail (FP_IS_PRINT (print), FALSE);
+
+  if (!fpi_print_index_lookup (gallery->index, print))
+    return FALSE;
+
+  fp_gallery_unshare (gallery);
+
+  /* The gallery holds its own reference, so stored stays valid */
+  stored = fpi_print_index_lookup (gallery->index, print);
+  g_ptr_array_remove (gallery->prints, stored);
+  fpi_print_index_remove (gallery->index, print);
+
+  return TRUE;
+}
+
+/**
+ * fp_gallery_contains:
+ * @gallery: A #FpGallery
+ * @print: The #FpPrint to look for
+ *
+ * Checks whether the gallery contains a print that is equal to @print.
+ *
+ * Returns: %TRUE if an equal print is part of the gallery
+ */
+gboolean
+fp_gallery_contains (FpGallery *gallery,
+                     FpPrint   *print)
+{
+  g_return_val_if_fail (FP_IS_GALLERY (gallery), FALSE);
+  g_return_val_if_fail (FP_IS_PRINT (print), FALSE);
+
+  return fpi_print_index_lookup (gallery->index, print) != NULL;
+}
+
+/**
+ * fp_gallery_get_n_prints:
+ * @gallery: A #FpGallery
+ *
+ * Returns: The number of prints in the gallery
+ */
+guint
+fp_gallery_get_n_prints (FpGallery *gallery)
+{
+  g_return_val_if_fail (FP_IS_GALLERY (gallery), 0);
+
+  return gallery->prints->len;
+}
+
+/**
+ * fp_gallery_get_prints:
+ * @gallery: A #FpGallery
+ *
+ * Gets a copy of the list of prints in the gallery, in the order they
+ * were added. It does not change when the gallery is modified later on.
+ *
+ * Returns: (element-type FpPrint) (transfer container): The prints
+ */
+GPtrArray *
+fp_gallery_get_prints (FpGallery *gallery)
+{
+  GPtrArray *prints;
+  guint i;
+
+  g_return_val_if_fail (FP_IS_GALLERY (gallery), NULL);
+
+  prints = g_ptr_array_new_full (gallery->prints->len, g_object_unref);
+  for (i = 0; i < gallery->prints->len; i++)
+    g_ptr_array_add (prints, g_object_ref (g_ptr_array_index (gallery->prints, i)));
+
+  return prints;
+}
+
+/**
+ * fp_gallery_get_identify_mode:
+ * @gallery: A #FpGallery
+ *
+ * Returns: The #FpIdentifyMode used to identify against the gallery
+ */
+FpIdentifyMode
+fp_gallery_get_identify_mode (FpGallery *gallery)
+{
+  g_return_val_if_fail (FP_IS_GALLERY (gallery), FP_IDENTIFY_MODE_FIRST_MATCH);
+
+  return gallery->identify_mode;
+}
+
+/**
+ * fp_gallery_set_identify_mode:
+ * @gallery: A #FpGallery
+ * @mode: The #FpIdentifyMode to use
+ *
+ * Select whether fp_device_identify_gallery() reports the first matching
+ * print of the gallery (the default) or searches the whole gallery for
+ * the print with the highest score. The latter is slower, but does not
+ * depend on the order of the gallery. It only takes effect for the
+ * identifications that are started afterwards.
+ */
+void
+fp_gallery_set_identify_mode (FpGallery     *gallery,
+                              FpIdentifyMode mode)
+{
+  g_return_if_fail (FP_IS_GALLERY (gallery));
+
+  if (gallery->identify_mode == mode)
+    return;
+
+  gallery->identify_mode = mode;
+  g_object_notify_by_pspec (G_OBJECT (gallery), properties[PROP_IDENTIFY_MODE]);
+}
+
+/**
+ * fp_gallery_get_prefilter_candidates:
+ * @gallery: A #FpGallery
+ *
+ * Returns: The number of gallery prints that are matched, or 0 if the
+ *   pre-filter is disabled
+ */
+guint
+fp_gallery_get_prefilter_candidates (FpGallery *gallery)
+{
+  g_return_val_if_fail (FP_IS_GALLERY (gallery), 0);
+
+  return gallery->prefilter_candidates;
+}
+
+/**
+ * fp_gallery_set_prefilter_candidates:
+ * @gallery: A #FpGallery
+ * @candidates: Number of gallery prints to match, or 0 to match all
+ *
+ * Enable a coarse pre-filter for devices that match on the host. Only the
+ * @candidates prints of the gallery that are most similar to the scanned
+ * print according to cheap global features are passed on to the matcher.
+ * Lower values make identification against large galleries faster, at the
+ * cost of possibly missing the correct print. Prints that cannot be
+ * matched on the host are skipped by the pre-filter, they only cause an
+ * error if none of the selected prints matches.
+ *
+ * The pre-filter is disabled by default.
+ */
+void
+fp_gallery_set_prefilter_candidates (FpGallery *gallery,
+                                     guint      candidates)
+{
+  g_return_if_fail (FP_IS_GALLERY (gallery));
+
+  if (gallery->prefilter_candidates == candidates)
+    return;
+
+  gallery->prefilter_candidates = candidates;
+  g_object_notify_by_pspec (G_OBJECT (gallery), properties[PROP_PREFILTER_CANDIDATES]);
+}
+
+/* Hands out the current prints and their index without copying them. Both
+ * must be released together once they are not needed anymore; until
+ * then, the gallery copies them before it is modified. */
+void
+fpi_gallery_share (FpGallery      *gallery,
+                   GPtrArray     **prints,
+                   FpiPrintIndex **index)
+{
+  g_return_if_fail (FP_IS_GALLERY (gallery));
+  g_return_if_fail (prints != NULL);
+  g_return_if_fail (index != NULL);
+
+  *prints = g_ptr_array_ref (gallery->prints);
+  *index = fpi_print_index_ref (gallery->index);
+}
+
+typedef struct
+{
+  GPtrArray         *probes;
+  GPtrArray         *templates;
+  FpiPrintIndex     *index;
+  FpGalleryScoreFunc score_func;
+  gpointer           score_data;
+  GDestroyNotify     score_destroy;
+
+  /* Serializes the calls to score_func */
+  GMutex             lock;
+  gint               next;
+  gint               workers;
+} ScorePrintsData;
+
+static void
+score_prints_data_free (ScorePrintsData *data)
+{
+  g_ptr_array_unref (data->probes);
+  g_ptr_array_unref (data->templates);
+  fpi_print_index_unref (data->index);
+  if (data->score_destroy)
+    data->score_destroy (data->score_data);
+  g_mutex_clear (&data->lock);
+  g_free (data);
+}
+
+static gboolean
+check_nbis_prints (GPtrArray *prints, GError **error)
+{
+  guint i;
+
+  for (i = 0; i < prints->len; i++)
+    {
+      FpPrint *print = g_ptr_array_index (prints, i);
+
+      if (print->type != FPI_PRINT_NBIS)
+        {
+          g_propagate_error (error,
+                             fpi_device_error_new_msg (FP_DEVICE_ERROR_NOT_SUPPORTED,
+                                                       "It is only possible to match NBIS type print data"));
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+static void
+score_prints_worker (gpointer task_ptr, gpointer unused)
+{
+  g_autoptr(GTask) task = task_ptr;
+  ScorePrintsData *data = g_task_get_task_data (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+  g_autofree gint *scores = NULL;
+
+  /* One row at a time, so memory does not grow with the number of probes */
+  scores = g_new (gint, MAX (data->templates->len, 1));
+
+  while (!g_cancellable_is_cancelled (cancellable))
+    {
+      FpPrint *probe;
+      gint i;
+
+      i = g_atomic_int_add (&data->next, 1);
+      if (i >= (gint) data->probes->len)
+        break;
+
+      probe = g_ptr_array_index (data->probes, i);
+      if (!fpi_print_bz3_score_gallery (probe, data->templates, scores, cancellable))
+        break;
+
+      if (data->score_func)
+        {
+          g_mutex_lock (&data->lock);
+          data->score_func (probe, i, scores, data->templates->len, data->score_data);
+          g_mutex_unlock (&data->lock);
+        }
+    }
+
+  if (!g_atomic_int_dec_and_test (&data->workers))
+    return;
+
+  /* We are the last worker, report the result */
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  g_task_return_boolean (task, TRUE);
+}
+
+static GThreadPool *
+gallery_get_score_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *p;
+
+      p = g_thread_pool_new (score_prints_worker, NULL,
+                             g_get_num_processors (), FALSE, NULL);
+      g_once_init_leave (&pool, (gsize) p);
+    }
+
+  return (GThreadPool *) pool;
+}
+
+/**
+ * fp_gallery_score_prints:
+ * @gallery: A #FpGallery
+ * @probes: (element-type FpPrint) (transfer none): #GPtrArray of #FpPrint
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @score_func: (nullable) (scope notified): Function to report the scores
+ * @score_data: (closure score_func): user data for @score_func
+ * @score_destroy: (destroy score_data): Destroy notify for @score_data
+ * @callback: the function to call on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Computes the Bozorth3 score of every print in @probes against every
+ * print in @gallery, without the need for a device. All prints need to
+ * have been created by a driver that matches on the host (i.e. they
+ * contain minutiae), otherwise %FP_DEVICE_ERROR_NOT_SUPPORTED is returned.
+ *
+ * The work is spread over one thread per CPU core. Each row of the score
+ * matrix is passed to @score_func as soon as it is available, so the
+ * whole matrix never needs to be kept in memory. @score_func is called
+ * from the worker threads, but never concurrently. The rows are reported
+ * in no particular order, use @probe_index to place them.
+ *
+ * The columns are in the order of fp_gallery_get_prints() at the time
+ * this function is called; later modifications of @gallery do not affect
+ * the running operation. @probes must not be modified until the operation
+ * is done.
+ */
+void
+fp_gallery_score_prints (FpGallery          *gallery,
+                         GPtrArray          *probes,
+                         GCancellable       *cancellable,
+                         FpGalleryScoreFunc  score_func,
+                         gpointer            score_data,
+                         GDestroyNotify      score_destroy,
+                         GAsyncReadyCallback callback,
+                         gpointer            user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  GError *error = NULL;
+  ScorePrintsData *data;
+  GThreadPool *pool;
+  gint n_workers;
+  gint i;
+
+  g_return_if_fail (FP_IS_GALLERY (gallery));
+  g_return_if_fail (probes != NULL);
+
+  task = g_task_new (gallery, cancellable, callback, user_data);
+  g_task_set_source_tag (task, fp_gallery_score_prints);
+
+  data = g_new0 (ScorePrintsData, 1);
+  data->probes = g_ptr_array_ref (probes);
+  fpi_gallery_share (gallery, &data->templates, &data->index);
+  data->score_func = score_func;
+  data->score_data = score_data;
+  data->score_destroy = score_destroy;
+  g_mutex_init (&data->lock);
+  g_task_set_task_data (task, data, (GDestroyNotify) score_prints_data_free);
+
+  if (!check_nbis_prints (data->probes, &error) ||
+      !check_nbis_prints (data->templates, &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  if (probes->len == 0)
+    {
+      g_task_return_boolean (task, TRUE);
+      return;
+    }
+
+  pool = gallery_get_score_pool ();
+  n_workers = MIN (probes->len, g_get_num_processors ());
+  data->workers = n_workers;
+
+  for (i = 0; i < n_workers; i++)
+    g_thread_pool_push (pool, g_object_ref (task), NULL);
+}
+
+/**
+ * fp_gallery_score_prints_finish:
+ * @gallery: A #FpGallery
+ * @result: A #GAsyncResult
+ * @error: Return location for errors, or %NULL to ignore
+ *
+ * Finish an asynchronous operation started with fp_gallery_score_prints().
+ *
+ * Returns: %FALSE on error, %TRUE otherwise
+ */
+gboolean
+fp_gallery_score_prints_finish (FpGallery    *gallery,
+                                GAsyncResult *result,
+                                GError      **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, gallery), FALSE);
+
+  return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+async_result_ready (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GTask **task = user_data;
+
+  *task = g_object_ref (G_TASK (res));
+}
+
+/**
+ * fp_gallery_score_prints_sync:
+ * @gallery: A #FpGallery
+ * @probes: (element-type FpPrint) (transfer none): #GPtrArray of #FpPrint
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @score_func: (nullable) (scope call): Function to report the scores
+ * @score_data: (closure score_func): user data for @score_func
+ * @error: Return location for errors, or %NULL to ignore
+ *
+ * Score the prints against the gallery synchronously, see
+ * fp_gallery_score_prints().
+ *
+ * Returns: %FALSE on error, %TRUE otherwise
+ */
+gboolean
+fp_gallery_score_prints_sync (FpGallery         *gallery,
+                              GPtrArray         *probes,
+                              GCancellable      *cancellable,
+                              FpGalleryScoreFunc score_func,
+                              gpointer           score_data,
+                              GError           **error)
+{
+  g_autoptr(GAsyncResult) task = NULL;
+
+  g_return_val_if_fail (FP_IS_GALLERY (gallery), FALSE);
+
+  fp_gallery_score_prints (gallery, probes, cancellable,
+                           score_func, score_data, NULL,
+                           async_result_ready, &task);
+  while (!task)
+    g_main_context_iteration (NULL, TRUE);
+
+  return fp_gallery_score_prints_finish (gallery, task, error);
+}
+
+static void
+identify_ranked_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  g_autoptr(GTask) task = user_data;
+  GError *error = NULL;
+  GArray *candidates;
+
+  candidates = fpi_print_bz3_identify_ranked_finish (FP_PRINT (source_object), res, &error);
+  if (!candidates)
+    g_task_return_error (task, error);
+  else
+    g_task_return_pointer (task, candidates, (GDestroyNotify) g_array_unref);
+}
+
+/**
+ * fp_gallery_identify_ranked:
+ * @gallery: A #FpGallery
+ * @print: The #FpPrint to identify
+ * @max_candidates: The maximum number of candidates to report, must be
+ *   larger than zero
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: the function to call on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Identifies @print against the whole gallery without a device and
+ * reports the @max_candidates prints with the highest Bozorth3 scores,
+ * rather than only whether and which print matched. No threshold is
+ * applied. This is useful to fuse the scores with other information or
+ * to tune the match threshold.
+ *
+ * All prints need to have been created by a driver that matches on the
+ * host, otherwise %FP_DEVICE_ERROR_NOT_SUPPORTED is returned. For such
+ * devices, the print returned by fp_device_identify_finish() or
+ * fp_image_detect_minutiae_batch_finish() can be used as @print. It must
+ * contain a single scan.
+ *
+ * The work is spread over one thread per CPU core. Later modifications
+ * of @gallery do not affect the running operation.
+ */
+void
+fp_gallery_identify_ranked (FpGallery          *gallery,
+                            FpPrint            *print,
+                            guint               max_candidates,
+                            GCancellable       *cancellable,
+                            GAsyncReadyCallback callback,
+                            gpointer            user_data)
+{
+  g_autoptr(GPtrArray) templates = NULL;
+  FpiPrintIndex *index;
+  GTask *task;
+
+  g_return_if_fail (FP_IS_GALLERY (gallery));
+  g_return_if_fail (FP_IS_PRINT (print));
+  g_return_if_fail (max_candidates > 0);
+
+  task = g_task_new (gallery, cancellable, callback, user_data);
+  g_task_set_source_tag (task, fp_gallery_identify_ranked);
+
+  /* Holding the index makes the gallery copy its prints before a change */
+  fpi_gallery_share (gallery, &templates, &index);
+  g_task_set_task_data (task, index, (GDestroyNotify) fpi_print_index_unref);
+
+  fpi_print_bz3_identify_ranked (templates, print, max_candidates, cancellable,
+                                 identify_ranked_done, task);
+}
+
+/**
+ * fp_gallery_identify_ranked_finish:
+ * @gallery: A #FpGallery
+ * @result: A #GAsyncResult
+ * @scores: (out) (optional) (element-type gint) (transfer full): Return
+ *   location for the score of each candidate
+ * @error: Return location for errors, or %NULL to ignore
+ *
+ * Finish an asynchronous operation started with fp_gallery_identify_ranked().
+ *
+ * Returns: (element-type FpPrint) (transfer container): The candidates,
+ *   sorted by descending score with ties in gallery order; %NULL on error
+ */
+GPtrArray *
+fp_gallery_identify_ranked_finish (FpGallery    *gallery,
+                                   GAsyncResult *result,
+                                   GArray      **scores,
+                                   GError      **error)
+{
+  g_autoptr(GArray) candidates = NULL;
+  GPtrArray *prints;
+  guint i;
+
+  g_return_val_if_fail (g_task_is_valid (result, gallery), NULL);
+
+  candidates = g_task_propagate_pointer (G_TASK (result), error);
+  if (!candidates)
+    return NULL;
+
+  prints = g_ptr_array_new_full (candidates->len, g_object_unref);
+  if (scores)
+    *scores = g_array_sized_new (FALSE, FALSE, sizeof (gint), candidates->len);
+
+  for (i = 0; i < candidates->len; i++)
+    {
+      FpiPrintCandidate *candidate = &g_array_index (candidates, FpiPrintCandidate, i);
+
+      g_ptr_array_add (prints, g_object_ref (candidate->print));
+      if (scores)
+        g_array_append_val (*scores, candidate->score);
+    }
+
+  return prints;
+}
+
+/**
+ * fp_gallery_identify_ranked_sync:
+ * @gallery: A #FpGallery
+ * @print: The #FpPrint to identify
+ * @max_candidates: The maximum number of candidates to report, must be
+ *   larger than zero
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @scores: (out) (optional) (element-type gint) (transfer full): Return
+ *   location for the score of each candidate
+ * @error: Return location for errors, or %NULL to ignore
+ *
+ * Identify the print against the gallery synchronously, see
+ * fp_gallery_identify_ranked().
+ *
+ * Returns: (element-type FpPrint) (transfer container): The candidates,
+ *   sorted by descending score with ties in gallery order; %NULL on error
+ */
+GPtrArray *
+fp_gallery_identify_ranked_sync (FpGallery    *gallery,
+                                 FpPrint      *print,
+                                 guint         max_candidates,
+                                 GCancellable *cancellable,
+                                 GArray      **scores,
+                                 GError      **error)
+{
+  g_autoptr(GAsyncResult) task = NULL;
+
+  g_return_val_if_fail (FP_IS_GALLERY (gallery), NULL);
+  g_return_val_if_fail (FP_IS_PRINT (print), NULL);
+  g_return_val_if_fail (max_candidates > 0, NULL);
+
+  fp_gallery_identify_ranked (gallery, print, max_candidates, cancellable,
+                              async_result_ready, &task);
+  while (!task)
+    g_main_context_iteration (NULL, TRUE);
+
+  return fp_gallery_identify_ranked_finish (gallery, task, scores, error);
+}
@@ -0,0 +1,119 @@
+/*
+ * FpGallery - A reusable collection of prints for identification
+ * Copyright (C) 2026 The libfprint authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#pragma once
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define FP_TYPE_GALLERY (fp_gallery_get_type ())
+G_DECLARE_FINAL_TYPE (FpGallery, fp_gallery, FP, GALLERY, GObject)
+
+#include "fp-print.h"
+
+/**
+ * FpIdentifyMode:
+ * @FP_IDENTIFY_MODE_FIRST_MATCH: Report the first print in the gallery
+ *   that matches, the remaining gallery is not searched
+ * @FP_IDENTIFY_MODE_BEST_MATCH: Search the whole gallery and report the
+ *   print with the highest score
+ *
+ * How prints are matched against a gallery on the host, see
+ * fp_gallery_set_identify_mode().
+ */
+typedef enum {
+  FP_IDENTIFY_MODE_FIRST_MATCH = 0,
+  FP_IDENTIFY_MODE_BEST_MATCH,
+} FpIdentifyMode;
+
+/**
+ * FpGalleryScoreFunc:
+ * @probe: The probe #FpPrint that was scored
+ * @probe_index: The index of @probe in the probes that were passed
+ * @scores: (array length=n_scores): The scores of @probe against every
+ *   print of the gallery
+ * @n_scores: The number of gallery prints
+ * @user_data: User provided data
+ *
+ * Called by fp_gallery_score_prints() with one row of the score matrix.
+ * The @scores array is only valid during the call.
+ */
+typedef void (*FpGalleryScoreFunc) (FpPrint    *probe,
+                                    guint       probe_index,
+                                    const gint *scores,
+                                    guint       n_scores,
+                                    gpointer    user_data);
+
+FpGallery *fp_gallery_new (void);
+FpGallery *fp_gallery_new_from_prints (GPtrArray *prints);
+
+gboolean   fp_gallery_add (FpGallery *gallery,
+                           FpPrint   *print);
+gboolean   fp_gallery_remove (FpGallery *gallery,
+                              FpPrint   *print);
+gboolean   fp_gallery_contains (FpGallery *gallery,
+                                FpPrint   *print);
+
+guint      fp_gallery_get_n_prints (FpGallery *gallery);
+GPtrArray *fp_gallery_get_prints (FpGallery *gallery);
+
+FpIdentifyMode fp_gallery_get_identify_mode (FpGallery *gallery);
+void           fp_gallery_set_identify_mode (FpGallery     *gallery,
+                                             FpIdentifyMode mode);
+guint          fp_gallery_get_prefilter_candidates (FpGallery *gallery);
+void           fp_gallery_set_prefilter_candidates (FpGallery *gallery,
+                                                    guint      candidates);
+
+void       fp_gallery_score_prints (FpGallery          *gallery,
+                                    GPtrArray          *probes,
+                                    GCancellable       *cancellable,
+                                    FpGalleryScoreFunc  score_func,
+                                    gpointer            score_data,
+                                    GDestroyNotify      score_destroy,
+                                    GAsyncReadyCallback callback,
+                                    gpointer            user_data);
+gboolean   fp_gallery_score_prints_finish (FpGallery    *gallery,
+                                           GAsyncResult *result,
+                                           GError      **error);
+gboolean   fp_gallery_score_prints_sync (FpGallery         *gallery,
+                                         GPtrArray         *probes,
+                                         GCancellable      *cancellable,
+                                         FpGalleryScoreFunc score_func,
+                                         gpointer           score_data,
+                                         GError           **error);
+
+void       fp_gallery_identify_ranked (FpGallery          *gallery,
+                                       FpPrint            *print,
+                                       guint               max_candidates,
+                                       GCancellable       *cancellable,
+                                       GAsyncReadyCallback callback,
+                                       gpointer            user_data);
+GPtrArray *fp_gallery_identify_ranked_finish (FpGallery    *gallery,
+                                              GAsyncResult *result,
+                                              GArray      **scores,
+                                              GError      **error);
+GPtrArray *fp_gallery_identify_ranked_sync (FpGallery    *gallery,
+                                            FpPrint      *print,
+                                            guint         max_candidates,
+                                            GCancellable *cancellable,
+                                            GArray      **scores,
+                                            GError      **error);
+
+G_END_DECLS
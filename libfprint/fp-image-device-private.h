@@ -33,6 +33,7 @@ typedef struct
   gint                enroll_stage;
 
   gboolean            minutiae_scan_active;
+  gboolean            identify_active;
   GError             *action_error;
   FpImage            *capture_image;
 
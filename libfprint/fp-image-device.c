@@ -134,6 +134,7 @@ fp_image_device_start_capture_action (FpDevice *device)
   /* The internal state machine guarantees both of these. */
   g_assert (!priv->finger_present);
   g_assert (!priv->minutiae_scan_active);
+  g_assert (!priv->identify_active);
 
   /* And activate the device; we rely on fpi_image_device_activate_complete()
    * to be called when done (or immediately). */
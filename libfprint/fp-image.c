@@ -22,6 +22,7 @@
 
 #include "fpi-image.h"
 #include "fpi-log.h"
+#include "fp-print-private.h"
 
 #include <nbis.h>
 
@@ -163,6 +164,7 @@ typedef struct
   gint                width, height;
   gdouble             ppmm;
   FpiImageFlags       flags;
+  guint               threads;
   guchar             *image;
   guchar             *binarized;
 } DetectMinutiaeData;
@@ -176,101 +178,222 @@ fp_image_detect_minutiae_free (DetectMinutiaeData *data)
   g_free (data);
 }
 
+static DetectMinutiaeData *
+fp_image_detect_minutiae_data_new (FpImage *self)
+{
+  DetectMinutiaeData *data = g_new0 (DetectMinutiaeData, 1);
+
+  data->image = g_malloc (self->width * self->height);
+  memcpy (data->image, self->data, self->width * self->height);
+  data->flags = self->flags;
+  data->width = self->width;
+  data->height = self->height;
+  data->ppmm = self->ppmm;
+  data->threads = self->detection_threads;
+
+  return data;
+}
+
+/* Moves the result of a successful detection into the image */
+static void
+fp_image_detect_minutiae_apply (FpImage            *image,
+                                DetectMinutiaeData *data)
+{
+  gint i;
+
+  image->flags = data->flags;
+
+  g_clear_pointer (&image->data, g_free);
+  image->data = g_steal_pointer (&data->image);
+
+  g_clear_pointer (&image->binarized, g_free);
+  image->binarized = g_steal_pointer (&data->binarized);
+
+  g_clear_pointer (&image->minutiae, g_ptr_array_unref);
+  image->minutiae = g_ptr_array_new_full (data->minutiae->num,
+                                          (GDestroyNotify) free_minutia);
+
+  for (i = 0; i < data->minutiae->num; i++)
+    g_ptr_array_add (image->minutiae,
+                     g_steal_pointer (&data->minutiae->list[i]));
+
+  /* Don't let it delete anything. */
+  data->minutiae->num = 0;
+}
+
 static void
 fp_image_detect_minutiae_cb (GObject      *source_object,
                              GAsyncResult *res,
                              gpointer      user_data)
 {
   GTask *task = G_TASK (res);
-  FpImage *image;
   DetectMinutiaeData *data = g_task_get_task_data (task);
 
   if (!g_task_had_error (task))
-    {
-      gint i;
-      image = FP_IMAGE (source_object);
+    fp_image_detect_minutiae_apply (FP_IMAGE (source_object), data);
 
-      image->flags = data->flags;
+  if (data->user_cb)
+    data->user_cb (source_object, res, user_data);
+}
 
-      g_clear_pointer (&image->data, g_free);
-      image->data = g_steal_pointer (&data->image);
+/* The NBIS lookup tables only depend on the image size and some of the
+ * LFS parameters, and they are only read during the extraction. So they
+ * are cached for the few image sizes that a sensor produces and shared by
+ * all threads. Cached tables are never freed, if the cache is full, each
+ * extraction builds its own tables again. */
+#define LFSTABLES_CACHE_SIZE 8
 
-      g_clear_pointer (&image->binarized, g_free);
-      image->binarized = g_steal_pointer (&data->binarized);
+typedef struct
+{
+  gint    width;
+  gint    height;
+  gint    windowsize;
+  gint    windowoffset;
+  gint    dirbin_grid_w;
+  gint    dirbin_grid_h;
+  gint    num_directions;
+  gint    num_dft_waves;
+  gdouble start_dir_angle;
+} LfsTablesKey;
+
+static GMutex lfstables_cache_lock;
+static GHashTable *lfstables_cache;
+
+static guint
+lfs_tables_key_hash (gconstpointer v)
+{
+  const LfsTablesKey *key = v;
 
-      g_clear_pointer (&image->minutiae, g_ptr_array_unref);
-      image->minutiae = g_ptr_array_new_full (data->minutiae->num,
-                                              (GDestroyNotify) free_minutia);
+  return (key->width * 31 + key->height) * 31 + key->windowsize;
+}
 
-      for (i = 0; i < data->minutiae->num; i++)
-        g_ptr_array_add (image->minutiae,
-                         g_steal_pointer (&data->minutiae->list[i]));
+static gboolean
+lfs_tables_key_equal (gconstpointer a, gconstpointer b)
+{
+  const LfsTablesKey *ka = a;
+  const LfsTablesKey *kb = b;
+
+  return ka->width == kb->width &&
+         ka->height == kb->height &&
+         ka->windowsize == kb->windowsize &&
+         ka->windowoffset == kb->windowoffset &&
+         ka->dirbin_grid_w == kb->dirbin_grid_w &&
+         ka->dirbin_grid_h == kb->dirbin_grid_h &&
+         ka->num_directions == kb->num_directions &&
+         ka->num_dft_waves == kb->num_dft_waves &&
+         ka->start_dir_angle == kb->start_dir_angle;
+}
 
-      /* Don't let it delete anything. */
-      data->minutiae->num = 0;
+static const LFSTABLES *
+get_cached_lfstables (gint width, gint height, const LFSPARMS *lfsparms)
+{
+  LfsTablesKey key = {
+    .width = width,
+    .height = height,
+    .windowsize = lfsparms->windowsize,
+    .windowoffset = lfsparms->windowoffset,
+    .dirbin_grid_w = lfsparms->dirbin_grid_w,
+    .dirbin_grid_h = lfsparms->dirbin_grid_h,
+    .num_directions = lfsparms->num_directions,
+    .num_dft_waves = lfsparms->num_dft_waves,
+    .start_dir_angle = lfsparms->start_dir_angle,
+  };
+  LFSTABLES *lfstables;
+
+  g_mutex_lock (&lfstables_cache_lock);
+
+  if (!lfstables_cache)
+    lfstables_cache = g_hash_table_new_full (lfs_tables_key_hash,
+                                             lfs_tables_key_equal,
+                                             g_free, NULL);
+
+  lfstables = g_hash_table_lookup (lfstables_cache, &key);
+
+  if (!lfstables && g_hash_table_size (lfstables_cache) < LFSTABLES_CACHE_SIZE)
+    {
+      gint r = init_lfstables (&lfstables, width, height, lfsparms);
+
+      if (r == 0)
+        {
+          g_hash_table_insert (lfstables_cache, g_memdup (&key, sizeof (key)), lfstables);
+        }
+      else
+        {
+          fp_dbg ("Initializing the minutiae detection tables failed, code %d", r);
+          lfstables = NULL;
+        }
     }
 
-  if (data->user_cb)
-    data->user_cb (source_object, res, user_data);
+  g_mutex_unlock (&lfstables_cache_lock);
+
+  /* NULL makes get_minutiae() build private tables */
+  return lfstables;
 }
 
-static void
-vflip (guint8 *data, gint width, gint height)
+/* The blocks of the image maps are analyzed by the extracting thread and
+ * by jobs dispatched to a shared thread pool. Each pool thread keeps an
+ * arena for the working buffers of the jobs it runs. */
+typedef struct
 {
-  int data_len = width * height;
-  unsigned char rowbuf[width];
-  int i;
+  void (*func) (void *);
+  void *data;
+} LfsMapJob;
 
-  for (i = 0; i < height / 2; i++)
-    {
-      int offset = i * width;
-      int swap_offset = data_len - (width * (i + 1));
+static void
+lfs_map_arena_free (gpointer arena)
+{
+  free_lfsarena (arena, NULL);
+  g_free (arena);
+}
 
-      /* copy top row into buffer */
-      memcpy (rowbuf, data + offset, width);
+static GPrivate lfs_map_arena = G_PRIVATE_INIT (lfs_map_arena_free);
 
-      /* copy lower row over upper row */
-      memcpy (data + offset, data + swap_offset, width);
+static void
+lfs_map_worker (gpointer job_ptr, gpointer unused)
+{
+  g_autofree LfsMapJob *job = job_ptr;
+  LFSARENA *arena = g_private_get (&lfs_map_arena);
 
-      /* copy buffer over lower row */
-      memcpy (data + swap_offset, rowbuf, width);
+  if (!arena)
+    {
+      arena = g_new0 (LFSARENA, 1);
+      g_private_set (&lfs_map_arena, arena);
     }
+
+  reuse_lfsarena (arena);
+  job->func (job->data);
+  release_lfsarena (arena, NULL);
 }
 
 static void
-hflip (guint8 *data, gint width, gint height)
+lfs_map_dispatch (void (*func) (void *), void *data)
 {
-  unsigned char rowbuf[width];
-  int i, j;
+  static gsize pool = 0;
+  LfsMapJob *job;
 
-  for (i = 0; i < height; i++)
+  if (g_once_init_enter (&pool))
     {
-      int offset = i * width;
+      GThreadPool *p;
 
-      memcpy (rowbuf, data + offset, width);
-      for (j = 0; j < width; j++)
-        data[offset + j] = rowbuf[width - j - 1];
+      p = g_thread_pool_new (lfs_map_worker, NULL,
+                             g_get_num_processors (), FALSE, NULL);
+      g_once_init_leave (&pool, (gsize) p);
     }
-}
-
-static void
-invert_colors (guint8 *data, gint width, gint height)
-{
-  int data_len = width * height;
-  int i;
 
-  for (i = 0; i < data_len; i++)
-    data[i] = 0xff - data[i];
+  job = g_new (LfsMapJob, 1);
+  job->func = func;
+  job->data = data;
+  g_thread_pool_push ((GThreadPool *) pool, job, NULL);
 }
 
-static void
-fp_image_detect_minutiae_thread_func (GTask        *task,
-                                      gpointer      source_object,
-                                      gpointer      task_data,
-                                      GCancellable *cancellable)
+/* Runs the detection on the copy of the image in @data. If @arena is
+ * given, the working memory is taken from it and kept there afterwards. */
+static gboolean
+fp_image_detect_minutiae_run (DetectMinutiaeData *data,
+                              LFSARENA           *arena,
+                              GError            **error)
 {
   g_autoptr(GTimer) timer = NULL;
-  DetectMinutiaeData *data = task_data;
   struct fp_minutiae *minutiae = NULL;
   g_autofree gint *direction_map = NULL;
   g_autofree gint *low_contrast_map = NULL;
@@ -282,30 +405,29 @@ fp_image_detect_minutiae_thread_func (GTask        *task,
   gint bw, bh, bd;
   gint r;
   g_autofree LFSPARMS *lfsparms = NULL;
+  LFSALLOCSTATS allocstats = { 0 };
 
   /* Normalize the image first */
-  if (data->flags & FPI_IMAGE_H_FLIPPED)
-    hflip (data->image, data->width, data->height);
-
-  if (data->flags & FPI_IMAGE_V_FLIPPED)
-    vflip (data->image, data->width, data->height);
-
-  if (data->flags & FPI_IMAGE_COLORS_INVERTED)
-    invert_colors (data->image, data->width, data->height);
-
+  fpi_image_normalize (data->image, data->width, data->height, data->flags);
   data->flags &= ~(FPI_IMAGE_H_FLIPPED | FPI_IMAGE_V_FLIPPED | FPI_IMAGE_COLORS_INVERTED);
 
   lfsparms = g_memdup (&g_lfsparms_V2, sizeof (LFSPARMS));
   lfsparms->remove_perimeter_pts = data->flags & FPI_IMAGE_PARTIAL ? TRUE : FALSE;
+  lfsparms->map_threads = data->threads ? data->threads : g_get_num_processors ();
+  lfsparms->map_dispatch = lfs_map_dispatch;
 
   timer = g_timer_new ();
   r = get_minutiae (&minutiae, &quality_map, &direction_map,
                     &low_contrast_map, &low_flow_map, &high_curve_map,
                     &map_w, &map_h, &bdata, &bw, &bh, &bd,
                     data->image, data->width, data->height, 8,
-                    data->ppmm, lfsparms);
+                    data->ppmm, lfsparms,
+                    get_cached_lfstables (data->width, data->height, lfsparms),
+                    arena, &allocstats);
   g_timer_stop (timer);
   fp_dbg ("Minutiae scan completed in %f secs", g_timer_elapsed (timer, NULL));
+  fp_dbg ("Minutiae scan used %d working buffers (%d reused) from %d arena blocks",
+          allocstats.num_allocs, allocstats.num_reused, allocstats.num_blocks);
 
   data->binarized = g_steal_pointer (&bdata);
   data->minutiae = minutiae;
@@ -313,23 +435,141 @@ fp_image_detect_minutiae_thread_func (GTask        *task,
   if (r)
     {
       fp_err ("get minutiae failed, code %d", r);
-      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED, "Minutiae scan failed with code %d", r);
-      g_object_unref (task);
-      return;
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED, "Minutiae scan failed with code %d", r);
+      return FALSE;
     }
 
   if (!data->minutiae || data->minutiae->num == 0)
     {
-      g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_FAILED,
-                               "No minutiae found");
-      g_object_unref (task);
-      return;
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                   "No minutiae found");
+      return FALSE;
     }
 
-  g_task_return_boolean (task, TRUE);
+  return TRUE;
+}
+
+static void
+fp_image_detect_minutiae_thread_func (GTask        *task,
+                                      gpointer      source_object,
+                                      gpointer      task_data,
+                                      GCancellable *cancellable)
+{
+  GError *error = NULL;
+
+  if (fp_image_detect_minutiae_run (task_data, NULL, &error))
+    g_task_return_boolean (task, TRUE);
+  else
+    g_task_return_error (task, error);
+
   g_object_unref (task);
 }
 
+typedef struct
+{
+  GPtrArray *images;
+  /* The print of each image, NULL if the detection failed */
+  GPtrArray *prints;
+  gchar     *driver;
+  gchar     *device_id;
+  guint      threads;
+  gint       next;
+  gint       workers;
+} DetectMinutiaeBatchData;
+
+static void
+print_unref_nullable (gpointer print)
+{
+  if (print)
+    g_object_unref (print);
+}
+
+static void
+fp_image_detect_minutiae_batch_free (DetectMinutiaeBatchData *data)
+{
+  g_ptr_array_unref (data->images);
+  g_ptr_array_unref (data->prints);
+  g_free (data->driver);
+  g_free (data->device_id);
+  g_free (data);
+}
+
+static void
+fp_image_detect_minutiae_batch_worker (gpointer task_ptr, gpointer unused)
+{
+  g_autoptr(GTask) task = task_ptr;
+  DetectMinutiaeBatchData *data = g_task_get_task_data (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+  LFSARENA arena = { 0, };
+
+  /* An image is only copied once a worker takes it, and only its print is
+   * kept afterwards. The working memory of the first image is reused for
+   * all others. */
+  while (!g_cancellable_is_cancelled (cancellable))
+    {
+      g_autoptr(GError) error = NULL;
+      DetectMinutiaeData *item;
+      FpPrint *print;
+      gint i;
+
+      i = g_atomic_int_add (&data->next, 1);
+      if (i >= (gint) data->images->len)
+        break;
+
+      item = fp_image_detect_minutiae_data_new (g_ptr_array_index (data->images, i));
+      if (item->threads == 0)
+        item->threads = data->threads;
+
+      if (fp_image_detect_minutiae_run (item, &arena, &error))
+        {
+          print = g_object_new (FP_TYPE_PRINT,
+                                "driver", data->driver,
+                                "device-id", data->device_id,
+                                NULL);
+          fpi_print_set_type (print, FPI_PRINT_NBIS);
+          fpi_print_add_minutiae (print, item->minutiae, item->width, item->height);
+
+          /* Every worker only writes the positions it took */
+          g_ptr_array_index (data->prints, i) = g_object_ref_sink (print);
+        }
+      else
+        {
+          fp_dbg ("Minutiae detection in image %d failed: %s", i, error->message);
+        }
+
+      fp_image_detect_minutiae_free (item);
+    }
+
+  free_lfsarena (&arena, NULL);
+
+  if (!g_atomic_int_dec_and_test (&data->workers))
+    return;
+
+  /* We are the last worker, report the result */
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  g_task_return_pointer (task, g_ptr_array_ref (data->prints),
+                         (GDestroyNotify) g_ptr_array_unref);
+}
+
+static GThreadPool *
+fp_image_get_detect_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *p;
+
+      p = g_thread_pool_new (fp_image_detect_minutiae_batch_worker, NULL,
+                             g_get_num_processors (), FALSE, NULL);
+      g_once_init_leave (&pool, (gsize) p);
+    }
+
+  return (GThreadPool *) pool;
+}
+
 /**
  * fp_image_get_height:
  * @self: A #FpImage
@@ -444,16 +684,10 @@ fp_image_detect_minutiae (FpImage            *self,
                           gpointer            user_data)
 {
   GTask *task;
-  DetectMinutiaeData *data = g_new0 (DetectMinutiaeData, 1);
+  DetectMinutiaeData *data = fp_image_detect_minutiae_data_new (self);
 
   task = g_task_new (self, cancellable, fp_image_detect_minutiae_cb, user_data);
 
-  data->image = g_malloc (self->width * self->height);
-  memcpy (data->image, self->data, self->width * self->height);
-  data->flags = self->flags;
-  data->width = self->width;
-  data->height = self->height;
-  data->ppmm = self->ppmm;
   data->user_cb = callback;
 
   g_task_set_task_data (task, data, (GDestroyNotify) fp_image_detect_minutiae_free);
@@ -478,6 +712,94 @@ fp_image_detect_minutiae_finish (FpImage      *self,
   return g_task_propagate_boolean (G_TASK (result), error);
 }
 
+/**
+ * fp_image_detect_minutiae_batch:
+ * @images: (element-type FpImage) (transfer none): #GPtrArray of #FpImage
+ * @driver: The driver the prints are created for
+ * @device_id: The device ID the prints are created for
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to call on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Detects the minutiae found in many images and creates a print from
+ * each of them, e.g. to create new templates from stored captures. Pass
+ * the driver and device ID of the prints being replaced (see
+ * fp_print_get_driver() and fp_print_get_device_id()), so that the new
+ * prints are compatible with the same devices.
+ *
+ * This is faster than calling fp_image_detect_minutiae() for every image:
+ * the images are spread over a fixed number of worker threads (one per
+ * processor), and each worker reuses its working memory for all the
+ * images it processes. The images themselves are not modified, and they
+ * must not be modified until the operation is done.
+ */
+void
+fp_image_detect_minutiae_batch (GPtrArray          *images,
+                                const gchar        *driver,
+                                const gchar        *device_id,
+                                GCancellable       *cancellable,
+                                GAsyncReadyCallback callback,
+                                gpointer            user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  DetectMinutiaeBatchData *data;
+  GThreadPool *pool;
+  guint n_workers;
+  guint i;
+
+  g_return_if_fail (images != NULL);
+  g_return_if_fail (driver != NULL && device_id != NULL);
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, fp_image_detect_minutiae_batch);
+
+  n_workers = MIN (images->len, g_get_num_processors ());
+
+  data = g_new0 (DetectMinutiaeBatchData, 1);
+  data->images = g_ptr_array_ref (images);
+  data->prints = g_ptr_array_new_full (images->len, print_unref_nullable);
+  g_ptr_array_set_size (data->prints, images->len);
+  data->driver = g_strdup (driver);
+  data->device_id = g_strdup (device_id);
+  /* The processors are shared between the images first */
+  data->threads = MAX (1, g_get_num_processors () / MAX (n_workers, 1));
+  data->workers = n_workers;
+  g_task_set_task_data (task, data, (GDestroyNotify) fp_image_detect_minutiae_batch_free);
+
+  if (images->len == 0)
+    {
+      g_task_return_pointer (task, g_ptr_array_ref (data->prints),
+                             (GDestroyNotify) g_ptr_array_unref);
+      return;
+    }
+
+  pool = fp_image_get_detect_pool ();
+  for (i = 0; i < n_workers; i++)
+    g_thread_pool_push (pool, g_object_ref (task), NULL);
+}
+
+/**
+ * fp_image_detect_minutiae_batch_finish:
+ * @result: A #GAsyncResult
+ * @error: Return location for errors, or %NULL to ignore
+ *
+ * Finish minutiae detection in many images. Only cancellation is reported
+ * as an error, failures in single images are not.
+ *
+ * Returns: (element-type FpPrint) (transfer full): The prints of type
+ *   NBIS in the order of the images, with %NULL in place of the print of
+ *   an image in which the detection failed (e.g. because no minutiae were
+ *   found); %NULL on error
+ */
+GPtrArray *
+fp_image_detect_minutiae_batch_finish (GAsyncResult *result,
+                                       GError      **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
 /**
  * fp_minutia_get_coords:
  * @min: A #FpMinutia
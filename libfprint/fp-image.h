@@ -47,6 +47,15 @@ gboolean      fp_image_detect_minutiae_finish (FpImage      *self,
                                                GAsyncResult *result,
                                                GError      **error);
 
+void          fp_image_detect_minutiae_batch (GPtrArray          *images,
+                                              const gchar        *driver,
+                                              const gchar        *device_id,
+                                              GCancellable       *cancellable,
+                                              GAsyncReadyCallback callback,
+                                              gpointer            user_data);
+GPtrArray    *fp_image_detect_minutiae_batch_finish (GAsyncResult *result,
+                                                     GError      **error);
+
 const guchar * fp_image_get_data (FpImage *self,
                                   gsize   *len);
 const guchar * fp_image_get_binarized (FpImage *self,
@@ -43,4 +43,18 @@ struct _FpPrint
 
   GVariant  *data;
   GPtrArray *prints;
+
+  /* Lazily computed Bozorth3 gallery tables for prints, accessed atomically */
+  GPtrArray *bz3_tables;
+  /* Lazily computed identify pre-filter features, accessed atomically */
+  GArray    *bz3_index;
+  /* Lazily computed content hash, accessed atomically */
+  guint64   *content_hash;
 };
+
+void       fpi_print_clear_caches (FpPrint *print);
+void       fpi_print_add_minutiae (FpPrint            *print,
+                                   struct fp_minutiae *minutiae,
+                                   gint                width,
+                                   gint                height);
+GPtrArray *fpi_print_ensure_bz3_tables (FpPrint *print);
@@ -80,6 +80,7 @@ fp_print_finalize (GObject *object)
   g_clear_pointer (&self->enroll_date, g_date_free);
   g_clear_pointer (&self->data, g_variant_unref);
   g_clear_pointer (&self->prints, g_ptr_array_unref);
+  fpi_print_clear_caches (self);
 
   G_OBJECT_CLASS (fp_print_parent_class)->finalize (object);
 }
@@ -191,11 +192,13 @@ fp_print_set_property (GObject      *object,
     case PROP_FPI_DATA:
       g_clear_pointer (&self->data, g_variant_unref);
       self->data = g_value_dup_variant (value);
+      fpi_print_clear_caches (self);
       break;
 
     case PROP_FPI_PRINTS:
       g_clear_pointer (&self->prints, g_ptr_array_unref);
       self->prints = g_value_get_pointer (value);
+      fpi_print_clear_caches (self);
       break;
 
     default:
@@ -578,6 +581,154 @@ fp_print_compatible (FpPrint *self, FpDevice *device)
   return TRUE;
 }
 
+/* Mixes the data in 64 bit words, which is a lot faster than a byte wise
+ * hash for the few kilobytes of minutiae a print usually has. */
+#define FPI_PRINT_HASH_INIT G_GUINT64_CONSTANT (0xcbf29ce484222325)
+#define FPI_PRINT_HASH_PRIME G_GUINT64_CONSTANT (0x100000001b3)
+
+static inline guint64
+print_hash_bytes (guint64 hash, gconstpointer data, gsize size)
+{
+  const guint8 *p = data;
+  guint64 word;
+
+  for (; size >= sizeof (word); p += sizeof (word), size -= sizeof (word))
+    {
+      memcpy (&word, p, sizeof (word));
+      hash = (hash ^ word) * FPI_PRINT_HASH_PRIME;
+      hash ^= hash >> 29;
+    }
+
+  for (; size > 0; p++, size--)
+    hash = (hash ^ *p) * FPI_PRINT_HASH_PRIME;
+
+  return hash;
+}
+
+static inline guint64
+print_hash_string (guint64 hash, const gchar *str)
+{
+  /* Include the terminator so that NULL and "" hash differently and
+   * adjacent strings cannot run into each other. */
+  if (!str)
+    return print_hash_bytes (hash, "\xff", 1);
+
+  return print_hash_bytes (hash, str, strlen (str) + 1);
+}
+
+/* Hashes all the information that fp_print_equal() compares, so prints
+ * that are equal always have the same hash. */
+static guint64
+print_compute_content_hash (FpPrint *print)
+{
+  guint64 hash = FPI_PRINT_HASH_INIT;
+
+  hash = print_hash_bytes (hash, &print->type, sizeof (print->type));
+  hash = print_hash_string (hash, print->driver);
+  hash = print_hash_string (hash, print->device_id);
+
+  if (print->type == FPI_PRINT_RAW)
+    {
+      g_autoptr(GVariant) normal = NULL;
+
+      /* Equal variants have the same serialized normal form, which is
+       * usually what the print already holds. */
+      if (g_variant_is_normal_form (print->data))
+        normal = g_variant_ref (print->data);
+      else
+        normal = g_variant_get_normal_form (print->data);
+
+      hash = print_hash_string (hash, g_variant_get_type_string (normal));
+      hash = print_hash_bytes (hash, g_variant_get_data (normal), g_variant_get_size (normal));
+    }
+  else if (print->type == FPI_PRINT_NBIS)
+    {
+      guint i;
+
+      for (i = 0; i < print->prints->len; i++)
+        {
+          struct xyt_struct *xyt = g_ptr_array_index (print->prints, i);
+
+          hash = print_hash_bytes (hash, &xyt->nrows, sizeof (xyt->nrows));
+          hash = print_hash_bytes (hash, xyt->xcol, xyt->nrows * sizeof (xyt->xcol[0]));
+          hash = print_hash_bytes (hash, xyt->ycol, xyt->nrows * sizeof (xyt->ycol[0]));
+          hash = print_hash_bytes (hash, xyt->thetacol, xyt->nrows * sizeof (xyt->thetacol[0]));
+        }
+    }
+  else
+    {
+      g_assert_not_reached ();
+    }
+
+  /* Finalize so that all bits depend on the whole input */
+  hash ^= hash >> 33;
+  hash *= G_GUINT64_CONSTANT (0xff51afd7ed558ccd);
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
+/**
+ * fp_print_get_content_hash:
+ * @self: A #FpPrint
+ *
+ * Gets a 64 bit hash of the information about the print that
+ * fp_print_equal() compares. Prints that are equal have the same hash,
+ * so prints with a different hash are known to differ without comparing
+ * them.
+ *
+ * The hash is computed when it is first needed and then kept with the
+ * print. It may change between libfprint versions and architectures, so
+ * it should not be stored.
+ *
+ * Returns: The content hash of the print
+ */
+guint64
+fp_print_get_content_hash (FpPrint *self)
+{
+  guint64 *hash;
+
+  g_return_val_if_fail (FP_IS_PRINT (self), 0);
+  g_return_val_if_fail (self->type != FPI_PRINT_UNDEFINED, 0);
+
+  hash = g_atomic_pointer_get (&self->content_hash);
+  if (G_LIKELY (hash))
+    return *hash;
+
+  /* The hash is stored behind a pointer, as 64 bit values cannot be
+   * accessed atomically on all platforms. If another thread was faster,
+   * use its result instead. */
+  hash = g_new (guint64, 1);
+  *hash = print_compute_content_hash (self);
+
+  if (!g_atomic_pointer_compare_and_exchange (&self->content_hash, NULL, hash))
+    {
+      g_free (hash);
+      hash = g_atomic_pointer_get (&self->content_hash);
+    }
+
+  return *hash;
+}
+
+/**
+ * fp_print_hash:
+ * @self: A #FpPrint
+ *
+ * Gets a hash of the print that can be used together with fp_print_equal()
+ * to use prints as keys of a #GHashTable. Like fp_print_equal() this
+ * only considers the information about the print and not the metadata,
+ * see fp_print_get_content_hash().
+ *
+ * Returns: The hash of the print
+ */
+guint
+fp_print_hash (FpPrint *self)
+{
+  guint64 hash = fp_print_get_content_hash (self);
+
+  return (guint) (hash ^ (hash >> 32));
+}
+
 /**
  * fp_print_equal:
  * @self: First #FpPrint
@@ -605,6 +756,11 @@ fp_print_equal (FpPrint *self, FpPrint *other)
   if (g_strcmp0 (self->device_id, other->device_id))
     return FALSE;
 
+  /* Prints with a different content cannot have the same hash, as the
+   * hash is cached this avoids most deep comparisons. */
+  if (fp_print_get_content_hash (self) != fp_print_get_content_hash (other))
+    return FALSE;
+
   if (self->type == FPI_PRINT_RAW)
     {
       return g_variant_equal (self->data, other->data);
@@ -621,7 +777,10 @@ fp_print_equal (FpPrint *self, FpPrint *other)
           struct xyt_struct *a = g_ptr_array_index (self->prints, i);
           struct xyt_struct *b = g_ptr_array_index (other->prints, i);
 
-          if (memcmp (a, b, sizeof (struct xyt_struct)) != 0)
+          if (a->nrows != b->nrows ||
+              memcmp (a->xcol, b->xcol, a->nrows * sizeof (a->xcol[0])) != 0 ||
+              memcmp (a->ycol, b->ycol, a->nrows * sizeof (a->ycol[0])) != 0 ||
+              memcmp (a->thetacol, b->thetacol, a->nrows * sizeof (a->thetacol[0])) != 0)
             return FALSE;
         }
 
@@ -635,28 +794,132 @@ fp_print_equal (FpPrint *self, FpPrint *other)
 
 #define FPI_PRINT_VARIANT_TYPE G_VARIANT_TYPE ("(issbymsmsia{sv}v)")
 
+/* The compact FP4 format stores each minutia of an NBIS print in 6 bytes:
+ * x and y as signed little endian 16 bit values, followed by a little
+ * endian 16 bit value holding theta + 180 in the lower 9 bits and the
+ * quality in the upper 7 bits, if the print has a quality. */
+#define FPI_PRINT_FP4_NBIS_TYPE G_VARIANT_TYPE ("(a(yay))")
+#define FPI_PRINT_FP4_MINUTIA_SIZE 6
+#define FPI_PRINT_FP4_HAS_QUALITY (1 << 0)
+#define FPI_PRINT_FP4_BZ3_TABLES_KEY "bz3-tables"
+
 G_STATIC_ASSERT (sizeof (((struct xyt_struct *) NULL)->xcol[0]) == 4);
 
-/**
- * fp_print_serialize:
- * @print: A #FpPrint
- * @data: (array length=length) (transfer full) (out): Return location for data pointer
- * @length: (transfer full) (out): Length of @data
- * @error: Return location for error
- *
- * Serialize a print definition for permanent storage. Note that this is
- * lossy in the sense that e.g. the image data is discarded.
- *
- * Returns: (type void): %TRUE on success
- */
-gboolean
-fp_print_serialize (FpPrint *print,
-                    guchar **data,
-                    gsize   *length,
-                    GError **error)
+static GVariant *
+fp_print_nbis_to_fp3 (FpPrint *print)
+{
+  GVariantBuilder nested = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("(a(aiaiai))"));
+  guint i;
+
+  g_variant_builder_open (&nested, G_VARIANT_TYPE ("a(aiaiai)"));
+  for (i = 0; i < print->prints->len; i++)
+    {
+      struct xyt_struct *xyt = g_ptr_array_index (print->prints, i);
+
+      g_variant_builder_open (&nested, G_VARIANT_TYPE ("(aiaiai)"));
+
+      g_variant_builder_add_value (&nested,
+                                   g_variant_new_fixed_array (G_VARIANT_TYPE_INT32,
+                                                              xyt->xcol,
+                                                              xyt->nrows,
+                                                              sizeof (xyt->xcol[0])));
+      g_variant_builder_add_value (&nested,
+                                   g_variant_new_fixed_array (G_VARIANT_TYPE_INT32,
+                                                              xyt->ycol,
+                                                              xyt->nrows,
+                                                              sizeof (xyt->ycol[0])));
+      g_variant_builder_add_value (&nested,
+                                   g_variant_new_fixed_array (G_VARIANT_TYPE_INT32,
+                                                              xyt->thetacol,
+                                                              xyt->nrows,
+                                                              sizeof (xyt->thetacol[0])));
+      g_variant_builder_close (&nested);
+    }
+
+  g_variant_builder_close (&nested);
+
+  return g_variant_builder_end (&nested);
+}
+
+static GVariant *
+fp_print_nbis_to_fp4 (FpPrint *print,
+                      GError **error)
+{
+  GVariantBuilder nested = G_VARIANT_BUILDER_INIT (FPI_PRINT_FP4_NBIS_TYPE);
+  guint i;
+
+  g_variant_builder_open (&nested, G_VARIANT_TYPE ("a(yay)"));
+  for (i = 0; i < print->prints->len; i++)
+    {
+      struct xyt_struct *xyt = g_ptr_array_index (print->prints, i);
+      g_autofree guint8 *packed = g_malloc (xyt->nrows * FPI_PRINT_FP4_MINUTIA_SIZE);
+      gint j;
+
+      for (j = 0; j < xyt->nrows; j++)
+        {
+          guint8 *minutia = packed + j * FPI_PRINT_FP4_MINUTIA_SIZE;
+          guint16 theta = xyt->thetacol[j] + 180;
+
+          if (xyt->xcol[j] < G_MININT16 || xyt->xcol[j] > G_MAXINT16 ||
+              xyt->ycol[j] < G_MININT16 || xyt->ycol[j] > G_MAXINT16 ||
+              xyt->thetacol[j] < -180 || xyt->thetacol[j] > 180)
+            {
+              g_variant_builder_clear (&nested);
+              g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                           "Minutia %d of print %u cannot be stored compactly", j, i);
+              return NULL;
+            }
+
+          minutia[0] = (guint16) xyt->xcol[j] & 0xff;
+          minutia[1] = (guint16) xyt->xcol[j] >> 8;
+          minutia[2] = (guint16) xyt->ycol[j] & 0xff;
+          minutia[3] = (guint16) xyt->ycol[j] >> 8;
+          minutia[4] = theta & 0xff;
+          minutia[5] = theta >> 8;
+        }
+
+      g_variant_builder_add (&nested, "(y@ay)", 0,
+                             g_variant_new_fixed_array (G_VARIANT_TYPE_BYTE, packed,
+                                                        xyt->nrows * FPI_PRINT_FP4_MINUTIA_SIZE,
+                                                        1));
+    }
+  g_variant_builder_close (&nested);
+
+  return g_variant_builder_end (&nested);
+}
+
+static GVariant *
+fp_print_bz3_tables_to_variant (FpPrint *print)
+{
+  GVariantBuilder builder = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("aai"));
+  GPtrArray *tables = fpi_print_ensure_bz3_tables (print);
+  guint i;
+
+  for (i = 0; i < tables->len; i++)
+    {
+      struct bz_gallery_table *table = g_ptr_array_index (tables, i);
+
+      g_variant_builder_add_value (&builder,
+                                   g_variant_new_fixed_array (G_VARIANT_TYPE_INT32,
+                                                              table->cols,
+                                                              table->nrows * COLS_SIZE_2,
+                                                              sizeof (gint32)));
+    }
+
+  return g_variant_builder_end (&builder);
+}
+
+static gboolean
+fp_print_serialize_format (FpPrint              *print,
+                           guint                 version,
+                           FpPrintSerializeFlags flags,
+                           guchar              **data,
+                           gsize                *length,
+                           GError              **error)
 {
   g_autoptr(GVariant) result = NULL;
   GVariantBuilder builder = G_VARIANT_BUILDER_INIT (FPI_PRINT_VARIANT_TYPE);
+  gboolean compact = version >= 4;
   gsize len;
 
   g_assert (data);
@@ -676,43 +939,31 @@ fp_print_serialize (FpPrint *print,
   else
     g_variant_builder_add (&builder, "i", G_MININT32);
 
-  /* Unused a{sv} for expansion */
+  /* a{sv} for expansion, FP4 may store the match cache there */
   g_variant_builder_open (&builder, G_VARIANT_TYPE_VARDICT);
+  if (compact && print->type == FPI_PRINT_NBIS &&
+      (flags & FP_PRINT_SERIALIZE_MATCH_CACHE))
+    g_variant_builder_add (&builder, "{sv}", FPI_PRINT_FP4_BZ3_TABLES_KEY,
+                           fp_print_bz3_tables_to_variant (print));
   g_variant_builder_close (&builder);
 
   /* Insert NBIS print data for type NBIS, otherwise the GVariant directly */
   if (print->type == FPI_PRINT_NBIS)
     {
-      GVariantBuilder nested = G_VARIANT_BUILDER_INIT (G_VARIANT_TYPE ("(a(aiaiai))"));
-      guint i;
+      GVariant *nbis;
 
-      g_variant_builder_open (&nested, G_VARIANT_TYPE ("a(aiaiai)"));
-      for (i = 0; i < print->prints->len; i++)
-        {
-          struct xyt_struct *xyt = g_ptr_array_index (print->prints, i);
+      if (compact)
+        nbis = fp_print_nbis_to_fp4 (print, error);
+      else
+        nbis = fp_print_nbis_to_fp3 (print);
 
-          g_variant_builder_open (&nested, G_VARIANT_TYPE ("(aiaiai)"));
-
-          g_variant_builder_add_value (&nested,
-                                       g_variant_new_fixed_array (G_VARIANT_TYPE_INT32,
-                                                                  xyt->xcol,
-                                                                  xyt->nrows,
-                                                                  sizeof (xyt->xcol[0])));
-          g_variant_builder_add_value (&nested,
-                                       g_variant_new_fixed_array (G_VARIANT_TYPE_INT32,
-                                                                  xyt->ycol,
-                                                                  xyt->nrows,
-                                                                  sizeof (xyt->ycol[0])));
-          g_variant_builder_add_value (&nested,
-                                       g_variant_new_fixed_array (G_VARIANT_TYPE_INT32,
-                                                                  xyt->thetacol,
-                                                                  xyt->nrows,
-                                                                  sizeof (xyt->thetacol[0])));
-          g_variant_builder_close (&nested);
+      if (!nbis)
+        {
+          g_variant_builder_clear (&builder);
+          return FALSE;
         }
 
-      g_variant_builder_close (&nested);
-      g_variant_builder_add (&builder, "v", g_variant_builder_end (&nested));
+      g_variant_builder_add (&builder, "v", nbis);
     }
   else
     {
@@ -738,7 +989,7 @@ fp_print_serialize (FpPrint *print,
 
   (*data)[0] = (guchar) 'F';
   (*data)[1] = (guchar) 'P';
-  (*data)[2] = (guchar) '3';
+  (*data)[2] = (guchar) ('0' + version);
 
   g_variant_get_data (result);
   g_variant_store (result, (*data) + 3);
@@ -747,26 +998,226 @@ fp_print_serialize (FpPrint *print,
 }
 
 /**
- * fp_print_deserialize:
- * @data: (array length=length): The binary data
- * @length: Length of the data
+ * fp_print_serialize:
+ * @print: A #FpPrint
+ * @data: (array length=length) (transfer full) (out): Return location for data pointer
+ * @length: (transfer full) (out): Length of @data
  * @error: Return location for error
  *
- * Deserialize a print definition from permanent storage.
+ * Serialize a print definition for permanent storage. Note that this is
+ * lossy in the sense that e.g. the image data is discarded.
  *
- * Returns: (transfer full): A newly created #FpPrint on success
+ * Returns: (type void): %TRUE on success
  */
-FpPrint *
-fp_print_deserialize (const guchar *data,
-                      gsize         length,
-                      GError      **error)
+gboolean
+fp_print_serialize (FpPrint *print,
+                    guchar **data,
+                    gsize   *length,
+                    GError **error)
+{
+  return fp_print_serialize_format (print, 3, FP_PRINT_SERIALIZE_NONE,
+                                    data, length, error);
+}
+
+/**
+ * fp_print_serialize_compact:
+ * @print: A #FpPrint
+ * @flags: #FpPrintSerializeFlags selecting optional data
+ * @data: (array length=length) (transfer full) (out): Return location for data pointer
+ * @length: (transfer full) (out): Length of @data
+ * @error: Return location for error
+ *
+ * Serialize a print definition like fp_print_serialize(), but using a
+ * more compact format for prints that are matched on the host, which
+ * needs about half the space. With %FP_PRINT_SERIALIZE_MATCH_CACHE the
+ * data of fp_print_serialize_match_cache() is included, so it does not
+ * need to be computed again after loading the print.
+ *
+ * The result can be loaded using fp_print_deserialize() or
+ * fp_print_deserialize_bytes(), but not by versions of libfprint
+ * older than this function.
+ *
+ * Returns: (type void): %TRUE on success
+ */
+gboolean
+fp_print_serialize_compact (FpPrint              *print,
+                            FpPrintSerializeFlags flags,
+                            guchar              **data,
+                            gsize                *length,
+                            GError              **error)
+{
+  return fp_print_serialize_format (print, 4, flags, data, length, error);
+}
+
+/* Returns the format version from the header, 0 if it is unknown */
+static guint
+fp_print_header_version (const guchar *data,
+                         gsize         length)
+{
+  if (length <= 3 || memcmp (data, "FP", 2) != 0)
+    return 0;
+
+  if (data[2] == '3')
+    return 3;
+  else if (data[2] == '4')
+    return 4;
+
+  return 0;
+}
+
+static gboolean
+fp_print_nbis_from_fp3 (FpPrint  *print,
+                        GVariant *print_data)
+{
+  g_autoptr(GVariant) prints = g_variant_get_child_value (print_data, 0);
+  guint i;
+
+  for (i = 0; i < g_variant_n_children (prints); i++)
+    {
+      g_autofree struct xyt_struct *xyt = NULL;
+      const gint32 *xcol, *ycol, *thetacol;
+      gsize xlen, ylen, thetalen;
+      g_autoptr(GVariant) xyt_data = NULL;
+      GVariant *child;
+
+      xyt_data = g_variant_get_child_value (prints, i);
+
+      child = g_variant_get_child_value (xyt_data, 0);
+      xcol = g_variant_get_fixed_array (child, &xlen, sizeof (gint32));
+      g_variant_unref (child);
+
+      child = g_variant_get_child_value (xyt_data, 1);
+      ycol = g_variant_get_fixed_array (child, &ylen, sizeof (gint32));
+      g_variant_unref (child);
+
+      child = g_variant_get_child_value (xyt_data, 2);
+      thetacol = g_variant_get_fixed_array (child, &thetalen, sizeof (gint32));
+      g_variant_unref (child);
+
+      if (xlen != ylen || xlen != thetalen)
+        return FALSE;
+
+      if (xlen > MAX_BOZORTH_MINUTIAE)
+        return FALSE;
+
+      xyt = xyt_struct_new (xlen);
+      memcpy (xyt->xcol, xcol, sizeof (xcol[0]) * xlen);
+      memcpy (xyt->ycol, ycol, sizeof (xcol[0]) * xlen);
+      memcpy (xyt->thetacol, thetacol, sizeof (xcol[0]) * xlen);
+
+      g_ptr_array_add (print->prints, g_steal_pointer (&xyt));
+    }
+
+  return TRUE;
+}
+
+static gboolean
+fp_print_nbis_from_fp4 (FpPrint  *print,
+                        GVariant *print_data)
+{
+  g_autoptr(GVariant) prints = NULL;
+  guint i;
+
+  if (!g_variant_is_of_type (print_data, FPI_PRINT_FP4_NBIS_TYPE))
+    return FALSE;
+
+  prints = g_variant_get_child_value (print_data, 0);
+  for (i = 0; i < g_variant_n_children (prints); i++)
+    {
+      g_autofree struct xyt_struct *xyt = NULL;
+      g_autoptr(GVariant) packed_data = NULL;
+      const guint8 *packed;
+      guint8 print_flags;
+      gsize len;
+      gint j;
+
+      g_variant_get_child (prints, i, "(y@ay)", &print_flags, &packed_data);
+      packed = g_variant_get_fixed_array (packed_data, &len, 1);
+
+      if (len % FPI_PRINT_FP4_MINUTIA_SIZE != 0 ||
+          len / FPI_PRINT_FP4_MINUTIA_SIZE > MAX_BOZORTH_MINUTIAE)
+        return FALSE;
+
+      xyt = xyt_struct_new (len / FPI_PRINT_FP4_MINUTIA_SIZE);
+
+      for (j = 0; j < xyt->nrows; j++)
+        {
+          const guint8 *minutia = packed + j * FPI_PRINT_FP4_MINUTIA_SIZE;
+          guint16 theta = (minutia[4] | minutia[5] << 8) & 0x1ff;
+
+          /* The quality is not used for matching */
+          if (theta > 360)
+            return FALSE;
+
+          xyt->xcol[j] = (gint16) (minutia[0] | minutia[1] << 8);
+          xyt->ycol[j] = (gint16) (minutia[2] | minutia[3] << 8);
+          xyt->thetacol[j] = (gint) theta - 180;
+        }
+
+      g_ptr_array_add (print->prints, g_steal_pointer (&xyt));
+    }
+
+  return TRUE;
+}
+
+/* Copies the Bozorth3 gallery tables of @print from a variant of type
+ * "aai", as stored by fp_print_bz3_tables_to_variant(). Returns %NULL
+ * if they do not fit the print. */
+static GPtrArray *
+fp_print_bz3_tables_from_variant (FpPrint  *print,
+                                  GVariant *cols)
+{
+  g_autoptr(GPtrArray) tables = NULL;
+  guint i;
+
+  if (g_variant_n_children (cols) != print->prints->len)
+    return NULL;
+
+  tables = g_ptr_array_new_full (print->prints->len, g_free);
+  for (i = 0; i < print->prints->len; i++)
+    {
+      struct xyt_struct *xyt = g_ptr_array_index (print->prints, i);
+      g_autoptr(GVariant) child = g_variant_get_child_value (cols, i);
+      struct bz_gallery_table *table;
+      const gint32 *table_data;
+      gsize table_len;
+      gint j;
+
+      table_data = g_variant_get_fixed_array (child, &table_len, sizeof (gint32));
+      if (table_len % COLS_SIZE_2 != 0 || table_len / COLS_SIZE_2 > FCOLS_SIZE_1)
+        return NULL;
+
+      table = g_malloc (BZ_GALLERY_TABLE_SIZE (table_len / COLS_SIZE_2));
+      table->nrows = table_len / COLS_SIZE_2;
+      memcpy (table->cols, table_data, table_len * sizeof (gint32));
+      g_ptr_array_add (tables, table);
+
+      /* The minutiae indices are used to look up points in the print */
+      for (j = 0; j < table->nrows; j++)
+        {
+          if (table->cols[j][3] < 1 || table->cols[j][3] > xyt->nrows ||
+              table->cols[j][4] < 1 || table->cols[j][4] > xyt->nrows)
+            return NULL;
+        }
+    }
+
+  return g_steal_pointer (&tables);
+}
+
+/* Parses the serialized variant (without the 3 byte header), which must be
+ * stored at an address suitable for GVariant. If the data is already in
+ * normal form it is parsed in place, only the NBIS minutiae are copied. */
+static FpPrint *
+fp_print_deserialize_variant (GBytes  *variant_bytes,
+                              guint    version,
+                              GError **error)
 {
   g_autoptr(FpPrint) result = NULL;
   g_autoptr(GVariant) raw_value = NULL;
   g_autoptr(GVariant) value = NULL;
+  g_autoptr(GVariant) extra = NULL;
   g_autoptr(GVariant) print_data = NULL;
   g_autoptr(GDate) date = NULL;
-  guchar *aligned_data = NULL;
   guint8 finger_int8;
   FpFinger finger;
   g_autofree gchar *username = NULL;
@@ -777,31 +1228,15 @@ fp_print_deserialize (const guchar *data,
   const gchar *device_id;
   gboolean device_stored;
 
-  g_assert (data);
-  g_assert (length > 3);
-
-  if (memcmp (data, "FP3", 3) != 0)
-    goto invalid_format;
-
-  /* NOTE:
-   * We make sure that we have no variant left over from the parsing at the end
-   * of this function (meaning we don't need to keep the data around.
-   */
-
-  /* To support GLIB < 2.60 we need to make sure that the memory is aligned correctly.
-   * We also need to copy the backing store for the raw data that we may keep for
-   * longer. */
-  aligned_data = g_malloc (length - 3);
-  memcpy (aligned_data, data + 3, length - 3);
-  raw_value = g_variant_new_from_data (FPI_PRINT_VARIANT_TYPE,
-                                       aligned_data, length - 3,
-                                       FALSE, g_free, aligned_data);
+  raw_value = g_variant_new_from_bytes (FPI_PRINT_VARIANT_TYPE, variant_bytes, FALSE);
 
   if (!raw_value)
     goto invalid_format;
 
   if (G_BYTE_ORDER == G_BIG_ENDIAN)
     value = g_variant_byteswap (raw_value);
+  else if (g_variant_is_normal_form (raw_value))
+    value = g_variant_ref (raw_value);
   else
     value = g_variant_get_normal_form (raw_value);
 
@@ -815,7 +1250,7 @@ fp_print_deserialize (const guchar *data,
                  &username,
                  &description,
                  &julian_date,
-                 NULL,
+                 &extra,
                  &print_data);
 
   finger = finger_int8;
@@ -823,8 +1258,8 @@ fp_print_deserialize (const guchar *data,
   /* Assume data is valid at this point if the values are somewhat sane. */
   if (type == FPI_PRINT_NBIS)
     {
-      g_autoptr(GVariant) prints = g_variant_get_child_value (print_data, 0);
-      guint i;
+      g_autoptr(GVariant) cols = NULL;
+      gboolean valid;
 
       result = g_object_new (FP_TYPE_PRINT,
                              "driver", driver,
@@ -833,41 +1268,25 @@ fp_print_deserialize (const guchar *data,
                              NULL);
       g_object_ref_sink (result);
       fpi_print_set_type (result, FPI_PRINT_NBIS);
-      for (i = 0; i < g_variant_n_children (prints); i++)
-        {
-          g_autofree struct xyt_struct *xyt = NULL;
-          const gint32 *xcol, *ycol, *thetacol;
-          gsize xlen, ylen, thetalen;
-          g_autoptr(GVariant) xyt_data = NULL;
-          GVariant *child;
-
-          xyt_data = g_variant_get_child_value (prints, i);
-
-          child = g_variant_get_child_value (xyt_data, 0);
-          xcol = g_variant_get_fixed_array (child, &xlen, sizeof (gint32));
-          g_variant_unref (child);
 
-          child = g_variant_get_child_value (xyt_data, 1);
-          ycol = g_variant_get_fixed_array (child, &ylen, sizeof (gint32));
-          g_variant_unref (child);
+      if (version == 4)
+        valid = fp_print_nbis_from_fp4 (result, print_data);
+      else
+        valid = fp_print_nbis_from_fp3 (result, print_data);
 
-          child = g_variant_get_child_value (xyt_data, 2);
-          thetacol = g_variant_get_fixed_array (child, &thetalen, sizeof (gint32));
-          g_variant_unref (child);
+      if (!valid)
+        goto invalid_format;
 
-          if (xlen != ylen || xlen != thetalen)
-            goto invalid_format;
+      cols = g_variant_lookup_value (extra, FPI_PRINT_FP4_BZ3_TABLES_KEY,
+                                     G_VARIANT_TYPE ("aai"));
+      if (version == 4 && cols)
+        {
+          GPtrArray *tables = fp_print_bz3_tables_from_variant (result, cols);
 
-          if (xlen > G_N_ELEMENTS (xyt->xcol))
+          if (!tables)
             goto invalid_format;
 
-          xyt = g_new0 (struct xyt_struct, 1);
-          xyt->nrows = xlen;
-          memcpy (xyt->xcol, xcol, sizeof (xcol[0]) * xlen);
-          memcpy (xyt->ycol, ycol, sizeof (xcol[0]) * xlen);
-          memcpy (xyt->thetacol, thetacol, sizeof (xcol[0]) * xlen);
-
-          g_ptr_array_add (result->prints, g_steal_pointer (&xyt));
+          g_atomic_pointer_set (&result->bz3_tables, tables);
         }
     }
   else if (type == FPI_PRINT_RAW)
@@ -904,3 +1323,258 @@ invalid_format:
                "Data could not be parsed");
   return NULL;
 }
+
+/**
+ * fp_print_deserialize:
+ * @data: (array length=length): The binary data
+ * @length: Length of the data
+ * @error: Return location for error
+ *
+ * Deserialize a print definition from permanent storage.
+ *
+ * Returns: (transfer full): A newly created #FpPrint on success
+ */
+FpPrint *
+fp_print_deserialize (const guchar *data,
+                      gsize         length,
+                      GError      **error)
+{
+  g_autoptr(GBytes) variant_bytes = NULL;
+  guint version;
+
+  g_assert (data);
+  g_assert (length > 3);
+
+  version = fp_print_header_version (data, length);
+  if (version == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Data could not be parsed");
+      return NULL;
+    }
+
+  /* To support GLIB < 2.60 we need to make sure that the memory is aligned
+   * correctly. We also need to copy the backing store for the raw data that
+   * we may keep for longer. */
+  variant_bytes = g_bytes_new (data + 3, length - 3);
+
+  return fp_print_deserialize_variant (variant_bytes, version, error);
+}
+
+/**
+ * fp_print_deserialize_bytes:
+ * @bytes: The binary data, as created by fp_print_serialize()
+ * @error: Return location for error
+ *
+ * Deserialize a print definition from permanent storage, like
+ * fp_print_deserialize(). The data is used in place where possible and
+ * the print may keep a reference to @bytes, so it can be backed by e.g. a
+ * shared #GMappedFile holding many prints.
+ *
+ * Using the data in place requires the serialized data after the 3 byte
+ * header to be aligned to 8 bytes, otherwise it is copied.
+ *
+ * Returns: (transfer full): A newly created #FpPrint on success
+ */
+FpPrint *
+fp_print_deserialize_bytes (GBytes  *bytes,
+                            GError **error)
+{
+  g_autoptr(GBytes) variant_bytes = NULL;
+  const guchar *data;
+  gsize length;
+  guint version;
+
+  g_return_val_if_fail (bytes != NULL, NULL);
+
+  data = g_bytes_get_data (bytes, &length);
+
+  version = fp_print_header_version (data, length);
+  if (version == 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Data could not be parsed");
+      return NULL;
+    }
+
+  /* GLib < 2.60 cannot handle unaligned data itself */
+  if (GPOINTER_TO_SIZE (data + 3) % 8 == 0)
+    variant_bytes = g_bytes_new_from_bytes (bytes, 3, length - 3);
+  else
+    variant_bytes = g_bytes_new (data + 3, length - 3);
+
+  return fp_print_deserialize_variant (variant_bytes, version, error);
+}
+
+#define FPI_PRINT_MATCH_CACHE_VARIANT_TYPE G_VARIANT_TYPE ("(saai)")
+
+/* Identifies the NBIS data that a match cache was computed from */
+static gchar *
+fp_print_nbis_checksum (FpPrint *print)
+{
+  g_autoptr(GChecksum) checksum = g_checksum_new (G_CHECKSUM_SHA256);
+  guint i;
+
+  for (i = 0; i < print->prints->len; i++)
+    {
+      struct xyt_struct *xyt = g_ptr_array_index (print->prints, i);
+      gint32 nrows = GINT32_TO_LE (xyt->nrows);
+      gint j;
+
+      g_checksum_update (checksum, (guchar *) &nrows, sizeof (nrows));
+      for (j = 0; j < xyt->nrows; j++)
+        {
+          gint32 row[3] = {
+            GINT32_TO_LE (xyt->xcol[j]),
+            GINT32_TO_LE (xyt->ycol[j]),
+            GINT32_TO_LE (xyt->thetacol[j]),
+          };
+
+          g_checksum_update (checksum, (guchar *) row, sizeof (row));
+        }
+    }
+
+  return g_strdup (g_checksum_get_string (checksum));
+}
+
+/**
+ * fp_print_serialize_match_cache:
+ * @print: A #FpPrint
+ * @data: (array length=length) (transfer full) (out): Return location for data pointer
+ * @length: (transfer full) (out): Length of @data
+ * @error: Return location for error
+ *
+ * Serialize the data that is precomputed from a print when it is first
+ * used for matching on the host. The result can be stored next to the
+ * print data and loaded again using fp_print_load_match_cache() to avoid
+ * recomputing it after the print has been deserialized.
+ *
+ * This is only supported for prints that are matched on the host, i.e.
+ * prints enrolled with image based devices.
+ *
+ * Returns: (type void): %TRUE on success
+ */
+gboolean
+fp_print_serialize_match_cache (FpPrint *print,
+                                guchar **data,
+                                gsize   *length,
+                                GError **error)
+{
+  g_autoptr(GVariant) result = NULL;
+  g_autofree gchar *checksum = NULL;
+  GVariantBuilder builder = G_VARIANT_BUILDER_INIT (FPI_PRINT_MATCH_CACHE_VARIANT_TYPE);
+  gsize len;
+
+  g_assert (data);
+  g_assert (length);
+
+  if (print->type != FPI_PRINT_NBIS)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Only host matched prints have a match cache");
+      return FALSE;
+    }
+
+  checksum = fp_print_nbis_checksum (print);
+
+  g_variant_builder_add (&builder, "s", checksum);
+  g_variant_builder_add_value (&builder, fp_print_bz3_tables_to_variant (print));
+
+  result = g_variant_builder_end (&builder);
+
+  if (G_BYTE_ORDER == G_BIG_ENDIAN)
+    {
+      GVariant *tmp;
+      tmp = g_variant_byteswap (result);
+      g_variant_unref (result);
+      result = tmp;
+    }
+
+  len = g_variant_get_size (result);
+  /* Add 4 bytes of header */
+  len += 4;
+
+  *data = g_malloc (len);
+  *length = len;
+
+  memcpy (*data, "FPM1", 4);
+  g_variant_store (result, (*data) + 4);
+
+  return TRUE;
+}
+
+/**
+ * fp_print_load_match_cache:
+ * @print: A #FpPrint
+ * @data: (array length=length): The binary data
+ * @length: Length of the data
+ * @error: Return location for error
+ *
+ * Load data previously stored with fp_print_serialize_match_cache() into
+ * @print. The data is rejected if it was created from a different print.
+ *
+ * Returns: %TRUE on success
+ */
+gboolean
+fp_print_load_match_cache (FpPrint      *print,
+                           const guchar *data,
+                           gsize         length,
+                           GError      **error)
+{
+  g_autoptr(GVariant) raw_value = NULL;
+  g_autoptr(GVariant) value = NULL;
+  g_autoptr(GVariant) cols = NULL;
+  g_autoptr(GPtrArray) tables = NULL;
+  g_autofree gchar *checksum = NULL;
+  const gchar *stored_checksum;
+  guchar *aligned_data;
+
+  g_return_val_if_fail (FP_IS_PRINT (print), FALSE);
+  g_assert (data);
+
+  if (print->type != FPI_PRINT_NBIS)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                   "Only host matched prints have a match cache");
+      return FALSE;
+    }
+
+  if (length <= 4 || memcmp (data, "FPM1", 4) != 0)
+    goto invalid_format;
+
+  /* Ensure correct alignment, see fp_print_deserialize() */
+  aligned_data = g_malloc (length - 4);
+  memcpy (aligned_data, data + 4, length - 4);
+  raw_value = g_variant_new_from_data (FPI_PRINT_MATCH_CACHE_VARIANT_TYPE,
+                                       aligned_data, length - 4,
+                                       FALSE, g_free, aligned_data);
+
+  if (G_BYTE_ORDER == G_BIG_ENDIAN)
+    value = g_variant_byteswap (raw_value);
+  else
+    value = g_variant_get_normal_form (raw_value);
+
+  g_variant_get (value, "(&s@aai)", &stored_checksum, &cols);
+
+  checksum = fp_print_nbis_checksum (print);
+  if (g_strcmp0 (checksum, stored_checksum) != 0)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Match cache was not created for this print");
+      return FALSE;
+    }
+
+  tables = fp_print_bz3_tables_from_variant (print, cols);
+  if (!tables)
+    goto invalid_format;
+
+  fpi_print_clear_caches (print);
+  g_atomic_pointer_set (&print->bz3_tables, g_steal_pointer (&tables));
+
+  return TRUE;
+
+invalid_format:
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+               "Data could not be parsed");
+  return FALSE;
+}
@@ -78,6 +78,19 @@ typedef enum {
   FP_FINGER_STATUS_PRESENT = 1 << 1,
 } FpFingerStatusFlags;
 
+/**
+ * FpPrintSerializeFlags:
+ * @FP_PRINT_SERIALIZE_NONE: Only store the print
+ * @FP_PRINT_SERIALIZE_MATCH_CACHE: Also store the data precomputed for
+ *   matching prints on the host, see fp_print_serialize_match_cache()
+ *
+ * Optional data to include with fp_print_serialize_compact().
+ */
+typedef enum /*< flags >*/ {
+  FP_PRINT_SERIALIZE_NONE        = 0,
+  FP_PRINT_SERIALIZE_MATCH_CACHE = 1 << 0,
+} FpPrintSerializeFlags;
+
 FpPrint *fp_print_new (FpDevice *device);
 
 const gchar *fp_print_get_driver (FpPrint *print);
@@ -103,14 +116,33 @@ gboolean fp_print_compatible (FpPrint  *self,
                               FpDevice *device);
 gboolean fp_print_equal (FpPrint *self,
                          FpPrint *other);
+guint64  fp_print_get_content_hash (FpPrint *self);
+guint    fp_print_hash (FpPrint *self);
 
 gboolean fp_print_serialize (FpPrint *print,
                              guchar **data,
                              gsize   *length,
                              GError **error);
 
+gboolean fp_print_serialize_compact (FpPrint              *print,
+                                     FpPrintSerializeFlags flags,
+                                     guchar              **data,
+                                     gsize                *length,
+                                     GError              **error);
+
 FpPrint *fp_print_deserialize (const guchar *data,
                                gsize         length,
                                GError      **error);
+FpPrint *fp_print_deserialize_bytes (GBytes  *bytes,
+                                     GError **error);
+
+gboolean fp_print_serialize_match_cache (FpPrint *print,
+                                         guchar **data,
+                                         gsize   *length,
+                                         GError **error);
+gboolean fp_print_load_match_cache (FpPrint      *print,
+                                    const guchar *data,
+                                    gsize         length,
+                                    GError      **error);
 
 G_END_DECLS
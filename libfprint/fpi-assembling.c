@@ -26,6 +26,12 @@
 
 #include <string.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "fpi-assembling.h"
 
 /**
@@ -39,15 +45,205 @@
  * data in small stripes.
  */
 
+struct _FpiFrameStore
+{
+  guint8 *data;
+  gsize   frame_size;
+  gsize   stride;
+  guint   length;
+  guint   max_frames;
+};
+
+/**
+ * fpi_frame_store_new:
+ * @frame_size: size of a single frame or line in bytes
+ * @max_frames: maximum number of frames
+ *
+ * Creates a #FpiFrameStore with room for @max_frames frames, which is
+ * allocated in one go. For #fpi_frame, @frame_size needs to include
+ * the size of the structure itself.
+ *
+ * Returns: a new #FpiFrameStore
+ */
+FpiFrameStore *
+fpi_frame_store_new (gsize frame_size,
+                     guint max_frames)
+{
+  FpiFrameStore *store;
+
+  g_return_val_if_fail (frame_size > 0, NULL);
+
+  store = g_new0 (FpiFrameStore, 1);
+  store->frame_size = frame_size;
+  /* Keep every frame aligned, struct fpi_frame contains integers */
+  store->stride = (frame_size + 15) & ~(gsize) 15;
+  store->max_frames = max_frames;
+  store->data = g_malloc0_n (max_frames, store->stride);
+
+  return store;
+}
+
+/**
+ * fpi_frame_store_free:
+ * @store: a #FpiFrameStore
+ *
+ * Frees the store and all frames in it.
+ */
+void
+fpi_frame_store_free (FpiFrameStore *store)
+{
+  if (!store)
+    return;
+
+  g_free (store->data);
+  g_free (store);
+}
+
+/**
+ * fpi_frame_store_get_next:
+ * @store: a #FpiFrameStore
+ *
+ * Gets the slot that the next call to fpi_frame_store_append() will add,
+ * so that a frame can be filled in before deciding whether to keep it.
+ *
+ * Returns: (transfer none): the next frame, or %NULL if the store is full
+ */
+gpointer
+fpi_frame_store_get_next (FpiFrameStore *store)
+{
+  if (store->length >= store->max_frames)
+    return NULL;
+
+  return store->data + store->length * store->stride;
+}
+
+/**
+ * fpi_frame_store_append:
+ * @store: a #FpiFrameStore
+ *
+ * Adds a frame at the end of the store. The content is left as it was
+ * written through fpi_frame_store_get_next(), or as it was when the slot
+ * was last used.
+ *
+ * Returns: (transfer none): the new frame, or %NULL if the store is full
+ */
+gpointer
+fpi_frame_store_append (FpiFrameStore *store)
+{
+  gpointer frame = fpi_frame_store_get_next (store);
+
+  if (frame)
+    store->length++;
+
+  return frame;
+}
+
+/**
+ * fpi_frame_store_get:
+ * @store: a #FpiFrameStore
+ * @index: index of the frame
+ *
+ * Returns: (transfer none): the frame at @index
+ */
+gpointer
+fpi_frame_store_get (FpiFrameStore *store,
+                     guint          index)
+{
+  g_return_val_if_fail (index < store->length, NULL);
+
+  return store->data + index * store->stride;
+}
+
+/**
+ * fpi_frame_store_get_length:
+ * @store: a #FpiFrameStore
+ *
+ * Returns: the number of frames in the store
+ */
+guint
+fpi_frame_store_get_length (FpiFrameStore *store)
+{
+  return store->length;
+}
+
+/**
+ * fpi_frame_store_get_max_frames:
+ * @store: a #FpiFrameStore
+ *
+ * Returns: the number of frames the store has room for
+ */
+guint
+fpi_frame_store_get_max_frames (FpiFrameStore *store)
+{
+  return store->max_frames;
+}
+
+/**
+ * fpi_frame_store_truncate:
+ * @store: a #FpiFrameStore
+ * @length: the new number of frames
+ *
+ * Drops all frames from @length onwards. Use a @length of 0 to reuse the
+ * store for the next capture.
+ */
+void
+fpi_frame_store_truncate (FpiFrameStore *store,
+                          guint          length)
+{
+  g_return_if_fail (length <= store->length);
+
+  store->length = length;
+}
+
+/* Sum of absolute differences between two rows of pixels */
+static unsigned int
+calc_row_sad (const guint8 *row1,
+              const guint8 *row2,
+              unsigned int  width)
+{
+  unsigned int sad = 0;
+  unsigned int i = 0;
+
+#if defined(__SSE2__)
+  __m128i acc = _mm_setzero_si128 ();
+
+  for (; i + 16 <= width; i += 16)
+    acc = _mm_add_epi64 (acc,
+                         _mm_sad_epu8 (_mm_loadu_si128 ((const __m128i *) (row1 + i)),
+                                       _mm_loadu_si128 ((const __m128i *) (row2 + i))));
+
+  sad = _mm_cvtsi128_si32 (acc) + _mm_cvtsi128_si32 (_mm_srli_si128 (acc, 8));
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  uint32x4_t acc = vdupq_n_u32 (0);
+
+  for (; i + 16 <= width; i += 16)
+    acc = vpadalq_u16 (acc, vpaddlq_u8 (vabdq_u8 (vld1q_u8 (row1 + i),
+                                                  vld1q_u8 (row2 + i))));
+
+  sad = vaddvq_u32 (acc);
+#endif
+
+  for (; i < width; i++)
+    sad += row1[i] > row2[i] ? row1[i] - row2[i] : row2[i] - row1[i];
+
+  return sad;
+}
+
+/* Computes the normalized error between two frames at a given offset, on
+ * frames unpacked with unpack_frame(). The computation stops early and
+ * returns G_MAXUINT once the error is known to reach @limit, see
+ * find_overlap(). */
 static unsigned int
 calc_error (struct fpi_frame_asmbl_ctx *ctx,
-            struct fpi_frame           *first_frame,
-            struct fpi_frame           *second_frame,
+            const guint8               *first_frame,
+            const guint8               *second_frame,
             int                         dx,
-            int                         dy)
+            int                         dy,
+            guint64                     limit)
 {
   unsigned int width, height;
-  unsigned int x1, y1, x2, y2, err, i, j;
+  unsigned int x1, x2, i, err;
+  guint64 raw_limit = G_MAXUINT64;
 
   width = ctx->frame_width - (dx > 0 ? dx : -dx);
   height = ctx->frame_height - dy;
@@ -55,35 +251,25 @@ calc_error (struct fpi_frame_asmbl_ctx *ctx,
   if (height == 0 || width == 0)
     return INT_MAX;
 
-  y1 = 0;
-  y2 = dy;
-  i = 0;
-  err = 0;
-  do
-    {
-      x1 = dx < 0 ? 0 : dx;
-      x2 = dx < 0 ? -dx : 0;
-      j = 0;
+  x1 = dx < 0 ? 0 : dx;
+  x2 = dx < 0 ? -dx : 0;
 
-      do
-        {
-          unsigned char v1, v2;
+  /* The normalized error only grows with the raw error if the
+   * normalization below cannot overflow, otherwise all rows are needed. */
+  if (limit != G_MAXUINT64 &&
+      (guint64) 255 * height * width * ctx->frame_height * ctx->frame_width <= G_MAXUINT)
+    raw_limit = (limit * height * width + ctx->frame_height * ctx->frame_width - 1) /
+                (ctx->frame_height * ctx->frame_width);
 
-
-          v1 = ctx->get_pixel (ctx, first_frame, x1, y1);
-          v2 = ctx->get_pixel (ctx, second_frame, x2, y2);
-          err += v1 > v2 ? v1 - v2 : v2 - v1;
-          j++;
-          x1++;
-          x2++;
-
-        }
-      while (j < width);
-      i++;
-      y1++;
-      y2++;
+  err = 0;
+  for (i = 0; i < height; i++)
+    {
+      err += calc_row_sad (first_frame + i * ctx->frame_width + x1,
+                           second_frame + (i + dy) * ctx->frame_width + x2,
+                           width);
+      if (err >= raw_limit)
+        return G_MAXUINT;
     }
-  while (i < height);
 
   /* Normalize error */
   err *= (ctx->frame_height * ctx->frame_width);
@@ -92,22 +278,62 @@ calc_error (struct fpi_frame_asmbl_ctx *ctx,
   return err;
 }
 
+/* Copies a frame into a contiguous buffer, so that the overlap search does
+ * not need to call get_pixel for every pixel of every candidate offset. */
+static guint8 *
+unpack_frame (struct fpi_frame_asmbl_ctx *ctx,
+              struct fpi_frame           *frame,
+              guint8                     *buf)
+{
+  unsigned int x, y;
+
+  for (y = 0; y < ctx->frame_height; y++)
+    for (x = 0; x < ctx->frame_width; x++)
+      buf[x + y * ctx->frame_width] = ctx->get_pixel (ctx, frame, x, y);
+
+  return buf;
+}
+
 /* This function is rather CPU-intensive. It's better to use hardware
  * to detect movement direction when possible.
+ *
+ * The offset predicted from the previous frame (if any) is checked first,
+ * so that most other candidates can be discarded after a few rows. The
+ * result is the same as with an exhaustive search in order: the first
+ * offset with the lowest error.
  */
 static void
 find_overlap (struct fpi_frame_asmbl_ctx *ctx,
-              struct fpi_frame           *first_frame,
-              struct fpi_frame           *second_frame,
+              const guint8               *first_frame,
+              const guint8               *second_frame,
+              int                         predicted_dx,
+              int                         predicted_dy,
               int                        *dx_out,
               int                        *dy_out,
               unsigned int               *min_error)
 {
   int dx, dy;
   unsigned int err;
+  int best_pos = -1;
 
   *min_error = 255 * ctx->frame_height * ctx->frame_width;
 
+  /* Predicted offsets are given in the same sign convention as the
+   * output, i.e. with dx negated. */
+  if (predicted_dy >= 2 && predicted_dy < (int) ctx->frame_height &&
+      predicted_dx > -8 && predicted_dx <= 8)
+    {
+      err = calc_error (ctx, first_frame, second_frame,
+                        -predicted_dx, predicted_dy, G_MAXUINT64);
+      if (err < *min_error)
+        {
+          *min_error = err;
+          *dx_out = predicted_dx;
+          *dy_out = predicted_dy;
+          best_pos = (predicted_dy - 2) * 16 + (-predicted_dx + 8);
+        }
+    }
+
   /* Seeking in horizontal and vertical dimensions,
    * for horizontal dimension we'll check only 8 pixels
    * in both directions. For vertical direction diff is
@@ -117,66 +343,143 @@ find_overlap (struct fpi_frame_asmbl_ctx *ctx,
     {
       for (dx = -8; dx < 8; dx++)
         {
-          err = calc_error (ctx, first_frame, second_frame,
-                            dx, dy);
-          if (err < *min_error)
+          int pos = (dy - 2) * 16 + (dx + 8);
+
+          if (pos == best_pos)
+            continue;
+
+          /* Candidates before the best one so far win ties */
+          err = calc_error (ctx, first_frame, second_frame, dx, dy,
+                            pos < best_pos ? (guint64) *min_error + 1 : *min_error);
+          if (err < *min_error || (err == *min_error && pos < best_pos))
             {
               *min_error = err;
               *dx_out = -dx;
               *dy_out = dy;
+              best_pos = pos;
             }
         }
     }
 }
 
-static unsigned int
-do_movement_estimation (struct fpi_frame_asmbl_ctx *ctx,
-                        GSList *stripes, gboolean reverse)
+/* State of the movement estimation over a sequence of frames. Both
+ * directions are estimated at the same time. The forward deltas are
+ * stored in the frames directly, the reverse ones are kept aside in case
+ * the finger turns out to have moved the other way. */
+typedef struct
 {
-  GSList *l;
-  GTimer *timer;
-  guint num_frames = 1;
-  struct fpi_frame *prev_stripe;
-  unsigned int min_error;
+  guint8            *prev_buf;
+  guint8            *cur_buf;
+  GArray            *rev_deltas;
+  int                predicted_dx, predicted_dy;
+  int                rev_predicted_dx, rev_predicted_dy;
+  guint              num_frames;
   /* Max error is width * height * 255, for AES2501 which has the largest
    * sensor its 192*16*255 = 783360. So for 32bit value it's ~5482 frame before
    * we might get int overflow. Use 64bit value here to prevent integer overflow
    */
-  unsigned long long total_error = 0;
+  unsigned long long total_error;
+  unsigned long long rev_total_error;
+} MovementEstimation;
 
-  timer = g_timer_new ();
+static void
+movement_estimation_init (struct fpi_frame_asmbl_ctx *ctx,
+                          MovementEstimation         *est)
+{
+  memset (est, 0, sizeof (*est));
+  est->prev_buf = g_malloc (ctx->frame_width * ctx->frame_height);
+  est->cur_buf = g_malloc (ctx->frame_width * ctx->frame_height);
+  est->rev_deltas = g_array_new (FALSE, FALSE, sizeof (int));
+}
 
-  /* Skip the first frame */
-  prev_stripe = stripes->data;
+static void
+movement_estimation_clear (MovementEstimation *est)
+{
+  g_clear_pointer (&est->prev_buf, g_free);
+  g_clear_pointer (&est->cur_buf, g_free);
+  g_clear_pointer (&est->rev_deltas, g_array_unref);
+}
 
-  for (l = stripes->next; l != NULL; l = l->next, num_frames++)
-    {
-      struct fpi_frame *cur_stripe = l->data;
+static void
+movement_estimation_add_frame (struct fpi_frame_asmbl_ctx *ctx,
+                               MovementEstimation         *est,
+                               struct fpi_frame           *frame)
+{
+  unsigned int min_error;
+  int rev_delta[2];
+  guint8 *tmp;
 
-      if (reverse)
-        {
-          find_overlap (ctx, prev_stripe, cur_stripe,
-                        &cur_stripe->delta_x, &cur_stripe->delta_y,
-                        &min_error);
-          cur_stripe->delta_y = -cur_stripe->delta_y;
-          cur_stripe->delta_x = -cur_stripe->delta_x;
-        }
-      else
-        {
-          find_overlap (ctx, cur_stripe, prev_stripe,
-                        &cur_stripe->delta_x, &cur_stripe->delta_y,
-                        &min_error);
-        }
-      total_error += min_error;
+  est->num_frames++;
 
-      prev_stripe = cur_stripe;
+  /* Skip the first frame */
+  if (est->num_frames == 1)
+    {
+      unpack_frame (ctx, frame, est->prev_buf);
+      return;
     }
 
-  g_timer_stop (timer);
-  fp_dbg ("calc delta completed in %f secs", g_timer_elapsed (timer, NULL));
-  g_timer_destroy (timer);
+  unpack_frame (ctx, frame, est->cur_buf);
+
+  /* The finger usually moves at a similar speed for consecutive
+   * frames, so the previous offset is a good first guess. */
+  find_overlap (ctx, est->cur_buf, est->prev_buf,
+                est->predicted_dx, est->predicted_dy,
+                &frame->delta_x, &frame->delta_y,
+                &min_error);
+  est->predicted_dx = frame->delta_x;
+  est->predicted_dy = frame->delta_y;
+  est->total_error += min_error;
 
-  return total_error / num_frames;
+  find_overlap (ctx, est->prev_buf, est->cur_buf,
+                est->rev_predicted_dx, est->rev_predicted_dy,
+                &rev_delta[0], &rev_delta[1],
+                &min_error);
+  est->rev_predicted_dx = rev_delta[0];
+  est->rev_predicted_dy = rev_delta[1];
+  est->rev_total_error += min_error;
+  g_array_append_vals (est->rev_deltas, rev_delta, 2);
+
+  tmp = est->prev_buf;
+  est->prev_buf = est->cur_buf;
+  est->cur_buf = tmp;
+}
+
+/* Returns whether the reverse direction has the lower error, in which case
+ * movement_estimation_apply_reverse() needs to be called for all frames
+ * but the first. */
+static gboolean
+movement_estimation_is_reverse (MovementEstimation *est)
+{
+  int err, rev_err;
+
+  err = est->total_error / est->num_frames;
+  rev_err = est->rev_total_error / est->num_frames;
+  fp_dbg ("errors: %d rev: %d", err, rev_err);
+
+  return err >= rev_err;
+}
+
+static void
+movement_estimation_apply_reverse (MovementEstimation *est,
+                                   guint               index,
+                                   struct fpi_frame   *frame)
+{
+  frame->delta_x = -g_array_index (est->rev_deltas, int, 2 * (index - 1));
+  frame->delta_y = -g_array_index (est->rev_deltas, int, 2 * (index - 1) + 1);
+}
+
+static void
+movement_estimation_apply (MovementEstimation *est,
+                           GSList             *stripes)
+{
+  GSList *l;
+  guint i;
+
+  if (!movement_estimation_is_reverse (est))
+    return;
+
+  for (l = stripes->next, i = 1; l != NULL; l = l->next, i++)
+    movement_estimation_apply_reverse (est, i, l->data);
 }
 
 /**
@@ -190,18 +493,56 @@ do_movement_estimation (struct fpi_frame_asmbl_ctx *ctx,
  * This function is used for devices that don't do movement estimation
  * in hardware. If hardware movement estimation is supported, the driver
  * should populate @delta_x and @delta_y instead.
+ *
+ * See #FpiFrameAssembler to estimate the movement while frames are still
+ * being captured.
  */
 void
 fpi_do_movement_estimation (struct fpi_frame_asmbl_ctx *ctx,
                             GSList                     *stripes)
 {
-  int err, rev_err;
+  MovementEstimation est;
+  GSList *l;
+  GTimer *timer;
 
-  err = do_movement_estimation (ctx, stripes, FALSE);
-  rev_err = do_movement_estimation (ctx, stripes, TRUE);
-  fp_dbg ("errors: %d rev: %d", err, rev_err);
-  if (err < rev_err)
-    do_movement_estimation (ctx, stripes, FALSE);
+  timer = g_timer_new ();
+
+  movement_estimation_init (ctx, &est);
+  for (l = stripes; l != NULL; l = l->next)
+    movement_estimation_add_frame (ctx, &est, l->data);
+  movement_estimation_apply (&est, stripes);
+  movement_estimation_clear (&est);
+
+  g_timer_stop (timer);
+  fp_dbg ("calc delta completed in %f secs", g_timer_elapsed (timer, NULL));
+  g_timer_destroy (timer);
+}
+
+/**
+ * fpi_do_movement_estimation_store:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @frames: a #FpiFrameStore of #fpi_frame
+ *
+ * Same as fpi_do_movement_estimation() for frames in a #FpiFrameStore.
+ */
+void
+fpi_do_movement_estimation_store (struct fpi_frame_asmbl_ctx *ctx,
+                                  FpiFrameStore              *frames)
+{
+  MovementEstimation est;
+  guint i;
+
+  g_return_if_fail (frames->length > 0);
+
+  movement_estimation_init (ctx, &est);
+  for (i = 0; i < frames->length; i++)
+    movement_estimation_add_frame (ctx, &est, fpi_frame_store_get (frames, i));
+
+  if (movement_estimation_is_reverse (&est))
+    for (i = 1; i < frames->length; i++)
+      movement_estimation_apply_reverse (&est, i, fpi_frame_store_get (frames, i));
+
+  movement_estimation_clear (&est);
 }
 
 static inline void
@@ -242,6 +583,41 @@ aes_blit_stripe (struct fpi_frame_asmbl_ctx *ctx,
       img->data[ix + (iy * img->width)] = ctx->get_pixel (ctx, stripe, fx, fy);
 }
 
+/* Creates an image for frames that move by @height in total, and returns
+ * the position of the first frame in @x and @y. */
+static FpImage *
+create_frames_image (struct fpi_frame_asmbl_ctx *ctx,
+                     int                         height,
+                     int                        *x,
+                     int                        *y)
+{
+  FpImage *img;
+  gboolean reverse = FALSE;
+
+  fp_dbg ("height is %d", height);
+
+  if (height < 0)
+    {
+      reverse = TRUE;
+      height = -height;
+    }
+
+  /* For last frame */
+  height += ctx->frame_height;
+
+  /* Create buffer big enough for max image */
+  img = fp_image_new (ctx->image_width, height);
+  img->flags = FPI_IMAGE_COLORS_INVERTED;
+  img->flags |= reverse ? 0 :  FPI_IMAGE_H_FLIPPED | FPI_IMAGE_V_FLIPPED;
+  img->width = ctx->image_width;
+  img->height = height;
+
+  *y = reverse ? (height - ctx->frame_height) : 0;
+  *x = ((int) ctx->image_width - (int) ctx->frame_width) / 2;
+
+  return img;
+}
+
 /**
  * fpi_assemble_frames:
  * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
@@ -260,7 +636,6 @@ fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
   FpImage *img;
   int height = 0;
   int y, x;
-  gboolean reverse = FALSE;
   struct fpi_frame *fpi_frame;
 
   //FIXME g_return_if_fail
@@ -277,31 +652,60 @@ fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
       height += fpi_frame->delta_y;
     }
 
-  fp_dbg ("height is %d", height);
+  img = create_frames_image (ctx, height, &x, &y);
 
-  if (height < 0)
+  /* Assemble stripes */
+  for (l = stripes; l != NULL; l = l->next)
     {
-      reverse = TRUE;
-      height = -height;
+      fpi_frame = l->data;
+
+      y += fpi_frame->delta_y;
+      x += fpi_frame->delta_x;
+
+      aes_blit_stripe (ctx, img, fpi_frame, x, y);
     }
 
-  /* For last frame */
-  height += ctx->frame_height;
+  return img;
+}
 
-  /* Create buffer big enough for max image */
-  img = fp_image_new (ctx->image_width, height);
-  img->flags = FPI_IMAGE_COLORS_INVERTED;
-  img->flags |= reverse ? 0 :  FPI_IMAGE_H_FLIPPED | FPI_IMAGE_V_FLIPPED;
-  img->width = ctx->image_width;
-  img->height = height;
+/**
+ * fpi_assemble_frames_store:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @frames: a #FpiFrameStore of #fpi_frame
+ *
+ * Same as fpi_assemble_frames() for frames in a #FpiFrameStore.
+ *
+ * Returns: a newly allocated #fp_img.
+ */
+FpImage *
+fpi_assemble_frames_store (struct fpi_frame_asmbl_ctx *ctx,
+                           FpiFrameStore              *frames)
+{
+  FpImage *img;
+  int height = 0;
+  int y, x;
+  struct fpi_frame *fpi_frame;
+  guint i;
 
-  /* Assemble stripes */
-  y = reverse ? (height - ctx->frame_height) : 0;
-  x = ((int) ctx->image_width - (int) ctx->frame_width) / 2;
+  g_return_val_if_fail (frames->length > 0, NULL);
 
-  for (l = stripes; l != NULL; l = l->next)
+  /* No offset for 1st image */
+  fpi_frame = fpi_frame_store_get (frames, 0);
+  fpi_frame->delta_x = 0;
+  fpi_frame->delta_y = 0;
+  for (i = 0; i < frames->length; i++)
     {
-      fpi_frame = l->data;
+      fpi_frame = fpi_frame_store_get (frames, i);
+
+      height += fpi_frame->delta_y;
+    }
+
+  img = create_frames_image (ctx, height, &x, &y);
+
+  /* Assemble stripes */
+  for (i = 0; i < frames->length; i++)
+    {
+      fpi_frame = fpi_frame_store_get (frames, i);
 
       y += fpi_frame->delta_y;
       x += fpi_frame->delta_x;
@@ -312,6 +716,200 @@ fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
   return img;
 }
 
+struct _FpiFrameAssembler
+{
+  struct fpi_frame_asmbl_ctx *ctx;
+  GSList                     *frames;
+  GSList                     *last_frame;
+  GSList                     *next_frame;
+  guint                       n_frames;
+  MovementEstimation          est;
+  GSource                    *idle_source;
+};
+
+/**
+ * fpi_frame_assembler_new:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ *
+ * Creates a new #FpiFrameAssembler. The @ctx must stay valid until the
+ * assembler is freed.
+ *
+ * Returns: a new #FpiFrameAssembler
+ */
+FpiFrameAssembler *
+fpi_frame_assembler_new (struct fpi_frame_asmbl_ctx *ctx)
+{
+  FpiFrameAssembler *assembler;
+
+  g_return_val_if_fail (ctx != NULL, NULL);
+
+  assembler = g_new0 (FpiFrameAssembler, 1);
+  assembler->ctx = ctx;
+
+  return assembler;
+}
+
+static void
+fpi_frame_assembler_estimate (FpiFrameAssembler *assembler)
+{
+  if (!assembler->est.prev_buf)
+    movement_estimation_init (assembler->ctx, &assembler->est);
+
+  movement_estimation_add_frame (assembler->ctx, &assembler->est,
+                                 assembler->next_frame->data);
+  assembler->next_frame = assembler->next_frame->next;
+}
+
+static gboolean
+fpi_frame_assembler_idle_cb (gpointer user_data)
+{
+  FpiFrameAssembler *assembler = user_data;
+
+  fpi_frame_assembler_estimate (assembler);
+  if (assembler->next_frame)
+    return G_SOURCE_CONTINUE;
+
+  assembler->idle_source = NULL;
+  return G_SOURCE_REMOVE;
+}
+
+static void
+fpi_frame_assembler_clear_idle (FpiFrameAssembler *assembler)
+{
+  if (!assembler->idle_source)
+    return;
+
+  g_source_destroy (assembler->idle_source);
+  assembler->idle_source = NULL;
+}
+
+/**
+ * fpi_frame_assembler_add_frame:
+ * @assembler: a #FpiFrameAssembler
+ * @frame: (transfer full): a #fpi_frame allocated with g_malloc()
+ *
+ * Adds the next captured frame. The movement estimation for it is
+ * scheduled in an idle handler on the thread default main context.
+ */
+void
+fpi_frame_assembler_add_frame (FpiFrameAssembler *assembler,
+                               struct fpi_frame  *frame)
+{
+  GSList *l;
+
+  g_return_if_fail (assembler != NULL);
+  g_return_if_fail (frame != NULL);
+
+  l = g_slist_alloc ();
+  l->data = frame;
+  if (assembler->last_frame)
+    assembler->last_frame->next = l;
+  else
+    assembler->frames = l;
+  assembler->last_frame = l;
+  assembler->n_frames++;
+
+  if (!assembler->next_frame)
+    assembler->next_frame = l;
+
+  if (assembler->idle_source)
+    return;
+
+  assembler->idle_source = g_idle_source_new ();
+  g_source_set_callback (assembler->idle_source,
+                         fpi_frame_assembler_idle_cb,
+                         assembler,
+                         NULL);
+  g_source_set_name (assembler->idle_source,
+                     "libfprint frame assembler movement estimation");
+  g_source_attach (assembler->idle_source,
+                   g_main_context_get_thread_default ());
+  g_source_unref (assembler->idle_source);
+}
+
+/**
+ * fpi_frame_assembler_get_n_frames:
+ * @assembler: a #FpiFrameAssembler
+ *
+ * Returns: the number of frames added since the last reset
+ */
+guint
+fpi_frame_assembler_get_n_frames (FpiFrameAssembler *assembler)
+{
+  g_return_val_if_fail (assembler != NULL, 0);
+
+  return assembler->n_frames;
+}
+
+/**
+ * fpi_frame_assembler_reset:
+ * @assembler: a #FpiFrameAssembler
+ *
+ * Drops all frames, so that the assembler can be used for a new capture.
+ */
+void
+fpi_frame_assembler_reset (FpiFrameAssembler *assembler)
+{
+  g_return_if_fail (assembler != NULL);
+
+  fpi_frame_assembler_clear_idle (assembler);
+  movement_estimation_clear (&assembler->est);
+  g_slist_free_full (assembler->frames, g_free);
+  assembler->frames = NULL;
+  assembler->last_frame = NULL;
+  assembler->next_frame = NULL;
+  assembler->n_frames = 0;
+}
+
+/**
+ * fpi_frame_assembler_finish:
+ * @assembler: a #FpiFrameAssembler
+ *
+ * Estimates the movement for frames that were not handled yet and
+ * assembles the image. At least one frame needs to have been added.
+ * The assembler is reset afterwards.
+ *
+ * Returns: a newly allocated #FpImage
+ */
+FpImage *
+fpi_frame_assembler_finish (FpiFrameAssembler *assembler)
+{
+  FpImage *img;
+
+  g_return_val_if_fail (assembler != NULL, NULL);
+  g_return_val_if_fail (assembler->n_frames > 0, NULL);
+
+  fpi_frame_assembler_clear_idle (assembler);
+
+  fp_dbg ("%u of %u frames estimated before finishing",
+          assembler->est.num_frames, assembler->n_frames);
+
+  while (assembler->next_frame)
+    fpi_frame_assembler_estimate (assembler);
+  movement_estimation_apply (&assembler->est, assembler->frames);
+
+  img = fpi_assemble_frames (assembler->ctx, assembler->frames);
+  fpi_frame_assembler_reset (assembler);
+
+  return img;
+}
+
+/**
+ * fpi_frame_assembler_free:
+ * @assembler: a #FpiFrameAssembler
+ *
+ * Frees the assembler and all frames that were added to it.
+ */
+void
+fpi_frame_assembler_free (FpiFrameAssembler *assembler)
+{
+  if (!assembler)
+    return;
+
+  fpi_frame_assembler_reset (assembler);
+  g_free (assembler);
+}
+
 static int
 cmpint (const void *p1, const void *p2, gpointer data)
 {
@@ -326,12 +924,70 @@ cmpint (const void *p1, const void *p2, gpointer data)
     return 1;
 }
 
+/* Values that can be counted in a histogram rather than sorted, offsets
+ * between lines are bounded by max_search_offset. */
+#define MEDIAN_HISTOGRAM_SIZE 256
+
+/* Sliding window median, keeping a histogram of the values in the window
+ * up to date rather than sorting the window for every element. */
+static void
+median_filter_histogram (int *data, int *result, int size, int filtersize,
+                         int min_value, int num_values)
+{
+  int *counts = g_new0 (int, num_values);
+  int i, i1 = 0, i2 = -1;
+
+  for (i = 0; i < size; i++)
+    {
+      int new_i1 = MAX (i - (filtersize - 1) / 2, 0);
+      int new_i2 = MIN (i + (filtersize - 1) / 2, size - 1);
+      int k, v;
+
+      while (i2 < new_i2)
+        counts[data[++i2] - min_value]++;
+      while (i1 < new_i1)
+        counts[data[i1++] - min_value]--;
+
+      /* Same element as in the sorted window */
+      k = (i2 - i1 + 1) / 2;
+      for (v = 0; k >= counts[v]; v++)
+        k -= counts[v];
+      result[i] = v + min_value;
+    }
+
+  g_free (counts);
+}
+
 static void
 median_filter (int *data, int size, int filtersize)
 {
   int i;
-  int *result = (int *) g_malloc0 (size * sizeof (int));
-  int *sortbuf = (int *) g_malloc0 (filtersize * sizeof (int));
+  int *result;
+  int *sortbuf;
+  int min_value, max_value;
+
+  if (size <= 0)
+    return;
+
+  result = (int *) g_malloc0 (size * sizeof (int));
+
+  min_value = max_value = data[0];
+  for (i = 1; i < size; i++)
+    {
+      min_value = MIN (min_value, data[i]);
+      max_value = MAX (max_value, data[i]);
+    }
+
+  if ((gint64) max_value - min_value < MEDIAN_HISTOGRAM_SIZE)
+    {
+      median_filter_histogram (data, result, size, filtersize,
+                               min_value, max_value - min_value + 1);
+      memmove (data, result, size * sizeof (int));
+      g_free (result);
+      return;
+    }
+
+  sortbuf = (int *) g_malloc0 (filtersize * sizeof (int));
 
   for (i = 0; i < size; i++)
     {
@@ -350,51 +1006,72 @@ median_filter (int *data, int size, int filtersize)
   g_free (sortbuf);
 }
 
+/* Lines passed to fpi_assemble_lines() or fpi_assemble_lines_store(), so
+ * that both can share the same implementation. */
+typedef struct
+{
+  struct fpi_line_asmbl_ctx *ctx;
+  GSList                   **rows;
+  FpiFrameStore             *store;
+} LineSource;
+
+static inline gboolean
+line_exists (LineSource *src, int line)
+{
+  if (src->store)
+    return line < src->store->length;
+
+  return src->rows[line] != NULL;
+}
+
+static inline int
+line_deviation (LineSource *src, int line1, int line2)
+{
+  if (src->store)
+    return src->ctx->get_line_deviation (src->ctx, src->store, line1, line2);
+
+  return src->ctx->get_deviation (src->ctx, src->rows[line1], src->rows[line2]);
+}
+
+static inline unsigned char
+line_pixel (LineSource *src, int line, unsigned int x)
+{
+  if (src->store)
+    return src->ctx->get_line_pixel (src->ctx, src->store, line, x);
+
+  return src->ctx->get_pixel (src->ctx, src->rows[line], x);
+}
+
 static void
-interpolate_lines (struct fpi_line_asmbl_ctx *ctx,
-                   GSList *line1, gint32 y1_f,
-                   GSList *line2, gint32 y2_f,
+interpolate_lines (LineSource *src,
+                   int line1, gint32 y1_f,
+                   int line2, gint32 y2_f,
                    unsigned char *output, gint32 yi_f,
                    int size)
 {
   int i;
   unsigned char p1, p2;
 
-  if (!line1 || !line2)
+  if (!line_exists (src, line1) || !line_exists (src, line2))
     return;
 
   for (i = 0; i < size; i++)
     {
       gint unscaled;
-      p1 = ctx->get_pixel (ctx, line1, i);
-      p2 = ctx->get_pixel (ctx, line2, i);
+      p1 = line_pixel (src, line1, i);
+      p2 = line_pixel (src, line2, i);
 
       unscaled = (yi_f - y1_f) * p2 + (y2_f - yi_f) * p1;
       output[i] = (unscaled) / (y2_f - y1_f);
     }
 }
 
-/**
- * fpi_assemble_lines:
- * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
- * @lines: linked list of lines
- * @num_lines: number of items in @lines to process
- *
- * #fpi_assemble_lines assembles individual lines into a single image.
- * It also rescales image to account variable swiping speed.
- *
- * Note that @num_lines might be shorter than the length of the list,
- * if some lines should be skipped.
- *
- * Returns: a newly allocated #fp_img.
- */
-FpImage *
-fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
-                    GSList *lines, size_t num_lines)
+static FpImage *
+assemble_lines (LineSource *src, size_t num_lines)
 {
+  struct fpi_line_asmbl_ctx *ctx = src->ctx;
   /* Number of output lines per distance between two scanners */
   int i;
-  GSList *row1, *row2;
   /* The y coordinate is tracked as a 16.16 fixed point number. All
    * variables postfixed with _f follow this format here and in
    * interpolate_lines.
@@ -407,13 +1084,9 @@ fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
   unsigned char *output = g_malloc0 (ctx->line_width * ctx->max_height);
   FpImage *img;
 
-  g_return_val_if_fail (lines != NULL, NULL);
-  g_return_val_if_fail (num_lines >= 2, NULL);
-
   fp_dbg ("%"G_GINT64_FORMAT, g_get_real_time ());
 
-  row1 = lines;
-  for (i = 0; (i < num_lines - 1) && row1; i += 2)
+  for (i = 0; (i < num_lines - 1) && line_exists (src, i); i += 2)
     {
       int bestmatch = i;
       int bestdiff = 0;
@@ -422,24 +1095,17 @@ fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
       firstrow = i + 1;
       lastrow = MIN (i + ctx->max_search_offset, num_lines - 1);
 
-      row2 = g_slist_next (row1);
       for (j = firstrow; j <= lastrow; j++)
         {
-          int diff = ctx->get_deviation (ctx,
-                                         row1,
-                                         row2);
+          int diff = line_deviation (src, i, j);
           if ((j == firstrow) || (diff < bestdiff))
             {
               bestdiff = diff;
               bestmatch = j;
             }
-          row2 = g_slist_next (row2);
         }
       offsets[i / 2] = bestmatch - i;
       fp_dbg ("%d", offsets[i / 2]);
-      row1 = g_slist_next (row1);
-      if (row1)
-        row1 = g_slist_next (row1);
     }
 
   median_filter (offsets, (num_lines / 2) - 1, ctx->median_filter_size);
@@ -447,8 +1113,7 @@ fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
   fp_dbg ("offsets_filtered: %"G_GINT64_FORMAT, g_get_real_time ());
   for (i = 0; i <= (num_lines / 2) - 1; i++)
     fp_dbg ("%d", offsets[i]);
-  row1 = lines;
-  for (i = 0; i < num_lines - 1; i++, row1 = g_slist_next (row1))
+  for (i = 0; i < num_lines - 1; i++)
     {
       int offset = offsets[i / 2];
       if (offset > 0)
@@ -458,9 +1123,9 @@ fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
             {
               if (line_ind > ctx->max_height - 1)
                 goto out;
-              interpolate_lines (ctx,
-                                 row1, y_f,
-                                 g_slist_next (row1),
+              interpolate_lines (src,
+                                 i, y_f,
+                                 i + 1,
                                  ynext_f,
                                  output + line_ind * ctx->line_width,
                                  line_ind << 16,
@@ -480,3 +1145,63 @@ out:
   g_free (output);
   return img;
 }
+
+/**
+ * fpi_assemble_lines:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @lines: linked list of lines
+ * @num_lines: number of items in @lines to process
+ *
+ * #fpi_assemble_lines assembles individual lines into a single image.
+ * It also rescales image to account variable swiping speed.
+ *
+ * Note that @num_lines might be shorter than the length of the list,
+ * if some lines should be skipped.
+ *
+ * Returns: a newly allocated #fp_img.
+ */
+FpImage *
+fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
+                    GSList *lines, size_t num_lines)
+{
+  g_autofree GSList **rows = NULL;
+  LineSource src = { ctx, };
+  GSList *row;
+  int i;
+
+  g_return_val_if_fail (lines != NULL, NULL);
+  g_return_val_if_fail (num_lines >= 2, NULL);
+
+  /* Index the list once rather than walking it for every search */
+  rows = g_new0 (GSList *, num_lines);
+  for (i = 0, row = lines; i < num_lines && row; i++, row = row->next)
+    rows[i] = row;
+  src.rows = rows;
+
+  return assemble_lines (&src, num_lines);
+}
+
+/**
+ * fpi_assemble_lines_store:
+ * @ctx: #fpi_frame_asmbl_ctx - frame assembling context
+ * @lines: a #FpiFrameStore of lines
+ *
+ * Same as fpi_assemble_lines() for all lines in a #FpiFrameStore. The
+ * @get_line_deviation and @get_line_pixel functions of @ctx are used to
+ * access the lines.
+ *
+ * Returns: a newly allocated #fp_img.
+ */
+FpImage *
+fpi_assemble_lines_store (struct fpi_line_asmbl_ctx *ctx,
+                          FpiFrameStore             *lines)
+{
+  LineSource src = { ctx, NULL, lines };
+
+  g_return_val_if_fail (lines != NULL, NULL);
+  g_return_val_if_fail (lines->length >= 2, NULL);
+  g_return_val_if_fail (ctx->get_line_deviation != NULL, NULL);
+  g_return_val_if_fail (ctx->get_line_pixel != NULL, NULL);
+
+  return assemble_lines (&src, lines->length);
+}
@@ -38,6 +38,29 @@ struct fpi_frame
   unsigned char data[0];
 };
 
+/**
+ * FpiFrameStore:
+ *
+ * Stores frames or lines of a fixed size in a single preallocated buffer,
+ * so that drivers capturing hundreds of them do not need to allocate each
+ * one separately. Frames are accessed by index.
+ */
+typedef struct _FpiFrameStore FpiFrameStore;
+
+FpiFrameStore *fpi_frame_store_new (gsize frame_size,
+                                    guint max_frames);
+void fpi_frame_store_free (FpiFrameStore *store);
+gpointer fpi_frame_store_get_next (FpiFrameStore *store);
+gpointer fpi_frame_store_append (FpiFrameStore *store);
+gpointer fpi_frame_store_get (FpiFrameStore *store,
+                              guint          index);
+guint fpi_frame_store_get_length (FpiFrameStore *store);
+guint fpi_frame_store_get_max_frames (FpiFrameStore *store);
+void fpi_frame_store_truncate (FpiFrameStore *store,
+                               guint          length);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (FpiFrameStore, fpi_frame_store_free)
+
 /**
  * fpi_frame_asmbl_ctx:
  * @frame_width: width of the frame
@@ -69,6 +92,37 @@ void fpi_do_movement_estimation (struct fpi_frame_asmbl_ctx *ctx,
 FpImage *fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
                               GSList                     *stripes);
 
+void fpi_do_movement_estimation_store (struct fpi_frame_asmbl_ctx *ctx,
+                                       FpiFrameStore              *frames);
+
+FpImage *fpi_assemble_frames_store (struct fpi_frame_asmbl_ctx *ctx,
+                                    FpiFrameStore              *frames);
+
+/**
+ * FpiFrameAssembler:
+ *
+ * Assembles frames of a swipe sensor into an image while they are being
+ * captured. The movement between frames is estimated from an idle
+ * handler, i.e. in the time spent waiting for the next frame, so that the
+ * image is ready right after the last frame was captured.
+ *
+ * Drivers add every frame using fpi_frame_assembler_add_frame() and call
+ * fpi_frame_assembler_finish() once the finger was removed. This is
+ * equivalent to calling fpi_do_movement_estimation() and
+ * fpi_assemble_frames() on all frames.
+ */
+typedef struct _FpiFrameAssembler FpiFrameAssembler;
+
+FpiFrameAssembler *fpi_frame_assembler_new (struct fpi_frame_asmbl_ctx *ctx);
+void fpi_frame_assembler_free (FpiFrameAssembler *assembler);
+void fpi_frame_assembler_add_frame (FpiFrameAssembler *assembler,
+                                    struct fpi_frame  *frame);
+guint fpi_frame_assembler_get_n_frames (FpiFrameAssembler *assembler);
+void fpi_frame_assembler_reset (FpiFrameAssembler *assembler);
+FpImage *fpi_frame_assembler_finish (FpiFrameAssembler *assembler);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (FpiFrameAssembler, fpi_frame_assembler_free)
+
 /**
  * fpi_line_asmbl_ctx:
  * @line_width: width of line
@@ -79,6 +133,8 @@ FpImage *fpi_assemble_frames (struct fpi_frame_asmbl_ctx *ctx,
  * @get_deviation: pointer to a function that returns the numerical difference
  *                 between two lines
  * @get_pixel: pixel accessor, returns pixel brightness at x of line
+ * @get_line_deviation: same as @get_deviation, for lines in a #FpiFrameStore
+ * @get_line_pixel: same as @get_pixel, for lines in a #FpiFrameStore
  *
  * #fpi_line_asmbl_ctx is a structure holding the context for line assembling
  * routines.
@@ -110,8 +166,19 @@ struct fpi_line_asmbl_ctx
   unsigned char (*get_pixel)(struct fpi_line_asmbl_ctx *ctx,
                              GSList                    *line,
                              unsigned int               x);
+  int           (*get_line_deviation)(struct fpi_line_asmbl_ctx *ctx,
+                                      FpiFrameStore             *lines,
+                                      unsigned int               line1,
+                                      unsigned int               line2);
+  unsigned char (*get_line_pixel)(struct fpi_line_asmbl_ctx *ctx,
+                                  FpiFrameStore             *lines,
+                                  unsigned int               line,
+                                  unsigned int               x);
 };
 
 FpImage *fpi_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
                              GSList                    *lines,
                              size_t                     num_lines);
+
+FpImage *fpi_assemble_lines_store (struct fpi_line_asmbl_ctx *ctx,
+                                   FpiFrameStore             *lines);
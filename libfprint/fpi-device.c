@@ -544,6 +544,7 @@ match_data_free (FpMatchData *data)
 
   g_clear_object (&data->enrolled_print);
   g_clear_pointer (&data->gallery, g_ptr_array_unref);
+  g_clear_pointer (&data->gallery_index, fpi_print_index_unref);
 
   g_free (data);
 }
@@ -640,6 +641,89 @@ fpi_device_get_identify_data (FpDevice   *device,
     *prints = data->gallery;
 }
 
+/**
+ * fpi_device_get_identify_index:
+ * @device: The #FpDevice
+ *
+ * Get an index of the identify gallery. Devices that report which of
+ * their stored prints matched should use it to find the corresponding
+ * print in the gallery, rather than comparing every print in it.
+ *
+ * The index of a #FpGallery is used as is, otherwise the index is created
+ * on the first call and reused for the remainder of the identify
+ * operation.
+ *
+ * Returns: (transfer none): The #FpiPrintIndex of the gallery
+ */
+FpiPrintIndex *
+fpi_device_get_identify_index (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  FpMatchData *data;
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), NULL);
+  g_return_val_if_fail (priv->current_action == FPI_DEVICE_ACTION_IDENTIFY, NULL);
+
+  data = g_task_get_task_data (priv->current_task);
+  g_assert (data);
+
+  if (!data->gallery_index)
+    data->gallery_index = fpi_print_index_new (data->gallery);
+
+  return data->gallery_index;
+}
+
+/**
+ * fpi_device_get_identify_mode:
+ * @device: The #FpDevice
+ *
+ * Get the #FpIdentifyMode that was requested for the identify gallery.
+ * Devices that match on the host should honour it, it is always
+ * %FP_IDENTIFY_MODE_FIRST_MATCH unless a #FpGallery is used.
+ *
+ * Returns: The #FpIdentifyMode
+ */
+FpIdentifyMode
+fpi_device_get_identify_mode (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  FpMatchData *data;
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), FP_IDENTIFY_MODE_FIRST_MATCH);
+  g_return_val_if_fail (priv->current_action == FPI_DEVICE_ACTION_IDENTIFY,
+                        FP_IDENTIFY_MODE_FIRST_MATCH);
+
+  data = g_task_get_task_data (priv->current_task);
+  g_assert (data);
+
+  return data->identify_mode;
+}
+
+/**
+ * fpi_device_get_identify_prefilter:
+ * @device: The #FpDevice
+ *
+ * Get the number of gallery prints that should be matched after a coarse
+ * pre-filter, as requested by #FpGallery:prefilter-candidates. Only
+ * devices that match on the host need it.
+ *
+ * Returns: The number of candidates, or 0 to match the whole gallery
+ */
+guint
+fpi_device_get_identify_prefilter (FpDevice *device)
+{
+  FpDevicePrivate *priv = fp_device_get_instance_private (device);
+  FpMatchData *data;
+
+  g_return_val_if_fail (FP_IS_DEVICE (device), 0);
+  g_return_val_if_fail (priv->current_action == FPI_DEVICE_ACTION_IDENTIFY, 0);
+
+  data = g_task_get_task_data (priv->current_task);
+  g_assert (data);
+
+  return data->prefilter_candidates;
+}
+
 /**
  * fpi_device_get_delete_data:
  * @device: The #FpDevice
@@ -248,6 +248,9 @@ void fpi_device_get_verify_data (FpDevice *device,
                                  FpPrint **print);
 void fpi_device_get_identify_data (FpDevice   *device,
                                    GPtrArray **prints);
+FpiPrintIndex *fpi_device_get_identify_index (FpDevice *device);
+FpIdentifyMode fpi_device_get_identify_mode (FpDevice *device);
+guint fpi_device_get_identify_prefilter (FpDevice *device);
 void fpi_device_get_delete_data (FpDevice *device,
                                  FpPrint **print);
 GCancellable *fpi_device_get_cancellable (FpDevice *device);
@@ -190,8 +190,9 @@ fp_image_device_maybe_complete_action (FpImageDevice *self, GError *error)
         }
     }
 
-  /* Do not complete if the device is still active or a minutiae scan is pending. */
-  if (priv->active || priv->minutiae_scan_active)
+  /* Do not complete if the device is still active or a minutiae scan or
+   * identification is pending. */
+  if (priv->active || priv->minutiae_scan_active || priv->identify_active)
     return;
 
   if (!priv->action_error)
@@ -232,6 +233,35 @@ fp_image_device_maybe_complete_action (FpImageDevice *self, GError *error)
     }
 }
 
+static void
+fpi_image_device_identify_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  FpPrint *print = FP_PRINT (source_object);
+  g_autoptr(FpPrint) result = NULL;
+  GError *error = NULL;
+  FpImageDevice *self = FP_IMAGE_DEVICE (user_data);
+  FpDevice *device = FP_DEVICE (self);
+  FpImageDevicePrivate *priv;
+
+  /* Note: We rely on the device to not disappear during an operation. */
+  priv = fp_image_device_get_instance_private (self);
+  priv->identify_active = FALSE;
+
+  result = fpi_print_bz3_identify_finish (print, res, &error);
+
+  if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+    {
+      fp_image_device_maybe_complete_action (self, g_steal_pointer (&error));
+      fpi_image_device_deactivate (self, TRUE);
+      return;
+    }
+
+  if (!error || error->domain == FP_DEVICE_RETRY)
+    fpi_device_identify_report (device, result, g_object_ref (print), g_steal_pointer (&error));
+
+  fp_image_device_maybe_complete_action (self, g_steal_pointer (&error));
+}
+
 static void
 fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, gpointer user_data)
 {
@@ -334,26 +364,27 @@ fpi_image_device_minutiae_detected (GObject *source_object, GAsyncResult *res, g
     }
   else if (action == FPI_DEVICE_ACTION_IDENTIFY)
     {
-      gint i;
       GPtrArray *templates;
-      FpPrint *result = NULL;
 
-      fpi_device_get_identify_data (device, &templates);
-      for (i = 0; !error && i < templates->len; i++)
+      if (!print)
         {
-          FpPrint *template = g_ptr_array_index (templates, i);
+          if (!error || error->domain == FP_DEVICE_RETRY)
+            fpi_device_identify_report (device, NULL, NULL, g_steal_pointer (&error));
 
-          if (fpi_print_bz3_match (template, print, priv->bz3_threshold, &error) == FPI_MATCH_SUCCESS)
-            {
-              result = template;
-              break;
-            }
+          fp_image_device_maybe_complete_action (self, g_steal_pointer (&error));
+          return;
         }
 
-      if (!error || error->domain == FP_DEVICE_RETRY)
-        fpi_device_identify_report (device, result, g_steal_pointer (&print), g_steal_pointer (&error));
-
-      fp_image_device_maybe_complete_action (self, g_steal_pointer (&error));
+      /* Matching against a large gallery may take a while, so it is done
+       * by worker threads. */
+      fpi_device_get_identify_data (device, &templates);
+      priv->identify_active = TRUE;
+      fpi_print_bz3_identify (templates, print, priv->bz3_threshold,
+                              fpi_device_get_identify_mode (device),
+                              fpi_device_get_identify_prefilter (device),
+                              fpi_device_get_cancellable (device),
+                              fpi_image_device_identify_done,
+                              self);
     }
   else
     {
@@ -29,6 +29,17 @@
 #include <pixman.h>
 #endif
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define PIXEL_STATS_HAVE_AVX2
+#endif
+
 /**
  * SECTION: fpi-image
  * @title: Internal FpImage
@@ -37,6 +48,316 @@
  * Internal image handling routines. See #FpImage for public routines.
  */
 
+/* Kernels summing the pixels and their squares, or the squared
+ * differences of two buffers, in one pass. The squares are accumulated
+ * in 32 bit lanes, which are flushed into 64 bit totals before they can
+ * overflow, so any buffer size is fine. */
+typedef void (*PixelSumsFunc) (const guint8 *buf,
+                               gsize         size,
+                               guint64      *sum,
+                               guint64      *sq_sum);
+typedef guint64 (*SqDiffSumFunc) (const guint8 *buf1,
+                                  const guint8 *buf2,
+                                  gsize         size);
+
+typedef struct
+{
+  PixelSumsFunc pixel_sums;
+  SqDiffSumFunc sq_diff_sum;
+} PixelStatsKernels;
+
+/* Every 32 bit lane receives at most 4 squares of 255 per block */
+#define PIXEL_STATS_FLUSH_BLOCKS 4096
+
+static void
+pixel_sums_c (const guint8 *buf, gsize size, guint64 *sum, guint64 *sq_sum)
+{
+  guint64 s = 0, sq = 0;
+  gsize i;
+
+  for (i = 0; i < size; i++)
+    {
+      s += buf[i];
+      sq += (guint32) buf[i] * buf[i];
+    }
+
+  *sum = s;
+  *sq_sum = sq;
+}
+
+static guint64
+sq_diff_sum_c (const guint8 *buf1, const guint8 *buf2, gsize size)
+{
+  guint64 res = 0;
+  gsize i;
+
+  for (i = 0; i < size; i++)
+    {
+      gint dev = (gint) buf1[i] - (gint) buf2[i];
+      res += (guint32) (dev * dev);
+    }
+
+  return res;
+}
+
+#if defined(__SSE2__)
+static inline __m128i
+widen_epu32_sse2 (__m128i acc32)
+{
+  __m128i zero = _mm_setzero_si128 ();
+
+  return _mm_add_epi64 (_mm_unpacklo_epi32 (acc32, zero),
+                        _mm_unpackhi_epi32 (acc32, zero));
+}
+
+static inline guint64
+hsum_epi64_sse2 (__m128i v)
+{
+  guint64 lanes[2];
+
+  _mm_storeu_si128 ((__m128i *) lanes, v);
+
+  return lanes[0] + lanes[1];
+}
+
+static void
+pixel_sums_sse2 (const guint8 *buf, gsize size, guint64 *sum, guint64 *sq_sum)
+{
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i s = zero, sq = zero;
+  gsize i = 0;
+  guint64 tail_sum, tail_sq_sum;
+
+  while (i + 16 <= size)
+    {
+      __m128i sq32 = zero;
+      guint n;
+
+      for (n = 0; n < PIXEL_STATS_FLUSH_BLOCKS && i + 16 <= size; n++, i += 16)
+        {
+          __m128i v = _mm_loadu_si128 ((const __m128i *) (buf + i));
+          __m128i lo = _mm_unpacklo_epi8 (v, zero);
+          __m128i hi = _mm_unpackhi_epi8 (v, zero);
+
+          s = _mm_add_epi64 (s, _mm_sad_epu8 (v, zero));
+          sq32 = _mm_add_epi32 (sq32, _mm_add_epi32 (_mm_madd_epi16 (lo, lo),
+                                                     _mm_madd_epi16 (hi, hi)));
+        }
+
+      sq = _mm_add_epi64 (sq, widen_epu32_sse2 (sq32));
+    }
+
+  pixel_sums_c (buf + i, size - i, &tail_sum, &tail_sq_sum);
+  *sum = hsum_epi64_sse2 (s) + tail_sum;
+  *sq_sum = hsum_epi64_sse2 (sq) + tail_sq_sum;
+}
+
+static guint64
+sq_diff_sum_sse2 (const guint8 *buf1, const guint8 *buf2, gsize size)
+{
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i sq = zero;
+  gsize i = 0;
+
+  while (i + 16 <= size)
+    {
+      __m128i sq32 = zero;
+      guint n;
+
+      for (n = 0; n < PIXEL_STATS_FLUSH_BLOCKS && i + 16 <= size; n++, i += 16)
+        {
+          __m128i v1 = _mm_loadu_si128 ((const __m128i *) (buf1 + i));
+          __m128i v2 = _mm_loadu_si128 ((const __m128i *) (buf2 + i));
+          __m128i lo = _mm_sub_epi16 (_mm_unpacklo_epi8 (v1, zero),
+                                      _mm_unpacklo_epi8 (v2, zero));
+          __m128i hi = _mm_sub_epi16 (_mm_unpackhi_epi8 (v1, zero),
+                                      _mm_unpackhi_epi8 (v2, zero));
+
+          sq32 = _mm_add_epi32 (sq32, _mm_add_epi32 (_mm_madd_epi16 (lo, lo),
+                                                     _mm_madd_epi16 (hi, hi)));
+        }
+
+      sq = _mm_add_epi64 (sq, widen_epu32_sse2 (sq32));
+    }
+
+  return hsum_epi64_sse2 (sq) + sq_diff_sum_c (buf1 + i, buf2 + i, size - i);
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+static void
+pixel_sums_neon (const guint8 *buf, gsize size, guint64 *sum, guint64 *sq_sum)
+{
+  uint64x2_t s = vdupq_n_u64 (0), sq = vdupq_n_u64 (0);
+  gsize i = 0;
+  guint64 tail_sum, tail_sq_sum;
+
+  while (i + 16 <= size)
+    {
+      uint32x4_t s32 = vdupq_n_u32 (0), sq32 = vdupq_n_u32 (0);
+      guint n;
+
+      for (n = 0; n < PIXEL_STATS_FLUSH_BLOCKS && i + 16 <= size; n++, i += 16)
+        {
+          uint8x16_t v = vld1q_u8 (buf + i);
+
+          s32 = vpadalq_u16 (s32, vpaddlq_u8 (v));
+          sq32 = vpadalq_u16 (sq32, vmull_u8 (vget_low_u8 (v), vget_low_u8 (v)));
+          sq32 = vpadalq_u16 (sq32, vmull_u8 (vget_high_u8 (v), vget_high_u8 (v)));
+        }
+
+      s = vpadalq_u32 (s, s32);
+      sq = vpadalq_u32 (sq, sq32);
+    }
+
+  pixel_sums_c (buf + i, size - i, &tail_sum, &tail_sq_sum);
+  *sum = vaddvq_u64 (s) + tail_sum;
+  *sq_sum = vaddvq_u64 (sq) + tail_sq_sum;
+}
+
+static guint64
+sq_diff_sum_neon (const guint8 *buf1, const guint8 *buf2, gsize size)
+{
+  uint64x2_t sq = vdupq_n_u64 (0);
+  gsize i = 0;
+
+  while (i + 16 <= size)
+    {
+      uint32x4_t sq32 = vdupq_n_u32 (0);
+      guint n;
+
+      for (n = 0; n < PIXEL_STATS_FLUSH_BLOCKS && i + 16 <= size; n++, i += 16)
+        {
+          uint8x16_t d = vabdq_u8 (vld1q_u8 (buf1 + i), vld1q_u8 (buf2 + i));
+
+          sq32 = vpadalq_u16 (sq32, vmull_u8 (vget_low_u8 (d), vget_low_u8 (d)));
+          sq32 = vpadalq_u16 (sq32, vmull_u8 (vget_high_u8 (d), vget_high_u8 (d)));
+        }
+
+      sq = vpadalq_u32 (sq, sq32);
+    }
+
+  return vaddvq_u64 (sq) + sq_diff_sum_c (buf1 + i, buf2 + i, size - i);
+}
+#endif
+
+#ifdef PIXEL_STATS_HAVE_AVX2
+__attribute__((target ("avx2")))
+static inline __m256i
+widen_epu32_avx2 (__m256i acc32)
+{
+  __m256i zero = _mm256_setzero_si256 ();
+
+  return _mm256_add_epi64 (_mm256_unpacklo_epi32 (acc32, zero),
+                           _mm256_unpackhi_epi32 (acc32, zero));
+}
+
+__attribute__((target ("avx2")))
+static inline guint64
+hsum_epi64_avx2 (__m256i v)
+{
+  guint64 lanes[4];
+
+  _mm256_storeu_si256 ((__m256i *) lanes, v);
+
+  return lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+
+__attribute__((target ("avx2")))
+static void
+pixel_sums_avx2 (const guint8 *buf, gsize size, guint64 *sum, guint64 *sq_sum)
+{
+  __m256i zero = _mm256_setzero_si256 ();
+  __m256i s = zero, sq = zero;
+  gsize i = 0;
+  guint64 tail_sum, tail_sq_sum;
+
+  while (i + 32 <= size)
+    {
+      __m256i sq32 = zero;
+      guint n;
+
+      for (n = 0; n < PIXEL_STATS_FLUSH_BLOCKS && i + 32 <= size; n++, i += 32)
+        {
+          __m256i v = _mm256_loadu_si256 ((const __m256i *) (buf + i));
+          __m256i lo = _mm256_unpacklo_epi8 (v, zero);
+          __m256i hi = _mm256_unpackhi_epi8 (v, zero);
+
+          s = _mm256_add_epi64 (s, _mm256_sad_epu8 (v, zero));
+          sq32 = _mm256_add_epi32 (sq32, _mm256_add_epi32 (_mm256_madd_epi16 (lo, lo),
+                                                           _mm256_madd_epi16 (hi, hi)));
+        }
+
+      sq = _mm256_add_epi64 (sq, widen_epu32_avx2 (sq32));
+    }
+
+  pixel_sums_c (buf + i, size - i, &tail_sum, &tail_sq_sum);
+  *sum = hsum_epi64_avx2 (s) + tail_sum;
+  *sq_sum = hsum_epi64_avx2 (sq) + tail_sq_sum;
+}
+
+__attribute__((target ("avx2")))
+static guint64
+sq_diff_sum_avx2 (const guint8 *buf1, const guint8 *buf2, gsize size)
+{
+  __m256i zero = _mm256_setzero_si256 ();
+  __m256i sq = zero;
+  gsize i = 0;
+
+  while (i + 32 <= size)
+    {
+      __m256i sq32 = zero;
+      guint n;
+
+      for (n = 0; n < PIXEL_STATS_FLUSH_BLOCKS && i + 32 <= size; n++, i += 32)
+        {
+          __m256i v1 = _mm256_loadu_si256 ((const __m256i *) (buf1 + i));
+          __m256i v2 = _mm256_loadu_si256 ((const __m256i *) (buf2 + i));
+          __m256i lo = _mm256_sub_epi16 (_mm256_unpacklo_epi8 (v1, zero),
+                                         _mm256_unpacklo_epi8 (v2, zero));
+          __m256i hi = _mm256_sub_epi16 (_mm256_unpackhi_epi8 (v1, zero),
+                                         _mm256_unpackhi_epi8 (v2, zero));
+
+          sq32 = _mm256_add_epi32 (sq32, _mm256_add_epi32 (_mm256_madd_epi16 (lo, lo),
+                                                           _mm256_madd_epi16 (hi, hi)));
+        }
+
+      sq = _mm256_add_epi64 (sq, widen_epu32_avx2 (sq32));
+    }
+
+  return hsum_epi64_avx2 (sq) + sq_diff_sum_c (buf1 + i, buf2 + i, size - i);
+}
+#endif
+
+/* Selects the fastest kernels supported by the CPU, checked at runtime */
+static const PixelStatsKernels *
+get_pixel_stats_kernels (void)
+{
+  static gsize kernels = 0;
+
+  if (g_once_init_enter (&kernels))
+    {
+#ifdef PIXEL_STATS_HAVE_AVX2
+      static const PixelStatsKernels avx2 = { pixel_sums_avx2, sq_diff_sum_avx2 };
+#endif
+#if defined(__SSE2__)
+      static const PixelStatsKernels fallback = { pixel_sums_sse2, sq_diff_sum_sse2 };
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+      static const PixelStatsKernels fallback = { pixel_sums_neon, sq_diff_sum_neon };
+#else
+      static const PixelStatsKernels fallback = { pixel_sums_c, sq_diff_sum_c };
+#endif
+      const PixelStatsKernels *k = &fallback;
+
+#ifdef PIXEL_STATS_HAVE_AVX2
+      if (__builtin_cpu_supports ("avx2"))
+        k = &avx2;
+#endif
+
+      g_once_init_leave (&kernels, (gsize) k);
+    }
+
+  return (const PixelStatsKernels *) kernels;
+}
+
 /**
  * fpi_std_sq_dev:
  * @buf: buffer (usually bitmap, one byte per pixel)
@@ -57,21 +378,15 @@ gint
 fpi_std_sq_dev (const guint8 *buf,
                 gint          size)
 {
-  guint64 res = 0, mean = 0;
-  gint i;
+  guint64 sum, sq_sum, mean;
 
-  for (i = 0; i < size; i++)
-    mean += buf[i];
+  get_pixel_stats_kernels ()->pixel_sums (buf, size, &sum, &sq_sum);
 
-  mean /= size;
+  /* The mean is rounded down, expand the sum of the squared deviations
+   * from it so that all pixels are only read once. */
+  mean = sum / size;
 
-  for (i = 0; i < size; i++)
-    {
-      int dev = (int) buf[i] - mean;
-      res += dev * dev;
-    }
-
-  return res / size;
+  return (sq_sum - mean * (2 * sum - mean * size)) / size;
 }
 
 /**
@@ -96,15 +411,181 @@ fpi_mean_sq_diff_norm (const guint8 *buf1,
                        const guint8 *buf2,
                        gint          size)
 {
-  int res = 0, i;
+  return get_pixel_stats_kernels ()->sq_diff_sum (buf1, buf2, size) / size;
+}
 
-  for (i = 0; i < size; i++)
+#if defined(__SSE2__)
+typedef __m128i PixelBlock;
+
+static inline PixelBlock
+pixel_block_load (const guint8 *p)
+{
+  return _mm_loadu_si128 ((const __m128i *) p);
+}
+
+static inline void
+pixel_block_store (guint8 *p, PixelBlock v)
+{
+  _mm_storeu_si128 ((__m128i *) p, v);
+}
+
+static inline PixelBlock
+pixel_block_transform (PixelBlock v, gboolean reverse, gboolean invert)
+{
+  if (reverse)
+    {
+      /* SSE2 has no byte shuffle, reverse the words and swap their bytes */
+      v = _mm_shuffle_epi32 (v, _MM_SHUFFLE (0, 1, 2, 3));
+      v = _mm_shufflelo_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+      v = _mm_shufflehi_epi16 (v, _MM_SHUFFLE (2, 3, 0, 1));
+      v = _mm_or_si128 (_mm_slli_epi16 (v, 8), _mm_srli_epi16 (v, 8));
+    }
+
+  if (invert)
+    v = _mm_xor_si128 (v, _mm_set1_epi8 (-1));
+
+  return v;
+}
+#define PIXEL_BLOCK_SIZE 16
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+typedef uint8x16_t PixelBlock;
+
+static inline PixelBlock
+pixel_block_load (const guint8 *p)
+{
+  return vld1q_u8 (p);
+}
+
+static inline void
+pixel_block_store (guint8 *p, PixelBlock v)
+{
+  vst1q_u8 (p, v);
+}
+
+static inline PixelBlock
+pixel_block_transform (PixelBlock v, gboolean reverse, gboolean invert)
+{
+  if (reverse)
+    {
+      v = vrev64q_u8 (v);
+      v = vextq_u8 (v, v, 8);
+    }
+
+  if (invert)
+    v = vmvnq_u8 (v);
+
+  return v;
+}
+#define PIXEL_BLOCK_SIZE 16
+#endif
+
+/* Swaps the rows @a and @b, mirroring and inverting the pixels on the way
+ * as requested. @a and @b may be the same row. */
+static void
+normalize_row_pair (guint8  *a,
+                    guint8  *b,
+                    guint    width,
+                    gboolean hflip,
+                    gboolean invert)
+{
+  guint8 mask = invert ? 0xff : 0x00;
+  guint l = 0, r;
+
+  if (!hflip)
+    {
+#ifdef PIXEL_BLOCK_SIZE
+      for (; l + PIXEL_BLOCK_SIZE <= width; l += PIXEL_BLOCK_SIZE)
+        {
+          PixelBlock va = pixel_block_load (a + l);
+          PixelBlock vb = pixel_block_load (b + l);
+
+          pixel_block_store (a + l, pixel_block_transform (vb, FALSE, invert));
+          pixel_block_store (b + l, pixel_block_transform (va, FALSE, invert));
+        }
+#endif
+
+      for (; l < width; l++)
+        {
+          guint8 pa = a[l];
+          guint8 pb = b[l];
+
+          a[l] = pb ^ mask;
+          b[l] = pa ^ mask;
+        }
+
+      return;
+    }
+
+  /* Mirroring pairs each block with the one at the other end of the row */
+#ifdef PIXEL_BLOCK_SIZE
+  for (; 2 * (l + PIXEL_BLOCK_SIZE) <= width; l += PIXEL_BLOCK_SIZE)
+    {
+      guint m = width - l - PIXEL_BLOCK_SIZE;
+      PixelBlock va_l = pixel_block_load (a + l);
+      PixelBlock va_r = pixel_block_load (a + m);
+      PixelBlock vb_l = pixel_block_load (b + l);
+      PixelBlock vb_r = pixel_block_load (b + m);
+
+      pixel_block_store (a + l, pixel_block_transform (vb_r, TRUE, invert));
+      pixel_block_store (a + m, pixel_block_transform (vb_l, TRUE, invert));
+      pixel_block_store (b + l, pixel_block_transform (va_r, TRUE, invert));
+      pixel_block_store (b + m, pixel_block_transform (va_l, TRUE, invert));
+    }
+#endif
+
+  for (r = width - l - 1; l < width && l <= r; l++, r--)
+    {
+      guint8 pa_l = a[l], pa_r = a[r];
+      guint8 pb_l = b[l], pb_r = b[r];
+
+      a[l] = pb_r ^ mask;
+      a[r] = pb_l ^ mask;
+      b[l] = pa_r ^ mask;
+      b[r] = pa_l ^ mask;
+    }
+}
+
+/**
+ * fpi_image_normalize:
+ * @data: the pixels, one byte per pixel
+ * @width: width of the image
+ * @height: height of the image
+ * @flags: #FpiImageFlags describing the image
+ *
+ * Undoes the flips and the colour inversion described by @flags in place.
+ * All of them are applied in a single pass over the image, so drivers
+ * that set several flags do not pay for one pass per flag.
+ */
+void
+fpi_image_normalize (guint8       *data,
+                     guint         width,
+                     guint         height,
+                     FpiImageFlags flags)
+{
+  gboolean hflip = (flags & FPI_IMAGE_H_FLIPPED) != 0;
+  gboolean vflip = (flags & FPI_IMAGE_V_FLIPPED) != 0;
+  gboolean invert = (flags & FPI_IMAGE_COLORS_INVERTED) != 0;
+  guint top, bottom;
+
+  if (!hflip && !vflip && !invert)
+    return;
+
+  if (!vflip)
     {
-      int dev = (int) buf1[i] - (int) buf2[i];
-      res += dev * dev;
+      for (top = 0; top < height; top++)
+        normalize_row_pair (data + (gsize) top * width, data + (gsize) top * width,
+                            width, hflip, invert);
+      return;
     }
 
-  return res / size;
+  for (top = 0, bottom = height - 1; top < height / 2; top++, bottom--)
+    normalize_row_pair (data + (gsize) top * width, data + (gsize) bottom * width,
+                        width, hflip, invert);
+
+  /* The middle row of an odd height only has to be mirrored */
+  if (height % 2 == 1 && (hflip || invert))
+    normalize_row_pair (data + (gsize) top * width, data + (gsize) top * width,
+                        width, hflip, invert);
 }
 
 #if HAVE_PIXMAN
@@ -46,6 +46,9 @@ typedef enum {
  * @height: Height of the image
  * @ppmm: Pixels per millimeter
  * @flags: #FpiImageFlags for required normalization
+ * @detection_threads: Number of threads analysing the image blocks during
+ *   minutiae detection, 0 for one per processor. The result does not
+ *   depend on it.
  *
  * Structure holding an image. The public fields are only public for internal
  * use by the drivers.
@@ -63,6 +66,8 @@ struct _FpImage
 
   FpiImageFlags flags;
 
+  guint         detection_threads;
+
   /*< private >*/
   guint8    *data;
   guint8    *binarized;
@@ -77,6 +82,11 @@ gint fpi_mean_sq_diff_norm (const guint8 *buf1,
                             const guint8 *buf2,
                             gint          size);
 
+void fpi_image_normalize (guint8       *data,
+                          guint         width,
+                          guint         height,
+                          FpiImageFlags flags);
+
 #if HAVE_PIXMAN
 FpImage *fpi_image_resize (FpImage *orig,
                            guint    w_factor,
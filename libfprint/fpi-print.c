@@ -25,6 +25,8 @@
 #include "fpi-device.h"
 #include "fpi-compat.h"
 
+#include <math.h>
+
 /**
  * SECTION: fpi-print
  * @title: Internal FpPrint
@@ -50,7 +52,8 @@ fpi_print_add_print (FpPrint *print, FpPrint *add)
   g_return_if_fail (add->type == FPI_PRINT_NBIS);
 
   g_assert (add->prints->len == 1);
-  g_ptr_array_add (print->prints, g_memdup (add->prints->pdata[0], sizeof (struct xyt_struct)));
+  g_ptr_array_add (print->prints, xyt_struct_dup (add->prints->pdata[0]));
+  fpi_print_clear_caches (print);
 }
 
 /**
@@ -100,17 +103,17 @@ fpi_print_set_device_stored (FpPrint *print,
 /* XXX: This is the old version, but wouldn't it be smarter to instead
  * use the highest quality mintutiae? Possibly just using bz_prune from
  * upstream? */
-static void
+static struct xyt_struct *
 minutiae_to_xyt (struct fp_minutiae *minutiae,
                  int                 bwidth,
-                 int                 bheight,
-                 struct xyt_struct  *xyt)
+                 int                 bheight)
 {
   int i;
   struct fp_minutia *minutia;
   struct minutiae_struct c[MAX_FILE_MINUTIAE];
+  struct xyt_struct *xyt;
 
-  /* struct xyt_struct uses arrays of MAX_BOZORTH_MINUTIAE (200) */
+  /* Bozorth3 uses at most MAX_BOZORTH_MINUTIAE (200) */
   int nmin = min (minutiae->num, MAX_BOZORTH_MINUTIAE);
 
   for (i = 0; i < nmin; i++)
@@ -128,13 +131,29 @@ minutiae_to_xyt (struct fp_minutiae *minutiae,
   qsort ((void *) &c, (size_t) nmin, sizeof (struct minutiae_struct),
          sort_x_y);
 
+  xyt = xyt_struct_new (nmin);
   for (i = 0; i < nmin; i++)
     {
       xyt->xcol[i]     = c[i].col[0];
       xyt->ycol[i]     = c[i].col[1];
       xyt->thetacol[i] = c[i].col[2];
     }
-  xyt->nrows = nmin;
+
+  return xyt;
+}
+
+/* Adds the minutiae detected in an image of the given size to @print of
+ * type FPI_PRINT_NBIS, without the need for a #FpImage holding them. */
+void
+fpi_print_add_minutiae (FpPrint            *print,
+                        struct fp_minutiae *minutiae,
+                        gint                width,
+                        gint                height)
+{
+  g_return_if_fail (print->type == FPI_PRINT_NBIS);
+
+  g_ptr_array_add (print->prints, minutiae_to_xyt (minutiae, width, height));
+  fpi_print_clear_caches (print);
 }
 
 /**
@@ -158,7 +177,6 @@ fpi_print_add_from_image (FpPrint *print,
 {
   GPtrArray *minutiae;
   struct fp_minutiae _minutiae;
-  struct xyt_struct *xyt;
 
   if (print->type != FPI_PRINT_NBIS || !image)
     {
@@ -183,9 +201,7 @@ fpi_print_add_from_image (FpPrint *print,
   _minutiae.list = (struct fp_minutia **) minutiae->pdata;
   _minutiae.alloc = minutiae->len;
 
-  xyt = g_new0 (struct xyt_struct, 1);
-  minutiae_to_xyt (&_minutiae, image->width, image->height, xyt);
-  g_ptr_array_add (print->prints, xyt);
+  fpi_print_add_minutiae (print, &_minutiae, image->width, image->height);
 
   g_clear_object (&print->image);
   print->image = g_object_ref (image);
@@ -194,6 +210,213 @@ fpi_print_add_from_image (FpPrint *print,
   return TRUE;
 }
 
+/* The Bozorth3 working tables are too large for the stack and may only be
+ * used by one match at a time, so keep one lazily allocated context per
+ * thread. It is released again when the thread exits. */
+static GPrivate bz_match_ctx_key = G_PRIVATE_INIT ((GDestroyNotify) bz_match_context_free);
+
+static BzMatchContext *
+get_bz_match_context (void)
+{
+  BzMatchContext *ctx = g_private_get (&bz_match_ctx_key);
+
+  if (G_UNLIKELY (!ctx))
+    {
+      ctx = bz_match_context_new ();
+      g_private_set (&bz_match_ctx_key, ctx);
+    }
+
+  return ctx;
+}
+
+/* Drops all data that was derived from the print data, this needs to be
+ * called whenever the print data changes. It must not be called while
+ * the print is being matched. */
+void
+fpi_print_clear_caches (FpPrint *print)
+{
+  GPtrArray *tables = g_atomic_pointer_get (&print->bz3_tables);
+  GArray *index = g_atomic_pointer_get (&print->bz3_index);
+  guint64 *hash = g_atomic_pointer_get (&print->content_hash);
+
+  if (tables && g_atomic_pointer_compare_and_exchange (&print->bz3_tables, tables, NULL))
+    g_ptr_array_unref (tables);
+
+  if (index && g_atomic_pointer_compare_and_exchange (&print->bz3_index, index, NULL))
+    g_array_unref (index);
+
+  if (hash && g_atomic_pointer_compare_and_exchange (&print->content_hash, hash, NULL))
+    g_free (hash);
+}
+
+/* Returns the Bozorth3 gallery tables (struct bz_gallery_table) for all
+ * prints contained in @print. Building these is the expensive part of
+ * matching against a gallery print, so they are computed once and then
+ * kept with the print. This function is thread safe. */
+GPtrArray *
+fpi_print_ensure_bz3_tables (FpPrint *print)
+{
+  BzMatchContext *ctx;
+  GPtrArray *tables;
+  guint i;
+
+  g_return_val_if_fail (print->type == FPI_PRINT_NBIS, NULL);
+
+  tables = g_atomic_pointer_get (&print->bz3_tables);
+  if (G_LIKELY (tables))
+    return tables;
+
+  ctx = get_bz_match_context ();
+  tables = g_ptr_array_new_full (print->prints->len, g_free);
+  for (i = 0; i < print->prints->len; i++)
+    g_ptr_array_add (tables,
+                     bozorth_gallery_table_new (ctx, g_ptr_array_index (print->prints, i)));
+
+  /* Someone else may have been faster */
+  if (!g_atomic_pointer_compare_and_exchange (&print->bz3_tables, NULL, tables))
+    {
+      g_ptr_array_unref (tables);
+      tables = g_atomic_pointer_get (&print->bz3_tables);
+    }
+
+  return tables;
+}
+
+/* Coarse identify pre-filter. Each print is reduced to a histogram over
+ * the distance and the relative direction of all pairs of minutiae. Both
+ * do not change with translation and rotation, so the difference between
+ * two histograms is a cheap (if crude) estimate of how likely Bozorth3 is
+ * to find a match. */
+#define BZ3_INDEX_DIST_BINS 12
+#define BZ3_INDEX_DIST_STEP 32      /* pixels */
+#define BZ3_INDEX_ANGLE_BINS 4
+#define BZ3_INDEX_ANGLE_STEP (180 / BZ3_INDEX_ANGLE_BINS)
+
+typedef struct
+{
+  gfloat hist[BZ3_INDEX_DIST_BINS * BZ3_INDEX_ANGLE_BINS];
+} Bz3IndexFeature;
+
+static void
+bz3_index_feature_init (Bz3IndexFeature *feature, const struct xyt_struct *xyt)
+{
+  guint counts[G_N_ELEMENTS (feature->hist)] = { 0, };
+  guint pairs = 0;
+  guint k;
+  gint i, j;
+
+  for (i = 0; i < xyt->nrows; i++)
+    {
+      for (j = i + 1; j < xyt->nrows; j++)
+        {
+          gint dx = xyt->xcol[j] - xyt->xcol[i];
+          gint dy = xyt->ycol[j] - xyt->ycol[i];
+          gint dtheta = ABS (xyt->thetacol[j] - xyt->thetacol[i]) % 360;
+          gint dist_bin, angle_bin;
+
+          if (dtheta > 180)
+            dtheta = 360 - dtheta;
+
+          dist_bin = (gint) sqrtf (dx * dx + dy * dy) / BZ3_INDEX_DIST_STEP;
+          dist_bin = MIN (dist_bin, BZ3_INDEX_DIST_BINS - 1);
+          angle_bin = MIN (dtheta / BZ3_INDEX_ANGLE_STEP, BZ3_INDEX_ANGLE_BINS - 1);
+
+          counts[dist_bin * BZ3_INDEX_ANGLE_BINS + angle_bin]++;
+          pairs++;
+        }
+    }
+
+  for (k = 0; k < G_N_ELEMENTS (feature->hist); k++)
+    feature->hist[k] = pairs > 0 ? (gfloat) counts[k] / pairs : 0.0f;
+}
+
+/* L1 distance between the histograms, in the range of 0 to 2 */
+static gfloat
+bz3_index_feature_distance (const Bz3IndexFeature *a, const Bz3IndexFeature *b)
+{
+  gfloat distance = 0.0f;
+  guint k;
+
+  for (k = 0; k < G_N_ELEMENTS (a->hist); k++)
+    distance += fabsf (a->hist[k] - b->hist[k]);
+
+  return distance;
+}
+
+/* Returns the pre-filter features (Bz3IndexFeature) for all prints
+ * contained in @print, computed once like the gallery tables. */
+static GArray *
+bz3_ensure_index (FpPrint *print)
+{
+  GArray *index;
+  guint i;
+
+  index = g_atomic_pointer_get (&print->bz3_index);
+  if (G_LIKELY (index))
+    return index;
+
+  index = g_array_sized_new (FALSE, FALSE, sizeof (Bz3IndexFeature), print->prints->len);
+  g_array_set_size (index, print->prints->len);
+  for (i = 0; i < print->prints->len; i++)
+    bz3_index_feature_init (&g_array_index (index, Bz3IndexFeature, i),
+                            g_ptr_array_index (print->prints, i));
+
+  if (!g_atomic_pointer_compare_and_exchange (&print->bz3_index, NULL, index))
+    {
+      g_array_unref (index);
+      index = g_atomic_pointer_get (&print->bz3_index);
+    }
+
+  return index;
+}
+
+/* Returns the best score of @template against the probe. If @stop_early
+ * is set, the remaining sub-prints are skipped once one of them reached
+ * @bz3_threshold. */
+static gint
+bz3_template_score (BzMatchContext    *ctx,
+                    gint               probe_len,
+                    struct xyt_struct *pstruct,
+                    FpPrint           *template,
+                    gint               bz3_threshold,
+                    gboolean           stop_early)
+{
+  GPtrArray *tables = fpi_print_ensure_bz3_tables (template);
+  gint best_score = 0;
+  gint i;
+
+  for (i = 0; i < template->prints->len; i++)
+    {
+      struct xyt_struct *gstruct;
+      gint score;
+
+      gstruct = g_ptr_array_index (template->prints, i);
+      score = bozorth_to_gallery_table (ctx, probe_len, pstruct, gstruct,
+                                        g_ptr_array_index (tables, i));
+      fp_dbg ("score %d/%d", score, bz3_threshold);
+
+      best_score = MAX (best_score, score);
+      if (stop_early && score >= bz3_threshold)
+        break;
+    }
+
+  return best_score;
+}
+
+static gboolean
+bz3_check_print (FpPrint *print, GError **error)
+{
+  if (print->prints->len != 1)
+    {
+      g_propagate_error (error,
+                         fpi_device_error_new_msg (FP_DEVICE_ERROR_GENERAL,
+                                                   "New print contains more than one print!"));
+      return FALSE;
+    }
+
+  return TRUE;
+}
+
 /**
  * fpi_print_bz3_match:
  * @template: A #FpPrint containing one or more prints
@@ -207,14 +430,16 @@ fpi_print_add_from_image (FpPrint *print,
  * Both @template and @print need to be of type #FPI_PRINT_NBIS for this to
  * work.
  *
+ * This function is thread safe, each thread uses its own matching context.
+ *
  * Returns: Whether the prints match, @error will be set if #FPI_MATCH_ERROR is returned
  */
 FpiMatchResult
 fpi_print_bz3_match (FpPrint *template, FpPrint *print, gint bz3_threshold, GError **error)
 {
+  BzMatchContext *ctx;
   struct xyt_struct *pstruct;
   gint probe_len;
-  gint i;
 
   /* XXX: Use a different error type? */
   if (template->type != FPI_PRINT_NBIS || print->type != FPI_PRINT_NBIS)
@@ -224,29 +449,790 @@ fpi_print_bz3_match (FpPrint *template, FpPrint *print, gint bz3_threshold, GErr
       return FPI_MATCH_ERROR;
     }
 
-  if (print->prints->len != 1)
+  if (!bz3_check_print (print, error))
+    return FPI_MATCH_ERROR;
+
+  ctx = get_bz_match_context ();
+  pstruct = g_ptr_array_index (print->prints, 0);
+  probe_len = bozorth_probe_init (ctx, pstruct);
+
+  if (bz3_template_score (ctx, probe_len, pstruct, template, bz3_threshold, TRUE) >= bz3_threshold)
+    return FPI_MATCH_SUCCESS;
+
+  return FPI_MATCH_FAIL;
+}
+
+/**
+ * fpi_print_bz3_score_gallery:
+ * @print: A #FpPrint containing one or more prints
+ * @templates: (element-type FpPrint): The gallery of #FpPrint to score
+ * @scores: (array): Return location for one score per gallery print
+ * @cancellable: a #GCancellable, or %NULL
+ *
+ * Computes the raw Bozorth3 scores of @print against every print in
+ * @templates. The score of a pair is the highest score of any of the
+ * prints contained in @print against any of the prints contained in the
+ * template. Each probe print is only prepared once for the whole gallery.
+ *
+ * All prints need to be of type #FPI_PRINT_NBIS. This function is thread
+ * safe, each thread uses its own matching context.
+ *
+ * Returns: %FALSE if the operation was cancelled
+ */
+gboolean
+fpi_print_bz3_score_gallery (FpPrint      *print,
+                             GPtrArray    *templates,
+                             gint         *scores,
+                             GCancellable *cancellable)
+{
+  BzMatchContext *ctx;
+  guint i, j;
+
+  g_return_val_if_fail (print->type == FPI_PRINT_NBIS, FALSE);
+
+  ctx = get_bz_match_context ();
+  memset (scores, 0, templates->len * sizeof (scores[0]));
+
+  for (i = 0; i < print->prints->len; i++)
     {
-      *error = fpi_device_error_new_msg (FP_DEVICE_ERROR_GENERAL,
-                                         "New print contains more than one print!");
-      return FPI_MATCH_ERROR;
+      struct xyt_struct *pstruct = g_ptr_array_index (print->prints, i);
+      gint probe_len = bozorth_probe_init (ctx, pstruct);
+
+      for (j = 0; j < templates->len; j++)
+        {
+          if (g_cancellable_is_cancelled (cancellable))
+            return FALSE;
+
+          /* Nothing ever passes the threshold, so all sub-prints are scored */
+          scores[j] = MAX (scores[j],
+                           bz3_template_score (ctx, probe_len, pstruct,
+                                               g_ptr_array_index (templates, j),
+                                               G_MAXINT, FALSE));
+        }
+    }
+
+  return TRUE;
+}
+
+typedef struct
+{
+  GPtrArray           *templates;
+  gint                 bz3_threshold;
+  FpIdentifyMode       mode;
+
+  /* Accessed atomically by all workers */
+  gint                 next;
+  gint                 end;
+  gint                 workers;
+
+  /* Only set for ranked identification */
+  guint                max_candidates;
+
+  /* Gallery positions that passed the pre-filter in ascending order, or
+   * NULL if the whole gallery is searched. */
+  guint                prefilter_candidates;
+  gint                *order;
+
+  /* Protected by lock */
+  GMutex               lock;
+  gint                 match;
+  gint                 match_score;
+  GArray              *candidates;
+  GError              *error;
+  gint                 error_index;
+} Bz3IdentifyData;
+
+typedef struct
+{
+  gint template;
+  gint score;
+} Bz3Candidate;
+
+static void
+bz3_identify_data_free (Bz3IdentifyData *data)
+{
+  g_ptr_array_unref (data->templates);
+  g_mutex_clear (&data->lock);
+  g_clear_pointer (&data->candidates, g_array_unref);
+  g_clear_error (&data->error);
+  g_free (data->order);
+  g_free (data);
+}
+
+static inline gint
+bz3_identify_data_get_template (Bz3IdentifyData *data, gint i)
+{
+  return data->order ? data->order[i] : i;
+}
+
+typedef struct
+{
+  gint   template;
+  gfloat distance;
+} Bz3IndexCandidate;
+
+static gint
+bz3_index_candidate_cmp (gconstpointer a, gconstpointer b)
+{
+  const Bz3IndexCandidate *ca = a;
+  const Bz3IndexCandidate *cb = b;
+
+  if (ca->distance != cb->distance)
+    return ca->distance < cb->distance ? -1 : 1;
+
+  return ca->template - cb->template;
+}
+
+static gint
+bz3_int_cmp (gconstpointer a, gconstpointer b)
+{
+  return *(const gint *) a - *(const gint *) b;
+}
+
+/* Selects the prefilter_candidates templates that are closest to the probe
+ * according to the pre-filter features and stores them in data->order.
+ * Templates that cannot be matched are skipped, the error is only reported
+ * if none of the selected templates matches. */
+static void
+bz3_identify_prefilter (Bz3IdentifyData *data,
+                        FpPrint         *print)
+{
+  g_autoptr(GArray) distances = NULL;
+  Bz3IndexFeature probe;
+  gint n_templates = data->templates->len;
+  gint n_selected;
+  gint i;
+
+  bz3_index_feature_init (&probe, g_ptr_array_index (print->prints, 0));
+
+  distances = g_array_sized_new (FALSE, FALSE, sizeof (Bz3IndexCandidate), n_templates);
+  for (i = 0; i < n_templates; i++)
+    {
+      FpPrint *template = g_ptr_array_index (data->templates, i);
+      Bz3IndexCandidate candidate = { i, G_MAXFLOAT };
+      GArray *index;
+      guint j;
+
+      if (template->type != FPI_PRINT_NBIS)
+        {
+          if (!data->error)
+            data->error = fpi_device_error_new_msg (FP_DEVICE_ERROR_NOT_SUPPORTED,
+                                                    "It is only possible to match NBIS type print data");
+          continue;
+        }
+
+      index = bz3_ensure_index (template);
+      for (j = 0; j < index->len; j++)
+        candidate.distance = MIN (candidate.distance,
+                                  bz3_index_feature_distance (&probe,
+                                                              &g_array_index (index, Bz3IndexFeature, j)));
+
+      g_array_append_val (distances, candidate);
     }
 
+  g_array_sort (distances, bz3_index_candidate_cmp);
+
+  n_selected = MIN (distances->len, data->prefilter_candidates);
+  data->order = g_new (gint, n_selected);
+  for (i = 0; i < n_selected; i++)
+    data->order[i] = g_array_index (distances, Bz3IndexCandidate, i).template;
+
+  /* Keep the gallery order, so that first match mode stays deterministic */
+  qsort (data->order, n_selected, sizeof (gint), bz3_int_cmp);
+  g_atomic_int_set (&data->end, n_selected);
+
+  /* A match among the selected templates takes precedence */
+  if (data->error)
+    data->error_index = n_selected;
+
+  fp_dbg ("Pre-filter selected %d of %d templates", n_selected, n_templates);
+}
+
+/* Inserts a candidate into @candidates, which is kept sorted by descending
+ * score (ties in gallery order) and holds at most @max_candidates items. */
+static void
+bz3_candidates_insert (GArray *candidates,
+                       guint   max_candidates,
+                       gint    template,
+                       gint    score)
+{
+  Bz3Candidate candidate = { template, score };
+  guint pos = candidates->len;
+
+  while (pos > 0)
+    {
+      Bz3Candidate *prev = &g_array_index (candidates, Bz3Candidate, pos - 1);
+
+      if (prev->score > score || (prev->score == score && prev->template < template))
+        break;
+      pos--;
+    }
+
+  if (pos >= max_candidates)
+    return;
+
+  g_array_insert_val (candidates, pos, candidate);
+  if (candidates->len > max_candidates)
+    g_array_set_size (candidates, max_candidates);
+}
+
+static void
+print_candidate_clear (FpiPrintCandidate *candidate)
+{
+  g_clear_object (&candidate->print);
+}
+
+static GArray *
+bz3_identify_data_steal_candidates (Bz3IdentifyData *data)
+{
+  GArray *result;
+  guint i;
+
+  result = g_array_sized_new (FALSE, TRUE, sizeof (FpiPrintCandidate),
+                              data->candidates->len);
+  g_array_set_clear_func (result, (GDestroyNotify) print_candidate_clear);
+
+  for (i = 0; i < data->candidates->len; i++)
+    {
+      Bz3Candidate *c = &g_array_index (data->candidates, Bz3Candidate, i);
+      FpiPrintCandidate candidate;
+
+      candidate.print = g_object_ref (g_ptr_array_index (data->templates, c->template));
+      candidate.score = c->score;
+      g_array_append_val (result, candidate);
+
+      fp_dbg ("Candidate %u: template %d with score %d", i, c->template, c->score);
+    }
+
+  return result;
+}
+
+static GThreadPool *bz3_get_identify_pool (void);
+
+static void
+bz3_identify_worker (gpointer task_ptr, gpointer unused)
+{
+  g_autoptr(GTask) task = task_ptr;
+  Bz3IdentifyData *data = g_task_get_task_data (task);
+  FpPrint *print = g_task_get_source_object (task);
+  GCancellable *cancellable = g_task_get_cancellable (task);
+  gboolean first_match = data->mode == FP_IDENTIFY_MODE_FIRST_MATCH;
+  g_autoptr(GArray) candidates = NULL;
+  BzMatchContext *ctx;
+  struct xyt_struct *pstruct;
+  gint probe_len;
+
+  /* Ranked candidates are first collected per worker and only merged at
+   * the end, so that the lock is not taken for every template. */
+  if (data->max_candidates > 0)
+    candidates = g_array_sized_new (FALSE, FALSE, sizeof (Bz3Candidate),
+                                    MIN (data->max_candidates, data->templates->len));
+
+  /* With the pre-filter enabled, a single job is queued at first. It
+   * selects the templates and only then starts the other workers. */
+  if (data->prefilter_candidates > 0 && !data->order &&
+      !g_cancellable_is_cancelled (cancellable))
+    {
+      gint n_workers;
+      gint i;
+
+      bz3_identify_prefilter (data, print);
+
+      /* This job keeps running even if nothing was selected */
+      n_workers = MIN (g_atomic_int_get (&data->end), g_get_num_processors ());
+      n_workers = MAX (n_workers, 1);
+      g_atomic_int_add (&data->workers, n_workers - 1);
+      for (i = 1; i < n_workers; i++)
+        g_thread_pool_push (bz3_get_identify_pool (), g_object_ref (task), NULL);
+    }
+
+  ctx = get_bz_match_context ();
   pstruct = g_ptr_array_index (print->prints, 0);
-  probe_len = bozorth_probe_init (pstruct);
+  probe_len = bozorth_probe_init (ctx, pstruct);
 
-  for (i = 0; i < template->prints->len; i++)
+  /* Templates are handed out in order. In first match mode, the end is
+   * moved to the matching template, so that the reported match is always
+   * the first one in the gallery, just like with a serial search. */
+  while (!g_cancellable_is_cancelled (cancellable))
     {
-      struct xyt_struct *gstruct;
+      FpPrint *template;
       gint score;
-      gstruct = g_ptr_array_index (template->prints, i);
-      score = bozorth_to_gallery (probe_len, pstruct, gstruct);
-      fp_dbg ("score %d/%d", score, bz3_threshold);
+      gint i;
+
+      i = g_atomic_int_add (&data->next, 1);
+      if (i >= g_atomic_int_get (&data->end))
+        break;
+
+      template = g_ptr_array_index (data->templates,
+                                    bz3_identify_data_get_template (data, i));
+      if (template->type != FPI_PRINT_NBIS)
+        {
+          /* Like a match, the error ends the search at this template. A
+           * serial search would still report a match found before it. */
+          g_mutex_lock (&data->lock);
+          if (i < data->error_index)
+            {
+              g_clear_error (&data->error);
+              data->error = fpi_device_error_new_msg (FP_DEVICE_ERROR_NOT_SUPPORTED,
+                                                      "It is only possible to match NBIS type print data");
+              data->error_index = i;
+            }
+          if (g_atomic_int_get (&data->end) > i)
+            g_atomic_int_set (&data->end, i);
+          g_mutex_unlock (&data->lock);
+          continue;
+        }
 
-      if (score >= bz3_threshold)
-        return FPI_MATCH_SUCCESS;
+      score = bz3_template_score (ctx, probe_len, pstruct, template,
+                                  data->bz3_threshold, first_match);
+
+      if (candidates)
+        bz3_candidates_insert (candidates, data->max_candidates,
+                               bz3_identify_data_get_template (data, i), score);
+
+      if (score < data->bz3_threshold)
+        continue;
+
+      g_mutex_lock (&data->lock);
+      if (data->match < 0 ||
+          (first_match && i < data->match) ||
+          (!first_match && (score > data->match_score ||
+                            (score == data->match_score && i < data->match))))
+        {
+          data->match = i;
+          data->match_score = score;
+        }
+
+      if (first_match && g_atomic_int_get (&data->end) > i)
+        g_atomic_int_set (&data->end, i);
+      g_mutex_unlock (&data->lock);
     }
 
-  return FPI_MATCH_FAIL;
+  if (candidates)
+    {
+      guint i;
+
+      g_mutex_lock (&data->lock);
+      for (i = 0; i < candidates->len; i++)
+        {
+          Bz3Candidate *c = &g_array_index (candidates, Bz3Candidate, i);
+
+          bz3_candidates_insert (data->candidates, data->max_candidates,
+                                 c->template, c->score);
+        }
+      g_mutex_unlock (&data->lock);
+    }
+
+  if (!g_atomic_int_dec_and_test (&data->workers))
+    return;
+
+  /* We are the last worker, report the result */
+  if (g_task_return_error_if_cancelled (task))
+    return;
+
+  /* A serial search reports a match found before the error. After the
+   * pre-filter, the error is placed behind all selected templates. */
+  if (data->error &&
+      !((first_match || data->order) &&
+        data->match >= 0 && data->match < data->error_index))
+    {
+      g_task_return_error (task, g_steal_pointer (&data->error));
+      return;
+    }
+
+  if (data->max_candidates > 0)
+    {
+      g_task_return_pointer (task, bz3_identify_data_steal_candidates (data),
+                             (GDestroyNotify) g_array_unref);
+      return;
+    }
+
+  if (data->match >= 0)
+    {
+      gint match = bz3_identify_data_get_template (data, data->match);
+
+      fp_dbg ("Identified template %d with score %d/%d",
+              match, data->match_score, data->bz3_threshold);
+      g_task_return_pointer (task,
+                             g_object_ref (g_ptr_array_index (data->templates, match)),
+                             g_object_unref);
+    }
+  else
+    {
+      g_task_return_pointer (task, NULL, NULL);
+    }
+}
+
+static GThreadPool *
+bz3_get_identify_pool (void)
+{
+  static gsize pool = 0;
+
+  if (g_once_init_enter (&pool))
+    {
+      GThreadPool *p;
+
+      /* Shared (non exclusive) threads, each keeps its own match context
+       * around for as long as it lives. */
+      p = g_thread_pool_new (bz3_identify_worker, NULL,
+                             g_get_num_processors (), FALSE, NULL);
+      g_once_init_leave (&pool, (gsize) p);
+    }
+
+  return (GThreadPool *) pool;
+}
+
+static void
+bz3_identify_run (GTask               *task,
+                  GPtrArray           *templates,
+                  gint                 bz3_threshold,
+                  FpIdentifyMode       mode,
+                  guint                prefilter_candidates,
+                  guint                max_candidates)
+{
+  FpPrint *print = g_task_get_source_object (task);
+  GError *error = NULL;
+  Bz3IdentifyData *data;
+  GThreadPool *pool;
+  gint n_workers;
+  gint i;
+
+  if (print->type != FPI_PRINT_NBIS)
+    {
+      g_task_return_error (task,
+                           fpi_device_error_new_msg (FP_DEVICE_ERROR_NOT_SUPPORTED,
+                                                     "It is only possible to match NBIS type print data"));
+      return;
+    }
+
+  if (!bz3_check_print (print, &error))
+    {
+      g_task_return_error (task, error);
+      return;
+    }
+
+  data = g_new0 (Bz3IdentifyData, 1);
+  data->templates = g_ptr_array_ref (templates);
+  data->bz3_threshold = bz3_threshold;
+  data->mode = mode;
+  data->max_candidates = max_candidates;
+  if (prefilter_candidates < templates->len)
+    data->prefilter_candidates = prefilter_candidates;
+  data->end = templates->len;
+  data->match = -1;
+  data->error_index = G_MAXINT;
+  if (max_candidates > 0)
+    data->candidates = g_array_new (FALSE, FALSE, sizeof (Bz3Candidate));
+  g_mutex_init (&data->lock);
+  g_task_set_task_data (task, data, (GDestroyNotify) bz3_identify_data_free);
+
+  if (templates->len == 0)
+    {
+      if (max_candidates > 0)
+        g_task_return_pointer (task, bz3_identify_data_steal_candidates (data),
+                               (GDestroyNotify) g_array_unref);
+      else
+        g_task_return_pointer (task, NULL, NULL);
+      return;
+    }
+
+  pool = bz3_get_identify_pool ();
+  if (data->prefilter_candidates > 0)
+    n_workers = 1;
+  else
+    n_workers = MIN (templates->len, g_get_num_processors ());
+  data->workers = n_workers;
+
+  for (i = 0; i < n_workers; i++)
+    g_thread_pool_push (pool, g_object_ref (task), NULL);
+}
+
+/**
+ * fpi_print_bz3_identify:
+ * @templates: (element-type FpPrint): The gallery of #FpPrint to search
+ * @print: A newly scanned #FpPrint to identify
+ * @bz3_threshold: The BZ3 match threshold
+ * @mode: Whether to stop at the first match or to find the best one
+ * @prefilter_candidates: Number of gallery prints to match, or 0 to match
+ *   the whole gallery
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to call on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Asynchronously match the newly scanned @print (containing exactly one
+ * print) against all prints in @templates. The gallery is split between
+ * worker threads (one per CPU core), the result is reported in the thread
+ * default main context of the caller.
+ *
+ * If @prefilter_candidates is non-zero and smaller than the gallery, a
+ * coarse pre-filter first selects the given number of gallery prints that
+ * are most similar to @print (based on a histogram of the distances and
+ * relative directions between pairs of minutiae). Only these are then
+ * matched using Bozorth3, in gallery order. This is much faster for large
+ * galleries, but the correct print may be missed if the value is too low.
+ * Gallery prints that are not of type #FPI_PRINT_NBIS are skipped by the
+ * pre-filter; %FP_DEVICE_ERROR_NOT_SUPPORTED is only reported if none of
+ * the selected prints matches.
+ *
+ * The source object of the result is @print. Both @templates and @print
+ * must not be modified until the operation is done.
+ */
+void
+fpi_print_bz3_identify (GPtrArray           *templates,
+                        FpPrint             *print,
+                        gint                 bz3_threshold,
+                        FpIdentifyMode       mode,
+                        guint                prefilter_candidates,
+                        GCancellable        *cancellable,
+                        GAsyncReadyCallback  callback,
+                        gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (templates != NULL);
+  g_return_if_fail (FP_IS_PRINT (print));
+
+  task = g_task_new (print, cancellable, callback, user_data);
+  g_task_set_source_tag (task, fpi_print_bz3_identify);
+
+  bz3_identify_run (task, templates, bz3_threshold, mode,
+                    prefilter_candidates, 0);
+}
+
+/**
+ * fpi_print_bz3_identify_finish:
+ * @print: The #FpPrint passed to fpi_print_bz3_identify()
+ * @result: A #GAsyncResult
+ * @error: Return location for errors, or %NULL to ignore
+ *
+ * Finish an identification started with fpi_print_bz3_identify().
+ *
+ * Returns: (transfer full) (nullable): The matching #FpPrint of the
+ *   gallery, or %NULL if there was no match or an error occurred.
+ */
+FpPrint *
+fpi_print_bz3_identify_finish (FpPrint      *print,
+                               GAsyncResult *result,
+                               GError      **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, print), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == fpi_print_bz3_identify, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/**
+ * fpi_print_bz3_identify_ranked:
+ * @templates: (element-type FpPrint): The gallery of #FpPrint to search
+ * @print: A newly scanned #FpPrint to identify
+ * @max_candidates: The maximum number of candidates to report, must be
+ *   larger than zero
+ * @cancellable: a #GCancellable, or %NULL
+ * @callback: the function to call on completion
+ * @user_data: the data to pass to @callback
+ *
+ * Like fpi_print_bz3_identify(), but the whole gallery is always searched
+ * and no threshold is applied. Instead, the @max_candidates prints with the
+ * highest raw Bozorth3 scores are reported. This is considerably slower
+ * than a first match search, but is useful for score fusion or to tune the
+ * match threshold.
+ */
+void
+fpi_print_bz3_identify_ranked (GPtrArray          *templates,
+                               FpPrint            *print,
+                               guint               max_candidates,
+                               GCancellable       *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer            user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  g_return_if_fail (templates != NULL);
+  g_return_if_fail (FP_IS_PRINT (print));
+  g_return_if_fail (max_candidates > 0);
+
+  task = g_task_new (print, cancellable, callback, user_data);
+  g_task_set_source_tag (task, fpi_print_bz3_identify_ranked);
+
+  /* Nothing ever passes the threshold, so all sub-prints are scored */
+  bz3_identify_run (task, templates, G_MAXINT, FP_IDENTIFY_MODE_BEST_MATCH,
+                    0, max_candidates);
+}
+
+/**
+ * fpi_print_bz3_identify_ranked_finish:
+ * @print: The #FpPrint passed to fpi_print_bz3_identify_ranked()
+ * @result: A #GAsyncResult
+ * @error: Return location for errors, or %NULL to ignore
+ *
+ * Finish an identification started with fpi_print_bz3_identify_ranked().
+ *
+ * Returns: (transfer full) (element-type FpiPrintCandidate): The candidates
+ *   sorted by descending score, ties are in gallery order. %NULL if an
+ *   error occurred.
+ */
+GArray *
+fpi_print_bz3_identify_ranked_finish (FpPrint      *print,
+                                      GAsyncResult *result,
+                                      GError      **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, print), NULL);
+  g_return_val_if_fail (g_task_get_source_tag (G_TASK (result)) == fpi_print_bz3_identify_ranked, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+struct _FpiPrintIndex
+{
+  gint        ref_count;
+  GHashTable *prints;
+};
+
+/**
+ * fpi_print_index_new:
+ * @prints: (element-type FpPrint) (nullable): The prints to index
+ *
+ * Creates an index to find prints that are equal (see fp_print_equal())
+ * to a given print in constant time. This is intended for devices that
+ * report the stored print they matched, which then needs to be found in
+ * the identify gallery or a list of stored prints.
+ *
+ * If @prints contains several equal prints, the first one is found.
+ *
+ * Returns: (transfer full): A new #FpiPrintIndex
+ */
+FpiPrintIndex *
+fpi_print_index_new (GPtrArray *prints)
+{
+  FpiPrintIndex *index;
+  guint i;
+
+  index = g_new0 (FpiPrintIndex, 1);
+  index->ref_count = 1;
+  index->prints = g_hash_table_new_full ((GHashFunc) fp_print_hash,
+                                         (GEqualFunc) fp_print_equal,
+                                         g_object_unref,
+                                         NULL);
+
+  for (i = 0; prints && i < prints->len; i++)
+    fpi_print_index_add (index, g_ptr_array_index (prints, i));
+
+  return index;
+}
+
+/**
+ * fpi_print_index_ref:
+ * @index: A #FpiPrintIndex
+ *
+ * Increases the reference count of @index.
+ *
+ * Returns: (transfer full): @index
+ */
+FpiPrintIndex *
+fpi_print_index_ref (FpiPrintIndex *index)
+{
+  g_return_val_if_fail (index != NULL, NULL);
+
+  g_atomic_int_inc (&index->ref_count);
+
+  return index;
+}
+
+/**
+ * fpi_print_index_unref:
+ * @index: A #FpiPrintIndex
+ *
+ * Decreases the reference count of @index. Once it drops to zero, the
+ * index is freed and its references to the prints are dropped.
+ */
+void
+fpi_print_index_unref (FpiPrintIndex *index)
+{
+  g_return_if_fail (index != NULL);
+
+  if (!g_atomic_int_dec_and_test (&index->ref_count))
+    return;
+
+  g_hash_table_unref (index->prints);
+  g_free (index);
+}
+
+/**
+ * fpi_print_index_is_shared:
+ * @index: A #FpiPrintIndex
+ *
+ * Checks whether anybody but the caller holds a reference to @index.
+ *
+ * Returns: %TRUE if there is more than one reference to @index
+ */
+gboolean
+fpi_print_index_is_shared (FpiPrintIndex *index)
+{
+  g_return_val_if_fail (index != NULL, FALSE);
+
+  return g_atomic_int_get (&index->ref_count) > 1;
+}
+
+/**
+ * fpi_print_index_add:
+ * @index: A #FpiPrintIndex
+ * @print: The #FpPrint to add
+ *
+ * Adds @print to the index, unless an equal print is indexed already.
+ *
+ * Returns: %TRUE if @print was added
+ */
+gboolean
+fpi_print_index_add (FpiPrintIndex *index,
+                     FpPrint       *print)
+{
+  g_return_val_if_fail (index != NULL, FALSE);
+  g_return_val_if_fail (FP_IS_PRINT (print), FALSE);
+
+  if (g_hash_table_contains (index->prints, print))
+    return FALSE;
+
+  g_hash_table_add (index->prints, g_object_ref (print));
+
+  return TRUE;
+}
+
+/**
+ * fpi_print_index_remove:
+ * @index: A #FpiPrintIndex
+ * @print: The #FpPrint to remove
+ *
+ * Removes the indexed print that is equal to @print.
+ *
+ * Returns: %TRUE if a print was removed
+ */
+gboolean
+fpi_print_index_remove (FpiPrintIndex *index,
+                        FpPrint       *print)
+{
+  g_return_val_if_fail (index != NULL, FALSE);
+  g_return_val_if_fail (FP_IS_PRINT (print), FALSE);
+
+  return g_hash_table_remove (index->prints, print);
+}
+
+/**
+ * fpi_print_index_lookup:
+ * @index: A #FpiPrintIndex
+ * @print: The #FpPrint to look for
+ *
+ * Finds the indexed print that is equal to @print.
+ *
+ * Returns: (transfer none) (nullable): The equal #FpPrint or %NULL
+ */
+FpPrint *
+fpi_print_index_lookup (FpiPrintIndex *index,
+                        FpPrint       *print)
+{
+  g_return_val_if_fail (index != NULL, NULL);
+  g_return_val_if_fail (FP_IS_PRINT (print), NULL);
+
+  return g_hash_table_lookup (index->prints, print);
 }
 
 /**
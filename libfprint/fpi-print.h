@@ -30,6 +30,19 @@ typedef enum {
   FPI_MATCH_SUCCESS,
 } FpiMatchResult;
 
+/**
+ * FpiPrintCandidate:
+ * @print: The #FpPrint from the gallery
+ * @score: The highest Bozorth3 score of any of the prints in @print
+ *
+ * A candidate reported by fpi_print_bz3_identify_ranked().
+ */
+typedef struct
+{
+  FpPrint *print;
+  gint     score;
+} FpiPrintCandidate;
+
 void     fpi_print_add_print (FpPrint *print,
                               FpPrint *add);
 
@@ -47,6 +60,53 @@ FpiMatchResult fpi_print_bz3_match (FpPrint * template,
                                     gint bz3_threshold,
                                     GError **error);
 
+gboolean       fpi_print_bz3_score_gallery (FpPrint      *print,
+                                            GPtrArray    *templates,
+                                            gint         *scores,
+                                            GCancellable *cancellable);
+
+void           fpi_print_bz3_identify (GPtrArray           *templates,
+                                       FpPrint             *print,
+                                       gint                 bz3_threshold,
+                                       FpIdentifyMode       mode,
+                                       guint                prefilter_candidates,
+                                       GCancellable        *cancellable,
+                                       GAsyncReadyCallback  callback,
+                                       gpointer             user_data);
+FpPrint *      fpi_print_bz3_identify_finish (FpPrint      *print,
+                                              GAsyncResult *result,
+                                              GError      **error);
+
+void           fpi_print_bz3_identify_ranked (GPtrArray          *templates,
+                                              FpPrint            *print,
+                                              guint               max_candidates,
+                                              GCancellable       *cancellable,
+                                              GAsyncReadyCallback callback,
+                                              gpointer            user_data);
+GArray *       fpi_print_bz3_identify_ranked_finish (FpPrint      *print,
+                                                     GAsyncResult *result,
+                                                     GError      **error);
+
+/**
+ * FpiPrintIndex:
+ *
+ * An index to look up prints by their content, see fpi_print_index_new().
+ */
+typedef struct _FpiPrintIndex FpiPrintIndex;
+
+FpiPrintIndex * fpi_print_index_new (GPtrArray *prints);
+FpiPrintIndex * fpi_print_index_ref (FpiPrintIndex *index);
+void            fpi_print_index_unref (FpiPrintIndex *index);
+gboolean        fpi_print_index_is_shared (FpiPrintIndex *index);
+gboolean        fpi_print_index_add (FpiPrintIndex *index,
+                                     FpPrint       *print);
+gboolean        fpi_print_index_remove (FpiPrintIndex *index,
+                                        FpPrint       *print);
+FpPrint *       fpi_print_index_lookup (FpiPrintIndex *index,
+                                        FpPrint       *print);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (FpiPrintIndex, fpi_print_index_unref)
+
 /* Helpers to encode metadata into user ID strings. */
 gchar *  fpi_print_generate_user_id (FpPrint *print);
 gboolean fpi_print_fill_from_user_id (FpPrint    *print,
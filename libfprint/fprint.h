@@ -21,4 +21,5 @@
 
 #include "fp-context.h"
 #include "fp-device.h"
+#include "fp-gallery.h"
 #include "fp-image.h"
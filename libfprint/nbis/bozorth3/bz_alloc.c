@@ -60,11 +60,15 @@ of the software.
 #cat:        specified length exiting directly upon system error
 #cat: malloc_or_return_error - allocates a buffer of bytes from the heap
 #cat:        of specified length returning an error code upon system error
+#cat: xyt_struct_new - allocates an XYT structure with room for the
+#cat:        specified number of minutiae in a single block
+#cat: xyt_struct_dup - creates a copy of an XYT structure
 
 ***********************************************************************/
 
 #include <stdio.h>
 #include <string.h>
+#include <glib.h>
 #include <bozorth.h>
 
 
@@ -72,3 +76,32 @@ of the software.
 
 /***********************************************************************/
 /* returns CNULL on error */
+
+/***********************************************************************/
+/* The columns point into the same block, so it is freed with g_free() */
+/* and must be copied with xyt_struct_dup().                           */
+struct xyt_struct *xyt_struct_new( int nrows )
+{
+struct xyt_struct * xyt;
+
+xyt = (struct xyt_struct *) g_malloc0( XYT_STRUCT_SIZE( nrows ) );
+xyt->nrows    = nrows;
+xyt->xcol     = (int *) ( xyt + 1 );
+xyt->ycol     = xyt->xcol + nrows;
+xyt->thetacol = xyt->ycol + nrows;
+
+return xyt;
+}
+
+/***********************************************************************/
+struct xyt_struct *xyt_struct_dup( const struct xyt_struct * xyt )
+{
+struct xyt_struct * copy;
+
+copy = xyt_struct_new( xyt->nrows );
+memcpy( copy->xcol,     xyt->xcol,     xyt->nrows * sizeof( int ) );
+memcpy( copy->ycol,     xyt->ycol,     xyt->nrows * sizeof( int ) );
+memcpy( copy->thetacol, xyt->thetacol, xyt->nrows * sizeof( int ) );
+
+return copy;
+}
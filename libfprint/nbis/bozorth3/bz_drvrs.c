@@ -64,21 +64,27 @@ of the software.
 #cat:                        same probe fingerprint is matches repeatedly
 #cat:                        to multiple gallery fingerprints as in
 #cat:                        identification mode
-#cat: bozorth_main -         supports the matching scenario where a
-#cat:                        single probe fingerprint is to be matched
-#cat:                        to a single gallery fingerprint as in
-#cat:                        verificaiton mode
+#cat: bozorth_gallery_table_new - creates a copy of the pruned pairwise
+#cat:                        minutia comparison table for the gallery
+#cat:                        fingerprint which can be stored with it
+#cat: bozorth_to_gallery_table - like bozorth_to_gallery, but uses a
+#cat:                        precomputed gallery table
+
+      All routines operate on the working arrays of the BzMatchContext
+      passed in, the probe table built by bozorth_probe_init() is only
+      valid for bozorth_to_gallery() calls on that same context.
 
 ***********************************************************************/
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <glib.h>
 #include <bozorth.h>
 
 /**************************************************************************/
 
-int bozorth_probe_init( struct xyt_struct * pstruct )
+int bozorth_probe_init( BzMatchContext * ctx, struct xyt_struct * pstruct )
 {
 int sim;	/* number of pointwise comparisons for Subject's record*/
 int msim;	/* Pruned length of Subject's comparison pointer list */
@@ -93,14 +99,14 @@ bz_comp(
 	pstruct->ycol,
 	pstruct->thetacol,
 	&sim,
-	scols,
-	scolpt );
+	ctx->scols,
+	ctx->scolpt );
 
 msim = sim;	/* Init search to end of Subject's pointwise comparison table (last edge in Web) */
 
 
 
-bz_find( &msim, scolpt );
+bz_find( &msim, ctx->scolpt );
 
 
 
@@ -116,7 +122,7 @@ return msim;
 
 /**************************************************************************/
 
-int bozorth_gallery_init( struct xyt_struct * gstruct )
+int bozorth_gallery_init( BzMatchContext * ctx, struct xyt_struct * gstruct )
 {
 int fim;	/* number of pointwise comparisons for On-File record*/
 int mfim;	/* Pruned length of On-File Record's pointer list */
@@ -130,14 +136,14 @@ bz_comp(
 	gstruct->ycol,
 	gstruct->thetacol,
 	&fim,
-	fcols,
-	fcolpt );
+	ctx->fcols,
+	ctx->fcolpt );
 
 mfim = fim;	/* Init search to end of On-File Record's pointwise comparison table (last edge in Web) */
 
 
 
-bz_find( &mfim, fcolpt );
+bz_find( &mfim, ctx->fcolpt );
 
 
 
@@ -154,6 +160,7 @@ return mfim;
 /**************************************************************************/
 
 int bozorth_to_gallery(
+		BzMatchContext * ctx,
 		int probe_len,
 		struct xyt_struct * pstruct,
 		struct xyt_struct * gstruct
@@ -162,10 +169,52 @@ int bozorth_to_gallery(
 int np;
 int gallery_len;
 
-gallery_len = bozorth_gallery_init( gstruct );
-np = bz_match( probe_len, gallery_len );
-return bz_match_score( np, pstruct, gstruct );
+gallery_len = bozorth_gallery_init( ctx, gstruct );
+np = bz_match( ctx, probe_len, gallery_len );
+return bz_match_score( ctx, np, pstruct, gstruct );
+}
+
+/**************************************************************************/
+
+struct bz_gallery_table *bozorth_gallery_table_new(
+		BzMatchContext * ctx,
+		struct xyt_struct * gstruct
+		)
+{
+int i;
+int gallery_len;
+struct bz_gallery_table * gtable;
+
+gallery_len = bozorth_gallery_init( ctx, gstruct );
+
+/* Only the rows within the pruned length are ever looked at by bz_match() */
+gtable = g_malloc( BZ_GALLERY_TABLE_SIZE( gallery_len ) );
+gtable->nrows = gallery_len;
+for ( i = 0; i < gallery_len; i++ )
+	memcpy( gtable->cols[i], ctx->fcolpt[i], sizeof( gtable->cols[i] ) );
+
+return gtable;
 }
 
 /**************************************************************************/
 
+int bozorth_to_gallery_table(
+		BzMatchContext * ctx,
+		int probe_len,
+		struct xyt_struct * pstruct,
+		struct xyt_struct * gstruct,
+		const struct bz_gallery_table * gtable
+		)
+{
+int i;
+int np;
+
+/* The table is already sorted, bz_match() only needs the row pointers */
+for ( i = 0; i < gtable->nrows; i++ )
+	ctx->fcolpt[i] = (int *) gtable->cols[i];
+
+np = bz_match( ctx, probe_len, gtable->nrows );
+return bz_match_score( ctx, np, pstruct, gstruct );
+}
+
+/**************************************************************************/
@@ -187,13 +187,18 @@ struct cell {
 /**************************************************************************/
 #define MAX_FILE_MINUTIAE       1000 /* bz_load() */
 
+/* The columns are sized to nrows (at most MAX_BOZORTH_MINUTIAE) and   */
+/* stored right after the structure, see xyt_struct_new().              */
 struct xyt_struct {
 	int nrows;
-	int xcol[     MAX_BOZORTH_MINUTIAE ];
-	int ycol[     MAX_BOZORTH_MINUTIAE ];
-	int thetacol[ MAX_BOZORTH_MINUTIAE ];
+	int *xcol;
+	int *ycol;
+	int *thetacol;
 };
 
+#define XYT_STRUCT_SIZE(nrows) \
+	( sizeof( struct xyt_struct ) + 3 * (nrows) * sizeof( int ) )
+
 struct xytq_struct {
         int nrows;
         int xcol[     MAX_FILE_MINUTIAE ];
@@ -203,6 +208,17 @@ struct xytq_struct {
 };
 
 
+/* The pruned and sorted pairwise comparison table of a gallery print as */
+/* built by bozorth_gallery_init().  It only depends on the gallery print */
+/* so it may be computed once and reused for any number of matches.       */
+struct bz_gallery_table {
+	int nrows;
+	int cols[][ COLS_SIZE_2 ];
+};
+
+#define BZ_GALLERY_TABLE_SIZE(nrows) \
+	( sizeof( struct bz_gallery_table ) + (nrows) * sizeof( int [ COLS_SIZE_2 ] ) )
+
 #define XYT_NULL ( (struct xyt_struct *) NULL ) /* bz_load() */
 #define XYTQ_NULL ( (struct xytq_struct *) NULL ) /* bz_load() */
 
@@ -223,49 +239,81 @@ extern FILE *stderr;
 /**************************************************************************/
 /* In: BZ_GBLS.C */
 /**************************************************************************/
-/* Global arrays supporting "core" bozorth algorithm */
-extern int colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];
-extern int scols[ SCOLS_SIZE_1 ][ COLS_SIZE_2 ];
-extern int fcols[ FCOLS_SIZE_1 ][ COLS_SIZE_2 ];
-extern int * scolpt[ SCOLPT_SIZE ];
-extern int * fcolpt[ FCOLPT_SIZE ];
-extern int sc[ SC_SIZE ];
-extern int yl[ YL_SIZE_1 ][ YL_SIZE_2 ];
-/* Global arrays supporting "core" bozorth algorithm continued: */
-/*    Globals used significantly by sift() */
-extern int rq[ RQ_SIZE ];
-extern int tq[ TQ_SIZE ];
-extern int zz[ ZZ_SIZE ];
-extern int rx[ RX_SIZE ];
-extern int mm[ MM_SIZE ];
-extern int nn[ NN_SIZE ];
-extern int qq[ QQ_SIZE ];
-extern int rk[ RK_SIZE ];
-extern int cp[ CP_SIZE ];
-extern int rp[ RP_SIZE ];
-extern int rf[RF_SIZE_1][RF_SIZE_2];
-extern int cf[CF_SIZE_1][CF_SIZE_2];
-extern int bz_y[20000];
+/* Working arrays supporting the "core" bozorth algorithm.  These used to */
+/* be process globals; they are now owned by a match context so that      */
+/* several matches can run concurrently, one context per thread.          */
+typedef struct bz_match_context {
+	/* Sorted table of compatible edge pairs, output from bz_match() */
+	int colp[ COLP_SIZE_1 ][ COLP_SIZE_2 ];
+	/* Subject's and On-File Record's pointwise comparison tables */
+	int scols[ SCOLS_SIZE_1 ][ COLS_SIZE_2 ];
+	int fcols[ FCOLS_SIZE_1 ][ COLS_SIZE_2 ];
+	/* Sorted lists of pointers to the comparison table rows */
+	int * scolpt[ SCOLPT_SIZE ];
+	int * fcolpt[ FCOLPT_SIZE ];
+	/* Flags all compatible edges in the Subject's Web */
+	int sc[ SC_SIZE ];
+	int yl[ YL_SIZE_1 ][ YL_SIZE_2 ];
+
+	/* Used significantly by bz_sift() */
+	int rq[ RQ_SIZE ];
+	int tq[ TQ_SIZE ];
+	int zz[ ZZ_SIZE ];
+	int rx[ RX_SIZE ];
+	int mm[ MM_SIZE ];
+	int nn[ NN_SIZE ];
+	int qq[ QQ_SIZE ];
+	int rk[ RK_SIZE ];
+	int cp[ CP_SIZE ];
+	int rp[ RP_SIZE ];
+	int rf[ RF_SIZE_1 ][ RF_SIZE_2 ];
+	int cf[ CF_SIZE_1 ][ CF_SIZE_2 ];
+	int bz_y[ Y_SIZE ];
+
+	/* Formerly static within bz_match() */
+	int rot[ ROT_SIZE_1 ][ ROT_SIZE_2 ];
+	int * rtp[ ROT_SIZE_1 ];
+
+	/* Formerly static, shared by bz_match_score() & bz_final_loop() */
+	int ct[ CT_SIZE ];
+	int gct[ GCT_SIZE ];
+	int ctt[ CTT_SIZE ];
+	int ctp[ CTP_SIZE_1 ][ CTP_SIZE_2 ];
+	int yy[ YY_SIZE_1 ][ YY_SIZE_2 ][ YY_SIZE_3 ];
+	int sct[ SCT_SIZE_1 ][ SCT_SIZE_2 ];
+} BzMatchContext;
 
 /**************************************************************************/
 /**************************************************************************/
 /* ROUTINE PROTOTYPES */
 /**************************************************************************/
+/* In: BZ_GBLS.C */
+extern BzMatchContext *bz_match_context_new(void);
+extern void bz_match_context_free(BzMatchContext *);
 /* In: BZ_DRVRS.C */
-extern int bozorth_probe_init( struct xyt_struct *);
-extern int bozorth_gallery_init( struct xyt_struct *);
-extern int bozorth_to_gallery(int, struct xyt_struct *, struct xyt_struct *);
-extern int bozorth_main(struct xyt_struct *, struct xyt_struct *);
+extern int bozorth_probe_init(BzMatchContext *, struct xyt_struct *);
+extern int bozorth_gallery_init(BzMatchContext *, struct xyt_struct *);
+extern int bozorth_to_gallery(BzMatchContext *, int, struct xyt_struct *,
+                              struct xyt_struct *);
+extern struct bz_gallery_table *bozorth_gallery_table_new(BzMatchContext *,
+                              struct xyt_struct *);
+extern int bozorth_to_gallery_table(BzMatchContext *, int, struct xyt_struct *,
+                              struct xyt_struct *,
+                              const struct bz_gallery_table *);
 /* In: BOZORTH3.C */
 extern void bz_comp(int, int [], int [], int [], int *, int [][COLS_SIZE_2],
                     int *[]);
 extern void bz_find(int *, int *[]);
-extern int bz_match(int, int);
-extern int bz_match_score(int, struct xyt_struct *, struct xyt_struct *);
-extern void bz_sift(int *, int, int *, int, int, int, int *, int *);
+extern int bz_match(BzMatchContext *, int, int);
+extern int bz_match_score(BzMatchContext *, int, struct xyt_struct *,
+                          struct xyt_struct *);
+extern void bz_sift(BzMatchContext *, int *, int, int *, int, int, int, int *,
+                    int *);
 /* In: BZ_ALLOC.C */
 extern char *malloc_or_exit(int, const char *);
 extern char *malloc_or_return_error(int, const char *);
+extern struct xyt_struct *xyt_struct_new(int);
+extern struct xyt_struct *xyt_struct_dup(const struct xyt_struct *);
 /* In: BZ_IO.C */
 extern int parse_line_range(const char *, int *, int *);
 extern void set_progname(int, char *, pid_t);
@@ -128,6 +128,10 @@ typedef struct dftwaves{
    int nwaves;
    int wavelen;
    DFTWAVE **waves;
+   /* The same wave forms transposed to [wavelen][nwaves], so that all */
+   /* of them can be applied in a single pass over the row sums.       */
+   double *cos_t;
+   double *sin_t;
 }DFTWAVES;
 
 /* Rotated pixel offsets for a grid of specified dimensions */
@@ -145,6 +149,48 @@ typedef struct rotgrids{
    int **grids;
 } ROTGRIDS;
 
+/* All lookup tables used by lfs_detect_minutiae_V2(). They only depend */
+/* on the LFS parameters and the image dimensions and are not modified  */
+/* during detection, so one set may be shared between threads.          */
+typedef struct lfstables{
+   int iw;
+   int ih;
+   int pad;
+   DIR2RAD *dir2rad;
+   DFTWAVES *dftwaves;
+   ROTGRIDS *dftgrids;
+   ROTGRIDS *dirbingrids;
+} LFSTABLES;
+
+/* Working memory of one call to get_minutiae().  Short lived buffers  */
+/* are carved out of large blocks, which are all released at once at   */
+/* the end of the call.  Buffers released in the reverse order of      */
+/* their allocation are reused immediately.  An arena may also be kept */
+/* by the caller and passed to several calls, so that the blocks are   */
+/* only allocated once.                                                */
+#define LFS_ARENA_BLOCK_SIZE  (64 * 1024)
+
+typedef struct lfsarenablock{
+   struct lfsarenablock *next;
+   size_t size;           /* usable bytes following the block header  */
+   size_t used;
+   size_t peak;           /* highest value "used" ever had            */
+   size_t last;           /* offset of the most recent buffer         */
+} LFSARENABLOCK;
+
+/* Allocation counts of an arena, to keep track of the heap traffic */
+typedef struct lfsallocstats{
+   int num_allocs;        /* buffers handed out by the arena          */
+   int num_reused;        /* buffers carved out of reclaimed space    */
+   int num_blocks;        /* heap allocations backing those buffers   */
+   size_t size;           /* total size of all blocks in bytes        */
+} LFSALLOCSTATS;
+
+typedef struct lfsarena{
+   LFSARENABLOCK *blocks;
+   LFSALLOCSTATS stats;
+} LFSARENA;
+
 /*************************************************************************/
 /* 10, 2X3 pixel pair feature patterns used to define ridge endings      */
 /* and bifurcations.                                                     */
@@ -266,6 +312,12 @@ typedef struct g_lfsparms{
    /* Ridge Counting Controls */
    int    max_nbrs;
    int    max_ridge_steps;
+
+   /* Threading Controls */
+   int    map_threads;
+   /* Runs func(data) in another thread, e.g. of a thread pool.  Without */
+   /* it, the blocks of the image maps are analyzed serially.            */
+   void   (*map_dispatch)(void (*func)(void *), void *data);
 } LFSPARMS;
 
 /*************************************************************************/
@@ -624,6 +676,16 @@ typedef struct g_lfsparms{
 /* Maximum number of contour steps taken to validate a ridge crossing. */
 #define MAX_RIDGE_STEPS         10
 
+/*************************************************************************/
+/*         THREADING DEFINITIONS                                         */
+/*************************************************************************/
+/* Number of threads analyzing the blocks of the image maps. */
+#define MAP_THREADS              1
+
+/* Minimum number of blocks analyzed per thread, as handing work to */
+/* another thread is only worth it for a sufficient amount of work. */
+#define MIN_MAP_THREAD_BLOCKS  128
+
 /*************************************************************************/
 /*         QUALITY/RELIABILITY DEFINITIONS                               */
 /*************************************************************************/
@@ -785,7 +847,7 @@ extern int lfs_detect_minutiae_V2(MINUTIAE **,
                      int **, int **, int **, int **, int *, int *,
                      unsigned char **, int *, int *,
                      unsigned char *, const int, const int,
-                     const LFSPARMS *);
+                     const LFSPARMS *, const LFSTABLES *);
 
 /* dft.c */
 extern int dft_dir_powers(double **, unsigned char *, const int,
@@ -804,13 +866,15 @@ extern void free_dir2rad(DIR2RAD *);
 extern void free_dftwaves(DFTWAVES *);
 extern void free_rotgrids(ROTGRIDS *);
 extern void free_dir_powers(double **, const int);
+extern void free_lfstables(LFSTABLES *);
 
 /* getmin.c */
 extern int get_minutiae(MINUTIAE **, int **, int **, int **,
                  int **, int **, int *, int *,
                  unsigned char **, int *, int *, int *,
                  unsigned char *, const int, const int,
-                 const int, const double, const LFSPARMS *);
+                 const int, const double, const LFSPARMS *,
+                 const LFSTABLES *, LFSARENA *, LFSALLOCSTATS *);
 
 /* imgutil.c */
 extern void bits_6to8(unsigned char *, const int, const int);
@@ -836,6 +900,8 @@ extern int init_rotgrids(ROTGRIDS **, const int, const int, const int,
                      const double, const int, const int, const int, const int);
 extern int alloc_dir_powers(double ***, const int, const int);
 extern int alloc_power_stats(int **, double **, int **, double **, const int);
+extern int init_lfstables(LFSTABLES **, const int, const int,
+                     const LFSPARMS *);
 
 /* isempty.c */
 extern int is_image_empty(int *, const int, const int);
@@ -1208,6 +1274,12 @@ extern double angle2line(const int, const int, const int, const int);
 extern int line2direction(const int, const int, const int, const int,
                      const int);
 extern int closest_dir_dist(const int, const int, const int);
+extern void init_lfsarena(LFSARENA *);
+extern void free_lfsarena(LFSARENA *, LFSALLOCSTATS *);
+extern void reuse_lfsarena(LFSARENA *);
+extern void release_lfsarena(LFSARENA *, LFSALLOCSTATS *);
+extern void *alloc_arena_buffer(const size_t);
+extern void free_arena_buffer(void *);
 
 /* xytreps.c */
 extern void lfs2nist_minutia_XYT(int *, int *, int *,
@@ -1218,12 +1290,12 @@ extern void lfs2nist_format(MINUTIAE *, int, int);
 /*************************************************************************/
 /*        EXTERNAL GLOBAL VARIABLE DEFINITIONS                           */
 /*************************************************************************/
-extern double g_dft_coefs[];
-extern LFSPARMS g_lfsparms;
-extern LFSPARMS g_lfsparms_V2;
-extern int g_nbr8_dx[];
-extern int g_nbr8_dy[];
-extern int g_chaincodes_nbr8[];
-extern FEATURE_PATTERN g_feature_patterns[];
+extern const double g_dft_coefs[];
+extern const LFSPARMS g_lfsparms;
+extern const LFSPARMS g_lfsparms_V2;
+extern const int g_nbr8_dx[];
+extern const int g_nbr8_dy[];
+extern const int g_chaincodes_nbr8[];
+extern const FEATURE_PATTERN g_feature_patterns[];
 
 #endif
@@ -111,6 +111,8 @@ of the software.
       iw        - width (in pixels) of the image
       ih        - height (in pixels) of the image
       lfsparms  - parameters and thresholds for controlling LFS
+      lfstables - lookup tables built by init_lfstables() for this image
+                  size and lfsparms, or NULL to build them for this call
 
    Output:
       ominutiae - resulting list of minutiae
@@ -132,19 +134,15 @@ of the software.
       Zero      - successful completion
       Negative  - system error
 **************************************************************************/
-int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
+static int lfs_detect_minutiae_tables(MINUTIAE **ominutiae,
                         int **odmap, int **olcmap, int **olfmap, int **ohcmap,
                         int *omw, int *omh,
                         unsigned char **obdata, int *obw, int *obh,
                         unsigned char *idata, const int iw, const int ih,
-                        const LFSPARMS *lfsparms)
+                        const LFSPARMS *lfsparms, const LFSTABLES *lfstables)
 {
    unsigned char *pdata, *bdata;
    int pw, ph, bw, bh;
-   DIR2RAD *dir2rad;
-   DFTWAVES *dftwaves;
-   ROTGRIDS *dftgrids;
-   ROTGRIDS *dirbingrids;
    int *direction_map, *low_contrast_map, *low_flow_map, *high_curve_map;
    int mw, mh;
    int ret, maxpad;
@@ -163,45 +161,13 @@ int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
 
    /* Determine the maximum amount of image padding required to support */
    /* LFS processes.                                                    */
-   maxpad = get_max_padding_V2(lfsparms->windowsize, lfsparms->windowoffset,
-                          lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h);
-
-   /* Initialize lookup table for converting integer directions */
-   /* to angles in radians.                                     */
-   if((ret = init_dir2rad(&dir2rad, lfsparms->num_directions))){
-      /* Free memory allocated to this point. */
-      return(ret);
-   }
-
-   /* Initialize wave form lookup tables for DFT analyses. */
-   /* used for direction binarization.                             */
-   if((ret = init_dftwaves(&dftwaves, g_dft_coefs, lfsparms->num_dft_waves,
-                        lfsparms->windowsize))){
-      /* Free memory allocated to this point. */
-      free_dir2rad(dir2rad);
-      return(ret);
-   }
-
-   /* Initialize lookup table for pixel offsets to rotated grids */
-   /* used for DFT analyses.                                     */
-   if((ret = init_rotgrids(&dftgrids, iw, ih, maxpad,
-                        lfsparms->start_dir_angle, lfsparms->num_directions,
-                        lfsparms->windowsize, lfsparms->windowsize,
-                        RELATIVE2ORIGIN))){
-      /* Free memory allocated to this point. */
-      free_dir2rad(dir2rad);
-      free_dftwaves(dftwaves);
-      return(ret);
-   }
+   /* The lookup tables have been built for this padding. */
+   maxpad = lfstables->pad;
 
    /* Pad input image based on max padding. */
    if(maxpad > 0){   /* May not need to pad at all */
       if((ret = pad_uchar_image(&pdata, &pw, &ph, idata, iw, ih,
                              maxpad, lfsparms->pad_value))){
-         /* Free memory allocated to this point. */
-         free_dir2rad(dir2rad);
-         free_dftwaves(dftwaves);
-         free_rotgrids(dftgrids);
          return(ret);
       }
    }
@@ -231,18 +197,12 @@ int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
    /* Generate block maps from the input image. */
    if((ret = gen_image_maps(&direction_map, &low_contrast_map,
                     &low_flow_map, &high_curve_map, &mw, &mh,
-                    pdata, pw, ph, dir2rad, dftwaves, dftgrids, lfsparms))){
+                    pdata, pw, ph, lfstables->dir2rad, lfstables->dftwaves,
+                    lfstables->dftgrids, lfsparms))){
       /* Free memory allocated to this point. */
-      free_dir2rad(dir2rad);
-      free_dftwaves(dftwaves);
-      free_rotgrids(dftgrids);
       g_free(pdata);
       return(ret);
    }
-   /* Deallocate working memories. */
-   free_dir2rad(dir2rad);
-   free_dftwaves(dftwaves);
-   free_rotgrids(dftgrids);
 
    print2log("\nMAPS DONE\n");
 
@@ -253,38 +213,19 @@ int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
    /******************/
    set_timer(bin_timer);
 
-   /* Initialize lookup table for pixel offsets to rotated grids */
-   /* used for directional binarization.                         */
-   if((ret = init_rotgrids(&dirbingrids, iw, ih, maxpad,
-                        lfsparms->start_dir_angle, lfsparms->num_directions,
-                        lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h,
-                        RELATIVE2CENTER))){
-      /* Free memory allocated to this point. */
-      g_free(pdata);
-      g_free(direction_map);
-      g_free(low_contrast_map);
-      g_free(low_flow_map);
-      g_free(high_curve_map);
-      return(ret);
-   }
-
    /* Binarize input image based on NMAP information. */
    if((ret = binarize_V2(&bdata, &bw, &bh,
                       pdata, pw, ph, direction_map, mw, mh,
-                      dirbingrids, lfsparms))){
+                      lfstables->dirbingrids, lfsparms))){
       /* Free memory allocated to this point. */
       g_free(pdata);
       g_free(direction_map);
       g_free(low_contrast_map);
       g_free(low_flow_map);
       g_free(high_curve_map);
-      free_rotgrids(dirbingrids);
       return(ret);
    }
 
-   /* Deallocate working memory. */
-   free_rotgrids(dirbingrids);
-
    /* Check dimension of binary image.  If they are different from */
    /* the input image, then ERROR.                                 */
    if((iw != bw) || (ih != bh)){
@@ -428,3 +369,36 @@ int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
    return(0);
 }
 
+int lfs_detect_minutiae_V2(MINUTIAE **ominutiae,
+                        int **odmap, int **olcmap, int **olfmap, int **ohcmap,
+                        int *omw, int *omh,
+                        unsigned char **obdata, int *obw, int *obh,
+                        unsigned char *idata, const int iw, const int ih,
+                        const LFSPARMS *lfsparms, const LFSTABLES *lfstables)
+{
+   LFSTABLES *call_tables = NULL;
+   int ret;
+
+   /* The lookup tables are only read during detection, so the same */
+   /* tables may be used by concurrent calls.                       */
+   if(lfstables == NULL){
+      if((ret = init_lfstables(&call_tables, iw, ih, lfsparms)))
+         return(ret);
+      lfstables = call_tables;
+   }
+   else if((lfstables->iw != iw) || (lfstables->ih != ih)){
+      fprintf(stderr, "ERROR : lfs_detect_minutiae_V2 : ");
+      fprintf(stderr, "lookup tables built for %d x %d image, not %d x %d\n",
+              lfstables->iw, lfstables->ih, iw, ih);
+      return(-582);
+   }
+
+   ret = lfs_detect_minutiae_tables(ominutiae, odmap, olcmap, olfmap, ohcmap,
+                                    omw, omh, obdata, obw, obh,
+                                    idata, iw, ih, lfsparms, lfstables);
+
+   if(call_tables != NULL)
+      free_lfstables(call_tables);
+
+   return(ret);
+}
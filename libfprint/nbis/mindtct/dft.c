@@ -59,6 +59,7 @@ of the software.
                         dft_dir_powers()
                         sum_rot_block_rows()
                         dft_power()
+                        get_dft_power4_func()
                         dft_power_stats()
                         get_max_norm()
                         sort_dft_waves()
@@ -67,6 +68,149 @@ of the software.
 #include <stdio.h>
 #include <lfs.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#include <immintrin.h>
+#define DFT_HAVE_AVX
+#endif
+
+/*************************************************************************
+**************************************************************************
+#cat: dft_power4_*() - Computes the DFT power of 4 wave forms applied to
+#cat:          the row sums of a rotated block in a single pass.
+
+   Kernels applying all 4 DFT wave forms (NUM_DFT_WAVES) to a vector of
+   pixel row sums at once, using the transposed wave forms of DFTWAVES.
+   Each SIMD lane accumulates the cos or sin part of one wave in the same
+   order as dft_power() does.  Multiplications and additions are kept
+   separate, so the results are bit-for-bit identical to dft_power() as
+   long as the compiler does not contract the scalar code into fused
+   multiply-adds.  If it does (e.g. on aarch64 by default), the powers
+   may differ in the last bits.
+
+   Input:
+      rowsums - accumulated rows of pixels from within a rotated grid
+      dftwaves - structure containing the DFT wave forms
+   Output:
+      power4  - the DFT power for each of the 4 wave forms
+**************************************************************************/
+typedef void (*dft_power4_func)(double *, const int *, const DFTWAVES *);
+
+#if defined(__SSE2__)
+static void dft_power4_sse2(double *power4, const int *rowsums,
+                            const DFTWAVES *dftwaves)
+{
+   __m128d c01 = _mm_setzero_pd(), c23 = _mm_setzero_pd();
+   __m128d s01 = _mm_setzero_pd(), s23 = _mm_setzero_pd();
+   const double *cptr = dftwaves->cos_t;
+   const double *sptr = dftwaves->sin_t;
+   int i;
+
+   for(i = 0; i < dftwaves->wavelen; i++, cptr += 4, sptr += 4){
+      __m128d r = _mm_set1_pd((double)rowsums[i]);
+
+      c01 = _mm_add_pd(c01, _mm_mul_pd(r, _mm_loadu_pd(cptr)));
+      c23 = _mm_add_pd(c23, _mm_mul_pd(r, _mm_loadu_pd(cptr + 2)));
+      s01 = _mm_add_pd(s01, _mm_mul_pd(r, _mm_loadu_pd(sptr)));
+      s23 = _mm_add_pd(s23, _mm_mul_pd(r, _mm_loadu_pd(sptr + 2)));
+   }
+
+   _mm_storeu_pd(power4, _mm_add_pd(_mm_mul_pd(c01, c01), _mm_mul_pd(s01, s01)));
+   _mm_storeu_pd(power4 + 2, _mm_add_pd(_mm_mul_pd(c23, c23), _mm_mul_pd(s23, s23)));
+}
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+static void dft_power4_neon(double *power4, const int *rowsums,
+                            const DFTWAVES *dftwaves)
+{
+   float64x2_t c01 = vdupq_n_f64(0.0), c23 = vdupq_n_f64(0.0);
+   float64x2_t s01 = vdupq_n_f64(0.0), s23 = vdupq_n_f64(0.0);
+   const double *cptr = dftwaves->cos_t;
+   const double *sptr = dftwaves->sin_t;
+   int i;
+
+   for(i = 0; i < dftwaves->wavelen; i++, cptr += 4, sptr += 4){
+      float64x2_t r = vdupq_n_f64((double)rowsums[i]);
+
+      c01 = vaddq_f64(c01, vmulq_f64(r, vld1q_f64(cptr)));
+      c23 = vaddq_f64(c23, vmulq_f64(r, vld1q_f64(cptr + 2)));
+      s01 = vaddq_f64(s01, vmulq_f64(r, vld1q_f64(sptr)));
+      s23 = vaddq_f64(s23, vmulq_f64(r, vld1q_f64(sptr + 2)));
+   }
+
+   vst1q_f64(power4, vaddq_f64(vmulq_f64(c01, c01), vmulq_f64(s01, s01)));
+   vst1q_f64(power4 + 2, vaddq_f64(vmulq_f64(c23, c23), vmulq_f64(s23, s23)));
+}
+#else
+static void dft_power4_c(double *power4, const int *rowsums,
+                         const DFTWAVES *dftwaves)
+{
+   double cospart[4] = { 0.0, 0.0, 0.0, 0.0 };
+   double sinpart[4] = { 0.0, 0.0, 0.0, 0.0 };
+   int i, w;
+
+   for(i = 0; i < dftwaves->wavelen; i++){
+      for(w = 0; w < 4; w++){
+         cospart[w] += (rowsums[i] * dftwaves->cos_t[i * 4 + w]);
+         sinpart[w] += (rowsums[i] * dftwaves->sin_t[i * 4 + w]);
+      }
+   }
+
+   for(w = 0; w < 4; w++)
+      power4[w] = (cospart[w] * cospart[w]) + (sinpart[w] * sinpart[w]);
+}
+#endif
+
+#ifdef DFT_HAVE_AVX
+__attribute__((target("avx")))
+static void dft_power4_avx(double *power4, const int *rowsums,
+                           const DFTWAVES *dftwaves)
+{
+   __m256d c = _mm256_setzero_pd();
+   __m256d s = _mm256_setzero_pd();
+   const double *cptr = dftwaves->cos_t;
+   const double *sptr = dftwaves->sin_t;
+   int i;
+
+   for(i = 0; i < dftwaves->wavelen; i++, cptr += 4, sptr += 4){
+      __m256d r = _mm256_set1_pd((double)rowsums[i]);
+
+      c = _mm256_add_pd(c, _mm256_mul_pd(r, _mm256_loadu_pd(cptr)));
+      s = _mm256_add_pd(s, _mm256_mul_pd(r, _mm256_loadu_pd(sptr)));
+   }
+
+   _mm256_storeu_pd(power4, _mm256_add_pd(_mm256_mul_pd(c, c), _mm256_mul_pd(s, s)));
+}
+#endif
+
+/*************************************************************************
+**************************************************************************
+#cat: get_dft_power4_func - Selects the fastest dft_power4 kernel that is
+#cat:          supported by the CPU, the check is done at runtime.
+
+   Return Code:
+      The kernel to use
+**************************************************************************/
+static dft_power4_func get_dft_power4_func(void)
+{
+#ifdef DFT_HAVE_AVX
+   if(__builtin_cpu_supports("avx"))
+      return(dft_power4_avx);
+#endif
+
+#if defined(__SSE2__)
+   return(dft_power4_sse2);
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+   return(dft_power4_neon);
+#else
+   return(dft_power4_c);
+#endif
+}
+
 /*************************************************************************
 **************************************************************************
 #cat: dft_dir_powers - Conducts the DFT analysis on a block of image data.
@@ -106,6 +250,8 @@ int dft_dir_powers(double **powers, unsigned char *pdata,
    int w, dir;
    int *rowsums;
    unsigned char *blkptr;
+   dft_power4_func power4_func = NULL;
+   double power4[4];
 
    /* Allocate line sum vector, and initialize to zeros */
    /* This routine requires square block (grid), so ERROR otherwise. */
@@ -113,9 +259,13 @@ int dft_dir_powers(double **powers, unsigned char *pdata,
       fprintf(stderr, "ERROR : dft_dir_powers : DFT grids must be square\n");
       return(-90);
    }
-   rowsums = (int *)g_malloc(dftgrids->grid_w * sizeof(int));
+   rowsums = (int *)alloc_arena_buffer(dftgrids->grid_w * sizeof(int));
    memset(rowsums, 0, dftgrids->grid_w * sizeof(int));
 
+   /* The usual case of 4 waves is computed by a vectorized kernel */
+   if(dftwaves->nwaves == 4)
+      power4_func = get_dft_power4_func();
+
    /* Foreach direction ... */
    for(dir = 0; dir < dftgrids->ngrids; dir++){
       /* Compute vector of line sums from rotated grid */
@@ -123,6 +273,13 @@ int dft_dir_powers(double **powers, unsigned char *pdata,
       sum_rot_block_rows(rowsums, blkptr,
                          dftgrids->grids[dir], dftgrids->grid_w);
 
+      if(power4_func != NULL){
+         power4_func(power4, rowsums, dftwaves);
+         for(w = 0; w < 4; w++)
+            powers[w][dir] = power4[w];
+         continue;
+      }
+
       /* Foreach DFT wave ... */
       for(w = 0; w < dftwaves->nwaves; w++){
          dft_power(&(powers[w][dir]), rowsums,
@@ -131,7 +288,7 @@ int dft_dir_powers(double **powers, unsigned char *pdata,
    }
 
    /* Deallocate working memory. */
-   g_free(rowsums);
+   free_arena_buffer(rowsums);
 
    return(0);
 }
@@ -351,7 +508,7 @@ int sort_dft_waves(int *wis, const double *powmaxs, const double *pownorms,
    double *pownorms2;
 
    /* Allocate normalized power^2 array */
-   pownorms2 = (double *)g_malloc(nstats * sizeof(double));
+   pownorms2 = (double *)alloc_arena_buffer(nstats * sizeof(double));
 
    for(i = 0; i < nstats; i++){
       /* Wis will hold the sorted statistic indices when all is done. */
@@ -364,7 +521,7 @@ int sort_dft_waves(int *wis, const double *powmaxs, const double *pownorms,
    bubble_sort_double_dec_2(pownorms2, wis, nstats);
 
    /* Deallocate the working memory. */
-   g_free(pownorms2);
+   free_arena_buffer(pownorms2);
 
    return(0);
 }
@@ -58,6 +58,7 @@ of the software.
                         free_dftwaves()
                         free_rotgrids()
                         free_dir_powers()
+                        free_lfstables()
 ***********************************************************************/
 
 #include <stdio.h>
@@ -95,6 +96,8 @@ void free_dftwaves(DFTWAVES *dftwaves)
        g_free(dftwaves->waves[i]);
    }
    g_free(dftwaves->waves);
+   g_free(dftwaves->cos_t);
+   g_free(dftwaves->sin_t);
    g_free(dftwaves);
 }
 
@@ -134,3 +137,23 @@ void free_dir_powers(double **powers, const int nwaves)
    g_free(powers);
 }
 
+/*************************************************************************
+**************************************************************************
+#cat: free_lfstables - Deallocates the memory associated with a LFSTABLES
+#cat:                  structure, including partially initialized ones
+
+   Input:
+      lfstables - pointer to memory to be freed
+**************************************************************************/
+void free_lfstables(LFSTABLES *lfstables)
+{
+   if(lfstables->dir2rad != NULL)
+      free_dir2rad(lfstables->dir2rad);
+   if(lfstables->dftwaves != NULL)
+      free_dftwaves(lfstables->dftwaves);
+   if(lfstables->dftgrids != NULL)
+      free_rotgrids(lfstables->dftgrids);
+   if(lfstables->dirbingrids != NULL)
+      free_rotgrids(lfstables->dirbingrids);
+   g_free(lfstables);
+}
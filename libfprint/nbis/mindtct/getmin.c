@@ -64,6 +64,27 @@ of the software.
 #include <stdio.h>
 #include <lfs.h>
 
+/*************************************************************************
+**************************************************************************
+#cat: end_minutiae_arena - Stops taking working buffers from the arena of
+#cat:                get_minutiae(), keeping its memory if the arena was
+#cat:                passed in by the caller.
+
+   Input:
+      arena    - the arena used by get_minutiae()
+      keep     - flag to keep the memory of the arena for reuse
+   Output:
+      oallocstats - allocation counts of the arena, may be NULL
+**************************************************************************/
+static void end_minutiae_arena(LFSARENA *arena, const int keep,
+                               LFSALLOCSTATS *oallocstats)
+{
+   if(keep)
+      release_lfsarena(arena, oallocstats);
+   else
+      free_lfsarena(arena, oallocstats);
+}
+
 /*************************************************************************
 **************************************************************************
 #cat:   get_minutiae - Takes a grayscale fingerprint image, binarizes the input
@@ -78,6 +99,9 @@ of the software.
       id       - pixel depth (in bits) of the grayscale image
       ppmm     - the scan resolution (in pixels/mm) of the grayscale image
       lfsparms - parameters and thresholds for controlling LFS
+      lfstables - lookup tables from init_lfstables(), or NULL
+      iarena   - working memory arena kept by the caller for several
+                 calls, or NULL to use one just for this call
    Output:
       ominutiae         - points to a structure containing the
                           detected minutiae
@@ -92,6 +116,8 @@ of the software.
       obw      - width (in pixels) of binarized image
       obh      - height (in pixels) of binarized image
       obd      - pixel depth (in bits) of binarized image
+      oallocstats - allocation counts of the working memory arena,
+                    may be NULL
    Return Code:
       Zero     - successful completion
       Negative - system error
@@ -102,9 +128,12 @@ int get_minutiae(MINUTIAE **ominutiae, int **oquality_map,
                  int *omap_w, int *omap_h,
                  unsigned char **obdata, int *obw, int *obh, int *obd,
                  unsigned char *idata, const int iw, const int ih,
-                 const int id, const double ppmm, const LFSPARMS *lfsparms)
+                 const int id, const double ppmm, const LFSPARMS *lfsparms,
+                 const LFSTABLES *lfstables, LFSARENA *iarena,
+                 LFSALLOCSTATS *oallocstats)
 {
    int ret;
+   LFSARENA private_arena, *arena;
    MINUTIAE *minutiae;
    int *direction_map, *low_contrast_map, *low_flow_map;
    int *high_curve_map, *quality_map;
@@ -119,13 +148,24 @@ int get_minutiae(MINUTIAE **ominutiae, int **oquality_map,
       return(-2);
    }
 
+   /* Working buffers are taken from an arena until we are done. */
+   if(iarena != NULL){
+      arena = iarena;
+      reuse_lfsarena(arena);
+   }
+   else{
+      arena = &private_arena;
+      init_lfsarena(arena);
+   }
+
    /* Detect minutiae in grayscale fingerpeint image. */
    if((ret = lfs_detect_minutiae_V2(&minutiae,
                                    &direction_map, &low_contrast_map,
                                    &low_flow_map, &high_curve_map,
                                    &map_w, &map_h,
                                    &bdata, &bw, &bh,
-                                   idata, iw, ih, lfsparms))){
+                                   idata, iw, ih, lfsparms, lfstables))){
+      end_minutiae_arena(arena, iarena != NULL, oallocstats);
       return(ret);
    }
 
@@ -139,6 +179,7 @@ int get_minutiae(MINUTIAE **ominutiae, int **oquality_map,
       g_free(low_flow_map);
       g_free(high_curve_map);
       g_free(bdata);
+      end_minutiae_arena(arena, iarena != NULL, oallocstats);
       return(ret);
    }
 
@@ -153,6 +194,7 @@ int get_minutiae(MINUTIAE **ominutiae, int **oquality_map,
       g_free(high_curve_map);
       g_free(quality_map);
       g_free(bdata);
+      end_minutiae_arena(arena, iarena != NULL, oallocstats);
       return(ret);
    }
 
@@ -170,6 +212,8 @@ int get_minutiae(MINUTIAE **ominutiae, int **oquality_map,
    *obh = bh;
    *obd = id;
 
+   end_minutiae_arena(arena, iarena != NULL, oallocstats);
+
    /* Return normally. */
    return(0);
 }
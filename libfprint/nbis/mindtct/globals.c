@@ -71,10 +71,10 @@ FILE *logfp;
 /*      2 = twice the frequency in range X.             */
 /*      3 = three times the frequency in reange X.      */
 /*      4 = four times the frequency in ranage X.       */
-double g_dft_coefs[NUM_DFT_WAVES] = { 1,2,3,4 };
+const double g_dft_coefs[NUM_DFT_WAVES] = { 1,2,3,4 };
 
 /* Allocate and initialize a global LFS parameters structure. */
-LFSPARMS g_lfsparms = {
+const LFSPARMS g_lfsparms = {
    /* Image Controls */
    PAD_VALUE,
    JOIN_LINE_RADIUS,
@@ -155,12 +155,16 @@ LFSPARMS g_lfsparms = {
 
    /* Ridge Counting Controls */
    MAX_NBRS,
-   MAX_RIDGE_STEPS
+   MAX_RIDGE_STEPS,
+
+   /* Threading Controls */
+   MAP_THREADS,
+   NULL /* no other threads to dispatch to by default */
 };
 
 
 /* Allocate and initialize VERSION 2 global LFS parameters structure. */
-LFSPARMS g_lfsparms_V2 = {
+const LFSPARMS g_lfsparms_V2 = {
    /* Image Controls */
    PAD_VALUE,
    JOIN_LINE_RADIUS,
@@ -241,22 +245,26 @@ LFSPARMS g_lfsparms_V2 = {
 
    /* Ridge Counting Controls */
    MAX_NBRS,
-   MAX_RIDGE_STEPS
+   MAX_RIDGE_STEPS,
+
+   /* Threading Controls */
+   MAP_THREADS,
+   NULL /* no other threads to dispatch to by default */
 };
 
 /* Variables for conducting 8-connected neighbor analyses. */
 /* Pixel neighbor offsets:  0  1  2  3  4  5  6  7  */     /* 7 0 1 */
-int g_nbr8_dx[] =          {  0, 1, 1, 1, 0,-1,-1,-1 };      /* 6 C 2 */
-int g_nbr8_dy[] =          { -1,-1, 0, 1, 1, 1, 0,-1 };      /* 5 4 3 */
+const int g_nbr8_dx[] =          {  0, 1, 1, 1, 0,-1,-1,-1 };      /* 6 C 2 */
+const int g_nbr8_dy[] =          { -1,-1, 0, 1, 1, 1, 0,-1 };      /* 5 4 3 */
 
 /* The chain code lookup matrix for 8-connected neighbors. */
 /* Should put this in globals.                             */
-int g_chaincodes_nbr8[]={ 3, 2, 1,
+const int g_chaincodes_nbr8[]={ 3, 2, 1,
                         4,-1, 0,
                         5, 6, 7};
 
 /* Global array of feature pixel pairs. */
-FEATURE_PATTERN g_feature_patterns[]=
+const FEATURE_PATTERN g_feature_patterns[]=
                        {{RIDGE_ENDING,  /* a. Ridge Ending (appearing) */
                          APPEARING,
                          {0,0},
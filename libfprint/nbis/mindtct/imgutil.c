@@ -351,8 +351,8 @@ int free_path(const int x1, const int y1, const int x2, const int y2,
          /* If number of transitions seen > than threshold (ex. 2) ... */
          if(trans > lfsparms->maxtrans){
             /* Deallocate the line segment's coordinate lists. */
-            g_free(x_list);
-            g_free(y_list);
+            free_arena_buffer(y_list);
+            free_arena_buffer(x_list);
             /* Return free path to be FALSE. */
             return(FALSE);
          }
@@ -366,8 +366,8 @@ int free_path(const int x1, const int y1, const int x2, const int y2,
 
    /* If we get here we did not exceed the maximum allowable number        */
    /* of transitions.  So, deallocate the line segment's coordinate lists. */
-   g_free(x_list);
-   g_free(y_list);
+   free_arena_buffer(y_list);
+   free_arena_buffer(x_list);
 
    /* Return free path to be TRUE. */
    return(TRUE);
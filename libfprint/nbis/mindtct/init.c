@@ -63,6 +63,7 @@ of the software.
                         init_rotgrids()
                         alloc_dir_powers()
                         alloc_power_stats()
+                        init_lfstables()
 ***********************************************************************/
 
 #include <stdio.h>
@@ -196,6 +197,16 @@ int init_dftwaves(DFTWAVES **optr, const double *dft_coefs,
       }
    }
 
+   /* Store a transposed copy of all wave forms */
+   dftwaves->cos_t = (double *)g_malloc(nwaves * blocksize * sizeof(double));
+   dftwaves->sin_t = (double *)g_malloc(nwaves * blocksize * sizeof(double));
+   for (i = 0; i < nwaves; ++i) {
+      for (j = 0; j < blocksize; ++j) {
+         dftwaves->cos_t[j * nwaves + i] = dftwaves->waves[i]->cos[j];
+         dftwaves->sin_t[j * nwaves + i] = dftwaves->waves[i]->sin[j];
+      }
+   }
+
    *optr = dftwaves;
    return(0);
 }
@@ -619,5 +630,73 @@ int alloc_power_stats(int **owis, double **opowmaxs, int **opowmax_dirs,
    return(0);
 }
 
+/*************************************************************************
+**************************************************************************
+#cat: init_lfstables - Allocates and initializes all lookup tables needed
+#cat:           by lfs_detect_minutiae_V2() for images of a given size.
+#cat:           The tables are not modified during detection, so they
+#cat:           may be shared by multiple concurrent detections.
 
+   Input:
+      iw        - width (in pixels) of the input images
+      ih        - height (in pixels) of the input images
+      lfsparms  - parameters and thresholds for controlling LFS
+   Output:
+      optr      - points to the allocated/initialized LFSTABLES structure
+   Return Code:
+      Zero     - successful completion
+      Negative - system error
+**************************************************************************/
+int init_lfstables(LFSTABLES **optr, const int iw, const int ih,
+                   const LFSPARMS *lfsparms)
+{
+   LFSTABLES *lfstables;
+   int ret;
+
+   lfstables = (LFSTABLES *)g_malloc0(sizeof(LFSTABLES));
+   lfstables->iw = iw;
+   lfstables->ih = ih;
+
+   /* Determine the maximum amount of image padding required to support */
+   /* LFS processes.                                                    */
+   lfstables->pad = get_max_padding_V2(lfsparms->windowsize,
+                          lfsparms->windowoffset,
+                          lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h);
+
+   /* Initialize lookup table for converting integer directions */
+   /* to angles in radians.                                     */
+   if((ret = init_dir2rad(&(lfstables->dir2rad), lfsparms->num_directions))){
+      free_lfstables(lfstables);
+      return(ret);
+   }
 
+   /* Initialize wave form lookup tables for DFT analyses. */
+   if((ret = init_dftwaves(&(lfstables->dftwaves), g_dft_coefs,
+                        lfsparms->num_dft_waves, lfsparms->windowsize))){
+      free_lfstables(lfstables);
+      return(ret);
+   }
+
+   /* Initialize lookup table for pixel offsets to rotated grids */
+   /* used for DFT analyses.                                     */
+   if((ret = init_rotgrids(&(lfstables->dftgrids), iw, ih, lfstables->pad,
+                        lfsparms->start_dir_angle, lfsparms->num_directions,
+                        lfsparms->windowsize, lfsparms->windowsize,
+                        RELATIVE2ORIGIN))){
+      free_lfstables(lfstables);
+      return(ret);
+   }
+
+   /* Initialize lookup table for pixel offsets to rotated grids */
+   /* used for directional binarization.                         */
+   if((ret = init_rotgrids(&(lfstables->dirbingrids), iw, ih, lfstables->pad,
+                        lfsparms->start_dir_angle, lfsparms->num_directions,
+                        lfsparms->dirbin_grid_w, lfsparms->dirbin_grid_h,
+                        RELATIVE2CENTER))){
+      free_lfstables(lfstables);
+      return(ret);
+   }
+
+   *optr = lfstables;
+   return(0);
+}
@@ -95,8 +95,8 @@ int line_points(int **ox_list, int **oy_list, int *onum,
    asize = max(abs(x2-x1)+2, abs(y2-y1)+2);
 
    /* Allocate x and y-pixel coordinate lists to length 'asize'. */
-   x_list = (int *)g_malloc(asize * sizeof(int));
-   y_list = (int *)g_malloc(asize * sizeof(int));
+   x_list = (int *)alloc_arena_buffer(asize * sizeof(int));
+   y_list = (int *)alloc_arena_buffer(asize * sizeof(int));
 
    /* Compute delta x and y. */
    dx = x2 - x1;
@@ -181,8 +181,8 @@ int line_points(int **ox_list, int **oy_list, int *onum,
 
       if(i >= asize){
          fprintf(stderr, "ERROR : line_points : coord list overflow\n");
-         g_free(x_list);
-         g_free(y_list);
+         free_arena_buffer(y_list);
+         free_arena_buffer(x_list);
          return(-412);
       }
 
@@ -62,6 +62,8 @@ of the software.
                ROUTINES:
                         gen_image_maps()
                         gen_initial_maps()
+                        gen_initial_maps_rows()
+                        gen_initial_maps_job()
                         interpolate_direction_map()
                         morph_TF_map()
                         pixelize_map()
@@ -216,6 +218,231 @@ int gen_image_maps(int **odmap, int **olcmap, int **olfmap, int **ohcmap,
    return(0);
 }
 
+/* Shared state of the threads computing the initial maps.  Each block */
+/* is only written by the thread that analyzed it, so the resulting    */
+/* maps do not depend on the number of threads or their scheduling.    */
+typedef struct initmaps{
+   int *direction_map;
+   int *low_contrast_map;
+   int *low_flow_map;
+   int *blkoffs;
+   int mw, mh;
+   unsigned char *pdata;
+   int pw, ph;
+   const DFTWAVES *dftwaves;
+   const ROTGRIDS *dftgrids;
+   const LFSPARMS *lfsparms;
+   int next_row;             /* next row of blocks to be analyzed */
+   GMutex lock;
+   GCond done;
+   int pending;              /* dispatched workers not finished yet */
+} INITMAPS;
+
+/* One thread computing the initial maps */
+typedef struct initmapsworker{
+   INITMAPS *maps;
+   int ret;                  /* return code of the first failing block */
+   int err_block;            /* first failing block, or -1            */
+} INITMAPSWORKER;
+
+/*************************************************************************
+**************************************************************************
+#cat: gen_initial_maps_rows - Analyzes rows of blocks for gen_initial_maps()
+#cat:             until all rows of the image have been taken.  The rows
+#cat:             are handed out one by one, so this may run in several
+#cat:             threads at the same time.
+
+   Input:
+      maps      - the maps being computed and their input data
+   Output:
+      oerr_block - index of the block that failed, if any
+   Return Code:
+      Zero     - successful completion
+      Negative - system error
+**************************************************************************/
+static int gen_initial_maps_rows(INITMAPS *maps, int *oerr_block)
+{
+   const LFSPARMS *lfsparms = maps->lfsparms;
+   const DFTWAVES *dftwaves = maps->dftwaves;
+   const ROTGRIDS *dftgrids = maps->dftgrids;
+   int pw = maps->pw, ph = maps->ph;
+   int row, bi, blkdir;
+   int *wis, *powmax_dirs;
+   double **powers, *powmaxs, *pownorms;
+   int nstats;
+   int ret; /* return code */
+   int dft_offset;
+   int xminlimit, xmaxlimit, yminlimit, ymaxlimit;
+   int win_x, win_y, low_contrast_offset;
+
+   /* Allocate DFT directional power vectors */
+   if((ret = alloc_dir_powers(&powers, dftwaves->nwaves, dftgrids->ngrids))){
+      *oerr_block = 0;
+      return(ret);
+   }
+
+   /* Allocate DFT power statistic arrays */
+   /* Compute length of statistics arrays.  Statistics not needed   */
+   /* for the first DFT wave, so the length is number of waves - 1. */
+   nstats = dftwaves->nwaves - 1;
+   if((ret = alloc_power_stats(&wis, &powmaxs, &powmax_dirs,
+                            &pownorms, nstats))){
+      /* Free memory allocated to this point. */
+      free_dir_powers(powers, dftwaves->nwaves);
+      *oerr_block = 0;
+      return(ret);
+   }
+
+   /* Compute special window origin limits for determining low contrast.  */
+   /* These pixel limits avoid analyzing the padded borders of the image. */
+   xminlimit = dftgrids->pad;
+   yminlimit = dftgrids->pad;
+   xmaxlimit = pw - dftgrids->pad - lfsparms->windowsize - 1;
+   ymaxlimit = ph - dftgrids->pad - lfsparms->windowsize - 1;
+
+   /* Foreach row of blocks not yet taken by another thread ... */
+   while((row = g_atomic_int_add(&maps->next_row, 1)) < maps->mh){
+      /* Foreach block in the row ... */
+      for(bi = row * maps->mw; bi < (row + 1) * maps->mw; bi++){
+         /* Adjust block offset from pointing to block origin to pointing */
+         /* to surrounding window origin.                                 */
+         dft_offset = maps->blkoffs[bi] - (lfsparms->windowoffset * pw) -
+                         lfsparms->windowoffset;
+
+         /* Compute pixel coords of window origin. */
+         win_x = dft_offset % pw;
+         win_y = (int)(dft_offset / pw);
+
+         /* Make sure the current window does not access padded image pixels */
+         /* for analyzing low contrast.                                      */
+         win_x = max(xminlimit, win_x);
+         win_x = min(xmaxlimit, win_x);
+         win_y = max(yminlimit, win_y);
+         win_y = min(ymaxlimit, win_y);
+         low_contrast_offset = (win_y * pw) + win_x;
+
+         print2log("   BLOCK %2d (%2d, %2d) ", bi, bi%maps->mw, bi/maps->mw);
+
+         /* If block is low contrast ... */
+         if((ret = low_contrast_block(low_contrast_offset, lfsparms->windowsize,
+                                     maps->pdata, pw, ph, lfsparms))){
+            /* If system error ... */
+            if(ret < 0){
+               free_dir_powers(powers, dftwaves->nwaves);
+               g_free(wis);
+               g_free(powmaxs);
+               g_free(powmax_dirs);
+               g_free(pownorms);
+               *oerr_block = bi;
+               return(ret);
+            }
+
+            /* Otherwise, block is low contrast ... */
+            print2log("LOW CONTRAST\n");
+            maps->low_contrast_map[bi] = TRUE;
+            /* Direction Map's block is already set to INVALID. */
+         }
+         /* Otherwise, sufficient contrast for DFT processing ... */
+         else {
+            print2log("\n");
+
+            /* Compute DFT powers */
+            if((ret = dft_dir_powers(powers, maps->pdata, low_contrast_offset,
+                                  pw, ph, dftwaves, dftgrids))){
+               /* Free memory allocated to this point. */
+               free_dir_powers(powers, dftwaves->nwaves);
+               g_free(wis);
+               g_free(powmaxs);
+               g_free(powmax_dirs);
+               g_free(pownorms);
+               *oerr_block = bi;
+               return(ret);
+            }
+
+            /* Compute DFT power statistics, skipping first applied DFT  */
+            /* wave.  This is dependent on how the primary and secondary */
+            /* direction tests work below.                               */
+            if((ret = dft_power_stats(wis, powmaxs, powmax_dirs, pownorms, powers,
+                                   1, dftwaves->nwaves, dftgrids->ngrids))){
+               /* Free memory allocated to this point. */
+               free_dir_powers(powers, dftwaves->nwaves);
+               g_free(wis);
+               g_free(powmaxs);
+               g_free(powmax_dirs);
+               g_free(pownorms);
+               *oerr_block = bi;
+               return(ret);
+            }
+
+#ifdef LOG_REPORT /*vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv*/
+            {  int _w;
+               fprintf(logfp, "      Power\n");
+               for(_w = 0; _w < nstats; _w++){
+                  /* Add 1 to wis[w] to create index to original g_dft_coefs[] */
+                  fprintf(logfp, "         wis[%d] %d %12.3f %2d %9.3f %12.3f\n",
+                       _w, wis[_w]+1,
+                       powmaxs[wis[_w]], powmax_dirs[wis[_w]], pownorms[wis[_w]],
+                       powers[0][powmax_dirs[wis[_w]]]);
+               }
+            }
+#endif /*^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^*/
+
+            /* Conduct primary direction test */
+            blkdir = primary_dir_test(powers, wis, powmaxs, powmax_dirs,
+                                     pownorms, nstats, lfsparms);
+
+            if(blkdir != INVALID_DIR)
+               maps->direction_map[bi] = blkdir;
+            else{
+               /* Conduct secondary (fork) direction test */
+               blkdir = secondary_fork_test(powers, wis, powmaxs, powmax_dirs,
+                                     pownorms, nstats, lfsparms);
+               if(blkdir != INVALID_DIR)
+                  maps->direction_map[bi] = blkdir;
+               /* Otherwise current direction in Direction Map remains INVALID */
+               else
+                  /* Flag the block as having LOW RIDGE FLOW. */
+                  maps->low_flow_map[bi] = TRUE;
+            }
+
+         } /* End DFT */
+      } /* bi */
+   } /* row */
+
+   /* Deallocate working memory */
+   free_dir_powers(powers, dftwaves->nwaves);
+   g_free(wis);
+   g_free(powmaxs);
+   g_free(powmax_dirs);
+   g_free(pownorms);
+
+   return(0);
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: gen_initial_maps_job - Function dispatched to other threads by
+#cat:             gen_initial_maps().  Working buffers are taken from the
+#cat:             arena of the thread it runs in, if any.
+
+   Input:
+      data      - the INITMAPSWORKER of the job
+   Output:
+      data      - return code and failing block of the job
+**************************************************************************/
+static void gen_initial_maps_job(void *data)
+{
+   INITMAPSWORKER *worker = (INITMAPSWORKER *)data;
+   INITMAPS *maps = worker->maps;
+
+   worker->ret = gen_initial_maps_rows(maps, &worker->err_block);
+
+   g_mutex_lock(&maps->lock);
+   maps->pending--;
+   g_cond_signal(&maps->done);
+   g_mutex_unlock(&maps->lock);
+}
+
 /*************************************************************************
 **************************************************************************
 #cat: gen_initial_maps - Creates an initial Direction Map from the given
@@ -235,6 +462,10 @@ int gen_image_maps(int **odmap, int **olcmap, int **olfmap, int **ohcmap,
 #cat:             could not determine a significant ridge flow.  Blocks with
 #cat:             low ridge flow also have a corresponding direction of
 #cat:             INVALID in the Direction Map.
+#cat:             The blocks are analyzed by up to lfsparms->map_threads
+#cat:             threads, using lfsparms->map_dispatch to run the work in
+#cat:             the additional ones.  The maps are the same for any number
+#cat:             of threads.
 
    Input:
       blkoffs   - offsets to the pixel origin of each block in the padded image
@@ -259,15 +490,10 @@ int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
                 const DFTWAVES *dftwaves, const  ROTGRIDS *dftgrids,
                 const LFSPARMS *lfsparms)
 {
-   int *direction_map, *low_contrast_map, *low_flow_map;
-   int bi, bsize, blkdir;
-   int *wis, *powmax_dirs;
-   double **powers, *powmaxs, *pownorms;
-   int nstats;
-   int ret; /* return code */
-   int dft_offset;
-   int xminlimit, xmaxlimit, yminlimit, ymaxlimit;
-   int win_x, win_y, low_contrast_offset;
+   INITMAPS maps;
+   INITMAPSWORKER *workers;
+   int bsize, nthreads, i;
+   int ret, err_block; /* return code and failing block */
 
    print2log("INITIAL MAP\n");
 
@@ -276,172 +502,90 @@ int gen_initial_maps(int **odmap, int **olcmap, int **olfmap,
    bsize = mw * mh;
 
    /* Allocate Direction Map memory */
-   direction_map = (int *)g_malloc(bsize * sizeof(int));
+   maps.direction_map = (int *)g_malloc(bsize * sizeof(int));
    /* Initialize the Direction Map to INVALID (-1). */
-   memset(direction_map, INVALID_DIR, bsize * sizeof(int));
+   memset(maps.direction_map, INVALID_DIR, bsize * sizeof(int));
 
    /* Allocate Low Contrast Map memory */
-   low_contrast_map = (int *)g_malloc(bsize * sizeof(int));
+   maps.low_contrast_map = (int *)g_malloc(bsize * sizeof(int));
    /* Initialize the Low Contrast Map to FALSE (0). */
-   memset(low_contrast_map, 0, bsize * sizeof(int));
+   memset(maps.low_contrast_map, 0, bsize * sizeof(int));
 
    /* Allocate Low Ridge Flow Map memory */
-   low_flow_map = (int *)g_malloc(bsize * sizeof(int));
+   maps.low_flow_map = (int *)g_malloc(bsize * sizeof(int));
    /* Initialize the Low Flow Map to FALSE (0). */
-   memset(low_flow_map, 0, bsize * sizeof(int));
+   memset(maps.low_flow_map, 0, bsize * sizeof(int));
+
+   maps.blkoffs = blkoffs;
+   maps.mw = mw;
+   maps.mh = mh;
+   maps.pdata = pdata;
+   maps.pw = pw;
+   maps.ph = ph;
+   maps.dftwaves = dftwaves;
+   maps.dftgrids = dftgrids;
+   maps.lfsparms = lfsparms;
+   maps.next_row = 0;
+
+   /* Only use as many threads as there is enough work for. */
+   nthreads = min(lfsparms->map_threads, bsize / MIN_MAP_THREAD_BLOCKS);
+   nthreads = min(nthreads, mh);
+   if(lfsparms->map_dispatch == NULL)
+      nthreads = 1;
+#ifdef LOG_REPORT
+   /* Keep the log in block order. */
+   nthreads = 1;
+#endif
+   nthreads = max(nthreads, 1);
+
+   g_mutex_init(&maps.lock);
+   g_cond_init(&maps.done);
+   maps.pending = nthreads - 1;
+
+   /* Dispatch the additional workers, the calling thread is the first one. */
+   workers = (INITMAPSWORKER *)g_malloc0(nthreads * sizeof(INITMAPSWORKER));
+   for(i = 1; i < nthreads; i++){
+      workers[i].maps = &maps;
+      workers[i].err_block = -1;
+      lfsparms->map_dispatch(gen_initial_maps_job, &workers[i]);
+   }
 
-   /* Allocate DFT directional power vectors */
-   if((ret = alloc_dir_powers(&powers, dftwaves->nwaves, dftgrids->ngrids))){
-      /* Free memory allocated to this point. */
-      g_free(direction_map);
-      g_free(low_contrast_map);
-      g_free(low_flow_map);
-      return(ret);
+   workers[0].maps = &maps;
+   workers[0].err_block = -1;
+   workers[0].ret = gen_initial_maps_rows(&maps, &workers[0].err_block);
+
+   /* Workers that only start now find all rows taken and return at once. */
+   g_mutex_lock(&maps.lock);
+   while(maps.pending > 0)
+      g_cond_wait(&maps.done, &maps.lock);
+   g_mutex_unlock(&maps.lock);
+   g_cond_clear(&maps.done);
+   g_mutex_clear(&maps.lock);
+
+   /* Report the error of the first failing block, like a single */
+   /* thread would have.                                         */
+   ret = 0;
+   err_block = -1;
+   for(i = 0; i < nthreads; i++){
+      if(workers[i].ret &&
+         ((err_block < 0) || (workers[i].err_block < err_block))){
+         ret = workers[i].ret;
+         err_block = workers[i].err_block;
+      }
    }
+   g_free(workers);
 
-   /* Allocate DFT power statistic arrays */
-   /* Compute length of statistics arrays.  Statistics not needed   */
-   /* for the first DFT wave, so the length is number of waves - 1. */
-   nstats = dftwaves->nwaves - 1;
-   if((ret = alloc_power_stats(&wis, &powmaxs, &powmax_dirs,
-                            &pownorms, nstats))){
+   if(ret){
       /* Free memory allocated to this point. */
-      g_free(direction_map);
-      g_free(low_contrast_map);
-      g_free(low_flow_map);
-      free_dir_powers(powers, dftwaves->nwaves);
+      g_free(maps.direction_map);
+      g_free(maps.low_contrast_map);
+      g_free(maps.low_flow_map);
       return(ret);
    }
 
-   /* Compute special window origin limits for determining low contrast.  */
-   /* These pixel limits avoid analyzing the padded borders of the image. */
-   xminlimit = dftgrids->pad;
-   yminlimit = dftgrids->pad;
-   xmaxlimit = pw - dftgrids->pad - lfsparms->windowsize - 1;
-   ymaxlimit = ph - dftgrids->pad - lfsparms->windowsize - 1;
-
-   /* Foreach block in image ... */
-   for(bi = 0; bi < bsize; bi++){
-      /* Adjust block offset from pointing to block origin to pointing */
-      /* to surrounding window origin.                                 */
-      dft_offset = blkoffs[bi] - (lfsparms->windowoffset * pw) -
-                      lfsparms->windowoffset;
-
-      /* Compute pixel coords of window origin. */
-      win_x = dft_offset % pw;
-      win_y = (int)(dft_offset / pw);
-
-      /* Make sure the current window does not access padded image pixels */
-      /* for analyzing low contrast.                                      */
-      win_x = max(xminlimit, win_x);
-      win_x = min(xmaxlimit, win_x);
-      win_y = max(yminlimit, win_y);
-      win_y = min(ymaxlimit, win_y);
-      low_contrast_offset = (win_y * pw) + win_x;
-
-      print2log("   BLOCK %2d (%2d, %2d) ", bi, bi%mw, bi/mw);
-
-      /* If block is low contrast ... */
-      if((ret = low_contrast_block(low_contrast_offset, lfsparms->windowsize,
-                                  pdata, pw, ph, lfsparms))){
-         /* If system error ... */
-         if(ret < 0){
-            g_free(direction_map);
-            g_free(low_contrast_map);
-            g_free(low_flow_map);
-            free_dir_powers(powers, dftwaves->nwaves);
-            g_free(wis);
-            g_free(powmaxs);
-            g_free(powmax_dirs);
-            g_free(pownorms);
-            return(ret);
-         }
-
-         /* Otherwise, block is low contrast ... */
-         print2log("LOW CONTRAST\n");
-         low_contrast_map[bi] = TRUE;
-         /* Direction Map's block is already set to INVALID. */
-      }
-      /* Otherwise, sufficient contrast for DFT processing ... */
-      else {
-         print2log("\n");
-
-         /* Compute DFT powers */
-         if((ret = dft_dir_powers(powers, pdata, low_contrast_offset, pw, ph,
-                               dftwaves, dftgrids))){
-            /* Free memory allocated to this point. */
-            g_free(direction_map);
-            g_free(low_contrast_map);
-            g_free(low_flow_map);
-            free_dir_powers(powers, dftwaves->nwaves);
-            g_free(wis);
-            g_free(powmaxs);
-            g_free(powmax_dirs);
-            g_free(pownorms);
-            return(ret);
-         }
-
-         /* Compute DFT power statistics, skipping first applied DFT  */
-         /* wave.  This is dependent on how the primary and secondary */
-         /* direction tests work below.                               */
-         if((ret = dft_power_stats(wis, powmaxs, powmax_dirs, pownorms, powers,
-                                1, dftwaves->nwaves, dftgrids->ngrids))){
-            /* Free memory allocated to this point. */
-            g_free(direction_map);
-            g_free(low_contrast_map);
-            g_free(low_flow_map);
-            free_dir_powers(powers, dftwaves->nwaves);
-            g_free(wis);
-            g_free(powmaxs);
-            g_free(powmax_dirs);
-            g_free(pownorms);
-            return(ret);
-         }
-
-#ifdef LOG_REPORT /*vvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvvv*/
-         {  int _w;
-            fprintf(logfp, "      Power\n");
-            for(_w = 0; _w < nstats; _w++){
-               /* Add 1 to wis[w] to create index to original g_dft_coefs[] */
-               fprintf(logfp, "         wis[%d] %d %12.3f %2d %9.3f %12.3f\n",
-                    _w, wis[_w]+1,
-                    powmaxs[wis[_w]], powmax_dirs[wis[_w]], pownorms[wis[_w]],
-                    powers[0][powmax_dirs[wis[_w]]]);
-            }
-         }
-#endif /*^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^^*/
-
-         /* Conduct primary direction test */
-         blkdir = primary_dir_test(powers, wis, powmaxs, powmax_dirs,
-                                  pownorms, nstats, lfsparms);
-
-         if(blkdir != INVALID_DIR)
-            direction_map[bi] = blkdir;
-         else{
-            /* Conduct secondary (fork) direction test */
-            blkdir = secondary_fork_test(powers, wis, powmaxs, powmax_dirs,
-                                  pownorms, nstats, lfsparms);
-            if(blkdir != INVALID_DIR)
-               direction_map[bi] = blkdir;
-            /* Otherwise current direction in Direction Map remains INVALID */
-            else
-               /* Flag the block as having LOW RIDGE FLOW. */
-               low_flow_map[bi] = TRUE;
-         }
-
-      } /* End DFT */
-   } /* bi */
-
-   /* Deallocate working memory */
-   free_dir_powers(powers, dftwaves->nwaves);
-   g_free(wis);
-   g_free(powmaxs);
-   g_free(powmax_dirs);
-   g_free(pownorms);
-
-   *odmap = direction_map;
-   *olcmap = low_contrast_map;
-   *olfmap = low_flow_map;
+   *odmap = maps.direction_map;
+   *olcmap = maps.low_contrast_map;
+   *olfmap = maps.low_flow_map;
    return(0);
 }
 
@@ -955,8 +955,8 @@ int remove_malformations(MINUTIAE *minutiae,
                         print2log("%d,%d RMMAL3 (%f)\n",
                                   minutia->x, minutia->y, ratio);
                         if((ret = remove_minutia(i, minutiae))){
-                           g_free(x_list);
-                           g_free(y_list);
+                           free_arena_buffer(y_list);
+                           free_arena_buffer(x_list);
                            /* If system error, return error code. */
                            return(ret);
                         }
@@ -966,8 +966,8 @@ int remove_malformations(MINUTIAE *minutiae,
                   }
                }
 
-               g_free(x_list);
-               g_free(y_list);
+               free_arena_buffer(y_list);
+               free_arena_buffer(x_list);
 
             }
          }
@@ -1065,11 +1065,11 @@ int remove_near_invblock_V2(MINUTIAE *minutiae, int *direction_map,
    /*                           |    |                       */
 
    /* LUT for starting neighbor index given (ix, iy).        */
-   static int startblk[9] = { 6, 0, 0,
+   static const int startblk[9] = { 6, 0, 0,
                               6,-1, 2,
                               4, 4, 2 };
    /* LUT for ending neighbor index given (ix, iy).          */
-   static int endblk[9] =   { 8, 0, 2,
+   static const int endblk[9] =   { 8, 0, 2,
                               6,-1, 2,
                               6, 4, 4 };
 
@@ -1083,8 +1083,8 @@ int remove_near_invblock_V2(MINUTIAE *minutiae, int *direction_map,
    /*                      5 4 3                                    */
    /*                                                               */
    /*                       0  1  2  3  4  5  6  7  8                    */
-   static int blkdx[9] = {  0, 1, 1, 1, 0,-1,-1,-1, 0 };  /* Delta-X     */
-   static int blkdy[9] = { -1,-1, 0, 1, 1, 1, 0,-1,-1 };  /* Delta-Y     */
+   static const int blkdx[9] = {  0, 1, 1, 1, 0,-1,-1,-1, 0 };  /* Delta-X     */
+   static const int blkdy[9] = { -1,-1, 0, 1, 1, 1, 0,-1,-1 };  /* Delta-Y     */
 
    print2log("\nREMOVING MINUTIA NEAR INVALID BLOCKS:\n");
 
@@ -2312,9 +2312,9 @@ int remove_or_adjust_side_minutiae_V2(MINUTIAE *minutiae,
                   g_free(rot_y);
                   free_contour(contour_x, contour_y, contour_ex, contour_ey);
                   if(minmax_alloc > 0){
-                     g_free(minmax_val);
-                     g_free(minmax_type);
-                     g_free(minmax_i);
+                     free_arena_buffer(minmax_i);
+                     free_arena_buffer(minmax_type);
+                     free_arena_buffer(minmax_val);
                   }
                   /* Return error code. */
                   return(ret);
@@ -2358,9 +2358,9 @@ int remove_or_adjust_side_minutiae_V2(MINUTIAE *minutiae,
                   g_free(rot_y);
                   free_contour(contour_x, contour_y, contour_ex, contour_ey);
                   if(minmax_alloc > 0){
-                     g_free(minmax_val);
-                     g_free(minmax_type);
-                     g_free(minmax_i);
+                     free_arena_buffer(minmax_i);
+                     free_arena_buffer(minmax_type);
+                     free_arena_buffer(minmax_val);
                   }
                   /* Return error code. */
                   return(ret);
@@ -2387,9 +2387,9 @@ int remove_or_adjust_side_minutiae_V2(MINUTIAE *minutiae,
                g_free(rot_y);
                free_contour(contour_x, contour_y, contour_ex, contour_ey);
                if(minmax_alloc > 0){
-                  g_free(minmax_val);
-                  g_free(minmax_type);
-                  g_free(minmax_i);
+                  free_arena_buffer(minmax_i);
+                  free_arena_buffer(minmax_type);
+                  free_arena_buffer(minmax_val);
                }
                /* Return error code. */
                return(ret);
@@ -2401,9 +2401,9 @@ int remove_or_adjust_side_minutiae_V2(MINUTIAE *minutiae,
          /* Deallocate contour and min/max buffers. */
          free_contour(contour_x, contour_y, contour_ex, contour_ey);
          if(minmax_alloc > 0){
-            g_free(minmax_val);
-            g_free(minmax_type);
-            g_free(minmax_i);
+            free_arena_buffer(minmax_i);
+            free_arena_buffer(minmax_type);
+            free_arena_buffer(minmax_val);
          }
       } /* End else contour extracted. */
    } /* End while not end of minutiae list. */
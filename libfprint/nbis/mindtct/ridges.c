@@ -482,11 +482,11 @@ int sort_neighbors(int *nbr_list, const int nnbrs, const int first,
 {
    double *join_thetas, theta;
    int i;
-   static double pi2 = M_PI*2.0;
+   static const double pi2 = M_PI*2.0;
 
    /* List of angles of lines joining the current primary to each */
    /* of the secondary neighbors.                                 */
-   join_thetas = (double *)g_malloc(nnbrs * sizeof(double));
+   join_thetas = (double *)alloc_arena_buffer(nnbrs * sizeof(double));
 
    for(i = 0; i < nnbrs; i++){
       /* Compute angle to line connecting the 2 points.             */
@@ -508,7 +508,7 @@ int sort_neighbors(int *nbr_list, const int nnbrs, const int first,
    bubble_sort_double_inc_2(join_thetas, nbr_list, nnbrs);
 
    /* Deallocate the list of angles. */
-   g_free(join_thetas);
+   free_arena_buffer(join_thetas);
 
    /* Return normally. */
    return(0);
@@ -561,8 +561,8 @@ int ridge_count(const int first, const int second, MINUTIAE *minutiae,
    /* It there are no points on the line trajectory, then no ridges */
    /* to count (this should not happen, but just in case) ...       */
    if(num == 0){
-      g_free(xlist);
-      g_free(ylist);
+      free_arena_buffer(ylist);
+      free_arena_buffer(xlist);
       return(0);
    }
 
@@ -582,8 +582,8 @@ int ridge_count(const int first, const int second, MINUTIAE *minutiae,
 
    /* If opposite pixel not found ... then no ridges to count */
    if(!found){
-      g_free(xlist);
-      g_free(ylist);
+      free_arena_buffer(ylist);
+      free_arena_buffer(xlist);
       return(0);
    }
 
@@ -598,8 +598,8 @@ int ridge_count(const int first, const int second, MINUTIAE *minutiae,
       /* If 0-to-1 transition not found ... */
       if(!find_transition(&i, 0, 1, xlist, ylist, num, bdata, iw, ih)){
          /* Then we are done looking for ridges. */
-         g_free(xlist);
-         g_free(ylist);
+         free_arena_buffer(ylist);
+         free_arena_buffer(xlist);
 
          print2log("\n");
 
@@ -615,8 +615,8 @@ int ridge_count(const int first, const int second, MINUTIAE *minutiae,
       /* If 1-to-0 transition not found ... */
       if(!find_transition(&i, 1, 0, xlist, ylist, num, bdata, iw, ih)){
          /* Then we are done looking for ridges. */
-         g_free(xlist);
-         g_free(ylist);
+         free_arena_buffer(ylist);
+         free_arena_buffer(xlist);
 
          print2log("\n");
 
@@ -642,8 +642,8 @@ int ridge_count(const int first, const int second, MINUTIAE *minutiae,
 
       /* If system error ... */
       if(ret < 0){
-         g_free(xlist);
-         g_free(ylist);
+         free_arena_buffer(ylist);
+         free_arena_buffer(xlist);
          /* Return the error code. */
          return(ret);
       }
@@ -662,8 +662,8 @@ int ridge_count(const int first, const int second, MINUTIAE *minutiae,
    }
 
    /* Deallocate working memories. */
-   g_free(xlist);
-   g_free(ylist);
+   free_arena_buffer(ylist);
+   free_arena_buffer(xlist);
 
    print2log("\n");
 
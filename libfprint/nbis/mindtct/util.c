@@ -65,6 +65,12 @@ of the software.
                         angle2line()
                         line2direction()
                         closest_dir_dist()
+                        init_lfsarena()
+                        free_lfsarena()
+                        reuse_lfsarena()
+                        release_lfsarena()
+                        alloc_arena_buffer()
+                        free_arena_buffer()
 ***********************************************************************/
 
 #include <stdio.h>
@@ -178,9 +184,9 @@ int minmaxs(int **ominmax_val, int **ominmax_type, int **ominmax_i,
    /* min or max.                                                */
    minmax_alloc = num - 2;
    /* Allocate the buffers. */
-   minmax_val = (int *)g_malloc(minmax_alloc * sizeof(int));
-   minmax_type = (int *)g_malloc(minmax_alloc * sizeof(int));
-   minmax_i = (int *)g_malloc(minmax_alloc * sizeof(int));
+   minmax_val = (int *)alloc_arena_buffer(minmax_alloc * sizeof(int));
+   minmax_type = (int *)alloc_arena_buffer(minmax_alloc * sizeof(int));
+   minmax_i = (int *)alloc_arena_buffer(minmax_alloc * sizeof(int));
 
    /* Initialize number of min/max to 0. */
    minmax_num = 0;
@@ -518,7 +524,7 @@ int line2direction(const int fx, const int fy,
 {
    double theta, pi_factor;
    int idir, full_ndirs;
-   static double pi2 = M_PI*2.0;
+   static const double pi2 = M_PI*2.0;
 
    /* Compute angle to line connecting the 2 points.             */
    /* Coordinates are swapped and order of points reversed to    */
@@ -587,3 +593,236 @@ int closest_dir_dist(const int dir1, const int dir2, const int ndirs)
    return(dist);
 }
 
+
+/*************************************************************************
+**************************************************************************
+   Each buffer handed out by an arena is preceded by this header.  It
+   links the buffers of a block in allocation order, so that buffers
+   at the end of the block can be reclaimed once they are released.
+**************************************************************************/
+typedef struct arenabuffer{
+   size_t prev;
+   size_t freed;
+} ARENABUFFER;
+
+#define ARENA_ALIGN(_n_)   (((_n_) + 15) & ~((size_t)15))
+#define ARENA_NONE         ((size_t)-1)
+#define ARENA_DATA(_b_)    ((unsigned char *)(_b_) + \
+                            ARENA_ALIGN(sizeof(LFSARENABLOCK)))
+#define ARENA_BUFFER(_b_, _off_) ((ARENABUFFER *)(ARENA_DATA(_b_) + (_off_)))
+
+/* The arena buffers are allocated from, if any */
+static GPrivate current_arena;
+
+/*************************************************************************
+**************************************************************************
+#cat: new_arena_block - Allocates an empty arena block on the heap.
+
+   Input:
+      size     - number of usable bytes in the block
+   Return Code:
+      Pointer to the new block
+**************************************************************************/
+static LFSARENABLOCK *new_arena_block(const size_t size)
+{
+   LFSARENABLOCK *block;
+
+   block = (LFSARENABLOCK *)g_malloc(ARENA_ALIGN(sizeof(LFSARENABLOCK)) +
+                                     size);
+   block->next = NULL;
+   block->size = size;
+   block->used = 0;
+   block->peak = 0;
+   block->last = ARENA_NONE;
+
+   return(block);
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: init_lfsarena - Initializes an empty arena and makes it the one
+#cat:            alloc_arena_buffer() allocates from in the calling thread
+#cat:            until free_lfsarena() is called.
+
+   Input:
+      arena    - arena to be initialized
+**************************************************************************/
+void init_lfsarena(LFSARENA *arena)
+{
+   memset(arena, 0, sizeof(LFSARENA));
+   g_private_set(&current_arena, arena);
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: free_lfsarena - Deallocates all blocks of an arena at once, including
+#cat:            any buffers that have not been released yet.
+
+   Input:
+      arena    - arena to be deallocated
+   Output:
+      ostats   - allocation counts of the arena, may be NULL
+**************************************************************************/
+void free_lfsarena(LFSARENA *arena, LFSALLOCSTATS *ostats)
+{
+   LFSARENABLOCK *block, *next;
+
+   if(g_private_get(&current_arena) == arena)
+      g_private_set(&current_arena, NULL);
+
+   for(block = arena->blocks; block != NULL; block = next){
+      next = block->next;
+      g_free(block);
+   }
+   arena->blocks = NULL;
+
+   if(ostats != NULL)
+      *ostats = arena->stats;
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: reuse_lfsarena - Makes an arena that was kept with release_lfsarena()
+#cat:            the one alloc_arena_buffer() allocates from in the calling
+#cat:            thread again.  All of its space is available, and its
+#cat:            allocation counts start over, so they only cover the next
+#cat:            call, just like for a new arena.  The kept block is not
+#cat:            counted, as it needs no heap allocation.
+
+   Input:
+      arena    - arena to be reused
+**************************************************************************/
+void reuse_lfsarena(LFSARENA *arena)
+{
+   if(arena->blocks != NULL){
+      arena->blocks->used = 0;
+      arena->blocks->peak = 0;
+      arena->blocks->last = ARENA_NONE;
+   }
+
+   memset(&arena->stats, 0, sizeof(LFSALLOCSTATS));
+   g_private_set(&current_arena, arena);
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: release_lfsarena - Stops allocating from an arena in the calling
+#cat:            thread, but keeps its memory for a later reuse_lfsarena().
+#cat:            All buffers become invalid.  Several blocks are merged
+#cat:            into a single one, as only the most recent block is
+#cat:            allocated from, so a similar workload can run without
+#cat:            any further heap allocation.
+
+   Input:
+      arena    - arena to be released
+   Output:
+      ostats   - allocation counts of the arena, may be NULL
+**************************************************************************/
+void release_lfsarena(LFSARENA *arena, LFSALLOCSTATS *ostats)
+{
+   LFSARENABLOCK *block, *next;
+   size_t size;
+
+   if(g_private_get(&current_arena) == arena)
+      g_private_set(&current_arena, NULL);
+
+   if(ostats != NULL)
+      *ostats = arena->stats;
+
+   if((arena->blocks == NULL) || (arena->blocks->next == NULL))
+      return;
+
+   size = 0;
+   for(block = arena->blocks; block != NULL; block = next){
+      next = block->next;
+      size += block->size;
+      g_free(block);
+   }
+   arena->blocks = new_arena_block(size);
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: alloc_arena_buffer - Allocates a working buffer from the arena of
+#cat:            the calling thread.  The buffer must not outlive the
+#cat:            arena.  Without an arena the buffer is simply allocated
+#cat:            on the heap.
+
+   Input:
+      size     - number of bytes to allocate
+   Return Code:
+      Pointer to the allocated buffer
+**************************************************************************/
+void *alloc_arena_buffer(const size_t size)
+{
+   LFSARENA *arena;
+   LFSARENABLOCK *block;
+   ARENABUFFER *buffer;
+   size_t need, block_size;
+
+   arena = g_private_get(&current_arena);
+   if(arena == NULL)
+      return(g_malloc(size));
+
+   need = sizeof(ARENABUFFER) + ARENA_ALIGN(size);
+   g_assert(need > size);
+
+   /* Start a new block if the current one is full. */
+   block = arena->blocks;
+   if((block == NULL) || (block->size - block->used < need)){
+      block_size = max(LFS_ARENA_BLOCK_SIZE, need);
+      block = new_arena_block(block_size);
+      block->next = arena->blocks;
+      arena->blocks = block;
+
+      arena->stats.num_blocks++;
+      arena->stats.size += block_size;
+   }
+
+   if(block->used < block->peak)
+      arena->stats.num_reused++;
+   arena->stats.num_allocs++;
+
+   buffer = ARENA_BUFFER(block, block->used);
+   buffer->prev = block->last;
+   buffer->freed = FALSE;
+   block->last = block->used;
+   block->used += need;
+   block->peak = max(block->peak, block->used);
+
+   return(buffer + 1);
+}
+
+/*************************************************************************
+**************************************************************************
+#cat: free_arena_buffer - Releases a buffer allocated by alloc_arena_buffer().
+#cat:            The space is reclaimed right away if it is at the end of
+#cat:            the current block, otherwise when free_lfsarena() is called.
+
+   Input:
+      ptr      - buffer to be released, may be NULL
+**************************************************************************/
+void free_arena_buffer(void *ptr)
+{
+   LFSARENA *arena;
+   LFSARENABLOCK *block;
+
+   if(ptr == NULL)
+      return;
+
+   arena = g_private_get(&current_arena);
+   if(arena == NULL){
+      g_free(ptr);
+      return;
+   }
+
+   ((ARENABUFFER *)ptr - 1)->freed = TRUE;
+
+   /* Reclaim all released buffers at the end of the current block. */
+   block = arena->blocks;
+   while((block->last != ARENA_NONE) &&
+         ARENA_BUFFER(block, block->last)->freed){
+      block->used = block->last;
+      block->last = ARENA_BUFFER(block, block->last)->prev;
+   }
+}
@@ -198,3 +198,29 @@ patch -p0 < fix-scan-build-reports.patch
 
 # Add pass to remove perimeter points
 patch -p0 < remove-perimeter-pts.patch
+
+# Make Bozorth3 matching reentrant by moving the global state into
+# a BzMatchContext
+patch -p0 < bozorth-match-context.patch
+
+# Allow keeping the pruned gallery tables of a print around
+patch -p0 < bozorth-gallery-tables.patch
+
+# Size the minutiae columns of struct xyt_struct to the number of minutiae
+patch -p0 < bozorth-compact-xyt.patch
+
+# Make the global tables const and allow sharing the lookup tables of
+# the minutiae detection between threads
+patch -p0 < mindtct-shared-tables.patch
+
+# Compute the DFT powers of all wave forms in one vectorized pass
+patch -p0 < mindtct-dft-simd.patch
+
+# Take short lived working buffers from a per-extraction arena
+patch -p0 < mindtct-arena.patch
+
+# Analyze the blocks of the initial image maps in several threads
+patch -p0 < mindtct-threaded-maps.patch
+
+# Allow keeping the working memory arena across several extractions
+patch -p0 < mindtct-arena-reuse.patch
@@ -0,0 +1,728 @@
+/*
+ * Unit tests for minutiae detection
+ * Copyright (C) 2026 The libfprint authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <cairo.h>
+#include <math.h>
+#include "fpi-image.h"
+#include "fp-print-private.h"
+#include "test-config.h"
+
+#include "lfs.h"
+
+#define N_IMAGES 8
+#define DFT_IMAGE_SIZE 256
+#define DFT_BLOCKS 200
+
+/* Utility functions */
+
+/* Loads a capture, if @crop is set, the image is made a bit smaller so
+ * that it has a different size than the original. */
+static FpImage *
+load_capture (const char *driver, gboolean crop)
+{
+  g_autofree char *path = NULL;
+  cairo_surface_t *img;
+  FpImage *fp_img;
+  guchar *data;
+  gint width, height, stride;
+  gint x, y;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", driver, "capture.png", NULL);
+
+  img = cairo_image_surface_create_from_png (path);
+  g_assert_cmpint (cairo_surface_status (img), ==, CAIRO_STATUS_SUCCESS);
+  g_assert_cmpint (cairo_image_surface_get_format (img), ==, CAIRO_FORMAT_RGB24);
+  data = cairo_image_surface_get_data (img);
+  width = cairo_image_surface_get_width (img);
+  height = cairo_image_surface_get_height (img);
+  stride = cairo_image_surface_get_stride (img);
+
+  if (crop)
+    {
+      width -= 8;
+      height -= 8;
+    }
+
+  fp_img = fp_image_new (width, height);
+  fp_img->ppmm = 19.685; /* 500 dpi */
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      fp_img->data[x + y * width] = data[x * 4 + y * stride + 1];
+
+  cairo_surface_destroy (img);
+
+  return fp_img;
+}
+
+/* Creates a large image by tiling a capture 2x2 */
+static FpImage *
+load_tiled_capture (const char *driver)
+{
+  g_autoptr(FpImage) capture = load_capture (driver, FALSE);
+  FpImage *fp_img;
+  guint x, y;
+
+  fp_img = fp_image_new (capture->width * 2, capture->height * 2);
+  fp_img->ppmm = capture->ppmm;
+  for (y = 0; y < fp_img->height; y++)
+    for (x = 0; x < fp_img->width; x++)
+      fp_img->data[x + y * fp_img->width] =
+        capture->data[x % capture->width + (y % capture->height) * capture->width];
+
+  return fp_img;
+}
+
+static void
+on_minutiae_detected (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  g_autoptr(GError) error = NULL;
+  gint *pending = user_data;
+
+  fp_image_detect_minutiae_finish (FP_IMAGE (source_object), res, &error);
+  g_assert_no_error (error);
+
+  *pending -= 1;
+}
+
+static void
+detect_minutiae (FpImage **images, gint n_images)
+{
+  gint pending = n_images;
+  gint i;
+
+  /* All detections run in parallel */
+  for (i = 0; i < n_images; i++)
+    fp_image_detect_minutiae (images[i], NULL, on_minutiae_detected, &pending);
+
+  while (pending > 0)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+static void
+async_result_ready (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GTask **task = user_data;
+
+  *task = g_object_ref (G_TASK (res));
+}
+
+static void
+assert_same_minutiae (FpImage *a, FpImage *b)
+{
+  GPtrArray *ma = fp_image_get_minutiae (a);
+  GPtrArray *mb = fp_image_get_minutiae (b);
+  gsize la, lb;
+  const guchar *ba, *bb;
+  guint i;
+
+  g_assert_nonnull (ma);
+  g_assert_nonnull (mb);
+  g_assert_cmpuint (ma->len, ==, mb->len);
+
+  for (i = 0; i < ma->len; i++)
+    {
+      gint xa, ya, xb, yb;
+
+      fp_minutia_get_coords (g_ptr_array_index (ma, i), &xa, &ya);
+      fp_minutia_get_coords (g_ptr_array_index (mb, i), &xb, &yb);
+      g_assert_cmpint (xa, ==, xb);
+      g_assert_cmpint (ya, ==, yb);
+    }
+
+  ba = fp_image_get_binarized (a, &la);
+  bb = fp_image_get_binarized (b, &lb);
+  g_assert_cmpmem (ba, la, bb, lb);
+}
+
+/* Straightforward DFT power computation, the way NBIS originally did it */
+static void
+reference_dir_powers (double **powers, const unsigned char *pdata,
+                      int blkoffset, int pw, const DFTWAVES *dftwaves,
+                      const ROTGRIDS *dftgrids)
+{
+  g_autofree int *rowsums = g_new0 (int, dftgrids->grid_w);
+  int dir, w, i;
+
+  for (dir = 0; dir < dftgrids->ngrids; dir++)
+    {
+      sum_rot_block_rows (rowsums, pdata + blkoffset, dftgrids->grids[dir],
+                          dftgrids->grid_w);
+
+      for (w = 0; w < dftwaves->nwaves; w++)
+        {
+          double cospart = 0.0, sinpart = 0.0;
+
+          for (i = 0; i < dftwaves->wavelen; i++)
+            {
+              cospart += (rowsums[i] * dftwaves->waves[w]->cos[i]);
+              sinpart += (rowsums[i] * dftwaves->waves[w]->sin[i]);
+            }
+
+          powers[w][dir] = (cospart * cospart) + (sinpart * sinpart);
+        }
+    }
+}
+
+/* Returns a padded random image, the way lfs_detect_minutiae_V2() pads it */
+static unsigned char *
+random_padded_image (const LFSTABLES *tables, GRand *rand, int *pw)
+{
+  unsigned char *pdata;
+  int size, i;
+
+  *pw = tables->iw + 2 * tables->pad;
+  size = *pw * (tables->ih + 2 * tables->pad);
+  pdata = g_malloc (size);
+  for (i = 0; i < size; i++)
+    pdata[i] = g_rand_int_range (rand, 0, 256);
+
+  return pdata;
+}
+
+/* Offset of a random block within the unpadded part of the image */
+static int
+random_block_offset (const LFSTABLES *tables, GRand *rand, int pw)
+{
+  int x = g_rand_int_range (rand, 0, tables->iw - g_lfsparms_V2.blocksize);
+  int y = g_rand_int_range (rand, 0, tables->ih - g_lfsparms_V2.blocksize);
+
+  return (y + tables->pad) * pw + x + tables->pad;
+}
+
+/* Normalizes a copy of the image pixel by pixel */
+static guint8 *
+reference_normalize (const guint8 *data, guint width, guint height,
+                     FpiImageFlags flags)
+{
+  guint8 *out = g_malloc (width * height);
+  guint x, y;
+
+  for (y = 0; y < height; y++)
+    for (x = 0; x < width; x++)
+      {
+        guint sx = flags & FPI_IMAGE_H_FLIPPED ? width - x - 1 : x;
+        guint sy = flags & FPI_IMAGE_V_FLIPPED ? height - y - 1 : y;
+        guint8 p = data[sx + sy * width];
+
+        out[x + y * width] = flags & FPI_IMAGE_COLORS_INVERTED ? 0xff - p : p;
+      }
+
+  return out;
+}
+
+/* Two pass computations with 64 bit accumulators */
+static gint
+reference_std_sq_dev (const guint8 *buf, gint size)
+{
+  guint64 res = 0, mean = 0;
+  gint i;
+
+  for (i = 0; i < size; i++)
+    mean += buf[i];
+
+  mean /= size;
+
+  for (i = 0; i < size; i++)
+    {
+      gint64 dev = (gint64) buf[i] - (gint64) mean;
+      res += dev * dev;
+    }
+
+  return res / size;
+}
+
+static gint
+reference_mean_sq_diff_norm (const guint8 *buf1, const guint8 *buf2, gint size)
+{
+  guint64 res = 0;
+  gint i;
+
+  for (i = 0; i < size; i++)
+    {
+      gint dev = (gint) buf1[i] - (gint) buf2[i];
+      res += dev * dev;
+    }
+
+  return res / size;
+}
+
+/* Tests */
+
+static void
+test_minutiae_concurrent (void)
+{
+  g_autoptr(FpImage) reference = load_capture ("vfs5011", FALSE);
+  g_autoptr(FpImage) cropped_reference = load_capture ("vfs5011", TRUE);
+  FpImage *images[N_IMAGES];
+  gint i;
+
+  /* Serial detection first, for both image sizes */
+  detect_minutiae (&reference, 1);
+  detect_minutiae (&cropped_reference, 1);
+  g_assert_cmpuint (fp_image_get_minutiae (reference)->len, >, 0);
+
+  /* Then mix both sizes in parallel */
+  for (i = 0; i < N_IMAGES; i++)
+    images[i] = load_capture ("vfs5011", i % 2);
+
+  detect_minutiae (images, N_IMAGES);
+
+  for (i = 0; i < N_IMAGES; i++)
+    {
+      assert_same_minutiae (images[i], i % 2 ? cropped_reference : reference);
+      g_object_unref (images[i]);
+    }
+}
+
+static void
+test_minutiae_threads (void)
+{
+  g_autoptr(FpImage) reference = load_tiled_capture ("vfs5011");
+  guint threads[] = { 2, 3, 8 };
+  guint i;
+
+  reference->detection_threads = 1;
+  detect_minutiae (&reference, 1);
+
+  for (i = 0; i < G_N_ELEMENTS (threads); i++)
+    {
+      g_autoptr(FpImage) image = load_tiled_capture ("vfs5011");
+
+      image->detection_threads = threads[i];
+      detect_minutiae (&image, 1);
+      assert_same_minutiae (image, reference);
+    }
+}
+
+static void
+on_minutiae_batch_detected (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  GPtrArray **prints = user_data;
+  g_autoptr(GError) error = NULL;
+
+  g_assert_null (source_object);
+  *prints = fp_image_detect_minutiae_batch_finish (res, &error);
+  g_assert_no_error (error);
+  g_assert_nonnull (*prints);
+}
+
+/* Creates the print of an image with detected minutiae */
+static FpPrint *
+make_image_print (FpImage *image)
+{
+  g_autoptr(GError) error = NULL;
+  FpPrint *print = g_object_new (FP_TYPE_PRINT,
+                                 "driver", "test",
+                                 "device-id", "0",
+                                 NULL);
+
+  g_object_ref_sink (print);
+  fpi_print_set_type (print, FPI_PRINT_NBIS);
+  g_assert_true (fpi_print_add_from_image (print, image, &error));
+  g_assert_no_error (error);
+
+  return print;
+}
+
+static void
+test_minutiae_batch (void)
+{
+  g_autoptr(FpImage) reference = load_capture ("vfs5011", FALSE);
+  g_autoptr(FpImage) cropped_reference = load_capture ("vfs5011", TRUE);
+  g_autoptr(FpPrint) reference_print = NULL;
+  g_autoptr(FpPrint) cropped_reference_print = NULL;
+  g_autoptr(GPtrArray) images = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr(GPtrArray) prints = NULL;
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GTask) task = NULL;
+  FpImage *blank;
+  gint i;
+
+  detect_minutiae (&reference, 1);
+  detect_minutiae (&cropped_reference, 1);
+  reference_print = make_image_print (reference);
+  cropped_reference_print = make_image_print (cropped_reference);
+
+  for (i = 0; i < N_IMAGES; i++)
+    g_ptr_array_add (images, load_capture ("vfs5011", i % 2));
+
+  /* No minutiae can be found in a blank image, the others still are */
+  blank = fp_image_new (reference->width, reference->height);
+  blank->ppmm = reference->ppmm;
+  g_ptr_array_insert (images, 3, blank);
+
+  fp_image_detect_minutiae_batch (images, "test", "0", NULL,
+                                  on_minutiae_batch_detected, &prints);
+  while (!prints)
+    g_main_context_iteration (NULL, TRUE);
+
+  /* The prints are returned in order and the images are left alone */
+  g_assert_cmpuint (prints->len, ==, N_IMAGES + 1);
+  g_assert_null (g_ptr_array_index (prints, 3));
+  g_ptr_array_remove_index (prints, 3);
+
+  for (i = 0; i < N_IMAGES; i++)
+    {
+      FpPrint *print = g_ptr_array_index (prints, i);
+
+      g_assert_nonnull (print);
+      g_assert_cmpstr (fp_print_get_driver (print), ==, "test");
+      g_assert_true (fp_print_equal (print, i % 2 ? cropped_reference_print : reference_print));
+      g_assert_null (fp_image_get_minutiae (g_ptr_array_index (images, i < 3 ? i : i + 1)));
+    }
+
+  /* The prints are created for the given driver and device */
+  g_clear_pointer (&prints, g_ptr_array_unref);
+  g_ptr_array_set_size (images, 1);
+  fp_image_detect_minutiae_batch (images, "other", "1", NULL,
+                                  on_minutiae_batch_detected, &prints);
+  while (!prints)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_cmpuint (prints->len, ==, 1);
+  g_assert_nonnull (g_ptr_array_index (prints, 0));
+  g_assert_cmpstr (fp_print_get_driver (g_ptr_array_index (prints, 0)), ==, "other");
+  g_assert_cmpstr (fp_print_get_device_id (g_ptr_array_index (prints, 0)), ==, "1");
+  g_assert_false (fp_print_equal (g_ptr_array_index (prints, 0), reference_print));
+
+  g_cancellable_cancel (cancellable);
+  fp_image_detect_minutiae_batch (images, "test", "0", cancellable, async_result_ready, &task);
+  while (!task)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_assert_null (fp_image_detect_minutiae_batch_finish (G_ASYNC_RESULT (task), &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+}
+
+static void
+test_minutiae_arena (void)
+{
+  g_autoptr(FpImage) image = load_capture ("vfs5011", FALSE);
+  g_autofree guchar *idata = NULL;
+  g_autofree gint *quality_map = NULL;
+  gint *direction_map[2], *low_contrast_map[2];
+  gint *low_flow_map[2], *high_curve_map[2];
+  guchar *bdata[2];
+  MINUTIAE *minutiae[2];
+  LFSARENA arena = { 0, };
+  LFSALLOCSTATS stats, private_stats;
+  gint map_w, map_h, bw, bh, bd;
+  gint i;
+
+  /* With an arena */
+  idata = g_memdup (image->data, image->width * image->height);
+  g_assert_cmpint (get_minutiae (&minutiae[0], &quality_map, &direction_map[0],
+                                 &low_contrast_map[0], &low_flow_map[0],
+                                 &high_curve_map[0], &map_w, &map_h,
+                                 &bdata[0], &bw, &bh, &bd,
+                                 idata, image->width, image->height, 8,
+                                 image->ppmm, &g_lfsparms_V2, NULL, NULL, &stats), ==, 0);
+
+  /* All working buffers come from a single block, most are reused */
+  g_test_message ("%d working buffers, %d reused, %d blocks of %" G_GSIZE_FORMAT " bytes",
+                  stats.num_allocs, stats.num_reused, stats.num_blocks, stats.size);
+  g_assert_cmpint (stats.num_allocs, >, 1000);
+  g_assert_cmpint (stats.num_reused, >, stats.num_allocs / 2);
+  g_assert_cmpint (stats.num_blocks, ==, 1);
+  private_stats = stats;
+
+  /* Without an arena everything is allocated on the heap */
+  memcpy (idata, image->data, image->width * image->height);
+  g_assert_cmpint (lfs_detect_minutiae_V2 (&minutiae[1], &direction_map[1],
+                                           &low_contrast_map[1], &low_flow_map[1],
+                                           &high_curve_map[1], &map_w, &map_h,
+                                           &bdata[1], &bw, &bh,
+                                           idata, image->width, image->height,
+                                           &g_lfsparms_V2, NULL), ==, 0);
+
+  g_assert_cmpint (minutiae[0]->num, ==, minutiae[1]->num);
+  for (i = 0; i < minutiae[0]->num; i++)
+    {
+      g_assert_cmpint (minutiae[0]->list[i]->x, ==, minutiae[1]->list[i]->x);
+      g_assert_cmpint (minutiae[0]->list[i]->y, ==, minutiae[1]->list[i]->y);
+      g_assert_cmpint (minutiae[0]->list[i]->direction, ==, minutiae[1]->list[i]->direction);
+    }
+  g_assert_cmpmem (bdata[0], bw * bh, bdata[1], bw * bh);
+
+  /* An arena kept by the caller needs no new blocks when it is reused,
+   * the other counts are the same as for a new arena every time */
+  for (i = 0; i < 2; i++)
+    {
+      g_autofree gint *kept_quality_map = NULL;
+      g_autofree gint *kept_direction_map = NULL;
+      g_autofree gint *kept_low_contrast_map = NULL;
+      g_autofree gint *kept_low_flow_map = NULL;
+      g_autofree gint *kept_high_curve_map = NULL;
+      g_autofree guchar *kept_bdata = NULL;
+      MINUTIAE *kept_minutiae;
+      gint j;
+
+      memcpy (idata, image->data, image->width * image->height);
+      g_assert_cmpint (get_minutiae (&kept_minutiae, &kept_quality_map, &kept_direction_map,
+                                     &kept_low_contrast_map, &kept_low_flow_map,
+                                     &kept_high_curve_map, &map_w, &map_h,
+                                     &kept_bdata, &bw, &bh, &bd,
+                                     idata, image->width, image->height, 8,
+                                     image->ppmm, &g_lfsparms_V2, NULL, &arena, &stats), ==, 0);
+
+      g_assert_cmpint (stats.num_blocks, ==, i == 0 ? 1 : 0);
+      g_assert_cmpuint (stats.size, ==, i == 0 ? private_stats.size : 0);
+      g_assert_cmpint (stats.num_allocs, ==, private_stats.num_allocs);
+      g_assert_cmpint (stats.num_reused, ==, private_stats.num_reused);
+      g_assert_cmpint (kept_minutiae->num, ==, minutiae[0]->num);
+      for (j = 0; j < kept_minutiae->num; j++)
+        {
+          g_assert_cmpint (kept_minutiae->list[j]->x, ==, minutiae[0]->list[j]->x);
+          g_assert_cmpint (kept_minutiae->list[j]->y, ==, minutiae[0]->list[j]->y);
+        }
+      g_assert_cmpmem (kept_bdata, bw * bh, bdata[0], bw * bh);
+
+      free_minutiae (kept_minutiae);
+    }
+  free_lfsarena (&arena, NULL);
+
+  for (i = 0; i < 2; i++)
+    {
+      free_minutiae (minutiae[i]);
+      g_free (direction_map[i]);
+      g_free (low_contrast_map[i]);
+      g_free (low_flow_map[i]);
+      g_free (high_curve_map[i]);
+      g_free (bdata[i]);
+    }
+}
+
+static void
+test_normalize (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0xf11b);
+  guint width, height, flags, i;
+
+  /* Sizes around the vector width, with odd and even heights */
+  for (width = 1; width < 70; width++)
+    for (height = 1; height < 6; height++)
+      for (flags = 0; flags < 8; flags++)
+        {
+          g_autofree guint8 *data = g_malloc (width * height);
+          g_autofree guint8 *expected = NULL;
+
+          for (i = 0; i < width * height; i++)
+            data[i] = g_rand_int_range (rand, 0, 256);
+
+          expected = reference_normalize (data, width, height, flags);
+          fpi_image_normalize (data, width, height, flags);
+          g_assert_cmpmem (data, width * height, expected, width * height);
+        }
+}
+
+static void
+test_pixel_stats (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0x57a7);
+  gint n, i;
+
+  for (n = 0; n < 500; n++)
+    {
+      /* Mostly line sized buffers, some larger than what fits in 32 bits */
+      gint size = n < 400 ? g_rand_int_range (rand, 1, 300) : g_rand_int_range (rand, 1, 200000);
+      g_autofree guint8 *buf1 = g_malloc (size);
+      g_autofree guint8 *buf2 = g_malloc (size);
+      gboolean extreme = n % 5 == 0;
+
+      for (i = 0; i < size; i++)
+        {
+          buf1[i] = extreme ? 255 : g_rand_int_range (rand, 0, 256);
+          buf2[i] = extreme ? 0 : g_rand_int_range (rand, 0, 256);
+        }
+
+      g_assert_cmpint (fpi_std_sq_dev (buf1, size), ==, reference_std_sq_dev (buf1, size));
+      g_assert_cmpint (fpi_std_sq_dev (buf2, size), ==, reference_std_sq_dev (buf2, size));
+      g_assert_cmpint (fpi_mean_sq_diff_norm (buf1, buf2, size), ==,
+                       reference_mean_sq_diff_norm (buf1, buf2, size));
+    }
+}
+
+static void
+test_pixel_stats_benchmark (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0x57a7);
+  const gint sizes[] = { 144, 3200, 36864 };
+  guint k;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Only run in performance mode");
+      return;
+    }
+
+  for (k = 0; k < G_N_ELEMENTS (sizes); k++)
+    {
+      g_autoptr(GTimer) timer = NULL;
+      g_autofree guint8 *buf1 = g_malloc (sizes[k]);
+      g_autofree guint8 *buf2 = g_malloc (sizes[k]);
+      gint rounds = 10000000 / sizes[k];
+      double elapsed, reference_elapsed;
+      volatile gint sink = 0;
+      gint n;
+
+      for (n = 0; n < sizes[k]; n++)
+        {
+          buf1[n] = g_rand_int_range (rand, 0, 256);
+          buf2[n] = g_rand_int_range (rand, 0, 256);
+        }
+
+      timer = g_timer_new ();
+      for (n = 0; n < rounds; n++)
+        sink += reference_std_sq_dev (buf1, sizes[k]) +
+                reference_mean_sq_diff_norm (buf1, buf2, sizes[k]);
+      reference_elapsed = g_timer_elapsed (timer, NULL);
+
+      g_timer_start (timer);
+      for (n = 0; n < rounds; n++)
+        sink += fpi_std_sq_dev (buf1, sizes[k]) +
+                fpi_mean_sq_diff_norm (buf1, buf2, sizes[k]);
+      elapsed = g_timer_elapsed (timer, NULL);
+
+      g_test_message ("Pixel statistics of %d bytes: %.2f us, reference %.2f us",
+                      sizes[k], elapsed * 1e6 / rounds, reference_elapsed * 1e6 / rounds);
+      g_test_minimized_result (elapsed * 1e6 / rounds,
+                               "Pixel statistics of %d bytes: %.2f us",
+                               sizes[k], elapsed * 1e6 / rounds);
+    }
+}
+
+static void
+test_dft_powers (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0xdf7);
+  g_autofree unsigned char *pdata = NULL;
+  LFSTABLES *tables;
+  double **powers, **expected;
+  int pw, n, dir, w;
+
+  g_assert_cmpint (init_lfstables (&tables, DFT_IMAGE_SIZE, DFT_IMAGE_SIZE,
+                                   &g_lfsparms_V2), ==, 0);
+  pdata = random_padded_image (tables, rand, &pw);
+
+  g_assert_cmpint (alloc_dir_powers (&powers, tables->dftwaves->nwaves,
+                                     tables->dftgrids->ngrids), ==, 0);
+  g_assert_cmpint (alloc_dir_powers (&expected, tables->dftwaves->nwaves,
+                                     tables->dftgrids->ngrids), ==, 0);
+
+  for (n = 0; n < DFT_BLOCKS; n++)
+    {
+      int blkoffset = random_block_offset (tables, rand, pw);
+
+      g_assert_cmpint (dft_dir_powers (powers, pdata, blkoffset, pw,
+                                       tables->ih + 2 * tables->pad,
+                                       tables->dftwaves, tables->dftgrids), ==, 0);
+      reference_dir_powers (expected, pdata, blkoffset, pw,
+                            tables->dftwaves, tables->dftgrids);
+
+      /* The vectorized kernels only differ in the last bits, if the
+       * compiler contracts the reference into fused multiply-adds. */
+      for (w = 0; w < tables->dftwaves->nwaves; w++)
+        for (dir = 0; dir < tables->dftgrids->ngrids; dir++)
+          g_assert_cmpfloat (fabs (powers[w][dir] - expected[w][dir]), <=,
+                             fabs (expected[w][dir]) * 1e-12);
+    }
+
+  free_dir_powers (powers, tables->dftwaves->nwaves);
+  free_dir_powers (expected, tables->dftwaves->nwaves);
+  free_lfstables (tables);
+}
+
+static void
+test_dft_powers_benchmark (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0xdf7);
+  g_autoptr(GTimer) timer = NULL;
+  g_autofree unsigned char *pdata = NULL;
+  g_autofree int *offsets = NULL;
+  LFSTABLES *tables;
+  double **powers;
+  double elapsed, reference_elapsed;
+  int pw, ph, n, rounds;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Only run in performance mode");
+      return;
+    }
+
+  g_assert_cmpint (init_lfstables (&tables, DFT_IMAGE_SIZE, DFT_IMAGE_SIZE,
+                                   &g_lfsparms_V2), ==, 0);
+  pdata = random_padded_image (tables, rand, &pw);
+  ph = tables->ih + 2 * tables->pad;
+  g_assert_cmpint (alloc_dir_powers (&powers, tables->dftwaves->nwaves,
+                                     tables->dftgrids->ngrids), ==, 0);
+
+  offsets = g_new (int, DFT_BLOCKS);
+  for (n = 0; n < DFT_BLOCKS; n++)
+    offsets[n] = random_block_offset (tables, rand, pw);
+
+  /* Warm up caches before timing anything */
+  for (n = 0; n < DFT_BLOCKS; n++)
+    reference_dir_powers (powers, pdata, offsets[n], pw,
+                          tables->dftwaves, tables->dftgrids);
+
+  timer = g_timer_new ();
+  for (rounds = 0; rounds < 100; rounds++)
+    for (n = 0; n < DFT_BLOCKS; n++)
+      reference_dir_powers (powers, pdata, offsets[n], pw,
+                            tables->dftwaves, tables->dftgrids);
+  reference_elapsed = g_timer_elapsed (timer, NULL);
+
+  g_timer_start (timer);
+  for (rounds = 0; rounds < 100; rounds++)
+    for (n = 0; n < DFT_BLOCKS; n++)
+      dft_dir_powers (powers, pdata, offsets[n], pw, ph,
+                      tables->dftwaves, tables->dftgrids);
+  elapsed = g_timer_elapsed (timer, NULL);
+
+  g_test_message ("DFT direction powers: %.2f us per block, reference %.2f us",
+                  elapsed * 1e6 / (100 * DFT_BLOCKS),
+                  reference_elapsed * 1e6 / (100 * DFT_BLOCKS));
+  g_test_minimized_result (elapsed * 1e6 / (100 * DFT_BLOCKS),
+                           "DFT direction powers: %.2f us per block",
+                           elapsed * 1e6 / (100 * DFT_BLOCKS));
+
+  free_dir_powers (powers, tables->dftwaves->nwaves);
+  free_lfstables (tables);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/image/minutiae/concurrent", test_minutiae_concurrent);
+  g_test_add_func ("/image/minutiae/threads", test_minutiae_threads);
+  g_test_add_func ("/image/minutiae/batch", test_minutiae_batch);
+  g_test_add_func ("/image/minutiae/arena", test_minutiae_arena);
+  g_test_add_func ("/image/normalize", test_normalize);
+  g_test_add_func ("/image/pixel-stats", test_pixel_stats);
+  g_test_add_func ("/image/pixel-stats-benchmark", test_pixel_stats_benchmark);
+  g_test_add_func ("/image/dft/powers", test_dft_powers);
+  g_test_add_func ("/image/dft/powers-benchmark", test_dft_powers_benchmark);
+
+  return g_test_run ();
+}
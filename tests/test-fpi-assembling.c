@@ -53,6 +53,277 @@ cairo_get_pixel (struct fpi_frame_asmbl_ctx *ctx,
   return c_frame->data[x * 4 + y * c_frame->stride + 1];
 }
 
+/* Exhaustive overlap search as done originally, on get_pixel directly */
+static unsigned int
+reference_find_overlap (struct fpi_frame_asmbl_ctx *ctx,
+                        struct fpi_frame           *first_frame,
+                        struct fpi_frame           *second_frame,
+                        int                        *dx_out,
+                        int                        *dy_out)
+{
+  unsigned int min_error = 255 * ctx->frame_height * ctx->frame_width;
+  int dx, dy;
+
+  for (dy = 2; dy < ctx->frame_height; dy++)
+    for (dx = -8; dx < 8; dx++)
+      {
+        unsigned int width = ctx->frame_width - ABS (dx);
+        unsigned int height = ctx->frame_height - dy;
+        unsigned int x, y, err = 0;
+
+        for (y = 0; y < height; y++)
+          for (x = 0; x < width; x++)
+            {
+              guint8 v1 = ctx->get_pixel (ctx, first_frame, x + MAX (dx, 0), y);
+              guint8 v2 = ctx->get_pixel (ctx, second_frame, x + MAX (-dx, 0), y + dy);
+
+              err += ABS (v1 - v2);
+            }
+
+        err *= ctx->frame_height * ctx->frame_width;
+        err /= height * width;
+
+        if (err < min_error)
+          {
+            min_error = err;
+            *dx_out = -dx;
+            *dy_out = dy;
+          }
+      }
+
+  return min_error;
+}
+
+/* Frames with a varying speed and some sideways movement */
+static GSList *
+make_swipe_frames (struct fpi_frame_asmbl_ctx *ctx,
+                   cairo_surface_t            *img,
+                   GRand                      *rand,
+                   gint                        xborder)
+{
+  GSList *frames = NULL;
+  gint x = xborder;
+  gint y = 0;
+
+  while (y + ctx->frame_height < cairo_image_surface_get_height (img))
+    {
+      cairo_frame *frame = g_new0 (cairo_frame, 1);
+
+      frame->surf = img;
+      frame->width = cairo_image_surface_get_width (img);
+      frame->height = cairo_image_surface_get_height (img);
+      frame->stride = cairo_image_surface_get_stride (img);
+      frame->data = cairo_image_surface_get_data (img);
+      frame->x = x;
+      frame->y = y;
+
+      frames = g_slist_append (frames, frame);
+
+      x = CLAMP (x + g_rand_int_range (rand, -2, 3), 0, 2 * xborder);
+      y += g_rand_int_range (rand, 2, ctx->frame_height);
+    }
+
+  return frames;
+}
+
+/* Lines are rows of the test image, some of them repeated to simulate a
+ * varying swipe speed */
+#define TEST_LINE_WIDTH 144
+
+static int
+test_line_deviation (struct fpi_line_asmbl_ctx *ctx,
+                     const guint8 *line1, const guint8 *line2)
+{
+  int res = 0;
+  int i;
+
+  for (i = 0; i < ctx->line_width; i++)
+    res += (line1[i] - line2[i]) * (line1[i] - line2[i]);
+
+  return res;
+}
+
+static int
+test_get_deviation (struct fpi_line_asmbl_ctx *ctx,
+                    GSList *line1, GSList *line2)
+{
+  return test_line_deviation (ctx, line1->data, line2->data);
+}
+
+static unsigned char
+test_get_pixel (struct fpi_line_asmbl_ctx *ctx,
+                GSList *line, unsigned int x)
+{
+  return ((guint8 *) line->data)[x];
+}
+
+static int
+test_get_line_deviation (struct fpi_line_asmbl_ctx *ctx,
+                         FpiFrameStore *lines,
+                         unsigned int line1, unsigned int line2)
+{
+  return test_line_deviation (ctx,
+                              fpi_frame_store_get (lines, line1),
+                              fpi_frame_store_get (lines, line2));
+}
+
+static unsigned char
+test_get_line_pixel (struct fpi_line_asmbl_ctx *ctx,
+                     FpiFrameStore *lines,
+                     unsigned int line, unsigned int x)
+{
+  return ((guint8 *) fpi_frame_store_get (lines, line))[x];
+}
+
+static struct fpi_line_asmbl_ctx line_ctx = {
+  .line_width = TEST_LINE_WIDTH,
+  .max_height = 1000,
+  .resolution = 10,
+  .median_filter_size = 25,
+  .max_search_offset = 30,
+  .get_deviation = test_get_deviation,
+  .get_pixel = test_get_pixel,
+  .get_line_deviation = test_get_line_deviation,
+  .get_line_pixel = test_get_line_pixel,
+};
+
+/* Lines are interpolated from the rows of the test image, moving at a
+ * varying speed and wrapping around at the bottom, until @max_lines. */
+static FpiFrameStore *
+make_swipe_lines (cairo_surface_t *img, GRand *rand, guint max_lines)
+{
+  FpiFrameStore *lines = fpi_frame_store_new (TEST_LINE_WIDTH, max_lines);
+  guchar *data = cairo_image_surface_get_data (img);
+  gint stride = cairo_image_surface_get_stride (img);
+  gint height = cairo_image_surface_get_height (img);
+  gdouble speed = 0.3;
+  gdouble y = 0;
+  guint8 *line;
+  gint x;
+
+  while ((line = fpi_frame_store_append (lines)))
+    {
+      gint y1 = (gint) y % (height - 1);
+      gdouble f = y - (gint) y;
+
+      for (x = 0; x < TEST_LINE_WIDTH; x++)
+        line[x] = (1 - f) * data[(x + 8) * 4 + y1 * stride + 1] +
+                  f * data[(x + 8) * 4 + (y1 + 1) * stride + 1];
+
+      speed = CLAMP (speed + g_rand_double_range (rand, -0.02, 0.02), 0.1, 0.6);
+      y += speed;
+    }
+
+  return lines;
+}
+
+/* Line assembly as originally done, walking the list and sorting the
+ * window for every element of the median filter */
+static int
+reference_cmpint (const void *p1, const void *p2)
+{
+  return *((int *) p1) - *((int *) p2);
+}
+
+static FpImage *
+reference_assemble_lines (struct fpi_line_asmbl_ctx *ctx,
+                          GSList *lines, size_t num_lines)
+{
+  int *offsets = g_new0 (int, num_lines / 2);
+  int *filtered = g_new0 (int, num_lines / 2);
+  int *sortbuf = g_new0 (int, ctx->median_filter_size);
+  guint8 *output = g_malloc0 (ctx->line_width * ctx->max_height);
+  int median_size = (num_lines / 2) - 1;
+  gint32 y_f = 0;
+  int line_ind = 0;
+  GSList *row1, *row2;
+  FpImage *img;
+  int i, j;
+
+  row1 = lines;
+  for (i = 0; (i < num_lines - 1) && row1; i += 2)
+    {
+      int bestmatch = i;
+      int bestdiff = 0;
+      int lastrow = MIN (i + ctx->max_search_offset, num_lines - 1);
+
+      row2 = g_slist_next (row1);
+      for (j = i + 1; j <= lastrow; j++)
+        {
+          int diff = ctx->get_deviation (ctx, row1, row2);
+          if ((j == i + 1) || (diff < bestdiff))
+            {
+              bestdiff = diff;
+              bestmatch = j;
+            }
+          row2 = g_slist_next (row2);
+        }
+      offsets[i / 2] = bestmatch - i;
+      row1 = g_slist_next (g_slist_next (row1));
+    }
+
+  for (i = 0; i < median_size; i++)
+    {
+      int i1 = MAX (i - ((int) ctx->median_filter_size - 1) / 2, 0);
+      int i2 = MIN (i + ((int) ctx->median_filter_size - 1) / 2, median_size - 1);
+
+      memcpy (sortbuf, offsets + i1, (i2 - i1 + 1) * sizeof (int));
+      qsort (sortbuf, i2 - i1 + 1, sizeof (int), reference_cmpint);
+      filtered[i] = sortbuf[(i2 - i1 + 1) / 2];
+    }
+  memcpy (offsets, filtered, MAX (median_size, 0) * sizeof (int));
+
+  row1 = lines;
+  for (i = 0; i < num_lines - 1; i++, row1 = g_slist_next (row1))
+    {
+      int offset = offsets[i / 2];
+      gint32 ynext_f;
+
+      if (offset <= 0)
+        continue;
+
+      ynext_f = y_f + (ctx->resolution << 16) / offset;
+      for (; (line_ind << 16) < ynext_f; line_ind++)
+        {
+          if (line_ind > ctx->max_height - 1)
+            goto out;
+
+          for (j = 0; j < ctx->line_width; j++)
+            {
+              guint8 p1 = ctx->get_pixel (ctx, row1, j);
+              guint8 p2 = ctx->get_pixel (ctx, g_slist_next (row1), j);
+
+              output[line_ind * ctx->line_width + j] =
+                (((line_ind << 16) - y_f) * p2 + (ynext_f - (line_ind << 16)) * p1) /
+                (ynext_f - y_f);
+            }
+        }
+      y_f = ynext_f;
+    }
+out:
+  img = fp_image_new (ctx->line_width, line_ind);
+  memcpy (img->data, output, ctx->line_width * line_ind);
+
+  g_free (offsets);
+  g_free (filtered);
+  g_free (sortbuf);
+  g_free (output);
+
+  return img;
+}
+
+static GSList *
+frame_store_to_list (FpiFrameStore *store)
+{
+  GSList *list = NULL;
+  guint i;
+
+  for (i = fpi_frame_store_get_length (store); i > 0; i--)
+    list = g_slist_prepend (list, fpi_frame_store_get (store, i - 1));
+
+  return list;
+}
+
 static void
 test_frame_assembling (void)
 {
@@ -127,12 +398,337 @@ test_frame_assembling (void)
   g_assert (1);
 }
 
+static void
+test_movement_estimation (void)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0xa55e);
+  cairo_surface_t *img = NULL;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+  gint xborder = 8;
+  guint frame_heights[] = { 8, 16, 17, 43 };
+  guint k;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+  g_assert_cmpint (cairo_image_surface_get_format (img), ==, CAIRO_FORMAT_RGB24);
+
+  ctx.get_pixel = cairo_get_pixel;
+  ctx.frame_width = cairo_image_surface_get_width (img) - 2 * xborder;
+  ctx.image_width = ctx.frame_width;
+
+  for (k = 0; k < G_N_ELEMENTS (frame_heights); k++)
+    {
+      GSList *frames;
+      GSList *l;
+      int *expected, *rev_expected;
+      int err = 0, rev_err = 0;
+      guint n_frames, i;
+
+      ctx.frame_height = frame_heights[k];
+
+      frames = make_swipe_frames (&ctx, img, rand, xborder);
+
+      /* Every other set is swiped the other way */
+      if (k % 2)
+        frames = g_slist_reverse (frames);
+
+      n_frames = g_slist_length (frames);
+      expected = g_new0 (int, n_frames * 2);
+      rev_expected = g_new0 (int, n_frames * 2);
+
+      /* Both directions are estimated, the one with the lower error wins */
+      for (l = frames, i = 1; l->next != NULL; l = l->next, i++)
+        {
+          err += reference_find_overlap (&ctx, l->next->data, l->data,
+                                         &expected[i * 2], &expected[i * 2 + 1]);
+          rev_err += reference_find_overlap (&ctx, l->data, l->next->data,
+                                             &rev_expected[i * 2], &rev_expected[i * 2 + 1]);
+        }
+
+      fpi_do_movement_estimation (&ctx, frames);
+      for (l = frames->next, i = 1; l != NULL; l = l->next, i++)
+        {
+          cairo_frame *frame = l->data;
+
+          if (err < rev_err)
+            {
+              g_assert_cmpint (frame->frame.delta_x, ==, expected[i * 2]);
+              g_assert_cmpint (frame->frame.delta_y, ==, expected[i * 2 + 1]);
+            }
+          else
+            {
+              g_assert_cmpint (frame->frame.delta_x, ==, -rev_expected[i * 2]);
+              g_assert_cmpint (frame->frame.delta_y, ==, -rev_expected[i * 2 + 1]);
+            }
+        }
+
+      g_slist_free_full (frames, g_free);
+      g_free (expected);
+      g_free (rev_expected);
+    }
+
+  cairo_surface_destroy (img);
+}
+
+static void
+test_frame_assembler (void)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0xf4a3);
+  g_autoptr(FpiFrameAssembler) assembler = NULL;
+  cairo_surface_t *img = NULL;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+  gint xborder = 8;
+  guint k;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+
+  ctx.get_pixel = cairo_get_pixel;
+  ctx.frame_width = cairo_image_surface_get_width (img) - 2 * xborder;
+  ctx.frame_height = 16;
+  ctx.image_width = ctx.frame_width + 2 * xborder;
+
+  assembler = fpi_frame_assembler_new (&ctx);
+
+  /* Once without running the main loop, once with the idle handler
+   * catching up after every frame and once in reverse */
+  for (k = 0; k < 3; k++)
+    {
+      g_autoptr(FpImage) expected = NULL;
+      g_autoptr(FpImage) fp_img = NULL;
+      GSList *frames;
+      GSList *l;
+
+      frames = make_swipe_frames (&ctx, img, rand, xborder);
+      if (k == 2)
+        frames = g_slist_reverse (frames);
+
+      for (l = frames; l != NULL; l = l->next)
+        {
+          fpi_frame_assembler_add_frame (assembler,
+                                         g_memdup (l->data, sizeof (cairo_frame)));
+
+          while (k > 0 && g_main_context_iteration (NULL, FALSE))
+            ;
+        }
+      g_assert_cmpuint (fpi_frame_assembler_get_n_frames (assembler), ==,
+                        g_slist_length (frames));
+
+      fpi_do_movement_estimation (&ctx, frames);
+      expected = fpi_assemble_frames (&ctx, frames);
+
+      fp_img = fpi_frame_assembler_finish (assembler);
+      g_assert_cmpuint (fpi_frame_assembler_get_n_frames (assembler), ==, 0);
+
+      g_assert_cmpint (fp_img->width, ==, expected->width);
+      g_assert_cmpint (fp_img->height, ==, expected->height);
+      g_assert_cmpint (fp_img->flags, ==, expected->flags);
+      g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                       expected->data, expected->width * expected->height);
+
+      g_slist_free_full (frames, g_free);
+    }
+
+  /* Frames that are dropped are freed along with the assembler */
+  fpi_frame_assembler_add_frame (assembler, g_new0 (struct fpi_frame, 1));
+  fpi_frame_assembler_reset (assembler);
+  fpi_frame_assembler_add_frame (assembler, g_new0 (struct fpi_frame, 1));
+
+  g_clear_pointer (&assembler, fpi_frame_assembler_free);
+  g_assert_false (g_main_context_pending (NULL));
+
+  cairo_surface_destroy (img);
+}
+
+static void
+test_frame_store (void)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0x5703);
+  g_autoptr(FpiFrameStore) store = NULL;
+  g_autoptr(FpImage) expected = NULL;
+  g_autoptr(FpImage) fp_img = NULL;
+  cairo_surface_t *img = NULL;
+  struct fpi_frame_asmbl_ctx ctx = { 0, };
+  GSList *frames;
+  GSList *l;
+  gint xborder = 8;
+  guint i;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+
+  ctx.get_pixel = cairo_get_pixel;
+  ctx.frame_width = cairo_image_surface_get_width (img) - 2 * xborder;
+  ctx.frame_height = 16;
+  ctx.image_width = ctx.frame_width + 2 * xborder;
+
+  frames = make_swipe_frames (&ctx, img, rand, xborder);
+
+  store = fpi_frame_store_new (sizeof (cairo_frame), g_slist_length (frames));
+  for (l = frames; l != NULL; l = l->next)
+    memcpy (fpi_frame_store_append (store), l->data, sizeof (cairo_frame));
+
+  /* The store is full */
+  g_assert_null (fpi_frame_store_get_next (store));
+  g_assert_null (fpi_frame_store_append (store));
+  g_assert_cmpuint (fpi_frame_store_get_length (store), ==,
+                    fpi_frame_store_get_max_frames (store));
+
+  fpi_do_movement_estimation (&ctx, frames);
+  expected = fpi_assemble_frames (&ctx, frames);
+
+  fpi_do_movement_estimation_store (&ctx, store);
+  for (l = frames, i = 0; l != NULL; l = l->next, i++)
+    {
+      struct fpi_frame *frame = fpi_frame_store_get (store, i);
+
+      g_assert_cmpint (frame->delta_x, ==, ((struct fpi_frame *) l->data)->delta_x);
+      g_assert_cmpint (frame->delta_y, ==, ((struct fpi_frame *) l->data)->delta_y);
+    }
+
+  fp_img = fpi_assemble_frames_store (&ctx, store);
+  g_assert_cmpint (fp_img->height, ==, expected->height);
+  g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                   expected->data, expected->width * expected->height);
+
+  g_slist_free_full (frames, g_free);
+  g_clear_object (&expected);
+  g_clear_object (&fp_img);
+  g_clear_pointer (&store, fpi_frame_store_free);
+
+  /* Lines, with a store that is too small for all of them */
+  store = make_swipe_lines (img, rand, 500);
+  g_assert_cmpuint (fpi_frame_store_get_length (store), ==, 500);
+
+  frames = frame_store_to_list (store);
+
+  expected = fpi_assemble_lines (&line_ctx, frames, g_slist_length (frames));
+  fp_img = fpi_assemble_lines_store (&line_ctx, store);
+
+  g_assert_cmpint (fp_img->height, ==, expected->height);
+  g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                   expected->data, expected->width * expected->height);
+
+  /* Truncating keeps the first lines */
+  fpi_frame_store_truncate (store, 100);
+  g_assert_cmpuint (fpi_frame_store_get_length (store), ==, 100);
+  g_assert_true (fpi_frame_store_get (store, 99) == g_slist_nth_data (frames, 99));
+  g_assert_true (fpi_frame_store_get_next (store) == g_slist_nth_data (frames, 100));
+
+  g_slist_free (frames);
+  cairo_surface_destroy (img);
+}
+
+static void
+test_assemble_lines (void)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0x11e5);
+  cairo_surface_t *img = NULL;
+  const guint median_filter_sizes[] = { 1, 2, 25, 99 };
+  struct fpi_line_asmbl_ctx ctx = line_ctx;
+  guint k;
+
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+
+  ctx.max_height = 4000;
+
+  for (k = 0; k < G_N_ELEMENTS (median_filter_sizes); k++)
+    {
+      g_autoptr(FpiFrameStore) store = make_swipe_lines (img, rand, 1500 + 7 * k);
+      g_autoptr(FpImage) expected = NULL;
+      g_autoptr(FpImage) fp_img = NULL;
+      g_autoptr(FpImage) store_img = NULL;
+      GSList *lines = frame_store_to_list (store);
+
+      ctx.median_filter_size = median_filter_sizes[k];
+
+      expected = reference_assemble_lines (&ctx, lines, g_slist_length (lines));
+      fp_img = fpi_assemble_lines (&ctx, lines, g_slist_length (lines));
+      store_img = fpi_assemble_lines_store (&ctx, store);
+
+      g_assert_cmpint (fp_img->height, ==, expected->height);
+      g_assert_cmpmem (fp_img->data, fp_img->width * fp_img->height,
+                       expected->data, expected->width * expected->height);
+      g_assert_cmpmem (store_img->data, store_img->width * store_img->height,
+                       expected->data, expected->width * expected->height);
+
+      g_slist_free (lines);
+    }
+
+  cairo_surface_destroy (img);
+}
+
+static void
+test_assemble_lines_benchmark (void)
+{
+  g_autofree char *path = NULL;
+  g_autoptr(GRand) rand = NULL;
+  cairo_surface_t *img = NULL;
+  const guint num_lines[] = { 1000, 4000, 16000 };
+  struct fpi_line_asmbl_ctx ctx = line_ctx;
+  guint k;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Only run in performance mode (-m perf)");
+      return;
+    }
+
+  rand = g_rand_new_with_seed (0xbe11);
+  path = g_build_path (G_DIR_SEPARATOR_S, SOURCE_ROOT, "tests", "vfs5011", "capture.png", NULL);
+  img = cairo_image_surface_create_from_png (path);
+
+  for (k = 0; k < G_N_ELEMENTS (num_lines); k++)
+    {
+      g_autoptr(FpiFrameStore) store = make_swipe_lines (img, rand, num_lines[k]);
+      GSList *lines = frame_store_to_list (store);
+      gdouble reference_time, list_time, store_time;
+      FpImage *out;
+      gint64 start;
+
+      ctx.max_height = num_lines[k];
+
+      start = g_get_monotonic_time ();
+      out = reference_assemble_lines (&ctx, lines, num_lines[k]);
+      reference_time = (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+      g_object_unref (out);
+
+      start = g_get_monotonic_time ();
+      out = fpi_assemble_lines (&ctx, lines, num_lines[k]);
+      list_time = (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+      g_object_unref (out);
+
+      start = g_get_monotonic_time ();
+      out = fpi_assemble_lines_store (&ctx, store);
+      store_time = (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+      g_object_unref (out);
+
+      g_test_message ("%5u lines: %.4f s before, %.4f s with a list, %.4f s with a store",
+                      num_lines[k], reference_time, list_time, store_time);
+      g_test_minimized_result (store_time, "Line assembly time for %u lines", num_lines[k]);
+
+      g_slist_free (lines);
+    }
+
+  cairo_surface_destroy (img);
+}
+
 int
 main (int argc, char *argv[])
 {
   g_test_init (&argc, &argv, NULL);
 
   g_test_add_func ("/assembling/frames", test_frame_assembling);
+  g_test_add_func ("/assembling/movement-estimation", test_movement_estimation);
+  g_test_add_func ("/assembling/frame-assembler", test_frame_assembler);
+  g_test_add_func ("/assembling/frame-store", test_frame_store);
+  g_test_add_func ("/assembling/lines", test_assemble_lines);
+  g_test_add_func ("/assembling/lines-benchmark", test_assemble_lines_benchmark);
 
   return g_test_run ();
 }
@@ -1919,6 +1919,179 @@ test_driver_identify_error (void)
   g_assert_null (print);
 }
 
+static void
+fake_device_identify_by_index (FpDevice *device)
+{
+  FpiDeviceFake *fake_dev = FPI_DEVICE_FAKE (device);
+  FpPrint *match;
+
+  fake_dev->last_called_function = fake_device_identify_by_index;
+  fpi_device_get_identify_data (device, (GPtrArray **) &fake_dev->action_data);
+
+  match = fpi_print_index_lookup (fpi_device_get_identify_index (device),
+                                  fake_dev->ret_print);
+
+  fpi_device_identify_report (device, match, fake_dev->ret_print, NULL);
+  fpi_device_identify_complete (device, NULL);
+}
+
+static void
+test_driver_identify_gallery (void)
+{
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  g_autoptr(FpAutoCloseDevice) device = NULL;
+  g_autoptr(GPtrArray) prints = NULL;
+  g_autoptr(GPtrArray) gallery_prints = NULL;
+  g_autoptr(FpGallery) gallery = NULL;
+  g_autoptr(FpPrint) removed_match = NULL;
+  g_autoptr(GError) error = NULL;
+  GPtrArray *handed_out = NULL;
+  FpiDeviceFake *fake_dev;
+  gint i;
+
+  dev_class->identify = fake_device_identify_by_index;
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  fake_dev = FPI_DEVICE_FAKE (device);
+  prints = make_fake_prints_gallery (device, 500);
+  gallery = fp_gallery_new_from_prints (prints);
+
+  g_assert_true (fp_device_open_sync (device, NULL, NULL));
+
+  /* The same gallery can be used repeatedly */
+  for (i = 0; i < 2; i++)
+    {
+      g_autoptr(FpPrint) print = NULL;
+      g_autoptr(FpPrint) match = NULL;
+
+      fake_dev->ret_print = make_fake_print (device, g_variant_new_uint64 (42 + i));
+      g_assert_true (fp_device_identify_gallery_sync (device, gallery, NULL,
+                                                      NULL, NULL,
+                                                      &match, &print, &error));
+      g_assert_no_error (error);
+      g_assert (fake_dev->last_called_function == fake_device_identify_by_index);
+      g_assert_true (print == fake_dev->ret_print);
+      g_assert_true (match == g_ptr_array_index (prints, 42 + i));
+
+      /* The driver is handed the prints of the gallery without a copy */
+      if (i == 0)
+        handed_out = fake_dev->action_data;
+      g_assert_true (fake_dev->action_data == handed_out);
+    }
+
+  gallery_prints = fp_gallery_get_prints (gallery);
+  g_assert_true (gallery_prints != handed_out);
+
+  /* Later changes do not affect the prints that were handed out */
+  g_assert_true (fp_gallery_remove (gallery, g_ptr_array_index (prints, 42)));
+  g_assert_cmpuint (gallery_prints->len, ==, 500);
+  g_assert_cmpuint (fp_gallery_get_n_prints (gallery), ==, 499);
+
+  fake_dev->ret_print = make_fake_print (device, g_variant_new_uint64 (42));
+  g_assert_true (fp_device_identify_gallery_sync (device, gallery, NULL,
+                                                  NULL, NULL,
+                                                  &removed_match, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_null (removed_match);
+  g_assert_cmpuint (((GPtrArray *) fake_dev->action_data)->len, ==, 499);
+}
+
+static void
+fake_device_identify_get_mode (FpDevice *device)
+{
+  FpiDeviceFake *fake_dev = FPI_DEVICE_FAKE (device);
+
+  fake_dev->last_called_function = fake_device_identify_get_mode;
+  fake_dev->user_data = GINT_TO_POINTER (fpi_device_get_identify_mode (device));
+
+  fpi_device_identify_report (device, NULL, NULL, NULL);
+  fpi_device_identify_complete (device, NULL);
+}
+
+static void
+test_driver_identify_gallery_mode (void)
+{
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  g_autoptr(FpAutoCloseDevice) device = NULL;
+  g_autoptr(GPtrArray) prints = NULL;
+  g_autoptr(FpGallery) gallery = NULL;
+  g_autoptr(GError) error = NULL;
+  FpiDeviceFake *fake_dev;
+
+  dev_class->identify = fake_device_identify_get_mode;
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  fake_dev = FPI_DEVICE_FAKE (device);
+  prints = make_fake_prints_gallery (device, 10);
+  gallery = fp_gallery_new_from_prints (prints);
+
+  g_assert_true (fp_device_open_sync (device, NULL, NULL));
+
+  /* Plain arrays of prints always use the default */
+  fake_dev->user_data = GINT_TO_POINTER (-1);
+  g_assert_true (fp_device_identify_sync (device, prints, NULL, NULL, NULL,
+                                          NULL, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpint (GPOINTER_TO_INT (fake_dev->user_data), ==, FP_IDENTIFY_MODE_FIRST_MATCH);
+
+  g_assert_cmpint (fp_gallery_get_identify_mode (gallery), ==, FP_IDENTIFY_MODE_FIRST_MATCH);
+  fp_gallery_set_identify_mode (gallery, FP_IDENTIFY_MODE_BEST_MATCH);
+  g_assert_cmpint (fp_gallery_get_identify_mode (gallery), ==, FP_IDENTIFY_MODE_BEST_MATCH);
+
+  fake_dev->user_data = GINT_TO_POINTER (-1);
+  g_assert_true (fp_device_identify_gallery_sync (device, gallery, NULL, NULL, NULL,
+                                                  NULL, NULL, &error));
+  g_assert_no_error (error);
+  g_assert (fake_dev->last_called_function == fake_device_identify_get_mode);
+  g_assert_cmpint (GPOINTER_TO_INT (fake_dev->user_data), ==, FP_IDENTIFY_MODE_BEST_MATCH);
+}
+
+static void
+fake_device_identify_get_prefilter (FpDevice *device)
+{
+  FpiDeviceFake *fake_dev = FPI_DEVICE_FAKE (device);
+
+  fake_dev->last_called_function = fake_device_identify_get_prefilter;
+  fake_dev->user_data = GUINT_TO_POINTER (fpi_device_get_identify_prefilter (device));
+
+  fpi_device_identify_report (device, NULL, NULL, NULL);
+  fpi_device_identify_complete (device, NULL);
+}
+
+static void
+test_driver_identify_gallery_prefilter (void)
+{
+  g_autoptr(FpAutoResetClass) dev_class = auto_reset_device_class ();
+  g_autoptr(FpAutoCloseDevice) device = NULL;
+  g_autoptr(GPtrArray) prints = NULL;
+  g_autoptr(FpGallery) gallery = NULL;
+  g_autoptr(GError) error = NULL;
+  FpiDeviceFake *fake_dev;
+
+  dev_class->identify = fake_device_identify_get_prefilter;
+  device = g_object_new (FPI_TYPE_DEVICE_FAKE, NULL);
+  fake_dev = FPI_DEVICE_FAKE (device);
+  prints = make_fake_prints_gallery (device, 10);
+  gallery = fp_gallery_new_from_prints (prints);
+
+  g_assert_true (fp_device_open_sync (device, NULL, NULL));
+
+  fake_dev->user_data = GUINT_TO_POINTER (G_MAXUINT);
+  g_assert_true (fp_device_identify_sync (device, prints, NULL, NULL, NULL,
+                                          NULL, NULL, &error));
+  g_assert_no_error (error);
+  g_assert_cmpuint (GPOINTER_TO_UINT (fake_dev->user_data), ==, 0);
+
+  g_assert_cmpuint (fp_gallery_get_prefilter_candidates (gallery), ==, 0);
+  fp_gallery_set_prefilter_candidates (gallery, 3);
+  g_assert_cmpuint (fp_gallery_get_prefilter_candidates (gallery), ==, 3);
+
+  fake_dev->user_data = GUINT_TO_POINTER (G_MAXUINT);
+  g_assert_true (fp_device_identify_gallery_sync (device, gallery, NULL, NULL, NULL,
+                                                  NULL, NULL, &error));
+  g_assert_no_error (error);
+  g_assert (fake_dev->last_called_function == fake_device_identify_get_prefilter);
+  g_assert_cmpuint (GPOINTER_TO_UINT (fake_dev->user_data), ==, 3);
+}
+
 static void
 fake_device_identify_immediate_complete (FpDevice *device)
 {
@@ -3446,6 +3619,9 @@ main (int argc, char *argv[])
   g_test_add_func ("/driver/identify/fail", test_driver_identify_fail);
   g_test_add_func ("/driver/identify/retry", test_driver_identify_retry);
   g_test_add_func ("/driver/identify/error", test_driver_identify_error);
+  g_test_add_func ("/driver/identify/gallery", test_driver_identify_gallery);
+  g_test_add_func ("/driver/identify/gallery/mode", test_driver_identify_gallery_mode);
+  g_test_add_func ("/driver/identify/gallery/prefilter", test_driver_identify_gallery_prefilter);
   g_test_add_func ("/driver/identify/not_reported", test_driver_identify_not_reported);
   g_test_add_func ("/driver/identify/complete_retry", test_driver_identify_complete_retry);
   g_test_add_func ("/driver/identify/report_no_cb", test_driver_identify_report_no_callback);
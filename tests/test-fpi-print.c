@@ -0,0 +1,1072 @@
+/*
+ * Unit tests for NBIS print matching
+ * Copyright (C) 2026 The libfprint authors
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+#include "fp-print-private.h"
+#include "fp-gallery-private.h"
+
+#define N_PRINTS 24
+#define N_THREADS 4
+#define THRESHOLD 40
+
+/* Utility functions and shared data */
+
+static struct xyt_struct *test_xyt[N_PRINTS];
+
+static int
+xyt_sort (const void *a, const void *b)
+{
+  return sort_x_y (a, b);
+}
+
+/* Generates a synthetic, sorted minutiae set. If @base is given, most of
+ * its points are reused with some jitter so that the result matches. */
+static struct xyt_struct *
+random_xyt (GRand                   *rand,
+            const struct xyt_struct *base)
+{
+  struct minutiae_struct c[MAX_BOZORTH_MINUTIAE];
+  struct xyt_struct *xyt;
+  gint n = g_rand_int_range (rand, 30, 80);
+  gint i;
+
+  for (i = 0; i < n; i++)
+    {
+      if (base && i < base->nrows && g_rand_int_range (rand, 0, 4) != 0)
+        {
+          c[i].col[0] = base->xcol[i] + g_rand_int_range (rand, -2, 3);
+          c[i].col[1] = base->ycol[i] + g_rand_int_range (rand, -2, 3);
+          c[i].col[2] = base->thetacol[i];
+        }
+      else
+        {
+          c[i].col[0] = g_rand_int_range (rand, 0, 300);
+          c[i].col[1] = g_rand_int_range (rand, 0, 400);
+          c[i].col[2] = g_rand_int_range (rand, -179, 181);
+        }
+      c[i].col[3] = 0;
+    }
+
+  qsort (c, n, sizeof (struct minutiae_struct), xyt_sort);
+
+  xyt = xyt_struct_new (n);
+  for (i = 0; i < n; i++)
+    {
+      xyt->xcol[i] = c[i].col[0];
+      xyt->ycol[i] = c[i].col[1];
+      xyt->thetacol[i] = c[i].col[2];
+    }
+
+  return xyt;
+}
+
+static void
+setup_test_xyt (void)
+{
+  g_autoptr(GRand) rand = g_rand_new_with_seed (0x5eed);
+  gint i;
+
+  for (i = 0; i < N_PRINTS; i++)
+    test_xyt[i] = random_xyt (rand, (i % 3) ? test_xyt[i - 1] : NULL);
+}
+
+static void
+compute_scores (BzMatchContext *ctx, gint *scores)
+{
+  gint i, j;
+
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      gint probe_len = bozorth_probe_init (ctx, test_xyt[i]);
+
+      for (j = 0; j < N_PRINTS; j++)
+        scores[i * N_PRINTS + j] = bozorth_to_gallery (ctx, probe_len,
+                                                       test_xyt[i],
+                                                       test_xyt[j]);
+    }
+}
+
+static gpointer
+compute_scores_thread (gpointer user_data)
+{
+  BzMatchContext *ctx = bz_match_context_new ();
+  gint *scores = g_new0 (gint, N_PRINTS * N_PRINTS);
+
+  compute_scores (ctx, scores);
+  bz_match_context_free (ctx);
+
+  return scores;
+}
+
+static FpPrint *
+make_nbis_print (const struct xyt_struct *xyt)
+{
+  FpPrint *print = g_object_new (FP_TYPE_PRINT,
+                                 "driver", "test",
+                                 "device-id", "0",
+                                 NULL);
+
+  g_object_ref_sink (print);
+
+  fpi_print_set_type (print, FPI_PRINT_NBIS);
+  g_ptr_array_add (print->prints, xyt_struct_dup (xyt));
+
+  return print;
+}
+
+static GPtrArray *
+make_test_gallery (void)
+{
+  GPtrArray *gallery = g_ptr_array_new_with_free_func (g_object_unref);
+  gint i;
+
+  for (i = 0; i < N_PRINTS; i++)
+    g_ptr_array_add (gallery, make_nbis_print (test_xyt[i]));
+
+  return gallery;
+}
+
+typedef struct
+{
+  gboolean completed;
+  FpPrint *match;
+  GError  *error;
+} IdentifyResult;
+
+static void
+on_identify_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  IdentifyResult *result = user_data;
+
+  result->match = fpi_print_bz3_identify_finish (FP_PRINT (source_object),
+                                                 res, &result->error);
+  result->completed = TRUE;
+}
+
+static void
+run_identify (GPtrArray           *gallery,
+              FpPrint             *probe,
+              FpIdentifyMode       mode,
+              guint                prefilter,
+              GCancellable        *cancellable,
+              IdentifyResult      *result)
+{
+  fpi_print_bz3_identify (gallery, probe, THRESHOLD, mode, prefilter,
+                          cancellable, on_identify_done, result);
+
+  while (!result->completed)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+typedef struct
+{
+  gboolean completed;
+  GArray  *candidates;
+  GError  *error;
+} RankedResult;
+
+static void
+on_identify_ranked_done (GObject *source_object, GAsyncResult *res, gpointer user_data)
+{
+  RankedResult *result = user_data;
+
+  result->candidates = fpi_print_bz3_identify_ranked_finish (FP_PRINT (source_object),
+                                                             res, &result->error);
+  result->completed = TRUE;
+}
+
+static const gint *sort_scores;
+
+static gint
+compare_by_score (gconstpointer a, gconstpointer b)
+{
+  gint ia = *(const gint *) a;
+  gint ib = *(const gint *) b;
+
+  if (sort_scores[ia] != sort_scores[ib])
+    return sort_scores[ib] - sort_scores[ia];
+
+  return ia - ib;
+}
+
+/* Tests */
+
+static void
+test_bz3_concurrent_scores (void)
+{
+  g_autofree gint *serial = g_new0 (gint, N_PRINTS * N_PRINTS);
+  GThread *threads[N_THREADS];
+  BzMatchContext *ctx;
+  gint i;
+
+  ctx = bz_match_context_new ();
+  compute_scores (ctx, serial);
+  bz_match_context_free (ctx);
+
+  /* Sanity check, a print must always match itself */
+  g_assert_cmpint (serial[0], >=, THRESHOLD);
+
+  for (i = 0; i < N_THREADS; i++)
+    threads[i] = g_thread_new ("bz3-test", compute_scores_thread, NULL);
+
+  for (i = 0; i < N_THREADS; i++)
+    {
+      g_autofree gint *scores = g_thread_join (threads[i]);
+
+      g_assert_cmpmem (scores, sizeof (gint) * N_PRINTS * N_PRINTS,
+                       serial, sizeof (gint) * N_PRINTS * N_PRINTS);
+    }
+}
+
+static void
+test_bz3_gallery_tables (void)
+{
+  g_autoptr(GPtrArray) gallery = make_test_gallery ();
+  BzMatchContext *ctx = bz_match_context_new ();
+  gint i, j;
+
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      gint probe_len = bozorth_probe_init (ctx, test_xyt[i]);
+
+      for (j = 0; j < N_PRINTS; j++)
+        {
+          FpPrint *template = g_ptr_array_index (gallery, j);
+          GPtrArray *tables = fpi_print_ensure_bz3_tables (template);
+          gint score;
+
+          g_assert_cmpuint (tables->len, ==, 1);
+          g_assert_true (fpi_print_ensure_bz3_tables (template) == tables);
+
+          score = bozorth_to_gallery (ctx, probe_len, test_xyt[i], test_xyt[j]);
+          g_assert_cmpint (bozorth_to_gallery_table (ctx, probe_len,
+                                                     test_xyt[i], test_xyt[j],
+                                                     g_ptr_array_index (tables, 0)),
+                           ==, score);
+        }
+    }
+
+  bz_match_context_free (ctx);
+}
+
+static void
+test_bz3_match_cache_serialize (void)
+{
+  g_autoptr(FpPrint) print = make_nbis_print (test_xyt[0]);
+  g_autoptr(FpPrint) loaded = make_nbis_print (test_xyt[0]);
+  g_autoptr(FpPrint) other = make_nbis_print (test_xyt[1]);
+  g_autoptr(GError) error = NULL;
+  g_autofree guchar *data = NULL;
+  struct bz_gallery_table *a, *b;
+  gsize length;
+
+  g_assert_true (fp_print_serialize_match_cache (print, &data, &length, &error));
+  g_assert_no_error (error);
+
+  g_assert_false (fp_print_load_match_cache (other, data, length, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_clear_error (&error);
+
+  g_assert_true (fp_print_load_match_cache (loaded, data, length, &error));
+  g_assert_no_error (error);
+
+  a = g_ptr_array_index (fpi_print_ensure_bz3_tables (print), 0);
+  b = g_ptr_array_index (fpi_print_ensure_bz3_tables (loaded), 0);
+  g_assert_cmpmem (a, BZ_GALLERY_TABLE_SIZE (a->nrows),
+                   b, BZ_GALLERY_TABLE_SIZE (b->nrows));
+
+  /* Changing the print drops the cache */
+  fpi_print_add_print (loaded, other);
+  g_assert_cmpuint (fpi_print_ensure_bz3_tables (loaded)->len, ==, 2);
+}
+
+static void
+test_bz3_identify (void)
+{
+  g_autoptr(GPtrArray) gallery = make_test_gallery ();
+  g_autofree gint *serial = g_new0 (gint, N_PRINTS * N_PRINTS);
+  BzMatchContext *ctx;
+  gint i, j;
+
+  ctx = bz_match_context_new ();
+  compute_scores (ctx, serial);
+  bz_match_context_free (ctx);
+
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      g_autoptr(FpPrint) probe = make_nbis_print (test_xyt[i]);
+      IdentifyResult first = { 0, };
+      IdentifyResult best = { 0, };
+      gint *scores = &serial[i * N_PRINTS];
+      gint expected_first = -1;
+      gint expected_best = -1;
+
+      for (j = 0; j < N_PRINTS; j++)
+        {
+          if (scores[j] < THRESHOLD)
+            continue;
+
+          if (expected_first < 0)
+            expected_first = j;
+          if (expected_best < 0 || scores[j] > scores[expected_best])
+            expected_best = j;
+        }
+
+      run_identify (gallery, probe, FP_IDENTIFY_MODE_FIRST_MATCH, 0, NULL, &first);
+      g_assert_no_error (first.error);
+      g_assert_true (first.match == (expected_first < 0 ? NULL : g_ptr_array_index (gallery, expected_first)));
+
+      run_identify (gallery, probe, FP_IDENTIFY_MODE_BEST_MATCH, 0, NULL, &best);
+      g_assert_no_error (best.error);
+      g_assert_true (best.match == (expected_best < 0 ? NULL : g_ptr_array_index (gallery, expected_best)));
+
+      g_clear_object (&first.match);
+      g_clear_object (&best.match);
+    }
+}
+
+static void
+test_bz3_identify_prefilter (void)
+{
+  g_autoptr(GPtrArray) gallery = make_test_gallery ();
+  g_autofree gint *serial = g_new0 (gint, N_PRINTS * N_PRINTS);
+  BzMatchContext *ctx;
+  gint i;
+
+  ctx = bz_match_context_new ();
+  compute_scores (ctx, serial);
+  bz_match_context_free (ctx);
+
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      g_autoptr(FpPrint) probe = make_nbis_print (test_xyt[i]);
+      IdentifyResult single = { 0, };
+      IdentifyResult few = { 0, };
+      guint match;
+
+      /* An identical print always passes the pre-filter */
+      run_identify (gallery, probe, FP_IDENTIFY_MODE_FIRST_MATCH, 1, NULL, &single);
+      g_assert_no_error (single.error);
+      g_assert_true (single.match == g_ptr_array_index (gallery, i));
+
+      /* So the first match can only be an earlier print */
+      run_identify (gallery, probe, FP_IDENTIFY_MODE_FIRST_MATCH, 8, NULL, &few);
+      g_assert_no_error (few.error);
+      g_assert_nonnull (few.match);
+      g_assert_true (g_ptr_array_find (gallery, few.match, &match));
+      g_assert_cmpuint (match, <=, i);
+      g_assert_cmpint (serial[i * N_PRINTS + match], >=, THRESHOLD);
+
+      g_clear_object (&single.match);
+      g_clear_object (&few.match);
+    }
+}
+
+static void
+test_bz3_identify_prefilter_benchmark (void)
+{
+  const guint gallery_sizes[] = { 100, 1000, 10000, 100000 };
+  const gdouble penetrations[] = { 0.01, 0.05, 0.2, 1.0 };
+  const guint n_probes = 10;
+  const guint max_matched = 10000;
+  g_autoptr(GRand) rand = NULL;
+  guint s, p, k;
+
+  if (!g_test_perf ())
+    {
+      g_test_skip ("Only run in performance mode (-m perf)");
+      return;
+    }
+
+  rand = g_rand_new_with_seed (0xbe4c);
+
+  for (s = 0; s < G_N_ELEMENTS (gallery_sizes); s++)
+    {
+      g_autoptr(GPtrArray) gallery = g_ptr_array_new_with_free_func (g_object_unref);
+      g_autoptr(GPtrArray) probes = g_ptr_array_new_with_free_func (g_object_unref);
+      g_autofree guint *mates = g_new (guint, n_probes);
+
+      for (k = 0; k < gallery_sizes[s]; k++)
+        {
+          g_autofree struct xyt_struct *xyt = random_xyt (rand, NULL);
+
+          g_ptr_array_add (gallery, make_nbis_print (xyt));
+        }
+
+      for (k = 0; k < n_probes; k++)
+        {
+          g_autofree struct xyt_struct *xyt = NULL;
+          FpPrint *mate;
+
+          mates[k] = g_rand_int_range (rand, 0, gallery_sizes[s]);
+          mate = g_ptr_array_index (gallery, mates[k]);
+          xyt = random_xyt (rand, g_ptr_array_index (mate->prints, 0));
+          g_ptr_array_add (probes, make_nbis_print (xyt));
+        }
+
+      for (p = 0; p < G_N_ELEMENTS (penetrations); p++)
+        {
+          guint prefilter = MAX (1, penetrations[p] * gallery_sizes[s]);
+          guint found = 0;
+          gint64 start;
+          gdouble elapsed;
+
+          if (prefilter > max_matched)
+            continue;
+          if (prefilter >= gallery_sizes[s])
+            prefilter = 0;
+
+          start = g_get_monotonic_time ();
+          for (k = 0; k < n_probes; k++)
+            {
+              IdentifyResult result = { 0, };
+
+              run_identify (gallery, g_ptr_array_index (probes, k),
+                            FP_IDENTIFY_MODE_BEST_MATCH, prefilter, NULL, &result);
+              g_assert_no_error (result.error);
+
+              if (result.match == g_ptr_array_index (gallery, mates[k]))
+                found++;
+              g_clear_object (&result.match);
+            }
+          elapsed = (g_get_monotonic_time () - start) / (gdouble) G_USEC_PER_SEC;
+
+          g_test_message ("gallery %6u, penetration %5.1f%%: %.4f s per identify, %u/%u mates found",
+                          gallery_sizes[s], penetrations[p] * 100,
+                          elapsed / n_probes, found, n_probes);
+          g_test_minimized_result (elapsed / n_probes,
+                                   "Identify time with gallery %u and penetration %.1f%%",
+                                   gallery_sizes[s], penetrations[p] * 100);
+        }
+    }
+}
+
+static void
+test_bz3_identify_cancelled (void)
+{
+  g_autoptr(GPtrArray) gallery = make_test_gallery ();
+  g_autoptr(FpPrint) probe = make_nbis_print (test_xyt[0]);
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  IdentifyResult result = { 0, };
+
+  g_cancellable_cancel (cancellable);
+  run_identify (gallery, probe, FP_IDENTIFY_MODE_BEST_MATCH, 0, cancellable, &result);
+
+  g_assert_error (result.error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_null (result.match);
+  g_clear_error (&result.error);
+}
+
+static void
+test_bz3_identify_ranked (void)
+{
+  g_autoptr(GPtrArray) gallery = make_test_gallery ();
+  g_autofree gint *serial = g_new0 (gint, N_PRINTS * N_PRINTS);
+  const guint n_candidates[] = { 1, 5, N_PRINTS + 1 };
+  BzMatchContext *ctx;
+  gint i, j;
+  guint k;
+
+  ctx = bz_match_context_new ();
+  compute_scores (ctx, serial);
+  bz_match_context_free (ctx);
+
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      g_autoptr(FpPrint) probe = make_nbis_print (test_xyt[i]);
+      gint order[N_PRINTS];
+
+      for (j = 0; j < N_PRINTS; j++)
+        order[j] = j;
+      sort_scores = &serial[i * N_PRINTS];
+      qsort (order, N_PRINTS, sizeof (gint), compare_by_score);
+
+      for (k = 0; k < G_N_ELEMENTS (n_candidates); k++)
+        {
+          RankedResult result = { 0, };
+
+          fpi_print_bz3_identify_ranked (gallery, probe, n_candidates[k], NULL,
+                                         on_identify_ranked_done, &result);
+          while (!result.completed)
+            g_main_context_iteration (NULL, TRUE);
+
+          g_assert_no_error (result.error);
+          g_assert_cmpuint (result.candidates->len, ==, MIN (n_candidates[k], N_PRINTS));
+
+          for (j = 0; j < result.candidates->len; j++)
+            {
+              FpiPrintCandidate *c = &g_array_index (result.candidates, FpiPrintCandidate, j);
+
+              g_assert_true (c->print == g_ptr_array_index (gallery, order[j]));
+              g_assert_cmpint (c->score, ==, serial[i * N_PRINTS + order[j]]);
+            }
+
+          g_array_unref (result.candidates);
+        }
+    }
+}
+
+static void
+test_gallery_identify_ranked (void)
+{
+  g_autoptr(GPtrArray) prints = make_test_gallery ();
+  g_autoptr(FpGallery) gallery = fp_gallery_new_from_prints (prints);
+  g_autoptr(FpPrint) raw = make_raw_print ("test", "raw");
+  g_autofree gint *serial = g_new0 (gint, N_PRINTS * N_PRINTS);
+  BzMatchContext *ctx;
+  gint i, j;
+
+  ctx = bz_match_context_new ();
+  compute_scores (ctx, serial);
+  bz_match_context_free (ctx);
+
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      g_autoptr(FpPrint) probe = make_nbis_print (test_xyt[i]);
+      g_autoptr(GPtrArray) candidates = NULL;
+      g_autoptr(GArray) scores = NULL;
+      g_autoptr(GError) error = NULL;
+      gint order[N_PRINTS];
+
+      for (j = 0; j < N_PRINTS; j++)
+        order[j] = j;
+      sort_scores = &serial[i * N_PRINTS];
+      qsort (order, N_PRINTS, sizeof (gint), compare_by_score);
+
+      candidates = fp_gallery_identify_ranked_sync (gallery, probe, 3, NULL,
+                                                    &scores, &error);
+      g_assert_no_error (error);
+      g_assert_cmpuint (candidates->len, ==, 3);
+      g_assert_cmpuint (scores->len, ==, 3);
+
+      for (j = 0; j < candidates->len; j++)
+        {
+          g_assert_true (g_ptr_array_index (candidates, j) == g_ptr_array_index (prints, order[j]));
+          g_assert_cmpint (g_array_index (scores, gint, j), ==, serial[i * N_PRINTS + order[j]]);
+        }
+    }
+
+  /* The gallery needs to be matched on the host */
+  {
+    g_autoptr(FpPrint) probe = make_nbis_print (test_xyt[0]);
+    g_autoptr(GPtrArray) candidates = NULL;
+    g_autoptr(GError) error = NULL;
+
+    fp_gallery_add (gallery, raw);
+    candidates = fp_gallery_identify_ranked_sync (gallery, probe, 3, NULL,
+                                                  NULL, &error);
+    g_assert_error (error, FP_DEVICE_ERROR, FP_DEVICE_ERROR_NOT_SUPPORTED);
+    g_assert_null (candidates);
+  }
+}
+
+static void
+test_serialize_compact (void)
+{
+  g_autoptr(FpPrint) print = make_nbis_print (test_xyt[0]);
+  g_autoptr(FpPrint) other = make_nbis_print (test_xyt[1]);
+  g_autoptr(FpPrint) loaded = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autofree guchar *fp3_data = NULL;
+  g_autofree guchar *data = NULL;
+  g_autofree struct xyt_struct *wide = xyt_struct_dup (test_xyt[2]);
+  struct bz_gallery_table *a, *b;
+  gsize fp3_length, length;
+  guint i;
+
+  fpi_print_add_print (print, other);
+  fp_print_set_description (print, "compact");
+
+  g_assert_true (fp_print_serialize (print, &fp3_data, &fp3_length, &error));
+  g_assert_true (fp_print_serialize_compact (print, FP_PRINT_SERIALIZE_NONE,
+                                             &data, &length, &error));
+  g_assert_no_error (error);
+  g_test_message ("FP3: %" G_GSIZE_FORMAT " bytes, FP4: %" G_GSIZE_FORMAT " bytes",
+                  fp3_length, length);
+  g_assert_cmpmem (data, 3, "FP4", 3);
+  g_assert_cmpuint (length, <, fp3_length * 2 / 3);
+
+  loaded = fp_print_deserialize (data, length, &error);
+  g_assert_no_error (error);
+  g_assert_true (fp_print_equal (print, loaded));
+  g_assert_cmpstr (fp_print_get_description (loaded), ==, "compact");
+  g_assert_null (loaded->bz3_tables);
+  g_clear_object (&loaded);
+  g_clear_pointer (&data, g_free);
+
+  /* With the match cache, it is available right away */
+  g_assert_true (fp_print_serialize_compact (print, FP_PRINT_SERIALIZE_MATCH_CACHE,
+                                             &data, &length, &error));
+  loaded = fp_print_deserialize (data, length, &error);
+  g_assert_no_error (error);
+  g_assert_true (fp_print_equal (print, loaded));
+  g_assert_nonnull (loaded->bz3_tables);
+
+  for (i = 0; i < print->prints->len; i++)
+    {
+      a = g_ptr_array_index (fpi_print_ensure_bz3_tables (print), i);
+      b = g_ptr_array_index (loaded->bz3_tables, i);
+      g_assert_cmpmem (a, BZ_GALLERY_TABLE_SIZE (a->nrows),
+                       b, BZ_GALLERY_TABLE_SIZE (b->nrows));
+    }
+  g_clear_object (&loaded);
+  g_clear_pointer (&data, g_free);
+
+  /* Coordinates that do not fit into 16 bits */
+  wide->xcol[0] = 40000;
+  g_clear_object (&print);
+  print = make_nbis_print (wide);
+  g_assert_false (fp_print_serialize_compact (print, FP_PRINT_SERIALIZE_NONE,
+                                              &data, &length, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED);
+}
+
+static void
+test_deserialize_bytes (void)
+{
+  g_autoptr(FpPrint) nbis = make_nbis_print (test_xyt[0]);
+  g_autoptr(FpPrint) other = make_nbis_print (test_xyt[1]);
+  g_autoptr(FpPrint) raw = NULL;
+  g_autoptr(FpPrint) loaded = NULL;
+  g_autoptr(GError) error = NULL;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GBytes) file_bytes = NULL;
+  g_autoptr(GMappedFile) mapped = NULL;
+  g_autofree guchar *data = NULL;
+  g_autofree gchar *contents = NULL;
+  g_autofree gchar *path = NULL;
+  const guchar *map_start, *print_data;
+  const guchar invalid[] = "FP2 not a print";
+  gsize length, map_length;
+  gint fd;
+
+  fpi_print_add_print (nbis, other);
+  fp_print_set_username (nbis, "testuser");
+
+  /* Unaligned data is copied */
+  g_assert_true (fp_print_serialize (nbis, &data, &length, &error));
+  bytes = g_bytes_new (data, length);
+  loaded = fp_print_deserialize_bytes (bytes, &error);
+  g_assert_no_error (error);
+  g_assert_true (fp_print_equal (nbis, loaded));
+  g_assert_cmpuint (loaded->prints->len, ==, 2);
+  g_assert_cmpstr (fp_print_get_username (loaded), ==, "testuser");
+  g_clear_object (&loaded);
+  g_clear_pointer (&data, g_free);
+
+  /* Raw print data stays in the mapped file, if it is aligned */
+  raw = g_object_new (FP_TYPE_PRINT,
+                      "driver", "test",
+                      "device-id", "0",
+                      "fpi-type", FPI_PRINT_RAW,
+                      "fpi-data", g_variant_new_bytestring ("opaque device data"),
+                      NULL);
+  g_object_ref_sink (raw);
+  g_assert_true (fp_print_serialize (raw, &data, &length, &error));
+
+  fd = g_file_open_tmp ("test-print-XXXXXX", &path, &error);
+  g_assert_no_error (error);
+  close (fd);
+  contents = g_malloc0 (length + 5);
+  memcpy (contents + 5, data, length);
+  g_assert_true (g_file_set_contents (path, contents, length + 5, &error));
+
+  mapped = g_mapped_file_new (path, FALSE, &error);
+  g_assert_no_error (error);
+  file_bytes = g_mapped_file_get_bytes (mapped);
+  g_clear_pointer (&mapped, g_mapped_file_unref);
+  g_unlink (path);
+
+  g_clear_pointer (&bytes, g_bytes_unref);
+  bytes = g_bytes_new_from_bytes (file_bytes, 5, length);
+  loaded = fp_print_deserialize_bytes (bytes, &error);
+  g_assert_no_error (error);
+  g_assert_true (fp_print_equal (raw, loaded));
+
+  map_start = g_bytes_get_data (file_bytes, &map_length);
+  print_data = g_variant_get_data (loaded->data);
+  g_assert_true (print_data >= map_start && print_data < map_start + map_length);
+  g_clear_object (&loaded);
+
+  /* Invalid data */
+  g_clear_pointer (&bytes, g_bytes_unref);
+  bytes = g_bytes_new_static (invalid, sizeof (invalid));
+  g_assert_null (fp_print_deserialize_bytes (bytes, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+}
+
+static FpPrint *
+make_raw_print (const gchar *driver, const gchar *data)
+{
+  FpPrint *print = g_object_new (FP_TYPE_PRINT,
+                                 "driver", driver,
+                                 "device-id", "0",
+                                 "fpi-type", FPI_PRINT_RAW,
+                                 "fpi-data", g_variant_new_string (data),
+                                 NULL);
+
+  return g_object_ref_sink (print);
+}
+
+static void
+test_print_index (void)
+{
+  g_autoptr(GPtrArray) gallery = make_test_gallery ();
+  g_autoptr(FpiPrintIndex) index = NULL;
+  g_autoptr(FpPrint) raw_probe = make_raw_print ("test", "stored-1");
+  g_autoptr(FpPrint) other_driver = make_raw_print ("other", "stored-1");
+  g_autoptr(FpPrint) unknown = make_raw_print ("test", "unknown");
+  gint i;
+
+  g_ptr_array_add (gallery, make_raw_print ("test", "stored-0"));
+  g_ptr_array_add (gallery, make_raw_print ("test", "stored-1"));
+  /* A duplicate, the earlier print has to be found */
+  g_ptr_array_add (gallery, make_raw_print ("test", "stored-1"));
+
+  index = fpi_print_index_new (gallery);
+
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      g_autoptr(FpPrint) probe = make_nbis_print (test_xyt[i]);
+
+      g_assert_true (fpi_print_index_lookup (index, probe) == g_ptr_array_index (gallery, i));
+    }
+
+  g_assert_true (fpi_print_index_lookup (index, raw_probe) == g_ptr_array_index (gallery, N_PRINTS + 1));
+  g_assert_null (fpi_print_index_lookup (index, other_driver));
+  g_assert_null (fpi_print_index_lookup (index, unknown));
+}
+
+static void
+test_bz3_identify_unsupported (void)
+{
+  g_autoptr(FpPrint) probe = make_nbis_print (test_xyt[1]);
+  g_autofree gint *serial = g_new0 (gint, N_PRINTS * N_PRINTS);
+  BzMatchContext *ctx;
+  gint expected = -1;
+  gint i;
+
+  ctx = bz_match_context_new ();
+  compute_scores (ctx, serial);
+  bz_match_context_free (ctx);
+
+  for (i = 0; i < N_PRINTS && expected < 0; i++)
+    if (serial[N_PRINTS + i] >= THRESHOLD)
+      expected = i;
+  g_assert_cmpint (expected, >=, 0);
+
+  /* A template that cannot be matched only fails the search if it comes
+   * before the first match, just like in a serial search. */
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      g_autoptr(GPtrArray) gallery = make_test_gallery ();
+      IdentifyResult result = { 0, };
+
+      g_ptr_array_insert (gallery, i, make_raw_print ("test", "raw"));
+      run_identify (gallery, probe, FP_IDENTIFY_MODE_FIRST_MATCH, 0, NULL, &result);
+
+      if (i <= expected)
+        {
+          g_assert_error (result.error, FP_DEVICE_ERROR, FP_DEVICE_ERROR_NOT_SUPPORTED);
+          g_assert_null (result.match);
+          g_clear_error (&result.error);
+        }
+      else
+        {
+          g_assert_no_error (result.error);
+          g_assert_true (result.match == g_ptr_array_index (gallery, expected));
+          g_clear_object (&result.match);
+        }
+    }
+
+  /* The pre-filter skips the template, so the match is always found */
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      g_autoptr(GPtrArray) gallery = make_test_gallery ();
+      IdentifyResult result = { 0, };
+
+      g_ptr_array_insert (gallery, i, make_raw_print ("test", "raw"));
+      run_identify (gallery, probe, FP_IDENTIFY_MODE_FIRST_MATCH, N_PRINTS, NULL, &result);
+
+      g_assert_no_error (result.error);
+      g_assert_true (result.match == g_ptr_array_index (gallery, i <= expected ? expected + 1 : expected));
+      g_clear_object (&result.match);
+    }
+
+  /* Without any other template, the error is reported */
+  {
+    g_autoptr(GPtrArray) gallery = g_ptr_array_new_with_free_func (g_object_unref);
+    IdentifyResult result = { 0, };
+
+    g_ptr_array_add (gallery, make_raw_print ("test", "raw-0"));
+    g_ptr_array_add (gallery, make_raw_print ("test", "raw-1"));
+    run_identify (gallery, probe, FP_IDENTIFY_MODE_FIRST_MATCH, 1, NULL, &result);
+
+    g_assert_error (result.error, FP_DEVICE_ERROR, FP_DEVICE_ERROR_NOT_SUPPORTED);
+    g_assert_null (result.match);
+    g_clear_error (&result.error);
+  }
+}
+
+static gpointer
+content_hash_thread (gpointer print)
+{
+  guint64 *hash = g_new (guint64, 1);
+
+  *hash = fp_print_get_content_hash (print);
+
+  return hash;
+}
+
+static void
+test_content_hash (void)
+{
+  g_autoptr(FpPrint) nbis = make_nbis_print (test_xyt[0]);
+  g_autoptr(FpPrint) nbis_copy = make_nbis_print (test_xyt[0]);
+  g_autoptr(FpPrint) other = make_nbis_print (test_xyt[1]);
+  g_autoptr(FpPrint) raw = make_raw_print ("test", "stored-0");
+  g_autoptr(FpPrint) raw_copy = make_raw_print ("test", "stored-0");
+  g_autoptr(FpPrint) raw_other_driver = make_raw_print ("other", "stored-0");
+  g_autoptr(GHashTable) table = NULL;
+  guint64 hash;
+  gint i;
+
+  hash = fp_print_get_content_hash (nbis);
+  g_assert_cmpuint (hash, !=, 0);
+  g_assert_cmpuint (fp_print_get_content_hash (nbis), ==, hash);
+  g_assert_cmpuint (fp_print_get_content_hash (nbis_copy), ==, hash);
+  g_assert_cmpuint (fp_print_get_content_hash (other), !=, hash);
+  g_assert_cmpuint (fp_print_hash (nbis), ==, fp_print_hash (nbis_copy));
+
+  g_assert_cmpuint (fp_print_get_content_hash (raw), ==, fp_print_get_content_hash (raw_copy));
+  g_assert_cmpuint (fp_print_get_content_hash (raw), !=, fp_print_get_content_hash (raw_other_driver));
+
+  /* Changing the print data invalidates the hash */
+  fpi_print_add_print (nbis, other);
+  g_assert_cmpuint (fp_print_get_content_hash (nbis), !=, hash);
+  g_assert_false (fp_print_equal (nbis, nbis_copy));
+  fpi_print_add_print (nbis_copy, other);
+  g_assert_cmpuint (fp_print_get_content_hash (nbis), ==, fp_print_get_content_hash (nbis_copy));
+  g_assert_true (fp_print_equal (nbis, nbis_copy));
+
+  hash = fp_print_get_content_hash (raw);
+  g_object_set (raw, "fpi-data", g_variant_new_string ("stored-1"), NULL);
+  g_assert_cmpuint (fp_print_get_content_hash (raw), !=, hash);
+  g_assert_false (fp_print_equal (raw, raw_copy));
+
+  /* Prints can be deduplicated using a hash table */
+  table = g_hash_table_new_full ((GHashFunc) fp_print_hash,
+                                 (GEqualFunc) fp_print_equal,
+                                 g_object_unref, NULL);
+  for (i = 0; i < N_PRINTS; i++)
+    {
+      g_hash_table_add (table, make_nbis_print (test_xyt[i]));
+      g_hash_table_add (table, make_nbis_print (test_xyt[i]));
+    }
+  g_assert_cmpuint (g_hash_table_size (table), ==, N_PRINTS);
+}
+
+static void
+test_content_hash_concurrent (void)
+{
+  g_autoptr(FpPrint) print = make_nbis_print (test_xyt[0]);
+  g_autoptr(FpPrint) copy = make_nbis_print (test_xyt[0]);
+  GThread *threads[N_THREADS];
+  gint i;
+
+  /* Threads racing to compute the hash all get the same one */
+  for (i = 0; i < N_THREADS; i++)
+    threads[i] = g_thread_new ("hash-test", content_hash_thread, print);
+
+  for (i = 0; i < N_THREADS; i++)
+    {
+      g_autofree guint64 *hash = g_thread_join (threads[i]);
+
+      g_assert_cmpuint (*hash, ==, fp_print_get_content_hash (copy));
+    }
+}
+
+static void
+test_gallery (void)
+{
+  g_autoptr(GPtrArray) prints = make_test_gallery ();
+  g_autoptr(FpGallery) gallery = fp_gallery_new ();
+  g_autoptr(GPtrArray) shared = NULL;
+  g_autoptr(GPtrArray) current = NULL;
+  g_autoptr(FpPrint) copy = make_nbis_print (test_xyt[3]);
+  gint i;
+
+  for (i = 0; i < N_PRINTS; i++)
+    g_assert_true (fp_gallery_add (gallery, g_ptr_array_index (prints, i)));
+  g_assert_cmpuint (fp_gallery_get_n_prints (gallery), ==, N_PRINTS);
+
+  /* Equal prints are only added once */
+  g_assert_false (fp_gallery_add (gallery, copy));
+  g_assert_true (fp_gallery_contains (gallery, copy));
+  g_assert_cmpuint (fp_gallery_get_n_prints (gallery), ==, N_PRINTS);
+
+  shared = fp_gallery_get_prints (gallery);
+  g_assert_cmpuint (shared->len, ==, N_PRINTS);
+
+  /* Removing by an equal print keeps the order of the other prints */
+  g_assert_true (fp_gallery_remove (gallery, copy));
+  g_assert_false (fp_gallery_remove (gallery, copy));
+  g_assert_false (fp_gallery_contains (gallery, copy));
+  g_assert_cmpuint (fp_gallery_get_n_prints (gallery), ==, N_PRINTS - 1);
+
+  current = fp_gallery_get_prints (gallery);
+  g_assert_true (current != shared);
+  g_assert_true (g_ptr_array_index (current, 2) == g_ptr_array_index (prints, 2));
+  g_assert_true (g_ptr_array_index (current, 3) == g_ptr_array_index (prints, 4));
+
+  /* Previously returned prints are not modified */
+  g_assert_cmpuint (shared->len, ==, N_PRINTS);
+  g_assert_true (g_ptr_array_index (shared, 3) == g_ptr_array_index (prints, 3));
+
+  g_assert_true (fp_gallery_add (gallery, copy));
+  g_assert_cmpuint (current->len, ==, N_PRINTS - 1);
+  g_assert_cmpuint (fp_gallery_get_n_prints (gallery), ==, N_PRINTS);
+}
+
+static void
+test_gallery_share (void)
+{
+  g_autoptr(GPtrArray) prints = make_test_gallery ();
+  g_autoptr(FpGallery) gallery = fp_gallery_new_from_prints (prints);
+  g_autoptr(GPtrArray) shared = NULL;
+  g_autoptr(FpiPrintIndex) index = NULL;
+  GPtrArray *current;
+  FpiPrintIndex *current_index;
+
+  /* Prints that are in use are copied before the gallery changes */
+  fpi_gallery_share (gallery, &shared, &index);
+  g_assert_true (fp_gallery_remove (gallery, g_ptr_array_index (prints, 0)));
+  g_assert_cmpuint (shared->len, ==, N_PRINTS);
+  g_assert_nonnull (fpi_print_index_lookup (index, g_ptr_array_index (prints, 0)));
+  g_clear_pointer (&shared, g_ptr_array_unref);
+  g_clear_pointer (&index, fpi_print_index_unref);
+
+  /* Once they are released again, changes are made in place */
+  fpi_gallery_share (gallery, &shared, &index);
+  current = shared;
+  current_index = index;
+  g_clear_pointer (&shared, g_ptr_array_unref);
+  g_clear_pointer (&index, fpi_print_index_unref);
+
+  g_assert_true (fp_gallery_add (gallery, g_ptr_array_index (prints, 0)));
+  g_assert_true (fp_gallery_remove (gallery, g_ptr_array_index (prints, 1)));
+
+  fpi_gallery_share (gallery, &shared, &index);
+  g_assert_true (shared == current);
+  g_assert_true (index == current_index);
+  g_assert_cmpuint (shared->len, ==, N_PRINTS - 1);
+  g_assert_true (g_ptr_array_index (shared, N_PRINTS - 2) == g_ptr_array_index (prints, 0));
+}
+
+typedef struct
+{
+  gint *scores;
+  gint  rows[N_PRINTS];
+} ScoreMatrix;
+
+static void
+on_score_row (FpPrint    *probe,
+              guint       probe_index,
+              const gint *scores,
+              guint       n_scores,
+              gpointer    user_data)
+{
+  ScoreMatrix *matrix = user_data;
+
+  g_assert_cmpuint (probe_index, <, N_PRINTS);
+  g_assert_cmpuint (n_scores, ==, N_PRINTS);
+
+  matrix->rows[probe_index]++;
+  memcpy (&matrix->scores[probe_index * N_PRINTS], scores, sizeof (gint) * n_scores);
+}
+
+static void
+test_gallery_score_prints (void)
+{
+  BzMatchContext *ctx = bz_match_context_new ();
+  g_autofree gint *serial = g_new0 (gint, N_PRINTS * N_PRINTS);
+  g_autofree gint *scores = g_new0 (gint, N_PRINTS * N_PRINTS);
+  g_autoptr(GPtrArray) prints = make_test_gallery ();
+  g_autoptr(GPtrArray) raw_prints = g_ptr_array_new_with_free_func (g_object_unref);
+  g_autoptr(FpGallery) gallery = fp_gallery_new_from_prints (prints);
+  g_autoptr(GCancellable) cancellable = g_cancellable_new ();
+  g_autoptr(GError) error = NULL;
+  ScoreMatrix matrix = { scores, { 0, } };
+  gint i;
+
+  compute_scores (ctx, serial);
+  bz_match_context_free (ctx);
+
+  g_assert_true (fp_gallery_score_prints_sync (gallery, prints, NULL,
+                                               on_score_row, &matrix, &error));
+  g_assert_no_error (error);
+
+  for (i = 0; i < N_PRINTS; i++)
+    g_assert_cmpint (matrix.rows[i], ==, 1);
+  g_assert_cmpmem (scores, sizeof (gint) * N_PRINTS * N_PRINTS,
+                   serial, sizeof (gint) * N_PRINTS * N_PRINTS);
+
+  g_cancellable_cancel (cancellable);
+  g_assert_false (fp_gallery_score_prints_sync (gallery, prints, cancellable,
+                                                NULL, NULL, &error));
+  g_assert_error (error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_clear_error (&error);
+
+  /* Only prints containing minutiae can be scored */
+  g_ptr_array_add (raw_prints, make_raw_print ("test", "raw"));
+  g_assert_false (fp_gallery_score_prints_sync (gallery, raw_prints, NULL,
+                                                NULL, NULL, &error));
+  g_assert_error (error, FP_DEVICE_ERROR, FP_DEVICE_ERROR_NOT_SUPPORTED);
+}
+
+int
+main (int argc, char *argv[])
+{
+  g_test_init (&argc, &argv, NULL);
+
+  setup_test_xyt ();
+
+  g_test_add_func ("/print/bz3/concurrent-scores", test_bz3_concurrent_scores);
+  g_test_add_func ("/print/bz3/gallery-tables", test_bz3_gallery_tables);
+  g_test_add_func ("/print/bz3/match-cache-serialize", test_bz3_match_cache_serialize);
+  g_test_add_func ("/print/bz3/identify", test_bz3_identify);
+  g_test_add_func ("/print/bz3/identify-ranked", test_bz3_identify_ranked);
+  g_test_add_func ("/print/bz3/identify-prefilter", test_bz3_identify_prefilter);
+  g_test_add_func ("/print/bz3/identify-prefilter-benchmark", test_bz3_identify_prefilter_benchmark);
+  g_test_add_func ("/print/bz3/identify-cancelled", test_bz3_identify_cancelled);
+  g_test_add_func ("/print/bz3/identify-unsupported", test_bz3_identify_unsupported);
+  g_test_add_func ("/print/serialize-compact", test_serialize_compact);
+  g_test_add_func ("/print/deserialize-bytes", test_deserialize_bytes);
+  g_test_add_func ("/print/index", test_print_index);
+  g_test_add_func ("/print/content-hash", test_content_hash);
+  g_test_add_func ("/print/content-hash/concurrent", test_content_hash_concurrent);
+  g_test_add_func ("/print/gallery", test_gallery);
+  g_test_add_func ("/print/gallery/share", test_gallery_share);
+  g_test_add_func ("/print/gallery/score-prints", test_gallery_score_prints);
+  g_test_add_func ("/print/gallery/identify-ranked", test_gallery_identify_ranked);
+
+  return g_test_run ();
+}
@@ -356,6 +356,41 @@ class VirtualImage(unittest.TestCase):
         assert(self._identify_error is not None)
         assert(self._identify_error.matches(FPrint.device_error_quark(), FPrint.DeviceError.GENERAL))
 
+    def test_identify_gallery(self):
+        fp_whorl = self.enroll_print('whorl')
+        fp_tented_arch = self.enroll_print('tented_arch')
+
+        gallery = FPrint.Gallery.new_from_prints([fp_whorl, fp_tented_arch])
+        gallery.set_identify_mode(FPrint.IdentifyMode.BEST_MATCH)
+
+        def identify_cb(dev, res):
+            self._identify_match, self._identify_fp = dev.identify_finish(res)
+
+        for image, expected in (('tented_arch', fp_tented_arch), ('whorl', fp_whorl)):
+            self._identify_fp = None
+            self.dev.identify_gallery(gallery, callback=identify_cb)
+            self.send_image(image)
+            while self._identify_fp is None:
+                ctx.iteration(True)
+            assert(self._identify_match is expected)
+
+        # The scanned print can be ranked against the gallery
+        candidates, scores = gallery.identify_ranked_sync(self._identify_fp, 2)
+        self.assertEqual(len(candidates), 2)
+        self.assertIs(candidates[0], fp_whorl)
+        self.assertIs(candidates[1], fp_tented_arch)
+        self.assertGreater(scores[0], scores[1])
+
+        # The same image yields the same minutiae, so the pre-filter picks it
+        gallery.set_prefilter_candidates(1)
+        for image, expected in (('tented_arch', fp_tented_arch), ('whorl', fp_whorl)):
+            self._identify_fp = None
+            self.dev.identify_gallery(gallery, callback=identify_cb)
+            self.send_image(image)
+            while self._identify_fp is None:
+                ctx.iteration(True)
+            assert(self._identify_match is expected)
+
     def test_verify_serialized(self):
         done = False
 